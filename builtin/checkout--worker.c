@@ -0,0 +1,74 @@
+#include "builtin.h"
+#include "cache.h"
+#include "streaming.h"
+#include "parallel-checkout.h"
+
+static const char checkout_worker_usage[] =
+"git checkout--worker < <entries>";
+
+static int write_one(const unsigned char *sha1, unsigned int mode,
+		     const char *path, struct stat *st)
+{
+	int fd, result;
+
+	mode = (mode & 0100) ? 0777 : 0666;
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0)
+		return error("unable to create file %s (%s)",
+			     path, strerror(errno));
+
+	result = stream_blob_to_fd(fd, sha1, NULL, 1);
+	if (!result && fstat_is_reliable() && fstat(fd, st))
+		result = -1;
+	if (close(fd))
+		result = -1;
+	if (!result && !fstat_is_reliable() && lstat(path, st))
+		result = -1;
+	if (result) {
+		unlink(path);
+		return error("unable to write file %s", path);
+	}
+	return 0;
+}
+
+/*
+ * Read "<sha1> <octal mode> <path>" records, each terminated by NUL,
+ * from the standard input, write each blob to its path, and report a
+ * struct checkout_worker_result for each of them on the standard
+ * output.
+ */
+int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *p, *end;
+
+	if (argc != 1)
+		usage(checkout_worker_usage);
+
+	git_config(git_default_config, NULL);
+	if (strbuf_read(&buf, 0, 0) < 0)
+		die_errno("unable to read checkout entries");
+
+	p = buf.buf;
+	end = buf.buf + buf.len;
+	while (p < end) {
+		struct checkout_worker_result res;
+		unsigned char sha1[20];
+		char *path;
+		unsigned long mode;
+
+		if (get_sha1_hex(p, sha1) || p[40] != ' ')
+			die("malformed checkout entry '%s'", p);
+		mode = strtoul(p + 41, &path, 8);
+		if (*path != ' ')
+			die("malformed checkout entry '%s'", p);
+		path++;
+
+		memset(&res, 0, sizeof(res));
+		res.status = write_one(sha1, mode, path, &res.st);
+		write_or_die(1, &res, sizeof(res));
+		p = path + strlen(path) + 1;
+	}
+	strbuf_release(&buf);
+	return 0;
+}
@@ -23,6 +23,9 @@
 #include "branch.h"
 #include "remote.h"
 #include "run-command.h"
+#include "bundle.h"
+#include "url.h"
+#include "connected.h"
 
 /*
  * Overall FIXMEs:
@@ -44,6 +47,8 @@ static char *option_origin = NULL;
 static char *option_branch = NULL;
 static const char *real_git_dir;
 static char *option_upload_pack = "git-upload-pack";
+static char *option_bundle_uri;
+static int transfer_bundle_uri;
 static int option_verbosity;
 static int option_progress = -1;
 static struct string_list option_config;
@@ -98,6 +103,8 @@ static struct option builtin_clone_options[] = {
 		   "separate git dir from working tree"),
 	OPT_STRING_LIST('c', "config", &option_config, "key=value",
 			"set config inside the new repository"),
+	OPT_STRING(0, "bundle-uri", &option_bundle_uri, "uri",
+		   "unbundle the bundle at <uri> before fetching"),
 	OPT_END()
 };
 
@@ -607,6 +614,139 @@ static void write_config(struct string_list *config)
 	}
 }
 
+static int git_clone_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "transfer.bundleuri")) {
+		transfer_bundle_uri = git_config_bool(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
+static int is_bundle_url(const char *uri)
+{
+	return !prefixcmp(uri, "http://") || !prefixcmp(uri, "https://") ||
+		!prefixcmp(uri, "ftp://") || !prefixcmp(uri, "ftps://");
+}
+
+/* Iterate over the ref_list_entry items from *cb_data up to the end */
+struct bundle_tips {
+	struct ref_list_entry *next, *end;
+};
+
+static int iterate_bundle_tips(void *cb_data, unsigned char sha1[20])
+{
+	struct bundle_tips *tips = cb_data;
+
+	if (tips->next == tips->end)
+		return -1; /* end of list */
+	hashcpy(sha1, tips->next->sha1);
+	tips->next++;
+	return 0;
+}
+
+/*
+ * Unbundle the bundle at uri, and keep its refs under refs/bundles/
+ * so that the fetch that follows only asks for what it lacks.  The
+ * fetch gets everything if this fails.  Tips whose history the bundle
+ * does not hold in full are left out, as the server would not send
+ * what we claim to have.
+ */
+static void fetch_bundle_uri(const char *uri)
+{
+	struct bundle_header header;
+	struct bundle_tips tips;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf refname = STRBUF_INIT;
+	int fd, i, all_connected, downloaded = 0;
+
+	if (0 <= option_verbosity)
+		fprintf(stderr, _("Fetching bundle %s\n"), uri);
+
+	if (is_bundle_url(uri)) {
+		const char *argv[] = { "http-fetch", NULL, uri, NULL };
+		struct strbuf output = STRBUF_INIT;
+
+		strbuf_addstr(&path, git_path("bundle-uri.bundle"));
+		downloaded = 1;
+		strbuf_addf(&output, "--output=%s", path.buf);
+		argv[1] = output.buf;
+		i = run_command_v_opt(argv, RUN_GIT_CMD);
+		strbuf_release(&output);
+		if (i) {
+			warning(_("could not download bundle %s"), uri);
+			goto cleanup;
+		}
+	} else if (!prefixcmp(uri, "file://")) {
+		char *decoded = url_decode(uri + 7);
+		strbuf_addstr(&path, decoded);
+		free(decoded);
+	} else
+		strbuf_addstr(&path, uri);
+
+	memset(&header, 0, sizeof(header));
+	fd = read_bundle_header(path.buf, &header);
+	if (fd < 0 || unbundle(&header, fd, 0)) {
+		warning(_("could not unbundle %s"), uri);
+		goto cleanup;
+	}
+	reprepare_packed_git();
+
+	tips.next = header.references.list;
+	tips.end = tips.next + header.references.nr;
+	all_connected = !check_everything_connected(iterate_bundle_tips, 1, &tips);
+	for (i = 0; i < header.references.nr; i++) {
+		struct ref_list_entry *e = header.references.list + i;
+
+		if (prefixcmp(e->name, "refs/"))
+			continue;
+		tips.next = e;
+		tips.end = e + 1;
+		if (!all_connected &&
+		    check_everything_connected(iterate_bundle_tips, 1, &tips)) {
+			warning(_("bundle %s is missing objects of %s, ignoring it"),
+				uri, e->name);
+			continue;
+		}
+		strbuf_reset(&refname);
+		strbuf_addf(&refname, "refs/bundles/%s", e->name + 5);
+		update_ref("clone: from bundle", refname.buf, e->sha1,
+			   NULL, 0, MSG_ON_ERR);
+	}
+
+cleanup:
+	if (downloaded)
+		unlink(path.buf);
+	strbuf_release(&path);
+	strbuf_release(&refname);
+}
+
+static const char *bundle_uri_to_fetch(void)
+{
+	const char *uri;
+	int len;
+
+	if (option_bundle_uri)
+		return option_bundle_uri;
+	if (!transfer_bundle_uri)
+		return NULL;
+	uri = server_feature_value("bundle-uri", &len);
+	if (!uri)
+		return NULL;
+	uri = xmemdupz(uri, len);
+	/*
+	 * A server must not make us read local files, and learn from
+	 * what we then ask for which objects they hold.
+	 */
+	if (!is_bundle_url(uri)) {
+		warning(_("ignoring bundle URI '%s' advertised by the server"),
+			uri);
+		free((char *)uri);
+		return NULL;
+	}
+	return uri;
+}
+
 int cmd_clone(int argc, const char **argv, const char *prefix)
 {
 	int is_bundle = 0, is_local;
@@ -619,6 +759,7 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	const struct ref *our_head_points_at;
 	struct ref *mapped_refs;
 	const struct ref *ref;
+	struct string_list ref_prefixes = STRING_LIST_INIT_DUP;
 	struct strbuf key = STRBUF_INIT, value = STRBUF_INIT;
 	struct strbuf branch_top = STRBUF_INIT, reflog_msg = STRBUF_INIT;
 	struct transport *transport = NULL;
@@ -739,7 +880,7 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	 */
 	unsetenv(CONFIG_ENVIRONMENT);
 
-	git_config(git_default_config, NULL);
+	git_config(git_clone_config, NULL);
 
 	if (option_bare) {
 		if (option_mirror)
@@ -800,7 +941,14 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 					     option_upload_pack);
 	}
 
+	refspec_ref_prefixes(refspec, &ref_prefixes);
+	string_list_append(&ref_prefixes, "HEAD");
+	if (!option_mirror)
+		string_list_append(&ref_prefixes, "refs/tags/");
+	transport->ref_prefixes = &ref_prefixes;
 	refs = transport_get_remote_refs(transport);
+	transport->ref_prefixes = NULL;
+	string_list_clear(&ref_prefixes, 0);
 
 	if (refs) {
 		mapped_refs = wanted_peer_refs(refs, refspec);
@@ -852,8 +1000,12 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 
 	if (is_local)
 		clone_local(path, git_dir);
-	else if (refs && complete_refs_before_fetch)
+	else if (refs && complete_refs_before_fetch) {
+		const char *bundle_uri = bundle_uri_to_fetch();
+		if (bundle_uri && !option_depth)
+			fetch_bundle_uri(bundle_uri);
 		transport_fetch_refs(transport, mapped_refs);
+	}
 
 	update_remote_refs(refs, mapped_refs, remote_head_points_at,
 			   branch_top.buf, reflog_msg.buf);
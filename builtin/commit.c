@@ -282,7 +282,11 @@ static char *prepare_index(int argc, const char **argv, const char *prefix,
 	if (*argv)
 		pathspec = get_pathspec(prefix, argv);
 
-	if (read_cache_preload(pathspec) < 0)
+	/*
+	 * "commit -i <paths>" refreshes the whole index below, so
+	 * preload all of it rather than just the named paths.
+	 */
+	if (read_cache_preload(also ? NULL : pathspec) < 0)
 		die(_("index file corrupt"));
 
 	if (interactive) {
@@ -394,7 +398,7 @@ static char *prepare_index(int argc, const char **argv, const char *prefix,
 		exit(1);
 
 	discard_cache();
-	if (read_cache() < 0)
+	if (read_cache_preload(NULL) < 0)
 		die(_("cannot read the index"));
 
 	fd = hold_locked_index(&index_lock, 1);
@@ -1215,13 +1219,15 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 	refresh_index(&the_index, REFRESH_QUIET|REFRESH_UNMERGED, s.pathspec, NULL, NULL);
 
 	fd = hold_locked_index(&index_lock, 0);
-	if (0 <= fd)
-		update_index_if_able(&the_index, &index_lock);
 
 	s.is_initial = get_sha1(s.reference, sha1) ? 1 : 0;
 	s.ignore_submodule_arg = ignore_submodule_arg;
 	wt_status_collect(&s);
 
+	/* after collecting, to also save what the untracked cache learned */
+	if (0 <= fd)
+		update_index_if_able(&the_index, &index_lock);
+
 	if (s.relative_paths)
 		s.prefix = prefix;
 
@@ -18,6 +18,7 @@ static int prefer_ofs_delta = 1;
 static int no_done;
 static int fetch_fsck_objects = -1;
 static int transfer_fsck_objects = -1;
+static int skipping_negotiation;
 static struct fetch_pack_args args = {
 	/* .uploadpack = */ "git-upload-pack",
 };
@@ -60,6 +61,19 @@ static void rev_list_push(struct commit *commit, int mark)
 	}
 }
 
+static void clear_rev_list(void)
+{
+	struct commit_list *list;
+
+	for (list = rev_list; list; list = list->next) {
+		free(list->item->util);
+		list->item->util = NULL;
+	}
+	free_commit_list(rev_list);
+	rev_list = NULL;
+	non_common_revs = 0;
+}
+
 static int rev_list_insert_ref(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
 {
 	struct object *o = deref_tag(parse_object(sha1), refname, 0);
@@ -163,6 +177,115 @@ static const unsigned char *get_rev(void)
 	return commit->object.sha1;
 }
 
+/*
+ * The "skipping" negotiation walks each line of history like get_rev(),
+ * but instead of sending every commit as a "have", it skips over an
+ * exponentially growing number of them between two "have"s.  Once an
+ * ACK comes back, everything below the acknowledged commit is common,
+ * so the walk resumes from the commits we skipped over after it.
+ *
+ * Every queued commit has a skip_state in its util field: "ttl" is the
+ * number of commits still to skip on this line before the next "have",
+ * and "original_ttl" the length of the current skip.
+ */
+struct skip_state {
+	unsigned short ttl, original_ttl;
+};
+
+static struct skip_state *skip_state(struct commit *commit)
+{
+	if (!commit->util)
+		commit->util = xcalloc(1, sizeof(struct skip_state));
+	return commit->util;
+}
+
+static void skip_mark_common(struct commit *commit)
+{
+	struct commit_list *parents;
+
+	if (commit->object.flags & COMMON)
+		return;
+	commit->object.flags |= COMMON;
+	if ((commit->object.flags & SEEN) && !(commit->object.flags & POPPED))
+		non_common_revs--;
+	if (!commit->object.parsed)
+		return;
+	for (parents = commit->parents; parents; parents = parents->next)
+		if (parents->item->object.flags & SEEN)
+			skip_mark_common(parents->item);
+}
+
+/*
+ * Queue the parent of a commit that was just popped, and pass the
+ * skip distance down to it.  Returns 0 if the parent was not queued.
+ */
+static int skip_push_parent(struct commit *commit, struct commit *parent)
+{
+	struct skip_state *state, *parent_state;
+	unsigned short ttl, original_ttl;
+
+	/* popped already because of clock skew; pretend it is not there */
+	if (parent->object.flags & POPPED)
+		return 0;
+	rev_list_push(parent, SEEN);
+	if (!parent->object.parsed)
+		return 0;
+
+	if (commit->object.flags & (COMMON | COMMON_REF)) {
+		skip_mark_common(parent);
+		return 1;
+	}
+
+	state = skip_state(commit);
+	if (state->ttl) {
+		original_ttl = state->original_ttl;
+		ttl = state->ttl - 1;
+	} else {
+		original_ttl = state->original_ttl * 3 / 2 + 1;
+		ttl = original_ttl;
+	}
+	parent_state = skip_state(parent);
+	if (parent_state->original_ttl < original_ttl) {
+		parent_state->original_ttl = original_ttl;
+		parent_state->ttl = ttl;
+	}
+	return 1;
+}
+
+static const unsigned char *get_rev_skipping(void)
+{
+	struct commit *to_send = NULL;
+
+	while (!to_send) {
+		struct commit *commit;
+		struct commit_list *parents;
+		int parent_pushed = 0;
+
+		if (!rev_list || !non_common_revs)
+			return NULL;
+
+		commit = pop_commit(&rev_list);
+		commit->object.flags |= POPPED;
+		if (!(commit->object.flags & COMMON)) {
+			non_common_revs--;
+			if (!skip_state(commit)->ttl)
+				to_send = commit;
+		}
+
+		for (parents = commit->parents; parents; parents = parents->next)
+			parent_pushed |= skip_push_parent(commit, parents->item);
+
+		/* always send the end of a line of history */
+		if (!(commit->object.flags & COMMON) && !parent_pushed)
+			to_send = commit;
+
+		free(commit->util);
+		commit->util = NULL;
+	}
+
+	return to_send->object.sha1;
+}
+
 enum ack_type {
 	NAK = 0,
 	ACK,
@@ -386,7 +509,7 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 
 	flushes = 0;
 	retval = -1;
-	while ((sha1 = get_rev())) {
+	while ((sha1 = skipping_negotiation ? get_rev_skipping() : get_rev())) {
 		packet_buf_write(&req_buf, "have %s\n", sha1_to_hex(sha1));
 		if (args.verbose)
 			fprintf(stderr, "have %s\n", sha1_to_hex(sha1));
@@ -437,12 +560,15 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 						packet_buf_write(&req_buf, "have %s\n", hex);
 						state_len = req_buf.len;
 					}
-					mark_common(commit, 0, 1);
+					if (skipping_negotiation)
+						skip_mark_common(commit);
+					else
+						mark_common(commit, 0, 1);
 					retval = 0;
 					in_vain = 0;
 					got_continue = 1;
 					if (ack == ACK_ready) {
-						rev_list = NULL;
+						clear_rev_list();
 						got_ready = 1;
 					}
 					break;
@@ -464,6 +590,7 @@ done:
 	}
 	if (args.verbose)
 		fprintf(stderr, "done\n");
+	clear_rev_list();
 	if (retval != 0) {
 		multi_ack = 0;
 		flushes++;
@@ -635,7 +762,9 @@ static int everything_local(struct ref **refs, int nr_match, char **match)
 		if (!(o->flags & SEEN)) {
 			rev_list_push((struct commit *)o, COMMON_REF | SEEN);
 
-			mark_common((struct commit *)o, 1, 1);
+			/* skipping negotiation marks them when they are popped */
+			if (!skipping_negotiation)
+				mark_common((struct commit *)o, 1, 1);
 		}
 	}
 
@@ -879,6 +1008,18 @@ static int fetch_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "fetch.negotiationalgorithm")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "skipping"))
+			skipping_negotiation = 1;
+		else if (!strcmp(value, "default"))
+			skipping_negotiation = 0;
+		else
+			warning("ignoring unknown %s value '%s'", var, value);
+		return 0;
+	}
+
 	return git_default_config(var, value, cb);
 }
 
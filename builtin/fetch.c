@@ -152,8 +152,30 @@ static struct ref *get_ref_map(struct transport *transport,
 	struct ref *rm;
 	struct ref *ref_map = NULL;
 	struct ref **tail = &ref_map;
+	struct string_list ref_prefixes = STRING_LIST_INIT_DUP;
+	const struct ref *remote_refs;
 
-	const struct ref *remote_refs = transport_get_remote_refs(transport);
+	/* tell the transport which refs we are going to look at */
+	if (ref_count || tags == TAGS_SET) {
+		for (i = 0; i < ref_count; i++)
+			refspec_ref_prefixes(&refs[i], &ref_prefixes);
+	} else {
+		struct remote *remote = transport->remote;
+		struct branch *branch = branch_get(NULL);
+
+		for (i = 0; remote && i < remote->fetch_refspec_nr; i++)
+			refspec_ref_prefixes(&remote->fetch[i], &ref_prefixes);
+		for (i = 0; branch && i < branch->merge_nr; i++)
+			refspec_ref_prefixes(branch->merge[i], &ref_prefixes);
+		if (!ref_prefixes.nr)
+			string_list_append(&ref_prefixes, "HEAD");
+	}
+	if (tags != TAGS_UNSET)
+		string_list_append(&ref_prefixes, "refs/tags/");
+	transport->ref_prefixes = ref_prefixes.nr ? &ref_prefixes : NULL;
+	remote_refs = transport_get_remote_refs(transport);
+	transport->ref_prefixes = NULL;
+	string_list_clear(&ref_prefixes, 0);
 
 	if (ref_count || tags == TAGS_SET) {
 		for (i = 0; i < ref_count; i++) {
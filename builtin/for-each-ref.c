@@ -819,6 +819,35 @@ static int grab_single_ref(const char *refname, const unsigned char *sha1, int f
 	return 0;
 }
 
+/*
+ * Return the longest leading string that every ref matching one of
+ * the patterns must start with, so that only that part of the ref
+ * namespace needs to be read.
+ */
+static char *common_ref_prefix(const char **patterns)
+{
+	const char **pattern;
+	size_t len = 0;
+
+	if (!*patterns)
+		return xstrdup("");
+	for (pattern = patterns; *pattern; pattern++) {
+		size_t plen = strcspn(*pattern, "?*[\\");
+
+		if (pattern == patterns) {
+			len = plen;
+			continue;
+		}
+		if (plen < len)
+			len = plen;
+		for (plen = 0; plen < len; plen++)
+			if ((*pattern)[plen] != (*patterns)[plen])
+				break;
+		len = plen;
+	}
+	return xstrndup(*patterns, len);
+}
+
 static int cmp_ref_sort(struct ref_sort *s, struct refinfo *a, struct refinfo *b)
 {
 	struct atom_value *va, *vb;
@@ -986,6 +1015,7 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 	int maxcount = 0, quote_style = 0;
 	struct refinfo **refs;
 	struct grab_ref_cbdata cbdata;
+	char *ref_prefix;
 
 	struct option opts[] = {
 		OPT_BIT('s', "shell", &quote_style,
@@ -1026,7 +1056,9 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.grab_pattern = argv;
-	for_each_rawref(grab_single_ref, &cbdata);
+	ref_prefix = common_ref_prefix(argv);
+	for_each_rawref_in(ref_prefix, grab_single_ref, &cbdata);
+	free(ref_prefix);
 	refs = cbdata.grab_array;
 	num_refs = cbdata.grab_cnt;
 
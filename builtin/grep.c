@@ -17,6 +17,7 @@
 #include "grep.h"
 #include "quote.h"
 #include "dir.h"
+#include "grep-index.h"
 
 static char const * const grep_usage[] = {
 	"git grep [options] [-e] <pattern> [<rev>...] [[--] <path>...]",
@@ -25,17 +26,26 @@ static char const * const grep_usage[] = {
 
 static int use_threads = 1;
 
+/* Number of worker threads; 0 means one per online CPU. */
+static int num_threads;
+
+static int use_trigram_index = 1;
+
+/* Rules out the blobs that cannot match, if there is one. */
+static struct grep_index *trigram_index;
+
 #ifndef NO_PTHREADS
-#define THREADS 8
-static pthread_t threads[THREADS];
+static pthread_t *threads;
 
-/* We use one producer thread and THREADS consumer
+/* We use one producer thread and num_threads consumer
  * threads. The producer adds struct work_items to 'todo' and the
  * consumers pick work items from the same array.
  */
 struct work_item {
 	struct grep_source source;
 	char done;
+	char chunk;
+	char *file_buf;
 	struct strbuf out;
 };
 
@@ -46,10 +56,14 @@ struct work_item {
  * The work_items in [todo_start, todo_end) are waiting to be picked
  * up by a consumer thread.
  *
- * The ranges are modulo TODO_SIZE.
+ * The ranges are modulo todo_nr, which grows with the number of
+ * threads so that a slow item at todo_done does not leave most of
+ * them idle.
  */
 #define TODO_SIZE 128
-static struct work_item todo[TODO_SIZE];
+#define TODO_PER_THREAD 16
+static struct work_item *todo;
+static int todo_nr;
 static int todo_start;
 static int todo_end;
 static int todo_done;
@@ -85,26 +99,112 @@ static pthread_cond_t cond_result;
 
 static int skip_first_line;
 
-static void add_work(struct grep_opt *opt, enum grep_source_type type,
-		     const char *name, const void *id)
+/*
+ * Worktree files at least twice this size are searched in pieces
+ * by several threads, when the output allows it.
+ */
+#define GREP_CHUNK_SIZE (1024 * 1024)
+static int split_files;
+
+static void add_work_item(struct grep_source *gs, int chunk, char *file_buf)
 {
+	struct work_item *w;
+
 	grep_lock();
 
-	while ((todo_end+1) % ARRAY_SIZE(todo) == todo_done) {
+	while ((todo_end+1) % todo_nr == todo_done) {
 		pthread_cond_wait(&cond_write, &grep_mutex);
 	}
 
-	grep_source_init(&todo[todo_end].source, type, name, id);
-	if (opt->binary != GREP_BINARY_TEXT)
-		grep_source_load_driver(&todo[todo_end].source);
-	todo[todo_end].done = 0;
-	strbuf_reset(&todo[todo_end].out);
-	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
+	w = &todo[todo_end];
+	w->source = *gs;
+	w->done = 0;
+	w->chunk = chunk;
+	w->file_buf = file_buf;
+	strbuf_reset(&w->out);
+	todo_end = (todo_end + 1) % todo_nr;
 
 	pthread_cond_signal(&cond_add);
 	grep_unlock();
 }
 
+static unsigned count_lines(const char *buf, const char *end)
+{
+	unsigned nr = 0;
+
+	while ((buf = memchr(buf, '\n', end - buf))) {
+		nr++;
+		buf++;
+	}
+	return nr;
+}
+
+/*
+ * Queue a large worktree file as a run of work items, each covering
+ * whole lines.  The items are written out in order like any others,
+ * so the output is the same as for the whole file; the last one
+ * carries the buffer so that it is freed once all of them are done.
+ * Returns 0 if the file was not split and should be queued as usual.
+ */
+static int add_chunked_work(struct grep_opt *opt, struct grep_source *gs)
+{
+	struct stat st;
+	char *buf, *end, *p;
+	unsigned lno = 1;
+
+	if (lstat(gs->identifier, &st) || !S_ISREG(st.st_mode) ||
+	    st.st_size < 2 * GREP_CHUNK_SIZE)
+		return 0;
+	if (grep_source_load(gs) < 0) {
+		grep_source_clear(gs);
+		return 1;
+	}
+	/* Keep the loaded buffer; the worker will not read it again. */
+	if (opt->binary != GREP_BINARY_TEXT && grep_source_is_binary(gs))
+		return 0;
+
+	buf = gs->buf;
+	end = buf + gs->size;
+	for (p = buf; p < end; ) {
+		struct grep_source chunk;
+		char *eoc = end;
+
+		if (end - p > GREP_CHUNK_SIZE + GREP_CHUNK_SIZE / 2) {
+			eoc = memchr(p + GREP_CHUNK_SIZE, '\n',
+				     end - p - GREP_CHUNK_SIZE);
+			eoc = eoc ? eoc + 1 : end;
+		}
+
+		grep_source_init(&chunk, GREP_SOURCE_BUF, gs->name, NULL);
+		chunk.buf = p;
+		chunk.size = eoc - p;
+		chunk.lno = lno;
+		chunk.driver = gs->driver;
+		if (opt->linenum && eoc < end)
+			lno += count_lines(p, eoc);
+		add_work_item(&chunk, 1, eoc < end ? NULL : buf);
+		p = eoc;
+	}
+
+	gs->buf = NULL;
+	grep_source_clear(gs);
+	return 1;
+}
+
+static void add_work(struct grep_opt *opt, enum grep_source_type type,
+		     const char *name, const void *id)
+{
+	struct grep_source gs;
+
+	grep_source_init(&gs, type, name, id);
+	if (opt->binary != GREP_BINARY_TEXT)
+		grep_source_load_driver(&gs);
+	if (type == GREP_SOURCE_FILE && split_files &&
+	    add_chunked_work(opt, &gs))
+		return;
+	add_work_item(&gs, 0, NULL);
+}
+
 static struct work_item *get_work(void)
 {
 	struct work_item *ret;
@@ -118,7 +218,7 @@ static struct work_item *get_work(void)
 		ret = NULL;
 	} else {
 		ret = &todo[todo_start];
-		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+		todo_start = (todo_start + 1) % todo_nr;
 	}
 	grep_unlock();
 	return ret;
@@ -132,7 +232,7 @@ static void work_done(struct work_item *w)
 	w->done = 1;
 	old_done = todo_done;
 	for(; todo[todo_done].done && todo_done != todo_start;
-	    todo_done = (todo_done+1) % ARRAY_SIZE(todo)) {
+	    todo_done = (todo_done+1) % todo_nr) {
 		w = &todo[todo_done];
 		if (w->out.len) {
 			const char *p = w->out.buf;
@@ -151,6 +251,8 @@ static void work_done(struct work_item *w)
 			write_or_die(1, p, len);
 		}
 		grep_source_clear(&w->source);
+		free(w->file_buf);
+		w->file_buf = NULL;
 	}
 
 	if (old_done != todo_done)
@@ -166,12 +268,18 @@ static void *run(void *arg)
 {
 	int hit = 0;
 	struct grep_opt *opt = arg;
+	int binary = opt->binary;
 
 	while (1) {
 		struct work_item *w = get_work();
 		if (!w)
 			break;
 
+		/*
+		 * The producer has already checked the whole file of
+		 * a chunk; the chunk itself may look binary.
+		 */
+		opt->binary = w->chunk ? GREP_BINARY_TEXT : binary;
 		opt->output_priv = w;
 		hit |= grep_source(opt, &w->source);
 		grep_source_clear_data(&w->source);
@@ -201,11 +309,23 @@ static void start_threads(struct grep_opt *opt)
 	pthread_cond_init(&cond_result, NULL);
 	grep_use_locks = 1;
 
-	for (i = 0; i < ARRAY_SIZE(todo); i++) {
+	/* Only split files when each line is reported on its own. */
+	split_files = !(opt->name_only || opt->unmatch_name_only ||
+			opt->count || opt->status_only || opt->all_match ||
+			opt->pre_context || opt->post_context ||
+			opt->funcname || opt->funcbody ||
+			opt->file_break || opt->heading);
+
+	todo_nr = TODO_SIZE;
+	if (todo_nr < num_threads * TODO_PER_THREAD)
+		todo_nr = num_threads * TODO_PER_THREAD;
+	todo = xcalloc(todo_nr, sizeof(*todo));
+	for (i = 0; i < todo_nr; i++) {
 		strbuf_init(&todo[i].out, 0);
 	}
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	threads = xcalloc(num_threads, sizeof(*threads));
+	for (i = 0; i < num_threads; i++) {
 		int err;
 		struct grep_opt *o = grep_opt_dup(opt);
 		o->output = strbuf_out;
@@ -236,7 +356,7 @@ static int wait_all(void)
 	pthread_cond_broadcast(&cond_add);
 	grep_unlock();
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	for (i = 0; i < num_threads; i++) {
 		void *h;
 		pthread_join(threads[i], &h);
 		hit |= (int) (intptr_t) h;
@@ -250,6 +370,11 @@ static int wait_all(void)
 	pthread_cond_destroy(&cond_result);
 	grep_use_locks = 0;
 
+	for (i = 0; i < todo_nr; i++)
+		strbuf_release(&todo[i].out);
+	free(todo);
+	free(threads);
+
 	return hit;
 }
 #else /* !NO_PTHREADS */
@@ -281,6 +406,19 @@ static int grep_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "grep.trigramindex")) {
+		use_trigram_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "grep.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    num_threads);
+		return 0;
+	}
+
 	if (!strcmp(var, "color.grep"))
 		opt->color = git_config_colorbool(var, value);
 	else if (!strcmp(var, "color.grep.context"))
@@ -330,6 +468,11 @@ static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1,
 		strbuf_addstr(&pathbuf, filename);
 	}
 
+	if (trigram_index && !grep_index_may_match(trigram_index, sha1)) {
+		strbuf_release(&pathbuf);
+		return 0;
+	}
+
 #ifndef NO_PTHREADS
 	if (use_threads) {
 		add_work(opt, GREP_SOURCE_SHA1, pathbuf.buf, sha1);
@@ -779,6 +922,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		{ OPTION_STRING, 'O', "open-files-in-pager", &show_in_pager,
 			"pager", "show matching files in the pager",
 			PARSE_OPT_OPTARG, NULL, (intptr_t)default_pager },
+		OPT_INTEGER(0, "threads", &num_threads,
+			"use <n> worker threads"),
 		OPT_BOOLEAN(0, "ext-grep", &external_grep_allowed__ignored,
 			    "allow calling of grep(1) (ignored by this build)"),
 		{ OPTION_CALLBACK, 0, "help-all", &options, NULL, "show usage",
@@ -910,10 +1055,16 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		break;
 	}
 
+	if (num_threads < 0)
+		die(_("invalid number of threads specified (%d)"), num_threads);
 #ifndef NO_PTHREADS
-	if (list.nr || cached || online_cpus() == 1)
+	if (!num_threads)
+		num_threads = online_cpus();
+	if (list.nr || cached || num_threads == 1)
 		use_threads = 0;
 #else
+	if (num_threads > 1)
+		warning(_("no threads support, ignoring --threads"));
 	use_threads = 0;
 #endif
 
@@ -965,6 +1116,19 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	if (!use_index && (untracked || cached))
 		die(_("--cached or --untracked cannot be used with --no-index."));
 
+	/*
+	 * Every blob could contain a line that does not match, and -L
+	 * lists the blobs without any match.
+	 */
+	if (use_index && use_trigram_index &&
+	    !opt.invert && !opt.unmatch_name_only) {
+		trigram_index = open_grep_index();
+		if (trigram_index && !grep_index_select(trigram_index, &opt)) {
+			close_grep_index(trigram_index);
+			trigram_index = NULL;
+		}
+	}
+
 	if (!use_index || untracked) {
 		int use_exclude = (opt_exclude < 0) ? use_index : !!opt_exclude;
 		if (list.nr)
@@ -985,6 +1149,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 
 	if (use_threads)
 		hit |= wait_all();
+	if (trigram_index)
+		close_grep_index(trigram_index);
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
 	free_grep_patterns(&opt);
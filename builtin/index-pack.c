@@ -12,7 +12,7 @@
 #include "thread-utils.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--report-external] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -22,6 +22,7 @@ struct object_entry {
 	enum object_type real_type;
 	unsigned delta_depth;
 	int base_object_no;
+	unsigned streamed : 1;
 };
 
 union delta_base {
@@ -76,6 +77,7 @@ static int nr_threads;
 
 static int from_stdin;
 static int strict;
+static int report_external;
 static int verbose;
 
 static struct progress *progress;
@@ -88,6 +90,20 @@ static unsigned deepest_delta;
 static git_SHA_CTX input_ctx;
 static uint32_t input_crc32;
 static int input_fd, output_fd, pack_fd;
+static off_t flushed_bytes;
+
+/*
+ * Objects that are not deltas or that were resolved while the pack was
+ * streaming in, kept to rebuild the deltas based on them.
+ */
+#define RESOLVED_CACHE_SIZE 1024
+static struct resolved_cache_entry {
+	int obj_no;
+	void *data;
+	unsigned long size;
+} resolved_cache[RESOLVED_CACHE_SIZE];
+static size_t resolved_cache_used;
+static unsigned int resolved_cache_clock;
 
 #ifndef NO_PTHREADS
 
@@ -107,6 +123,26 @@ static pthread_mutex_t work_mutex;
 #define work_lock()		lock_mutex(&work_mutex)
 #define work_unlock()		unlock_mutex(&work_mutex)
 
+static pthread_mutex_t cache_mutex;
+#define cache_lock()		lock_mutex(&cache_mutex)
+#define cache_unlock()		unlock_mutex(&cache_mutex)
+
+/*
+ * With --stdin, the threads resolve the OFS_DELTA objects whose base
+ * has been resolved while the rest of the pack is still coming in.
+ * The reader publishes the objects once they are in the pack file;
+ * a delta then goes to the stream_ready list, or waits in the
+ * stream_child list of its base until that base is resolved.  Both
+ * lists are linked through stream_next.
+ */
+static int stream_deltas;
+static int stream_done;
+static int nr_published;
+static int stream_ready = -1;
+static int *stream_next, *stream_child;
+static pthread_mutex_t stream_mutex;
+static pthread_cond_t stream_cond;
+
 static pthread_key_t key;
 
 static inline void lock_mutex(pthread_mutex_t *mutex)
@@ -129,6 +165,7 @@ static void init_thread(void)
 	init_recursive_mutex(&read_mutex);
 	pthread_mutex_init(&counter_mutex, NULL);
 	pthread_mutex_init(&work_mutex, NULL);
+	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_key_create(&key, NULL);
 	thread_data = xcalloc(nr_threads, sizeof(*thread_data));
 	threads_active = 1;
@@ -142,6 +179,7 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&read_mutex);
 	pthread_mutex_destroy(&counter_mutex);
 	pthread_mutex_destroy(&work_mutex);
+	pthread_mutex_destroy(&cache_mutex);
 	pthread_key_delete(key);
 	free(thread_data);
 }
@@ -157,6 +195,9 @@ static void cleanup_thread(void)
 #define work_lock()
 #define work_unlock()
 
+#define cache_lock()
+#define cache_unlock()
+
 #endif
 
 
@@ -192,6 +233,25 @@ static void check_object(struct object *obj)
 	}
 }
 
+/*
+ * List the objects that objects in the pack link to, but that are
+ * not in the pack themselves (bases appended by --fix-thin count as
+ * outside).  If all of them are connected, so is every object in the
+ * pack.
+ */
+static void list_external_objects(struct strbuf *out)
+{
+	unsigned i, max;
+
+	max = get_max_object_index();
+	for (i = 0; i < max; i++) {
+		struct object *obj = get_indexed_object(i);
+		if (obj && (obj->flags & FLAG_LINK) &&
+		    !(obj->flags & FLAG_CHECKED))
+			strbuf_addf(out, "external\t%s\n", sha1_to_hex(obj->sha1));
+	}
+}
+
 static void check_objects(void)
 {
 	unsigned i, max;
@@ -212,6 +272,7 @@ static void flush(void)
 		memmove(input_buffer, input_buffer + input_offset, input_len);
 		input_offset = 0;
 	}
+	flushed_bytes = consumed_bytes;
 }
 
 /*
@@ -588,7 +649,7 @@ static void sha1_object(const void *data, unsigned long size,
 	} else
 		read_unlock();
 
-	if (strict) {
+	if (strict || report_external) {
 		read_lock();
 		if (type == OBJ_BLOB) {
 			struct blob *blob = lookup_blob(sha1);
@@ -608,7 +669,7 @@ static void sha1_object(const void *data, unsigned long size,
 			obj = parse_object_buffer(sha1, type, size, buf, &eaten);
 			if (!obj)
 				die(_("invalid %s"), typename(type));
-			if (fsck_object(obj, 1, fsck_error_function))
+			if (strict && fsck_object(obj, 1, fsck_error_function))
 				die(_("Error in object"));
 			if (fsck_walk(obj, mark_link, NULL))
 				die(_("Not all child objects of %s are reachable"), sha1_to_hex(obj->sha1));
@@ -632,6 +693,86 @@ static int is_delta_type(enum object_type type)
 	return (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA);
 }
 
+static void *get_resolved_cache(int obj_no, unsigned long *size)
+{
+	struct resolved_cache_entry *ent = resolved_cache + obj_no % RESOLVED_CACHE_SIZE;
+	void *data = NULL;
+
+	cache_lock();
+	if (ent->data && ent->obj_no == obj_no) {
+		data = xmalloc(ent->size);
+		memcpy(data, ent->data, ent->size);
+		*size = ent->size;
+	}
+	cache_unlock();
+	return data;
+}
+
+static void clear_resolved_cache_entry(struct resolved_cache_entry *ent)
+{
+	if (ent->data) {
+		resolved_cache_used -= ent->size;
+		free(ent->data);
+		ent->data = NULL;
+	}
+}
+
+static void add_resolved_cache(int obj_no, const void *data, unsigned long size)
+{
+	struct resolved_cache_entry *ent = resolved_cache + obj_no % RESOLVED_CACHE_SIZE;
+
+	if (size > delta_base_cache_limit / 4)
+		return;
+	cache_lock();
+	clear_resolved_cache_entry(ent);
+	while (resolved_cache_used + size > delta_base_cache_limit)
+		clear_resolved_cache_entry(resolved_cache +
+			resolved_cache_clock++ % RESOLVED_CACHE_SIZE);
+	ent->obj_no = obj_no;
+	ent->data = xmalloc(size);
+	memcpy(ent->data, data, size);
+	ent->size = size;
+	resolved_cache_used += size;
+	cache_unlock();
+}
+
+static void clear_resolved_cache(void)
+{
+	int i;
+
+	for (i = 0; i < RESOLVED_CACHE_SIZE; i++)
+		clear_resolved_cache_entry(resolved_cache + i);
+}
+
+/*
+ * Return the contents of an object that is not a delta or that was
+ * resolved while streaming, rebuilding it from its bases if needed.
+ */
+static void *get_resolved_data(struct object_entry *obj, unsigned long *size)
+{
+	int obj_no = obj - objects;
+	void *data, *base, *raw;
+	unsigned long base_size;
+
+	data = get_resolved_cache(obj_no, size);
+	if (data)
+		return data;
+	if (!is_delta_type(obj->type)) {
+		data = get_data_from_pack(obj);
+		*size = obj->size;
+	} else {
+		base = get_resolved_data(objects + obj->base_object_no, &base_size);
+		raw = get_data_from_pack(obj);
+		data = patch_delta(base, base_size, raw, obj->size, size);
+		free(raw);
+		free(base);
+		if (!data)
+			bad_object(obj->idx.offset, _("failed to apply delta"));
+	}
+	add_resolved_cache(obj_no, data, *size);
+	return data;
+}
+
 /*
  * This function is part of find_unresolved_deltas(). There are two
  * walkers going in the opposite ways.
@@ -661,14 +802,18 @@ static void *get_base_data(struct base_data *c)
 		struct base_data **delta = NULL;
 		int delta_nr = 0, delta_alloc = 0;
 
-		while (is_delta_type(c->obj->type) && !c->data) {
+		while (is_delta_type(c->obj->type) && !c->data && c->base) {
 			ALLOC_GROW(delta, delta_nr + 1, delta_alloc);
 			delta[delta_nr++] = c;
 			c = c->base;
 		}
 		if (!delta_nr) {
-			c->data = get_data_from_pack(obj);
-			c->size = obj->size;
+			if (obj->streamed)
+				c->data = get_resolved_data(obj, &c->size);
+			else {
+				c->data = get_data_from_pack(obj);
+				c->size = obj->size;
+			}
 			get_thread_data()->base_cache_used += c->size;
 			prune_base_data(c);
 		}
@@ -741,6 +886,14 @@ static struct base_data *find_unresolved_deltas_1(struct base_data *base,
 		link_base_data(prev_base, base);
 	}
 
+	/* skip the children that were resolved while streaming */
+	while (base->ref_first <= base->ref_last &&
+	       objects[deltas[base->ref_first].obj_no].streamed)
+		base->ref_first++;
+	while (base->ofs_first <= base->ofs_last &&
+	       objects[deltas[base->ofs_first].obj_no].streamed)
+		base->ofs_first++;
+
 	if (base->ref_first <= base->ref_last) {
 		struct object_entry *child = objects + deltas[base->ref_first].obj_no;
 		struct base_data *result = alloc_base_data();
@@ -818,7 +971,8 @@ static void *threaded_second_pass(void *data)
 		work_lock();
 		display_progress(progress, nr_resolved_deltas);
 		while (nr_dispatched < nr_objects &&
-		       is_delta_type(objects[nr_dispatched].type))
+		       is_delta_type(objects[nr_dispatched].type) &&
+		       !objects[nr_dispatched].streamed)
 			nr_dispatched++;
 		if (nr_dispatched >= nr_objects) {
 			work_unlock();
@@ -831,8 +985,153 @@ static void *threaded_second_pass(void *data)
 	}
 	return NULL;
 }
+
+static void stream_resolve(int i)
+{
+	struct object_entry *obj = objects + i;
+	struct object_entry *base = objects + obj->base_object_no;
+	void *base_data, *delta_data, *data;
+	unsigned long base_size, size;
+
+	base_data = get_resolved_data(base, &base_size);
+	delta_data = get_data_from_pack(obj);
+	data = patch_delta(base_data, base_size,
+			   delta_data, obj->size, &size);
+	free(delta_data);
+	free(base_data);
+	if (!data)
+		bad_object(obj->idx.offset, _("failed to apply delta"));
+	obj->real_type = base->real_type;
+	obj->delta_depth = base->delta_depth + 1;
+	sha1_object(data, size, obj->real_type, obj->idx.sha1);
+	add_resolved_cache(i, data, size);
+	free(data);
+	counter_lock();
+	if (deepest_delta < obj->delta_depth)
+		deepest_delta = obj->delta_depth;
+	nr_resolved_deltas++;
+	counter_unlock();
+}
+
+static void *stream_thread(void *data)
+{
+	set_thread_data(data);
+	pthread_mutex_lock(&stream_mutex);
+	for (;;) {
+		int i = stream_ready, child;
+
+		if (i < 0) {
+			if (stream_done)
+				break;
+			pthread_cond_wait(&stream_cond, &stream_mutex);
+			continue;
+		}
+		stream_ready = stream_next[i];
+		pthread_mutex_unlock(&stream_mutex);
+
+		stream_resolve(i);
+
+		pthread_mutex_lock(&stream_mutex);
+		objects[i].streamed = 1;
+		while ((child = stream_child[i]) >= 0) {
+			stream_child[i] = stream_next[child];
+			stream_next[child] = stream_ready;
+			stream_ready = child;
+		}
+		if (stream_ready >= 0)
+			pthread_cond_broadcast(&stream_cond);
+	}
+	pthread_mutex_unlock(&stream_mutex);
+	return NULL;
+}
+
+static void start_streaming(void)
+{
+	int i, ret;
+
+	stream_next = xmalloc(nr_objects * sizeof(*stream_next));
+	stream_child = xmalloc(nr_objects * sizeof(*stream_child));
+	for (i = 0; i < nr_objects; i++)
+		stream_child[i] = -1;
+	pthread_mutex_init(&stream_mutex, NULL);
+	pthread_cond_init(&stream_cond, NULL);
+	init_thread();
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&thread_data[i].thread, NULL,
+				     stream_thread, thread_data + i);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+}
+
+/*
+ * Hand the deltas among the first nr_parsed objects that are now in
+ * the pack file to the threads, or to their base if it is not
+ * resolved yet.
+ */
+static void stream_publish(int nr_parsed)
+{
+	int ready = 0;
+
+	pthread_mutex_lock(&stream_mutex);
+	while (nr_published < nr_parsed &&
+	       objects[nr_published + 1].idx.offset <= flushed_bytes) {
+		int i = nr_published++, base_no;
+
+		if (objects[i].type != OBJ_OFS_DELTA ||
+		    objects[i].base_object_no < 0)
+			continue;
+		base_no = objects[i].base_object_no;
+		if (!is_delta_type(objects[base_no].type) ||
+		    objects[base_no].streamed) {
+			stream_next[i] = stream_ready;
+			stream_ready = i;
+			ready = 1;
+		} else {
+			stream_next[i] = stream_child[base_no];
+			stream_child[base_no] = i;
+		}
+	}
+	if (ready)
+		pthread_cond_broadcast(&stream_cond);
+	pthread_mutex_unlock(&stream_mutex);
+}
+
+static void finish_streaming(void)
+{
+	int i;
+
+	pthread_mutex_lock(&stream_mutex);
+	stream_done = 1;
+	pthread_cond_broadcast(&stream_cond);
+	pthread_mutex_unlock(&stream_mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	cleanup_thread();
+	pthread_mutex_destroy(&stream_mutex);
+	pthread_cond_destroy(&stream_cond);
+	free(stream_next);
+	free(stream_child);
+}
 #endif
 
+/* The object starting at offset among the first nr ones, or -1 */
+static int find_object_at(off_t offset, int nr)
+{
+	int first = 0, last = nr;
+
+	while (first < last) {
+		int next = (first + last) / 2;
+		if (objects[next].idx.offset == offset)
+			return next;
+		if (objects[next].idx.offset < offset)
+			first = next + 1;
+		else
+			last = next;
+	}
+	return -1;
+}
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -849,11 +1148,18 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+#ifndef NO_PTHREADS
+	if (stream_deltas)
+		start_streaming();
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &delta->base);
 		obj->real_type = obj->type;
 		if (is_delta_type(obj->type)) {
+			if (obj->type == OBJ_OFS_DELTA)
+				obj->base_object_no =
+					find_object_at(delta->base.offset, i);
 			nr_deltas++;
 			delta->obj_no = i;
 			delta++;
@@ -861,12 +1167,24 @@ static void parse_pack_objects(unsigned char *sha1)
 			sha1_object(data, obj->size, obj->type, obj->idx.sha1);
 		free(data);
 		display_progress(progress, i+1);
+#ifndef NO_PTHREADS
+		if (stream_deltas) {
+			objects[i + 1].idx.offset = consumed_bytes;
+			stream_publish(i + 1);
+		}
+#endif
 	}
 	objects[i].idx.offset = consumed_bytes;
 	stop_progress(&progress);
 
 	/* Check pack integrity */
 	flush();
+#ifndef NO_PTHREADS
+	if (stream_deltas) {
+		stream_publish(nr_objects);
+		finish_streaming();
+	}
+#endif
 	git_SHA1_Final(sha1, &input_ctx);
 	if (hashcmp(fill(20), sha1))
 		die(_("pack is corrupted (SHA1 mismatch)"));
@@ -892,7 +1210,7 @@ static void resolve_deltas(void)
 {
 	int i;
 
-	if (!nr_deltas)
+	if (nr_deltas == nr_resolved_deltas)
 		return;
 
 	/* Sort deltas by base SHA1/offset for fast searching */
@@ -922,7 +1240,7 @@ static void resolve_deltas(void)
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 
-		if (is_delta_type(obj->type))
+		if (is_delta_type(obj->type) && !obj->streamed)
 			continue;
 		resolve_base(obj);
 		display_progress(progress, nr_resolved_deltas);
@@ -1316,6 +1634,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	const char *keep_name = NULL, *keep_msg = NULL;
 	char *index_name_buf = NULL, *keep_name_buf = NULL;
 	struct pack_idx_entry **idx_objects;
+	struct strbuf externals = STRBUF_INIT;
 	struct pack_idx_option opts;
 	unsigned char pack_sha1[20];
 
@@ -1339,6 +1658,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				fix_thin_pack = 1;
 			} else if (!strcmp(arg, "--strict")) {
 				strict = 1;
+			} else if (!strcmp(arg, "--report-external")) {
+				report_external = 1;
 			} else if (!strcmp(arg, "--verify")) {
 				verify = 1;
 			} else if (!strcmp(arg, "--verify-stat")) {
@@ -1441,6 +1762,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		if (nr_threads > 3)
 			nr_threads = 3;
 	}
+	stream_deltas = from_stdin &&
+		(nr_threads > 1 || getenv("GIT_FORCE_THREADS"));
 #endif
 
 	curr_pack = open_pack_file(pack_name);
@@ -1449,8 +1772,11 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	deltas = xcalloc(nr_objects, sizeof(struct delta_entry));
 	parse_pack_objects(pack_sha1);
 	resolve_deltas();
+	clear_resolved_cache();
 	conclude_pack(fix_thin_pack, curr_pack, pack_sha1);
 	free(deltas);
+	if (report_external)
+		list_external_objects(&externals);
 	if (strict)
 		check_objects();
 
@@ -1470,6 +1796,9 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		      pack_sha1);
 	else
 		close(input_fd);
+	if (report_external)
+		write_or_die(1, externals.buf, externals.len);
+	strbuf_release(&externals);
 	free(objects);
 	free(index_name_buf);
 	free(keep_name_buf);
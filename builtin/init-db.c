@@ -183,9 +183,9 @@ static int create_default_files(const char *template_path)
 	unsigned len = strlen(git_dir);
 	static char path[PATH_MAX];
 	struct stat st1;
-	char repo_version_string[10];
+	char repo_version_string[16];
 	char junk[2];
-	int reinit;
+	int reinit, repo_version;
 	int filemode;
 
 	if (len > sizeof(path)-50)
@@ -241,8 +241,20 @@ static int create_default_files(const char *template_path)
 			exit(1);
 	}
 
+	/* Keep the newer format an existing repository may be in */
+	repo_version = GIT_REPO_VERSION;
+	if (reinit) {
+		strcpy(path + len, "config");
+		repository_format_version = 0;
+		git_config_from_file(check_repository_format_version,
+				     path, NULL);
+		path[len] = 0;
+		if (repo_version < repository_format_version)
+			repo_version = repository_format_version;
+	}
+
 	/* This forces creation of new config file */
-	sprintf(repo_version_string, "%d", GIT_REPO_VERSION);
+	sprintf(repo_version_string, "%d", repo_version);
 	git_config_set("core.repositoryformatversion", repo_version_string);
 
 	path[len] = 0;
@@ -13,6 +13,7 @@
 #include "parse-options.h"
 #include "resolve-undo.h"
 #include "string-list.h"
+#include "sparse-index.h"
 
 static int abbrev;
 static int show_deleted;
@@ -26,6 +27,7 @@ static int show_killed;
 static int show_valid_bit;
 static int line_terminator = '\n';
 static int debug_mode;
+static int show_sparse_dirs;
 
 static const char *prefix;
 static int max_prefix_len;
@@ -497,6 +499,8 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 			"pretend that paths removed since <tree-ish> are still present"),
 		OPT__ABBREV(&abbrev),
 		OPT_BOOLEAN(0, "debug", &debug_mode, "show debugging data"),
+		OPT_BOOLEAN(0, "sparse", &show_sparse_dirs,
+			"show sparse directories instead of expanding them"),
 		OPT_END()
 	};
 
@@ -509,11 +513,12 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 		prefix_len = strlen(prefix);
 	git_config(git_default_config, NULL);
 
-	if (read_cache() < 0)
-		die("index file corrupt");
-
 	argc = parse_options(argc, argv, prefix, builtin_ls_files_options,
 			ls_files_usage, 0);
+	if (show_sparse_dirs)
+		command_requires_full_index = 0;
+	if (read_cache() < 0)
+		die("index file corrupt");
 	if (show_tag || show_valid_bit) {
 		tag_cached = "H ";
 		tag_unmerged = "M ";
@@ -2,6 +2,7 @@
 #include "cache.h"
 #include "transport.h"
 #include "remote.h"
+#include "string-list.h"
 
 static const char ls_remote_usage[] =
 "git ls-remote [--heads] [--tags]  [-u <exec> | --upload-pack <exec>]\n"
@@ -38,6 +39,7 @@ int cmd_ls_remote(int argc, const char **argv, const char *prefix)
 	int status = 0;
 	const char *uploadpack = NULL;
 	const char **pattern = NULL;
+	struct string_list ref_prefixes = STRING_LIST_INIT_NODUP;
 
 	struct remote *remote;
 	struct transport *transport;
@@ -118,6 +120,13 @@ int cmd_ls_remote(int argc, const char **argv, const char *prefix)
 	if (uploadpack != NULL)
 		transport_set_option(transport, TRANS_OPT_UPLOADPACK, uploadpack);
 
+	if (flags & REF_HEADS)
+		string_list_append(&ref_prefixes, "refs/heads/");
+	if (flags & REF_TAGS)
+		string_list_append(&ref_prefixes, "refs/tags/");
+	if (ref_prefixes.nr)
+		transport->ref_prefixes = &ref_prefixes;
+
 	ref = transport_get_remote_refs(transport);
 	if (transport_disconnect(transport))
 		return 1;
@@ -465,6 +465,128 @@ static enum write_one_status write_one(struct sha1file *f,
 	return WRITE_ONE_WRITTEN;
 }
 
+/*
+ * Can "e" be copied out of "p" byte-for-byte, including its in-pack
+ * header, if it is written at "write_offset" in the output?
+ */
+static int reusable_verbatim(struct object_entry *e, struct packed_git *p,
+			     off_t write_offset)
+{
+	struct object_entry *base = e->delta;
+
+	if (e->idx.offset || e->preferred_base || e->in_pack != p)
+		return 0;
+	if (e->type != e->in_pack_type)
+		return 0;	/* not reusing the in-pack representation */
+
+	switch (e->in_pack_type) {
+	case OBJ_OFS_DELTA:
+		/*
+		 * The relative base offset in the header stays the same
+		 * only if the base sits at the same distance behind us
+		 * as it does in the original pack.
+		 */
+		return base && allow_ofs_delta &&
+			base->in_pack == p && base->idx.offset > 1 &&
+			write_offset - base->idx.offset ==
+			e->in_pack_offset - base->in_pack_offset;
+	case OBJ_REF_DELTA:
+		/* we would rewrite it as an OFS_DELTA otherwise */
+		return base && !allow_ofs_delta && base->idx.offset > 1;
+	default:
+		return !base;
+	}
+}
+
+struct reused_run {
+	struct packed_git *p;
+	struct revindex_entry *end;	/* next object expected in "p" */
+	off_t pos;			/* where it would be written */
+	uint32_t nr, nr_delta;
+};
+
+/*
+ * Add "e" to the run, after its delta base if that has not been
+ * written yet, just like write_one() would write them.
+ */
+static int extend_reused_run(struct reused_run *run, struct object_entry *e)
+{
+	if (e->delta && !e->delta->idx.offset &&
+	    !extend_reused_run(run, e->delta))
+		return 0;
+	if (run->end->offset != e->in_pack_offset ||
+	    !reusable_verbatim(e, run->p, run->pos))
+		return 0;
+	e->idx.offset = run->pos;
+	run->pos += run->end[1].offset - run->end->offset;
+	run->end++;
+	written_list[nr_written + run->nr++] = &e->idx;
+	if (e->delta)
+		run->nr_delta++;
+	return 1;
+}
+
+/*
+ * Objects that sit back to back in one existing pack and are written
+ * back to back in the same order can be streamed to the output with a
+ * single copy_pack_data() call, instead of re-encoding the header of
+ * each one.  This is only done when writing to stdout, where we
+ * neither verify the reused data nor record CRCs for an .idx file.
+ *
+ * Returns the number of entries from the start of "wo" that have been
+ * taken care of; the caller writes the next one with write_one().
+ */
+static uint32_t write_reused_run(struct sha1file *f,
+				 struct object_entry **wo, uint32_t nr,
+				 off_t *offset)
+{
+	struct reused_run run;
+	struct pack_window *w_curs = NULL;
+	struct revindex_entry *start;
+	struct object_entry *e;
+	off_t len;
+	uint32_t i;
+
+	if (!pack_to_stdout || !reuse_object)
+		return 0;
+	for (e = wo[0]; e->delta && !e->delta->idx.offset; e = e->delta)
+		; /* the first object written is the bottom-most unwritten base */
+	if (e->idx.offset || !e->in_pack)
+		return 0;
+
+	memset(&run, 0, sizeof(run));
+	run.p = e->in_pack;
+	run.end = start = find_pack_revindex(run.p, e->in_pack_offset);
+	run.pos = *offset;
+	for (i = 0; i < nr; i++) {
+		e = wo[i];
+		if (e->idx.offset || e->preferred_base)
+			continue; /* write_one() would skip it, too */
+		if (!extend_reused_run(&run, e))
+			break;
+	}
+
+	if (run.nr < 2) {
+		while (run.nr)
+			written_list[nr_written + --run.nr]->offset = 0;
+		return 0;
+	}
+
+	len = run.pos - *offset;
+	if (signed_add_overflows(*offset, len))
+		die("pack too large for current definition of off_t");
+	copy_pack_data(f, run.p, &w_curs, start->offset, len);
+	unuse_pack(&w_curs);
+	*offset += len;
+
+	nr_written += run.nr;
+	written += run.nr;
+	reused += run.nr;
+	reused_delta += run.nr_delta;
+	written_delta += run.nr_delta;
+	return i;
+}
+
 static int mark_tagged(const char *path, const unsigned char *sha1, int flag,
 		       void *cb_data)
 {
@@ -658,6 +780,13 @@ static void write_pack_file(void)
 		nr_written = 0;
 		for (; i < nr_objects; i++) {
 			struct object_entry *e = write_order[i];
+			uint32_t run = write_reused_run(f, write_order + i,
+							nr_objects - i, &offset);
+			if (run) {
+				i += run - 1;
+				display_progress(progress_state, written);
+				continue;
+			}
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
 			display_progress(progress_state, written);
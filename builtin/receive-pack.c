@@ -174,7 +174,10 @@ struct command {
 	struct command *next;
 	const char *error_string;
 	unsigned int skip_update:1,
-		     did_not_exist:1;
+		     did_not_exist:1,
+		     queued:1,
+		     check_old:1;
+	const char *namespaced_name;
 	unsigned char old_sha1[20];
 	unsigned char new_sha1[20];
 	char ref_name[FLEX_ARRAY]; /* more */
@@ -417,7 +420,6 @@ static const char *update(struct command *cmd)
 	const char *namespaced_name;
 	unsigned char *old_sha1 = cmd->old_sha1;
 	unsigned char *new_sha1 = cmd->new_sha1;
-	struct ref_lock *lock;
 
 	/* only refs/... are allowed */
 	if (prefixcmp(name, "refs/") || check_refname_format(name + 5, 0)) {
@@ -507,16 +509,29 @@ static const char *update(struct command *cmd)
 		return "hook declined";
 	}
 
-	if (is_null_sha1(new_sha1)) {
-		if (!parse_object(old_sha1)) {
-			old_sha1 = NULL;
-			if (ref_exists(name)) {
-				rp_warning("Allowing deletion of corrupt ref.");
-			} else {
-				rp_warning("Deleting a non-existent ref.");
-				cmd->did_not_exist = 1;
-			}
+	cmd->namespaced_name = namespaced_name;
+	cmd->check_old = 1;
+	if (is_null_sha1(new_sha1) && !parse_object(old_sha1)) {
+		cmd->check_old = 0;
+		if (ref_exists(name)) {
+			rp_warning("Allowing deletion of corrupt ref.");
+		} else {
+			rp_warning("Deleting a non-existent ref.");
+			cmd->did_not_exist = 1;
 		}
+	}
+	cmd->queued = 1;
+	return NULL; /* good, to be written by write_updates() */
+}
+
+static const char *write_one_update(struct command *cmd)
+{
+	const char *name = cmd->ref_name;
+	const char *namespaced_name = cmd->namespaced_name;
+	unsigned char *old_sha1 = cmd->check_old ? cmd->old_sha1 : NULL;
+	struct ref_lock *lock;
+
+	if (is_null_sha1(cmd->new_sha1)) {
 		if (delete_ref(namespaced_name, old_sha1, 0)) {
 			rp_error("failed to delete %s", name);
 			return "failed to delete";
@@ -529,13 +544,52 @@ static const char *update(struct command *cmd)
 			rp_error("failed to lock %s", name);
 			return "failed to lock";
 		}
-		if (write_ref_sha1(lock, new_sha1, "push")) {
+		if (write_ref_sha1(lock, cmd->new_sha1, "push")) {
 			return "failed to write"; /* error() already called */
 		}
 		return NULL; /* good */
 	}
 }
 
+/*
+ * Write all the updates that passed the checks in one ref transaction,
+ * so that the refs are locked once and packed-refs is rewritten at
+ * most once.  If that fails, some of them may have been written all
+ * the same; go through the others one by one to find out which ones
+ * fail, and why.
+ */
+static void write_updates(struct command *commands)
+{
+	struct ref_transaction *transaction = ref_transaction_begin();
+	struct command *cmd;
+	int ret;
+
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (!cmd->queued)
+			continue;
+		if (is_null_sha1(cmd->new_sha1))
+			ref_transaction_delete(transaction, cmd->namespaced_name,
+					       cmd->check_old ? cmd->old_sha1 : NULL,
+					       0);
+		else
+			ref_transaction_update(transaction, cmd->namespaced_name,
+					       cmd->new_sha1, cmd->old_sha1, 0);
+	}
+	ret = ref_transaction_commit(transaction, "push", QUIET_ON_ERR);
+	for (cmd = commands; ret && cmd; cmd = cmd->next)
+		if (cmd->queued &&
+		    ref_transaction_applied(transaction, cmd->namespaced_name))
+			cmd->queued = 0;
+	/* this releases the locks the transaction may still hold */
+	ref_transaction_free(transaction);
+	if (!ret)
+		return;
+
+	for (cmd = commands; cmd; cmd = cmd->next)
+		if (cmd->queued)
+			cmd->error_string = write_one_update(cmd);
+}
+
 static char update_post_hook[] = "hooks/post-update";
 
 static void run_update_post_hook(struct command *commands)
@@ -692,6 +746,65 @@ static int iterate_receive_command_list(void *cb_data, unsigned char sha1[20])
 	return -1; /* end of list */
 }
 
+/*
+ * The pack we received through index-pack, and the objects outside of
+ * it that its objects link to.
+ */
+static struct packed_git *received_pack;
+static struct sha1_array pack_externals;
+
+static int iterate_pack_externals(void *cb_data, unsigned char sha1[20])
+{
+	int *i = cb_data;
+
+	if (*i >= pack_externals.nr)
+		return -1; /* end of list */
+	hashcpy(sha1, pack_externals.sha1[(*i)++]);
+	return 0;
+}
+
+static int add_ref_tip(const char *refname, const unsigned char *sha1,
+		       int flag, void *cb_data)
+{
+	sha1_array_append(cb_data, sha1);
+	return 0;
+}
+
+/*
+ * If every new ref value is in the received pack, the new values are
+ * connected as long as everything the pack refers to outside of itself
+ * is.  That is a given for the tips of our refs; any other object the
+ * pack refers to merely existing is not enough (it may be a dangling
+ * commit whose tree is missing), so walk from those up to our refs.
+ * Returns 0 if connected, and -1 if a full check is needed.
+ */
+static int check_connected_by_pack(struct command *commands)
+{
+	struct sha1_array ref_tips = SHA1_ARRAY_INIT;
+	struct command *cmd;
+	int i;
+
+	if (!received_pack)
+		return -1;
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (is_null_sha1(cmd->new_sha1))
+			continue;
+		if (!find_pack_entry_one(cmd->new_sha1, received_pack))
+			return -1;
+	}
+
+	for_each_ref(add_ref_tip, &ref_tips);
+	for (i = 0; i < pack_externals.nr; i++)
+		if (sha1_array_lookup(&ref_tips, pack_externals.sha1[i]) < 0)
+			break;
+	sha1_array_clear(&ref_tips);
+	if (i == pack_externals.nr)
+		return 0;
+
+	i = 0;
+	return check_everything_connected(iterate_pack_externals, 1, &i) ? -1 : 0;
+}
+
 static void execute_commands(struct command *commands, const char *unpacker_error)
 {
 	struct command *cmd;
@@ -704,7 +817,8 @@ static void execute_commands(struct command *commands, const char *unpacker_erro
 	}
 
 	cmd = commands;
-	if (check_everything_connected(iterate_receive_command_list,
+	if (check_connected_by_pack(commands) &&
+	    check_everything_connected(iterate_receive_command_list,
 				       0, &cmd))
 		set_connectivity_errors(commands);
 
@@ -730,6 +844,7 @@ static void execute_commands(struct command *commands, const char *unpacker_erro
 
 		cmd->error_string = update(cmd);
 	}
+	write_updates(commands);
 }
 
 static struct command *read_head_info(void)
@@ -799,6 +914,37 @@ static const char *parse_pack_header(struct pack_header *hdr)
 
 static const char *pack_lockfile;
 
+/*
+ * Read what index-pack --report-external says after the pack name,
+ * and find the pack it wrote (named in the .keep file's name).
+ */
+static void read_pack_externals(int fd)
+{
+	struct strbuf sb = STRBUF_INIT;
+	unsigned char sha1[20];
+	const char *name, *p;
+
+	if (strbuf_read(&sb, fd, 0) < 0)
+		goto out;
+	for (p = sb.buf; *p; p += 50) {
+		if (prefixcmp(p, "external\t") || get_sha1_hex(p + 9, sha1) ||
+		    p[49] != '\n')
+			goto out;
+		sha1_array_append(&pack_externals, sha1);
+	}
+
+	name = pack_lockfile ? strrchr(pack_lockfile, '/') : NULL;
+	if (!name || prefixcmp(name, "/pack-") || get_sha1_hex(name + 6, sha1))
+		goto out;
+	reprepare_packed_git();
+	for (received_pack = packed_git; received_pack;
+	     received_pack = received_pack->next)
+		if (!hashcmp(received_pack->sha1, sha1))
+			break;
+out:
+	strbuf_release(&sb);
+}
+
 static const char *unpack(void)
 {
 	struct pack_header hdr;
@@ -832,7 +978,7 @@ static const char *unpack(void)
 			return NULL;
 		return "unpack-objects abnormal exit";
 	} else {
-		const char *keeper[7];
+		const char *keeper[8];
 		int s, status, i = 0;
 		char keep_arg[256];
 		struct child_process ip;
@@ -846,6 +992,7 @@ static const char *unpack(void)
 		if (fsck_objects)
 			keeper[i++] = "--strict";
 		keeper[i++] = "--fix-thin";
+		keeper[i++] = "--report-external";
 		keeper[i++] = hdr_arg;
 		keeper[i++] = keep_arg;
 		keeper[i++] = NULL;
@@ -858,12 +1005,14 @@ static const char *unpack(void)
 			return "index-pack fork failed";
 		}
 		pack_lockfile = index_pack_lockfile(ip.out);
+		read_pack_externals(ip.out);
 		close(ip.out);
 		status = finish_command(&ip);
 		if (!status) {
 			reprepare_packed_git();
 			return NULL;
 		}
+		received_pack = NULL;
 		return "index-pack abnormal exit";
 	}
 }
@@ -0,0 +1,53 @@
+#include "cache.h"
+#include "builtin.h"
+#include "parse-options.h"
+#include "tree.h"
+#include "grep-index.h"
+
+static const char * const update_grep_index_usage[] = {
+	"git update-grep-index [-v] [--rebuild] [<tree-ish>...]",
+	NULL
+};
+
+int cmd_update_grep_index(int argc, const char **argv, const char *prefix)
+{
+	static const char *head_argv[] = { "HEAD", NULL };
+	int verbose = 0, rebuild = 0, i, added;
+	struct tree **trees;
+	struct option options[] = {
+		OPT__VERBOSE(&verbose, "report the number of blobs added"),
+		OPT_BOOLEAN(0, "rebuild", &rebuild,
+			    "drop the blobs already in the index"),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     update_grep_index_usage, 0);
+	if (!argc) {
+		argv = head_argv;
+		argc = 1;
+	}
+
+	trees = xcalloc(argc, sizeof(*trees));
+	for (i = 0; i < argc; i++) {
+		unsigned char sha1[20];
+
+		if (get_sha1(argv[i], sha1))
+			die(_("Not a valid object name %s"), argv[i]);
+		trees[i] = parse_tree_indirect(sha1);
+		if (!trees[i])
+			die(_("not a tree object: %s"), argv[i]);
+	}
+
+	added = update_grep_index(trees, argc,
+				  rebuild ? GREP_INDEX_REBUILD : 0);
+	free(trees);
+	if (added < 0)
+		return 1;
+	if (verbose)
+		fprintf(stderr, Q_("Added %d blob to the grep index.\n",
+				   "Added %d blobs to the grep index.\n", added),
+			added);
+	return 0;
+}
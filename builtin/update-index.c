@@ -10,6 +10,8 @@
 #include "builtin.h"
 #include "refs.h"
 #include "resolve-undo.h"
+#include "split-index.h"
+#include "dir.h"
 #include "parse-options.h"
 
 /*
@@ -709,6 +711,8 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	int read_from_stdin = 0;
 	int prefix_length = prefix ? strlen(prefix) : 0;
 	int preferred_index_format = 0;
+	int split_index = -1;
+	int untracked_cache = -1;
 	char set_executable_bit = 0;
 	struct refresh_params refresh_args = {0, &has_errors};
 	int lock_error = 0;
@@ -794,6 +798,10 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 			resolve_undo_clear_callback},
 		OPT_INTEGER(0, "index-version", &preferred_index_format,
 			    "write index in this format"),
+		OPT_BOOL(0, "split-index", &split_index,
+			"enable or disable split index"),
+		OPT_BOOL(0, "untracked-cache", &untracked_cache,
+			"enable or disable untracked cache"),
 		OPT_END()
 	};
 
@@ -866,6 +874,47 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 		the_index.version = preferred_index_format;
 	}
 
+	if (split_index > 0) {
+		if (!core_split_index)
+			warning("core.splitIndex is set to false; "
+				"remove or change it, if you really want to "
+				"enable split index");
+		if (!the_index.split_index) {
+			init_split_index(&the_index);
+			active_cache_changed = 1;
+		}
+	} else if (!split_index) {
+		if (core_split_index > 0)
+			warning("core.splitIndex is set to true; "
+				"remove or change it, if you really want to "
+				"disable split index");
+		if (the_index.split_index) {
+			discard_split_index(&the_index);
+			active_cache_changed = 1;
+		}
+	}
+
+	if (untracked_cache > 0) {
+		if (!core_untracked_cache)
+			warning("core.untrackedCache is set to false; "
+				"remove or change it, if you really want to "
+				"enable the untracked cache");
+		if (!the_index.untracked) {
+			the_index.untracked = xcalloc(1, sizeof(*the_index.untracked));
+			active_cache_changed = 1;
+		}
+	} else if (!untracked_cache) {
+		if (core_untracked_cache > 0)
+			warning("core.untrackedCache is set to true; "
+				"remove or change it, if you really want to "
+				"disable the untracked cache");
+		if (the_index.untracked) {
+			free_untracked_cache(the_index.untracked);
+			the_index.untracked = NULL;
+			active_cache_changed = 1;
+		}
+	}
+
 	if (read_from_stdin) {
 		struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
 
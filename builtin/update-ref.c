@@ -6,19 +6,122 @@
 static const char * const git_update_ref_usage[] = {
 	"git update-ref [options] -d <refname> [<oldval>]",
 	"git update-ref [options]    <refname> <newval> [<oldval>]",
+	"git update-ref [options] --stdin",
 	NULL
 };
 
+static void parse_value(const char *value, unsigned char *sha1,
+			const char *what, const char *line)
+{
+	if (!*value)
+		hashclr(sha1);
+	else if (get_sha1(value, sha1))
+		die("invalid %s value '%s' in: %s", what, value, line);
+}
+
+/*
+ * Read commands from stdin, one per line, and carry them all out in
+ * one transaction:
+ *
+ *	update <ref> <newvalue> [<oldvalue>]
+ *	create <ref> <newvalue>
+ *	delete <ref> [<oldvalue>]
+ *	verify <ref> [<oldvalue>]
+ *	option no-deref
+ *
+ * where the option applies to the command that follows it.
+ */
+static int update_refs_stdin(const char *msg)
+{
+	struct ref_transaction *transaction = ref_transaction_begin();
+	struct strbuf line = STRBUF_INIT, buf = STRBUF_INIT;
+	int ret, flags = 0;
+
+	while (strbuf_getline(&line, stdin, '\n') != EOF) {
+		unsigned char new_sha1[20], old_sha1[20];
+		const char *args[4], *cmd, *refname;
+		char *p;
+		int nargs = 0;
+
+		strbuf_reset(&buf);
+		strbuf_addbuf(&buf, &line);
+		p = buf.buf;
+		do {
+			if (nargs == ARRAY_SIZE(args))
+				die("too many arguments in: %s", line.buf);
+			args[nargs++] = p;
+			p = strchr(p, ' ');
+			if (p)
+				*p++ = '\0';
+		} while (p);
+		cmd = args[0];
+		refname = nargs > 1 ? args[1] : NULL;
+
+		if (!strcmp(cmd, "option")) {
+			if (nargs != 2 || strcmp(refname, "no-deref"))
+				die("unknown option in: %s", line.buf);
+			flags |= REF_NODEREF;
+			continue;
+		}
+		if (!refname || !*refname)
+			die("missing ref name in: %s", line.buf);
+		if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL))
+			die("invalid ref format in: %s", line.buf);
+
+		if (!strcmp(cmd, "update") && (nargs == 3 || nargs == 4)) {
+			parse_value(args[2], new_sha1, "new", line.buf);
+			if (nargs == 4)
+				parse_value(args[3], old_sha1, "old", line.buf);
+			ref_transaction_update(transaction, refname, new_sha1,
+					       nargs == 4 ? old_sha1 : NULL, flags);
+		} else if (!strcmp(cmd, "create") && nargs == 3) {
+			parse_value(args[2], new_sha1, "new", line.buf);
+			if (is_null_sha1(new_sha1))
+				die("create with zero new value in: %s", line.buf);
+			ref_transaction_update(transaction, refname, new_sha1,
+					       null_sha1, flags);
+		} else if (!strcmp(cmd, "delete") && (nargs == 2 || nargs == 3)) {
+			if (nargs == 3) {
+				parse_value(args[2], old_sha1, "old", line.buf);
+				if (is_null_sha1(old_sha1))
+					die("delete with zero old value in: %s",
+					    line.buf);
+			}
+			ref_transaction_delete(transaction, refname,
+					       nargs == 3 ? old_sha1 : NULL, flags);
+		} else if (!strcmp(cmd, "verify") && (nargs == 2 || nargs == 3)) {
+			hashclr(old_sha1);
+			if (nargs == 3)
+				parse_value(args[2], old_sha1, "old", line.buf);
+			/* "updating" to the old value writes nothing */
+			ref_transaction_update(transaction, refname, old_sha1,
+					       old_sha1, flags);
+		} else {
+			die("unknown command or wrong number of arguments: %s",
+			    line.buf);
+		}
+		flags = 0;
+	}
+	strbuf_release(&line);
+	strbuf_release(&buf);
+
+	ret = ref_transaction_commit(transaction, msg, DIE_ON_ERR);
+	ref_transaction_free(transaction);
+	return ret;
+}
+
 int cmd_update_ref(int argc, const char **argv, const char *prefix)
 {
 	const char *refname, *oldval, *msg = NULL;
 	unsigned char sha1[20], oldsha1[20];
-	int delete = 0, no_deref = 0, flags = 0;
+	int delete = 0, no_deref = 0, read_stdin = 0, flags = 0;
 	struct option options[] = {
 		OPT_STRING( 'm', NULL, &msg, "reason", "reason of the update"),
 		OPT_BOOLEAN('d', NULL, &delete, "deletes the reference"),
 		OPT_BOOLEAN( 0 , "no-deref", &no_deref,
 					"update <refname> not the one it points to"),
+		OPT_BOOLEAN( 0 , "stdin", &read_stdin,
+					"read updates from stdin and apply them all or none"),
 		OPT_END(),
 	};
 
@@ -28,6 +131,12 @@ int cmd_update_ref(int argc, const char **argv, const char *prefix)
 	if (msg && !*msg)
 		die("Refusing to perform update with empty message.");
 
+	if (read_stdin) {
+		if (delete || no_deref || argc > 0)
+			usage_with_options(git_update_ref_usage, options);
+		return update_refs_stdin(msg);
+	}
+
 	if (delete) {
 		if (argc < 1 || argc > 2)
 			usage_with_options(git_update_ref_usage, options);
@@ -31,6 +31,20 @@ void cache_tree_free(struct cache_tree **it_p)
 	*it_p = NULL;
 }
 
+static void discard_subtrees(struct cache_tree *it)
+{
+	int i;
+
+	for (i = 0; i < it->subtree_nr; i++)
+		if (it->down[i]) {
+			cache_tree_free(&it->down[i]->cache_tree);
+			free(it->down[i]);
+		}
+	free(it->down);
+	it->down = NULL;
+	it->subtree_nr = it->subtree_alloc = 0;
+}
+
 static int subtree_name_cmp(const char *one, int onelen,
 			    const char *two, int twolen)
 {
@@ -286,6 +300,14 @@ static int update_one(struct cache_tree *it,
 		sub = find_subtree(it, path + baselen, sublen, 1);
 		if (!sub->cache_tree)
 			sub->cache_tree = cache_tree();
+		if (S_ISSPARSEDIR(ce->ce_mode) && !slash[1]) {
+			/* a sparse directory entry is the whole subtree */
+			discard_subtrees(sub->cache_tree);
+			hashcpy(sub->cache_tree->sha1, ce->sha1);
+			sub->cache_tree->entry_count = 1;
+			sub->used = 1;
+			continue;
+		}
 		subcnt = update_one(sub->cache_tree,
 				    cache + i, entries - i,
 				    path,
@@ -519,7 +541,7 @@ struct cache_tree *cache_tree_read(const char *buffer, unsigned long size)
 	return read_one(&buffer, &size);
 }
 
-static struct cache_tree *cache_tree_find(struct cache_tree *it, const char *path)
+struct cache_tree *cache_tree_find(struct cache_tree *it, const char *path)
 {
 	if (!it)
 		return NULL;
@@ -637,6 +659,71 @@ void prime_cache_tree(struct cache_tree **it, struct tree *tree)
 	prime_cache_tree_rec(*it, tree);
 }
 
+/*
+ * Make the subtree at "path" (a directory name with its trailing
+ * slash) cover "nr" index entries, and fix up the counts of the trees
+ * above it to match.  Returns the subtree, or NULL (after invalidating
+ * "path") if it was not valid to begin with.
+ */
+static struct cache_tree *resize_subtree(struct cache_tree *root,
+					 const char *path, int nr)
+{
+	struct cache_tree *it, *subtree = cache_tree_find(root, path);
+	int delta;
+
+	if (!subtree || subtree == root || subtree->entry_count < 0) {
+		cache_tree_invalidate_path(root, path);
+		return NULL;
+	}
+	delta = nr - subtree->entry_count;
+	for (it = root; it; ) {
+		const char *slash;
+		struct cache_tree_sub *sub;
+
+		if (0 <= it->entry_count)
+			it->entry_count += delta;
+		slash = strchr(path, '/');
+		if (!slash)
+			break;
+		sub = find_subtree(it, path, slash - path, 0);
+		it = sub ? sub->cache_tree : NULL;
+		path = slash + 1;
+	}
+	return subtree;
+}
+
+void cache_tree_collapse(struct cache_tree *root, const char *path)
+{
+	struct cache_tree *it;
+
+	if (!root)
+		return;
+	it = resize_subtree(root, path, 1);
+	if (it)
+		discard_subtrees(it);
+}
+
+void cache_tree_expand(struct cache_tree *root, const char *path,
+		       struct tree *tree)
+{
+	struct cache_tree *fresh, *it;
+
+	if (!root)
+		return;
+	fresh = cache_tree();
+	prime_cache_tree_rec(fresh, tree);
+	it = resize_subtree(root, path, fresh->entry_count);
+	if (it) {
+		discard_subtrees(it);
+		it->down = fresh->down;
+		it->subtree_nr = fresh->subtree_nr;
+		it->subtree_alloc = fresh->subtree_alloc;
+		fresh->down = NULL;
+		fresh->subtree_nr = fresh->subtree_alloc = 0;
+	}
+	cache_tree_free(&fresh);
+}
+
 /*
  * find the cache_tree that corresponds to the current level without
  * exploding the full path into textual form.  The root of the
@@ -47,6 +47,16 @@ int update_main_cache_tree(int);
 int write_cache_as_tree(unsigned char *sha1, int flags, const char *prefix);
 void prime_cache_tree(struct cache_tree **, struct tree *);
 
+struct cache_tree *cache_tree_find(struct cache_tree *, const char *path);
+
+/*
+ * Keep the cache tree in step with a sparse index: the subtree for
+ * directory "path" (with its trailing slash) becomes a single entry,
+ * or gets the entries of "tree" back.
+ */
+void cache_tree_collapse(struct cache_tree *, const char *path);
+void cache_tree_expand(struct cache_tree *, const char *path, struct tree *tree);
+
 extern int cache_tree_matches_traversal(struct cache_tree *, struct name_entry *ent, struct traverse_info *info);
 
 #endif
@@ -73,6 +73,14 @@ unsigned long git_deflate_bound(git_zstream *, unsigned long);
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * In a sparse index, a directory whose entries are all outside of the
+ * sparse checkout can be stored as a single entry, named after the
+ * directory with a trailing slash, that records the tree object for
+ * it.  See sparse-index.h.
+ */
+#define S_ISSPARSEDIR(m)	((m) == S_IFDIR)
+
 /*
  * Intensive research over the course of many years has shown that
  * port 9418 is totally unused by anything else. Or
@@ -162,6 +170,8 @@ struct cache_entry {
 #define CE_UNPACKED          (1 << 24)
 #define CE_NEW_SKIP_WORKTREE (1 << 25)
 
+#define CE_FSMONITOR_VALID   (1 << 26) /* known clean, see fsmonitor.h */
+
 /*
  * Extended on-disk flags
  */
@@ -274,8 +284,16 @@ struct index_state {
 	struct cache_tree *cache_tree;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 sparse_index : 1;
 	struct hash_table name_hash;
+	unsigned char sha1[20];
+	struct split_index *split_index;
+	struct untracked_cache *untracked;
+	uint64_t fsmonitor_last_update;
+	unsigned int *fsmonitor_dirty;
+	unsigned int fsmonitor_dirty_nr, fsmonitor_dirty_alloc;
+	unsigned fsmonitor_has_extension : 1;
 };
 
 extern struct index_state the_index;
@@ -352,6 +370,7 @@ static inline enum object_type object_type(unsigned int mode)
 
 #define GIT_DIR_ENVIRONMENT "GIT_DIR"
 #define GIT_NAMESPACE_ENVIRONMENT "GIT_NAMESPACE"
+#define GIT_PROTOCOL_ENVIRONMENT "GIT_PROTOCOL"
 #define GIT_WORK_TREE_ENVIRONMENT "GIT_WORK_TREE"
 #define DEFAULT_GIT_DIR_ENVIRONMENT ".git"
 #define DB_ENVIRONMENT "GIT_OBJECT_DIRECTORY"
@@ -440,6 +459,7 @@ extern int init_db(const char *template_dir, unsigned int flags);
 /* Initialize and use the cache information */
 extern int read_index(struct index_state *);
 extern int read_index_preload(struct index_state *, const char **pathspec);
+extern void preload_index(struct index_state *, const char **pathspec);
 extern int read_index_from(struct index_state *, const char *path);
 extern int is_index_unborn(struct index_state *);
 extern int read_index_unmerged(struct index_state *);
@@ -559,7 +579,11 @@ extern unsigned long pack_size_limit_cfg;
 extern int read_replace_refs;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_split_index;
+extern int core_untracked_cache;
+extern const char *core_fsmonitor;
 extern int core_apply_sparse_checkout;
+extern int core_sparse_checkout_cone;
 
 enum branch_track {
 	BRANCH_TRACK_UNSPECIFIED = -1,
@@ -597,12 +621,22 @@ enum object_creation_mode {
 
 extern enum object_creation_mode object_creation_mode;
 
+enum packed_refs_format {
+	PACKED_REFS_TEXT = 0,
+	PACKED_REFS_TABLE
+};
+
+extern enum packed_refs_format packed_refs_format;
+
 extern char *notes_ref_name;
 
 extern int grafts_replace_parents;
 
 #define GIT_REPO_VERSION 0
+/* version 1 repositories list what else they need in extensions.* */
+#define GIT_REPO_VERSION_READ 1
 extern int repository_format_version;
+extern int repository_format_ref_tables;
 extern int check_repository_format(void);
 
 #define MTIME_CHANGED	0x0001
@@ -1018,6 +1052,7 @@ struct ref {
 extern struct ref *find_ref_by_name(const struct ref *list, const char *name);
 
 #define CONNECT_VERBOSE       (1u << 0)
+#define CONNECT_PROTOCOL_V2   (1u << 1)
 extern struct child_process *git_connect(int fd[2], const char *url, const char *prog, int flags);
 extern int finish_connect(struct child_process *conn);
 extern int git_connection_is_socket(struct child_process *conn);
@@ -1028,6 +1063,27 @@ struct extra_have_objects {
 extern struct ref **get_remote_heads(int in, struct ref **list, unsigned int flags, struct extra_have_objects *);
 extern int server_supports(const char *feature);
 extern const char *parse_feature_request(const char *features, const char *feature);
+/* The value of a "feature=value" server capability, not NUL-terminated */
+extern const char *server_feature_value(const char *feature, int *len);
+
+/*
+ * Protocol version 2 (see Documentation/technical/protocol-v2.txt).
+ * get_protocol_version_config() is the version a client asks for
+ * (protocol.version), requested_protocol_version() the version a
+ * server was asked for in $GIT_PROTOCOL.  After get_remote_heads(),
+ * server_protocol_version() tells whether the server answered with
+ * version 2, in which case it has not sent any refs yet and they are
+ * asked for with get_remote_refs_v2().
+ */
+struct string_list;
+extern int get_protocol_version_config(void);
+extern int requested_protocol_version(void);
+extern int server_protocol_version(void);
+extern void write_ls_refs_request(struct strbuf *req, const struct string_list *prefixes);
+extern struct ref **read_ls_refs_response(int in, struct ref **list, unsigned int flags);
+extern struct ref **get_remote_refs_v2(int in, int out, struct ref **list,
+				       unsigned int flags,
+				       const struct string_list *prefixes);
 
 extern struct packed_git *parse_pack_index(unsigned char *sha1, const char *idx_path);
 
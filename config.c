@@ -743,6 +743,19 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.splitindex")) {
+		core_split_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.untrackedcache")) {
+		core_untracked_cache = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.fsmonitor"))
+		return git_config_pathname(&core_fsmonitor, var, value);
+
 	if (!strcmp(var, "core.createobject")) {
 		if (!strcmp(value, "rename"))
 			object_creation_mode = OBJECT_CREATION_USES_RENAMES;
@@ -753,11 +766,28 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.packedrefsformat")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "text"))
+			packed_refs_format = PACKED_REFS_TEXT;
+		else if (!strcmp(value, "table"))
+			packed_refs_format = PACKED_REFS_TABLE;
+		else
+			die("Invalid format for packed refs: %s", value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.sparsecheckout")) {
 		core_apply_sparse_checkout = git_config_bool(var, value);
 		return 0;
 	}
 
+	if (!strcmp(var, "core.sparsecheckoutcone")) {
+		core_sparse_checkout_cone = git_config_bool(var, value);
+		return 0;
+	}
+
 	/* Add other config variables here and to Documentation/config.txt. */
 	return 0;
 }
@@ -6,8 +6,10 @@
 #include "run-command.h"
 #include "remote.h"
 #include "url.h"
+#include "string-list.h"
 
 static char *server_capabilities;
+static int server_protocol_v2;
 
 static int check_ref(const char *name, int len, unsigned int flags)
 {
@@ -52,10 +54,35 @@ static void add_extra_have(struct extra_have_objects *extra, unsigned char *sha1
 /*
  * Read all the refs from the other end
  */
+/*
+ * A version 2 server only lists its capabilities; the ones of the
+ * fetch command are the ones that used to follow the first ref.
+ */
+static void read_v2_capabilities(int in)
+{
+	static char buffer[1000];
+	int len;
+
+	server_protocol_v2 = 1;
+	free(server_capabilities);
+	server_capabilities = NULL;
+	while ((len = packet_read_line(in, buffer, sizeof(buffer)))) {
+		if (buffer[len-1] == '\n')
+			buffer[--len] = 0;
+		if (!prefixcmp(buffer, "fetch=")) {
+			free(server_capabilities);
+			server_capabilities = xstrdup(buffer + 6);
+		}
+	}
+}
+
 struct ref **get_remote_heads(int in, struct ref **list,
 			      unsigned int flags,
 			      struct extra_have_objects *extra_have)
 {
+	int first = 1;
+
+	server_protocol_v2 = 0;
 	*list = NULL;
 	for (;;) {
 		struct ref *ref;
@@ -73,6 +100,12 @@ struct ref **get_remote_heads(int in, struct ref **list,
 		if (len > 4 && !prefixcmp(buffer, "ERR "))
 			die("remote error: %s", buffer + 4);
 
+		if (first && !strcmp(buffer, "version 2")) {
+			read_v2_capabilities(in);
+			break;
+		}
+		first = 0;
+
 		if (len < 42 || get_sha1_hex(buffer, old_sha1) || buffer[40] != ' ')
 			die("protocol error: expected sha/ref, got '%s'", buffer);
 		name = buffer + 41;
@@ -99,11 +132,143 @@ struct ref **get_remote_heads(int in, struct ref **list,
 	return list;
 }
 
+int server_protocol_version(void)
+{
+	return server_protocol_v2 ? 2 : 0;
+}
+
+void write_ls_refs_request(struct strbuf *req, const struct string_list *prefixes)
+{
+	int i;
+
+	packet_buf_write(req, "command=ls-refs\n");
+	packet_buf_write(req, "peel\n");
+	for (i = 0; prefixes && i < prefixes->nr; i++)
+		packet_buf_write(req, "ref-prefix %s\n", prefixes->items[i].string);
+	packet_buf_flush(req);
+}
+
+/*
+ * Read the answer to an ls-refs command.  A peeled value is turned
+ * into a "^{}" ref, as a version 0 server would have listed it.
+ */
+struct ref **read_ls_refs_response(int in, struct ref **list, unsigned int flags)
+{
+	struct strbuf peeled_name = STRBUF_INIT;
+
+	for (;;) {
+		static char buffer[1000];
+		unsigned char sha1[20];
+		char *name, *peeled;
+		struct ref *ref;
+		int len;
+
+		len = packet_read_line(in, buffer, sizeof(buffer));
+		if (!len)
+			break;
+		if (buffer[len-1] == '\n')
+			buffer[--len] = 0;
+
+		if (len > 4 && !prefixcmp(buffer, "ERR "))
+			die("remote error: %s", buffer + 4);
+
+		if (len < 42 || get_sha1_hex(buffer, sha1) || buffer[40] != ' ')
+			die("protocol error: expected sha/ref, got '%s'", buffer);
+		name = buffer + 41;
+		peeled = strstr(name, " peeled:");
+		if (peeled)
+			*peeled = '\0';
+
+		if (!check_ref(name, strlen(name), flags))
+			continue;
+		ref = alloc_ref(name);
+		hashcpy(ref->old_sha1, sha1);
+		*list = ref;
+		list = &ref->next;
+
+		if (!peeled)
+			continue;
+		if (get_sha1_hex(peeled + 8, sha1))
+			die("protocol error: bad peeled value in '%s'", name);
+		strbuf_reset(&peeled_name);
+		strbuf_addf(&peeled_name, "%s^{}", name);
+		if (!check_ref(peeled_name.buf, peeled_name.len, flags))
+			continue;
+		ref = alloc_ref(peeled_name.buf);
+		hashcpy(ref->old_sha1, sha1);
+		*list = ref;
+		list = &ref->next;
+	}
+	strbuf_release(&peeled_name);
+	return list;
+}
+
+struct ref **get_remote_refs_v2(int in, int out, struct ref **list,
+				unsigned int flags,
+				const struct string_list *prefixes)
+{
+	struct strbuf req = STRBUF_INIT;
+
+	write_ls_refs_request(&req, prefixes);
+	write_or_die(out, req.buf, req.len);
+	strbuf_release(&req);
+	return read_ls_refs_response(in, list, flags);
+}
+
+static int protocol_version_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "protocol.version"))
+		*(int *)cb = git_config_int(var, value);
+	return 0;
+}
+
+int get_protocol_version_config(void)
+{
+	static int version = -1;
+
+	if (version < 0) {
+		version = 0;
+		git_config(protocol_version_config, &version);
+		if (version != 0 && version != 2) {
+			warning("ignoring unknown protocol.version %d", version);
+			version = 0;
+		}
+	}
+	return version;
+}
+
+int requested_protocol_version(void)
+{
+	const char *p = getenv(GIT_PROTOCOL_ENVIRONMENT);
+
+	/* a colon-separated list of key=value parameters */
+	while (p && *p) {
+		size_t len = strcspn(p, ":");
+		if (len == 9 && !strncmp(p, "version=2", 9))
+			return 2;
+		p += len;
+		if (*p)
+			p++;
+	}
+	return 0;
+}
+
 int server_supports(const char *feature)
 {
 	return !!parse_feature_request(server_capabilities, feature);
 }
 
+const char *server_feature_value(const char *feature, int *len)
+{
+	const char *found = parse_feature_request(server_capabilities, feature);
+
+	if (!found || found[strlen(feature)] != '=')
+		return NULL;
+	found += strlen(feature) + 1;
+	*len = strcspn(found, " \t\n");
+	return found;
+}
+
 const char *parse_feature_request(const char *feature_list, const char *feature)
 {
 	int len;
@@ -552,12 +717,20 @@ struct child_process *git_connect(int fd[2], const char *url_orig,
 		 * from extended host header with a NUL byte.
 		 *
 		 * Note: Do not add any other headers here!  Doing so
-		 * will cause older git-daemon servers to crash.
+		 * will cause older git-daemon servers to crash.  Extra
+		 * parameters go after a second NUL byte, which older
+		 * servers ignore.
 		 */
-		packet_write(fd[1],
-			     "%s %s%chost=%s%c",
-			     prog, path, 0,
-			     target_host, 0);
+		if (flags & CONNECT_PROTOCOL_V2)
+			packet_write(fd[1],
+				     "%s %s%chost=%s%c%cversion=2%c",
+				     prog, path, 0,
+				     target_host, 0, 0, 0);
+		else
+			packet_write(fd[1],
+				     "%s %s%chost=%s%c",
+				     prog, path, 0,
+				     target_host, 0);
 		free(target_host);
 		free(url);
 		if (free_path)
@@ -592,8 +765,19 @@ struct child_process *git_connect(int fd[2], const char *url_orig,
 		*arg++ = host;
 	}
 	else {
-		/* remove repo-local variables from the environment */
-		conn->env = local_repo_env;
+		/*
+		 * remove repo-local variables from the environment, and
+		 * only pass on the protocol version we ask for
+		 */
+		static const char *env[LOCAL_REPO_ENV_SIZE + 2];
+		int i;
+
+		for (i = 0; local_repo_env[i]; i++)
+			env[i] = local_repo_env[i];
+		env[i] = (flags & CONNECT_PROTOCOL_V2) ?
+			GIT_PROTOCOL_ENVIRONMENT "=version=2" :
+			GIT_PROTOCOL_ENVIRONMENT;
+		conn->env = env;
 		conn->use_shell = 1;
 	}
 	*arg++ = cmd.buf;
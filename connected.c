@@ -1,62 +1,156 @@
 #include "cache.h"
-#include "run-command.h"
-#include "sigchain.h"
+#include "refs.h"
+#include "tag.h"
+#include "commit.h"
+#include "diff.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "sha1-array.h"
 #include "connected.h"
 
 /*
- * If we feed all the commits we want to verify to this command
+ * The tips of our existing refs, the "--not --all" side of the walk.
+ * They are collected once; later checks in the same process walk
+ * against the same boundary, which stays correct as objects are never
+ * removed while we run.
+ */
+static struct sha1_array ref_tips;
+static int ref_tips_loaded;
+
+static int add_ref_tip(const char *refname, const unsigned char *sha1,
+		       int flags, void *cb_data)
+{
+	sha1_array_append(&ref_tips, sha1);
+	return 0;
+}
+
+static void load_ref_tips(void)
+{
+	if (ref_tips_loaded)
+		return;
+	head_ref(add_ref_tip, NULL);
+	for_each_ref(add_ref_tip, NULL);
+	ref_tips_loaded = 1;
+}
+
+struct connectivity {
+	int quiet;
+	int missing;
+};
+
+static void missing_object(struct connectivity *data, const char *type,
+			   const unsigned char *sha1)
+{
+	if (!data->quiet && !data->missing)
+		error(_("missing %s %s"), type, sha1_to_hex(sha1));
+	data->missing = 1;
+}
+
+static void show_commit(struct commit *commit, void *cb_data)
+{
+}
+
+static void show_object(struct object *obj,
+			const struct name_path *path, const char *component,
+			void *cb_data)
+{
+	struct connectivity *data = cb_data;
+
+	switch (obj->type) {
+	case OBJ_TREE:
+		if (!obj->parsed)
+			missing_object(data, typename(obj->type), obj->sha1);
+		break;
+	case OBJ_BLOB:
+		if (!has_sha1_file(obj->sha1))
+			missing_object(data, typename(obj->type), obj->sha1);
+		break;
+	}
+}
+
+/*
+ * Parse the object a tip names, and the chain of tags it may start.
+ * Returns the object, or NULL if any of them is missing.
+ */
+static struct object *parse_tip(const unsigned char *sha1)
+{
+	struct object *obj = parse_object(sha1);
+	struct object *o = obj;
+
+	while (o && o->type == OBJ_TAG)
+		o = parse_object(((struct tag *)o)->tagged->sha1);
+	return o ? obj : NULL;
+}
+
+static void add_boundary(struct rev_info *revs)
+{
+	int i;
+
+	load_ref_tips();
+	for (i = 0; i < ref_tips.nr; i++) {
+		struct object *obj = parse_object(ref_tips.sha1[i]);
+		if (!obj)
+			continue;
+		obj->flags |= UNINTERESTING;
+		add_pending_object(revs, obj, "");
+	}
+}
+
+/*
+ * Walk the objects reachable from what fn gives us, stopping at the
+ * tips of our refs, like
  *
  *  $ git rev-list --objects --stdin --not --all
  *
- * and if it does not error out, that means everything reachable from
- * these commits locally exists and is connected to our existing refs.
- * Note that this does _not_ validate the individual objects.
+ * would, but in-process.  If every object we meet exists, everything
+ * reachable from these commits locally exists and is connected to our
+ * existing refs.  Note that this does _not_ validate the individual
+ * objects.
  *
  * Returns 0 if everything is connected, non-zero otherwise.
  */
 int check_everything_connected(sha1_iterate_fn fn, int quiet, void *cb_data)
 {
-	struct child_process rev_list;
-	const char *argv[] = {"rev-list", "--objects",
-			      "--stdin", "--not", "--all", NULL, NULL};
-	char commit[41];
+	struct connectivity data;
+	struct rev_info revs;
 	unsigned char sha1[20];
-	int err = 0;
 
 	if (fn(cb_data, sha1))
-		return err;
-
-	if (quiet)
-		argv[5] = "--quiet";
+		return 0;
 
-	memset(&rev_list, 0, sizeof(rev_list));
-	rev_list.argv = argv;
-	rev_list.git_cmd = 1;
-	rev_list.in = -1;
-	rev_list.no_stdout = 1;
-	rev_list.no_stderr = quiet;
-	if (start_command(&rev_list))
-		return error(_("Could not run 'git rev-list'"));
+	memset(&data, 0, sizeof(data));
+	data.quiet = quiet;
+	init_revisions(&revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	revs.missing_trees_ok = 1;
+	/* a limited walk reports missing parents instead of dying */
+	revs.limited = 1;
 
-	sigchain_push(SIGPIPE, SIG_IGN);
-
-	commit[40] = '\n';
 	do {
-		memcpy(commit, sha1_to_hex(sha1), 40);
-		if (write_in_full(rev_list.in, commit, 41) < 0) {
-			if (errno != EPIPE && errno != EINVAL)
-				error(_("failed write to rev-list: %s"),
-				      strerror(errno));
-			err = -1;
+		struct object *obj = parse_tip(sha1);
+		if (!obj) {
+			missing_object(&data, "object", sha1);
 			break;
 		}
+		add_pending_object(&revs, obj, "");
 	} while (!fn(cb_data, sha1));
 
-	if (close(rev_list.in)) {
-		error(_("failed to close rev-list's stdin: %s"), strerror(errno));
-		err = -1;
+	if (!data.missing) {
+		add_boundary(&revs);
+		if (prepare_revision_walk(&revs)) {
+			if (!quiet)
+				error(_("revision walk setup failed"));
+			data.missing = 1;
+		} else {
+			mark_edges_uninteresting(revs.commits, &revs, NULL);
+			traverse_commit_list(&revs, show_commit, show_object,
+					     &data);
+		}
 	}
 
-	sigchain_pop(SIGPIPE);
-	return finish_command(&rev_list) || err;
+	/* the caller may want to walk these objects again */
+	clear_object_flags(ALL_REV_FLAGS);
+	return data.missing;
 }
@@ -94,6 +94,22 @@ int sha1write(struct sha1file *f, void *buf, unsigned int count)
 		unsigned nr = count > left ? left : count;
 		void *data;
 
+		if (!offset && count >= sizeof(f->buffer) && f->check_fd < 0) {
+			/*
+			 * Hash and write as many whole buffers' worth
+			 * of data as we can directly from the caller's
+			 * memory, with a single write().
+			 */
+			nr = count - count % sizeof(f->buffer);
+			if (f->do_crc)
+				f->crc32 = crc32(f->crc32, buf, nr);
+			git_SHA1_Update(&f->ctx, buf, nr);
+			flush(f, buf, nr);
+			count -= nr;
+			buf = (char *) buf + nr;
+			continue;
+		}
+
 		if (f->do_crc)
 			f->crc32 = crc32(f->crc32, buf, nr);
 
@@ -475,6 +475,17 @@ static void parse_host_arg(char *extra_args, int buflen)
 			die("Invalid request");
 	}
 
+	/*
+	 * Further parameters follow an empty one, where older servers
+	 * stop looking; the only one we know is the protocol version.
+	 */
+	if (extra_args < end && !*extra_args) {
+		for (extra_args++; extra_args < end; extra_args += strlen(extra_args) + 1) {
+			if (!strcmp(extra_args, "version=2"))
+				setenv(GIT_PROTOCOL_ENVIRONMENT, extra_args, 1);
+		}
+	}
+
 	/*
 	 * Locate canonical hostname and its IP address.
 	 */
@@ -193,7 +193,8 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 				continue;
 		}
 
-		if (ce_uptodate(ce) || ce_skip_worktree(ce))
+		if (ce_uptodate(ce) || ce_skip_worktree(ce) ||
+		    (ce->ce_flags & CE_FSMONITOR_VALID))
 			continue;
 
 		/* If CE_VALID is set, don't look at workdir for file removal */
@@ -351,6 +352,30 @@ static int show_modified(struct rev_info *revs,
 	return 0;
 }
 
+/*
+ * A sparse directory entry in the index is compared with the tree it
+ * corresponds to (if any) in one go, as a tree-to-tree diff limited
+ * to the same pathspec.
+ */
+static void diff_sparse_directory(struct rev_info *revs,
+				  struct cache_entry *tree,
+				  struct cache_entry *idx)
+{
+	struct diff_options *opt = &revs->diffopt;
+	struct pathspec pathspec = opt->pathspec;
+	int recursive = DIFF_OPT_TST(opt, RECURSIVE);
+	const unsigned char *old = tree ? tree->sha1 : EMPTY_TREE_SHA1_BIN;
+
+	if (!hashcmp(old, idx->sha1))
+		return;
+	opt->pathspec = revs->prune_data;
+	DIFF_OPT_SET(opt, RECURSIVE);
+	diff_tree_sha1(old, idx->sha1, idx->name, opt);
+	if (!recursive)
+		DIFF_OPT_CLR(opt, RECURSIVE);
+	opt->pathspec = pathspec;
+}
+
 /*
  * This gets a mix of an existing index and a tree, one pathname entry
  * at a time. The index entry may be a single stage-0 one, but it could
@@ -376,6 +401,11 @@ static void do_oneway_diff(struct unpack_trees_options *o,
 	 */
 	match_missing = !revs->ignore_merges;
 
+	if (idx && S_ISSPARSEDIR(idx->ce_mode)) {
+		diff_sparse_directory(revs, tree, idx);
+		return;
+	}
+
 	if (cached && idx && ce_stage(idx)) {
 		struct diff_filepair *pair;
 		pair = diff_unmerge(&revs->diffopt, idx->name);
@@ -434,7 +464,8 @@ static int oneway_diff(struct cache_entry **src, struct unpack_trees_options *o)
 	if (tree == o->df_conflict_entry)
 		tree = NULL;
 
-	if (ce_path_match(idx ? idx : tree, &revs->prune_data)) {
+	if ((idx && S_ISSPARSEDIR(idx->ce_mode)) ||
+	    ce_path_match(idx ? idx : tree, &revs->prune_data)) {
 		do_oneway_diff(o, idx, tree);
 		if (diff_can_quit_early(&revs->diffopt)) {
 			o->exiting_early = 1;
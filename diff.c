@@ -24,6 +24,7 @@
 
 static int diff_detect_rename_default;
 static int diff_rename_limit_default = 400;
+static int diff_rename_threads_default;
 static int diff_suppress_blank_empty;
 int diff_use_color_default = -1;
 static const char *diff_word_regex_cfg;
@@ -181,6 +182,10 @@ int git_diff_basic_config(const char *var, const char *value, void *cb)
 		diff_rename_limit_default = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.renamethreads")) {
+		diff_rename_threads_default = git_config_int(var, value);
+		return 0;
+	}
 
 	if (userdiff_config(var, value) < 0)
 		return -1;
@@ -3187,6 +3192,7 @@ void diff_setup(struct diff_options *options)
 	options->line_termination = '\n';
 	options->break_opt = -1;
 	options->rename_limit = -1;
+	options->rename_threads = diff_rename_threads_default;
 	options->dirstat_permille = diff_dirstat_permille_default;
 	options->context = 3;
 	DIFF_OPT_SET(options, RENAME_EMPTY);
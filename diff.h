@@ -119,6 +119,7 @@ struct diff_options {
 	int pickaxe_opts;
 	int rename_score;
 	int rename_limit;
+	int rename_threads;
 	int needed_rename_limit;
 	int degraded_cc_to_c;
 	int show_rename_progress;
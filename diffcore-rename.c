@@ -6,6 +6,8 @@
 #include "diffcore.h"
 #include "hash.h"
 #include "progress.h"
+#include "string-list.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -490,6 +492,387 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+static const char *path_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+static int skip_basename_run(struct string_list *list, int i)
+{
+	while (++i < list->nr &&
+	       !strcmp(list->items[i].string, list->items[i - 1].string))
+		; /* nothing */
+	return i;
+}
+
+/*
+ * When we only look for renames, a deleted file and a created file
+ * that are the only ones with their basename are most likely the same
+ * file moved to another directory.  Pair them up before building the
+ * full matrix if they are clearly similar, i.e. at least halfway
+ * between the minimum score and an exact match.
+ */
+static int find_basename_renames(int minimum_score)
+{
+	struct string_list srcs = STRING_LIST_INIT_NODUP;
+	struct string_list dsts = STRING_LIST_INIT_NODUP;
+	int basename_score = minimum_score + (int)(MAX_SCORE - minimum_score) / 2;
+	int i, j, count = 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+		if (one->rename_used)
+			continue;
+		string_list_append(&srcs, path_basename(one->path))->util =
+			(void *)(intptr_t)i;
+	}
+	for (i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue;
+		string_list_append(&dsts, path_basename(rename_dst[i].two->path))->util =
+			(void *)(intptr_t)i;
+	}
+	sort_string_list(&srcs);
+	sort_string_list(&dsts);
+
+	i = j = 0;
+	while (i < srcs.nr && j < dsts.nr) {
+		int cmp = strcmp(srcs.items[i].string, dsts.items[j].string);
+		int src_end, dst_end;
+
+		if (cmp < 0) {
+			i = skip_basename_run(&srcs, i);
+			continue;
+		}
+		if (cmp > 0) {
+			j = skip_basename_run(&dsts, j);
+			continue;
+		}
+		src_end = skip_basename_run(&srcs, i);
+		dst_end = skip_basename_run(&dsts, j);
+		if (src_end == i + 1 && dst_end == j + 1) {
+			int src = (intptr_t)srcs.items[i].util;
+			int dst = (intptr_t)dsts.items[j].util;
+			struct diff_filespec *one = rename_src[src].p->one;
+			struct diff_filespec *two = rename_dst[dst].two;
+			int score = estimate_similarity(one, two, minimum_score);
+
+			diff_free_filespec_blob(one);
+			diff_free_filespec_blob(two);
+			if (score >= basename_score) {
+				record_rename_pair(dst, src, score);
+				count++;
+			}
+		}
+		i = src_end;
+		j = dst_end;
+	}
+
+	string_list_clear(&srcs, 0);
+	string_list_clear(&dsts, 0);
+	return count;
+}
+
+/*
+ * The remaining destinations are scored against the sources whose
+ * size is close enough for estimate_similarity() not to reject the
+ * pair outright; a binary search over the sources sorted by size finds
+ * them.  The span hashes of all files that take part are computed
+ * first, after which scoring only reads them, so both steps can be
+ * spread over several threads.
+ */
+struct rename_matrix {
+	struct diff_score *mx;
+	int *dst;			/* rename_dst index of each row */
+	int nr_dst;
+	int *src;			/* rename_src indices, by size */
+	int nr_src;
+	struct diff_filespec **prepare;	/* files to compute span hashes of */
+	int nr_prepare;
+	int minimum_score;
+	int next, done;
+	struct progress *progress;
+};
+
+#define RENAME_THREAD_MIN_PAIRS 1024
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t rename_mutex;
+static int rename_threads_active;
+
+static inline void rename_lock(void)
+{
+	if (rename_threads_active)
+		pthread_mutex_lock(&rename_mutex);
+}
+
+static inline void rename_unlock(void)
+{
+	if (rename_threads_active)
+		pthread_mutex_unlock(&rename_mutex);
+}
+#else
+#define rename_lock()
+#define rename_unlock()
+#endif
+
+static int src_size_compare(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+	unsigned long a_size = rename_src[a].p->one->size;
+	unsigned long b_size = rename_src[b].p->one->size;
+
+	if (a_size != b_size)
+		return a_size < b_size ? -1 : 1;
+	return a - b;
+}
+
+static int int_compare(const void *a_, const void *b_)
+{
+	return *(const int *)a_ - *(const int *)b_;
+}
+
+static int filespec_compare(const void *a_, const void *b_)
+{
+	const struct diff_filespec *a = *(struct diff_filespec * const *)a_;
+	const struct diff_filespec *b = *(struct diff_filespec * const *)b_;
+	return a < b ? -1 : a > b;
+}
+
+/* Position of the first source that is at least size bytes long */
+static int first_src_of_size(struct rename_matrix *rm, unsigned long size)
+{
+	int lo = 0, hi = rm->nr_src;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (rename_src[rm->src[mi]].p->one->size < size)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+/*
+ * Find the range of sources a destination of the given size needs to
+ * be compared with.  The bounds are a little loose, estimate_similarity()
+ * still makes the exact check.
+ */
+static void src_window(struct rename_matrix *rm, unsigned long size,
+		       int *begin, int *end)
+{
+	double lo = size * (rm->minimum_score / MAX_SCORE);
+	double hi = size * (MAX_SCORE / rm->minimum_score);
+
+	*begin = first_src_of_size(rm, lo > 1 ? (unsigned long)lo - 1 : 0);
+	if (hi >= (double)(ULONG_MAX - 2))
+		*end = rm->nr_src;
+	else
+		*end = first_src_of_size(rm, (unsigned long)hi + 2);
+}
+
+static void *prepare_counts(void *data)
+{
+	struct rename_matrix *rm = data;
+
+	for (;;) {
+		struct diff_filespec *one;
+		int ok;
+
+		rename_lock();
+		if (rm->next >= rm->nr_prepare) {
+			rename_unlock();
+			break;
+		}
+		one = rm->prepare[rm->next++];
+		ok = !diff_populate_filespec(one, 0);
+		if (ok)
+			diff_filespec_is_binary(one);
+		rename_unlock();
+
+		if (ok)
+			diffcore_prepare_count(one);
+		diff_free_filespec_blob(one);
+	}
+	return NULL;
+}
+
+static void *score_rows(void *data)
+{
+	struct rename_matrix *rm = data;
+	int *cand = xmalloc((rm->nr_src + 1) * sizeof(*cand));
+
+	for (;;) {
+		struct diff_filespec *two;
+		struct diff_score *m;
+		int row, begin, end, i, nr = 0;
+
+		rename_lock();
+		row = rm->next++;
+		rename_unlock();
+		if (row >= rm->nr_dst)
+			break;
+
+		two = rename_dst[rm->dst[row]].two;
+		m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+		if (two->cnt_data) {
+			src_window(rm, two->size, &begin, &end);
+			for (i = begin; i < end; i++)
+				if (rename_src[rm->src[i]].p->one->cnt_data)
+					cand[nr++] = rm->src[i];
+			/* ties go to the first source, as in path order */
+			qsort(cand, nr, sizeof(*cand), int_compare);
+		}
+		for (i = 0; i < nr; i++) {
+			struct diff_filespec *one = rename_src[cand[i]].p->one;
+			struct diff_score this_src;
+
+			this_src.score = estimate_similarity(one, two,
+							     rm->minimum_score);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = rm->dst[row];
+			this_src.src = cand[i];
+			record_if_better(m, &this_src);
+		}
+
+		rename_lock();
+		rm->done++;
+		display_progress(rm->progress, rm->done * rename_src_nr);
+		rename_unlock();
+	}
+	free(cand);
+	return NULL;
+}
+
+static void run_rename_threads(void *(*fn)(void *), struct rename_matrix *rm,
+			       int nr_threads)
+{
+	rm->next = 0;
+#ifndef NO_PTHREADS
+	if (nr_threads > 1) {
+		pthread_t *thread = xmalloc(nr_threads * sizeof(*thread));
+		int i, ret;
+
+		pthread_mutex_init(&rename_mutex, NULL);
+		rename_threads_active = 1;
+		for (i = 0; i < nr_threads; i++) {
+			ret = pthread_create(&thread[i], NULL, fn, rm);
+			if (ret)
+				die(_("unable to create thread: %s"),
+				    strerror(ret));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(thread[i], NULL);
+		rename_threads_active = 0;
+		pthread_mutex_destroy(&rename_mutex);
+		free(thread);
+		return;
+	}
+#endif
+	fn(rm);
+}
+
+/*
+ * Fill one row of NUM_CANDIDATE_PER_DST best candidates in mx for
+ * each destination that is not paired yet, and return the number of
+ * rows.  Unless we look for copies, sources that are already used
+ * cannot be picked and are not scored at all.
+ */
+static int fill_rename_matrix(struct diff_options *options,
+			      struct diff_score *mx, int minimum_score,
+			      int skip_unmodified, struct progress *progress)
+{
+	int copies = options->detect_rename == DIFF_DETECT_COPY;
+	struct rename_matrix rm;
+	int *cover;
+	int i, j, c, nr_threads = 1;
+
+	memset(&rm, 0, sizeof(rm));
+	rm.mx = mx;
+	rm.minimum_score = minimum_score;
+	rm.progress = progress;
+
+	rm.src = xmalloc((rename_src_nr + 1) * sizeof(*rm.src));
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (!S_ISREG(one->mode))
+			continue;
+		if (skip_unmodified && diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (!copies && one->rename_used)
+			continue;
+		if (!one->cnt_data && diff_populate_filespec(one, 1))
+			continue;
+		rm.src[rm.nr_src++] = i;
+	}
+	qsort(rm.src, rm.nr_src, sizeof(*rm.src), src_size_compare);
+
+	rm.dst = xmalloc((rename_dst_nr + 1) * sizeof(*rm.dst));
+	rm.prepare = xmalloc((rm.nr_src + rename_dst_nr + 1) *
+			     sizeof(*rm.prepare));
+	cover = xcalloc(rm.nr_src + 1, sizeof(*cover));
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+		struct diff_score *m;
+		int begin, end;
+
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+
+		m = &mx[rm.nr_dst * NUM_CANDIDATE_PER_DST];
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+		rm.dst[rm.nr_dst++] = i;
+
+		if (!S_ISREG(two->mode))
+			continue;
+		if (!two->cnt_data && diff_populate_filespec(two, 1))
+			continue;
+		if (!two->size)
+			continue; /* would score 0 against anything */
+		src_window(&rm, two->size, &begin, &end);
+		if (begin == end)
+			continue;
+		cover[begin]++;
+		cover[end]--;
+		if (!two->cnt_data)
+			rm.prepare[rm.nr_prepare++] = two;
+	}
+	for (i = c = 0; i < rm.nr_src; i++) {
+		struct diff_filespec *one = rename_src[rm.src[i]].p->one;
+
+		c += cover[i];
+		if (c && !one->cnt_data)
+			rm.prepare[rm.nr_prepare++] = one;
+	}
+	free(cover);
+
+	/* the same filespec must not be prepared by two threads at once */
+	qsort(rm.prepare, rm.nr_prepare, sizeof(*rm.prepare), filespec_compare);
+	for (i = j = 0; i < rm.nr_prepare; i++)
+		if (!j || rm.prepare[j - 1] != rm.prepare[i])
+			rm.prepare[j++] = rm.prepare[i];
+	rm.nr_prepare = j;
+
+#ifndef NO_PTHREADS
+	if ((double)rm.nr_dst * rm.nr_src >= RENAME_THREAD_MIN_PAIRS) {
+		nr_threads = options->rename_threads;
+		if (nr_threads <= 0)
+			nr_threads = online_cpus();
+	}
+#endif
+	run_rename_threads(prepare_counts, &rm, nr_threads);
+	run_rename_threads(score_rows, &rm, nr_threads);
+
+	free(rm.prepare);
+	free(rm.src);
+	free(rm.dst);
+	return rm.nr_dst;
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -497,7 +880,7 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
+	int i, rename_count, skip_unmodified = 0;
 	int num_create, dst_cnt;
 	struct progress *progress = NULL;
 
@@ -555,6 +938,9 @@ void diffcore_rename(struct diff_options *options)
 	if (minimum_score == MAX_SCORE)
 		goto cleanup;
 
+	if (detect_rename == DIFF_DETECT_RENAME)
+		rename_count += find_basename_renames(minimum_score);
+
 	/*
 	 * Calculate how many renames are left (but all the source
 	 * files still remain as options for rename/copies!)
@@ -583,41 +969,8 @@ void diffcore_rename(struct diff_options *options)
 	}
 
 	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (i+1)*rename_src_nr);
-	}
+	dst_cnt = fill_rename_matrix(options, mx, minimum_score,
+				     skip_unmodified, progress);
 	stop_progress(&progress);
 
 	/* cost matrix sorted by most to least similar pair */
@@ -129,4 +129,11 @@ extern int diffcore_count_changes(struct diff_filespec *src,
 				  unsigned long *src_copied,
 				  unsigned long *literal_added);
 
+/*
+ * Compute the span hash diffcore_count_changes() uses for one and keep
+ * it in one->cnt_data.  The data of one must be loaded and its
+ * is_binary known, so that this does not need to touch anything but one.
+ */
+extern void diffcore_prepare_count(struct diff_filespec *one);
+
 #endif
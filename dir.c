@@ -8,6 +8,7 @@
 #include "cache.h"
 #include "dir.h"
 #include "refs.h"
+#include "varint.h"
 
 struct path_simplify {
 	int len;
@@ -364,6 +365,170 @@ static void *read_skip_worktree_file_from_index(const char *path, size_t *size)
 	return data;
 }
 
+struct cone_dir {
+	struct cone_dir *next;
+	int recursive;
+	int len;
+	char name[FLEX_ARRAY];
+};
+
+static unsigned int hash_cone_dir(const char *name, int len)
+{
+	unsigned int hash = 0x123;
+
+	while (len--)
+		hash = hash * 101 + (unsigned char)*name++;
+	return hash;
+}
+
+static struct cone_dir *find_cone_dir(struct exclude_list *el,
+				      const char *name, int len)
+{
+	struct cone_dir *d;
+
+	d = lookup_hash(hash_cone_dir(name, len), &el->cone_dirs);
+	for (; d; d = d->next)
+		if (d->len == len && !memcmp(d->name, name, len))
+			return d;
+	return NULL;
+}
+
+static struct cone_dir *add_cone_dir(struct exclude_list *el,
+				     const char *name, int len)
+{
+	struct cone_dir *d = find_cone_dir(el, name, len);
+	void **pos;
+
+	if (d)
+		return d;
+	d = xcalloc(1, sizeof(*d) + len + 1);
+	memcpy(d->name, name, len);
+	d->len = len;
+	pos = insert_hash(hash_cone_dir(name, len), d, &el->cone_dirs);
+	if (pos) {
+		d->next = *pos;
+		*pos = d;
+	}
+	return d;
+}
+
+static int free_cone_dir(void *ptr, void *data)
+{
+	struct cone_dir *d = ptr;
+
+	while (d) {
+		struct cone_dir *next = d->next;
+		free(d);
+		d = next;
+	}
+	return 0;
+}
+
+static void clear_cone_patterns(struct exclude_list *el)
+{
+	for_each_hash(&el->cone_dirs, free_cone_dir, NULL);
+	free_hash(&el->cone_dirs);
+	el->use_cone_patterns = 0;
+}
+
+/*
+ * Sparse checkout patterns in "cone" form only ever name directories:
+ * all the files at the top level ("/" followed by "*") but none of its
+ * directories (the same, negated, with a trailing slash), and then
+ * "/A/" to take everything under A, optionally followed by "/A/" and
+ * "*" negated with a trailing slash to take only the files directly
+ * in A.  Instead of matching every path against every pattern, such a
+ * list is turned into a hash table of those directories (and their
+ * leading directories, which are needed to reach them).
+ *
+ * Returns 0 if the patterns in "el" are all of that form, in which
+ * case cone_directory_match() can be used instead of
+ * excluded_from_list(); otherwise warns and returns -1.
+ */
+int setup_cone_patterns(struct exclude_list *el)
+{
+	int i, has_root_files = 0, has_root_dirs = 0;
+
+	init_hash(&el->cone_dirs);
+	for (i = 0; i < el->nr; i++) {
+		struct exclude *x = el->excludes[i];
+		const char *p = x->pattern;
+		int len = x->patternlen;
+		struct cone_dir *d;
+
+		if (!strcmp(p, "/*") && x->to_exclude &&
+		    !(x->flags & EXC_FLAG_MUSTBEDIR)) {
+			has_root_files = 1;
+			continue;
+		}
+		if (!strcmp(p, "/*") && !x->to_exclude &&
+		    (x->flags & EXC_FLAG_MUSTBEDIR)) {
+			has_root_dirs = 1;
+			continue;
+		}
+		if (*p != '/' || !(x->flags & EXC_FLAG_MUSTBEDIR))
+			goto not_cone;
+		p++;
+		len--;
+		if (x->to_exclude) {
+			if (!len || !no_wildcard(p))
+				goto not_cone;
+			add_cone_dir(el, p, len)->recursive = 1;
+			continue;
+		}
+		/* "only the files in A" must follow the "/A/" it restricts */
+		if (len < 3 || strcmp(p + len - 2, "/*"))
+			goto not_cone;
+		d = find_cone_dir(el, p, len - 2);
+		if (!d)
+			goto not_cone;
+		d->recursive = 0;
+	}
+	if (!has_root_files || !has_root_dirs) {
+		warning("sparse-checkout patterns do not include the top-level files");
+		goto disable;
+	}
+
+	for (i = 0; i < el->nr; i++) {
+		struct exclude *x = el->excludes[i];
+		const char *p = x->pattern + 1;
+		const char *slash;
+
+		if (!x->to_exclude || !(x->flags & EXC_FLAG_MUSTBEDIR))
+			continue;
+		for (slash = strchr(p, '/'); slash; slash = strchr(slash + 1, '/'))
+			add_cone_dir(el, p, slash - p);
+	}
+	el->use_cone_patterns = 1;
+	return 0;
+
+not_cone:
+	warning("unrecognized pattern: '%s%s%s'",
+		el->excludes[i]->to_exclude ? "" : "!",
+		el->excludes[i]->pattern,
+		el->excludes[i]->flags & EXC_FLAG_MUSTBEDIR ? "/" : "");
+disable:
+	warning("disabling cone pattern matching");
+	clear_cone_patterns(el);
+	return -1;
+}
+
+/*
+ * How does the directory "dir" (without a trailing slash) fare under
+ * cone patterns: is everything below it in (CONE_MATCH_RECURSIVE),
+ * only the files directly in it (CONE_MATCH_PARENT), or nothing at
+ * all (0)?  Leading directories of a recursively matched directory
+ * are not checked; the caller is expected to stop descending there.
+ */
+int cone_directory_match(struct exclude_list *el, const char *dir, int len)
+{
+	struct cone_dir *d = find_cone_dir(el, dir, len);
+
+	if (!d)
+		return 0;
+	return d->recursive ? CONE_MATCH_RECURSIVE : CONE_MATCH_PARENT;
+}
+
 void free_excludes(struct exclude_list *el)
 {
 	int i;
@@ -374,6 +539,8 @@ void free_excludes(struct exclude_list *el)
 
 	el->nr = 0;
 	el->excludes = NULL;
+	if (el->use_cone_patterns)
+		clear_cone_patterns(el);
 }
 
 int add_excludes_from_file_to_list(const char *fname,
@@ -612,7 +779,8 @@ struct dir_entry *dir_add_ignored(struct dir_struct *dir, const char *pathname,
 enum exist_status {
 	index_nonexistent = 0,
 	index_directory,
-	index_gitdir
+	index_gitdir,
+	index_sparse_directory
 };
 
 /*
@@ -634,7 +802,8 @@ static enum exist_status directory_exists_in_index_icase(const char *dirname, in
 	 * and possibly additional path components.
 	 */
 	if (endchar == '/')
-		return index_directory;
+		return S_ISSPARSEDIR(ce->ce_mode) && ce_namelen(ce) == len + 1
+			? index_sparse_directory : index_directory;
 
 	/*
 	 * If there are no additional path components, then this cache_entry
@@ -675,7 +844,8 @@ static enum exist_status directory_exists_in_index(const char *dirname, int len)
 		if (endchar > '/')
 			break;
 		if (endchar == '/')
-			return index_directory;
+			return S_ISSPARSEDIR(ce->ce_mode) && ce_namelen(ce) == len + 1
+				? index_sparse_directory : index_directory;
 		if (!endchar && S_ISGITLINK(ce->ce_mode))
 			return index_gitdir;
 	}
@@ -730,6 +900,10 @@ static enum directory_treatment treat_directory(struct dir_struct *dir,
 	case index_directory:
 		return recurse_into_directory;
 
+	case index_sparse_directory:
+		/* tracked as a whole, and outside of the sparse checkout */
+		return ignore_directory;
+
 	case index_gitdir:
 		if (dir->flags & DIR_SHOW_OTHER_DIRECTORIES)
 			return ignore_directory;
@@ -946,6 +1120,298 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 	return treat_one_path(dir, path, simplify, dtype, de);
 }
 
+/*
+ * Untracked cache
+ *
+ * The outcome of reading a directory depends on the entries in it,
+ * the exclude patterns that apply to it and the index.  Adding or
+ * removing an entry changes the mtime of the directory, exclude files
+ * are checked by their stat data and contents, and index updates
+ * invalidate the directories along the path of the updated entry (see
+ * untracked_cache_invalidate_path()).  As long as none of these
+ * changed, the recorded untracked entries of a directory are used
+ * instead of reading it again.
+ */
+static struct untracked_cache_dir *new_untracked_dir(const char *name, int len)
+{
+	struct untracked_cache_dir *d = xcalloc(1, sizeof(*d) + len + 1);
+	memcpy(d->name, name, len);
+	return d;
+}
+
+static void clear_untracked_entries(struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->untracked_nr; i++)
+		free(d->untracked[i]);
+	d->untracked_nr = 0;
+}
+
+static void free_untracked_dir(struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	if (!d)
+		return;
+	for (i = 0; i < d->dirs_nr; i++)
+		free_untracked_dir(d->dirs[i]);
+	clear_untracked_entries(d);
+	free(d->untracked);
+	free(d->dirs);
+	free(d);
+}
+
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked_dir(uc->root);
+	free(uc->exclude_per_dir);
+	free(uc);
+}
+
+static void invalidate_untracked_subtree(struct untracked_cache *uc,
+					 struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	if (d->valid)
+		uc->dir_invalidated++;
+	d->valid = 0;
+	for (i = 0; i < d->dirs_nr; i++)
+		invalidate_untracked_subtree(uc, d->dirs[i]);
+}
+
+static struct untracked_cache_dir *find_untracked_dir(struct untracked_cache_dir *d,
+						      const char *name, int len,
+						      int *pos_p)
+{
+	int first = 0, last = d->dirs_nr;
+
+	while (first < last) {
+		int next = (first + last) >> 1;
+		struct untracked_cache_dir *sub = d->dirs[next];
+		int cmp = strncmp(name, sub->name, len);
+		if (!cmp && sub->name[len])
+			cmp = -1;
+		if (!cmp) {
+			*pos_p = next;
+			return sub;
+		}
+		if (cmp < 0)
+			last = next;
+		else
+			first = next + 1;
+	}
+	*pos_p = first;
+	return NULL;
+}
+
+/*
+ * Find (or create) the node for the directory "base" (which ends with
+ * a slash unless it is the top-level directory) below "parent".
+ */
+static struct untracked_cache_dir *lookup_untracked(struct untracked_cache *uc,
+						    struct untracked_cache_dir *parent,
+						    const char *base, int baselen,
+						    int check_only)
+{
+	struct untracked_cache_dir *d;
+	const char *name;
+	int len, pos;
+
+	if (!parent) {
+		if (!uc->root) {
+			uc->root = new_untracked_dir("", 0);
+			uc->dir_created++;
+		}
+		d = uc->root;
+	} else {
+		len = baselen - 1;
+		name = base + len;
+		while (name > base && name[-1] != '/')
+			name--;
+		len -= name - base;
+		d = find_untracked_dir(parent, name, len, &pos);
+		if (!d) {
+			d = new_untracked_dir(name, len);
+			ALLOC_GROW(parent->dirs, parent->dirs_nr + 1,
+				   parent->dirs_alloc);
+			memmove(parent->dirs + pos + 1, parent->dirs + pos,
+				(parent->dirs_nr - pos) * sizeof(*parent->dirs));
+			parent->dirs[pos] = d;
+			parent->dirs_nr++;
+			uc->dir_created++;
+		}
+	}
+	if (d->check_only != !!check_only) {
+		invalidate_untracked_subtree(uc, d);
+		d->check_only = !!check_only;
+	}
+	d->visited = 1;
+	return d;
+}
+
+static void hash_untracked_stat(const char *path, struct stat *st,
+				struct untracked_stat *us)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	if (strbuf_read_file(&buf, path, st->st_size) < 0)
+		hashclr(us->sha1);
+	else
+		hash_sha1_file(buf.buf, buf.len, "blob", us->sha1);
+	strbuf_release(&buf);
+}
+
+/*
+ * Bring the record of a file read_directory() depends on up to date.
+ * Returns 1 if its contents are the same as recorded before.
+ */
+static int refresh_untracked_stat(const char *path, struct untracked_stat *us,
+				  time_t racy)
+{
+	struct untracked_stat old = *us;
+	struct stat st;
+
+	if (lstat(path, &st)) {
+		memset(us, 0, sizeof(*us));
+		return !old.exists;
+	}
+	if (old.exists &&
+	    old.mtime.sec == (unsigned int)st.st_mtime &&
+	    old.mtime.nsec == ST_MTIME_NSEC(st) &&
+	    old.ino == (unsigned int)st.st_ino &&
+	    old.size == (unsigned int)st.st_size)
+		return 1;
+
+	hash_untracked_stat(path, &st, us);
+	us->exists = 1;
+	/* a racily clean file is hashed again next time */
+	us->mtime.sec = st.st_mtime < racy ? st.st_mtime : 0;
+	us->mtime.nsec = ST_MTIME_NSEC(st);
+	us->ino = st.st_ino;
+	us->size = st.st_size;
+	return old.exists && !hashcmp(old.sha1, us->sha1);
+}
+
+static int refresh_untracked_exclude(struct dir_struct *dir,
+				     struct untracked_cache_dir *d,
+				     const char *base, int baselen)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct untracked_stat old = d->exclude;
+	int same;
+
+	strbuf_add(&path, base, baselen);
+	strbuf_addstr(&path, dir->exclude_per_dir);
+	same = refresh_untracked_stat(path.buf, &d->exclude,
+				      dir->untracked_start);
+	strbuf_release(&path);
+	if (memcmp(&old, &d->exclude, sizeof(old)))
+		dir->untracked->changed = 1;
+	return same;
+}
+
+static int valid_cached_directory(struct dir_struct *dir,
+				  struct untracked_cache_dir *d,
+				  struct strbuf *path)
+{
+	int baselen = path->len;
+	unsigned int i;
+	struct stat st;
+
+	if (!d->valid)
+		return 0;
+	if (stat(baselen ? path->buf : ".", &st) ||
+	    d->mtime.sec != (unsigned int)st.st_mtime ||
+	    d->mtime.nsec != ST_MTIME_NSEC(st))
+		return 0;
+	if (!refresh_untracked_exclude(dir, d, path->buf, baselen)) {
+		invalidate_untracked_subtree(dir->untracked, d);
+		return 0;
+	}
+
+	for (i = 0; i < d->dirs_nr; i++) {
+		struct untracked_cache_dir *sub = d->dirs[i];
+		int ret = 1;
+
+		strbuf_setlen(path, baselen);
+		strbuf_addstr(path, sub->name);
+		strbuf_addch(path, '/');
+		if (d->check_only || sub->check_only)
+			/* what we recorded depends on it */
+			ret = valid_cached_directory(dir, sub, path);
+		else if (!(dir->flags & (DIR_SHOW_OTHER_DIRECTORIES |
+					 DIR_NO_GITLINKS)) &&
+			 directory_exists_in_index(path->buf, path->len - 1) ==
+			 index_nonexistent) {
+			/* it would not be recursed into if it became a repository */
+			unsigned char sha1[20];
+			ret = resolve_gitlink_ref(path->buf, "HEAD", sha1);
+		}
+		if (!ret) {
+			strbuf_setlen(path, baselen);
+			return 0;
+		}
+	}
+	strbuf_setlen(path, baselen);
+	return 1;
+}
+
+static int read_cached_directory(struct dir_struct *dir,
+				 struct untracked_cache_dir *d,
+				 const char *base, int baselen,
+				 int check_only,
+				 const struct path_simplify *simplify)
+{
+	struct strbuf path = STRBUF_INIT;
+	int contents = d->untracked_nr;
+	unsigned int i;
+
+	strbuf_add(&path, base, baselen);
+	if (!check_only) {
+		for (i = 0; i < d->untracked_nr; i++) {
+			strbuf_setlen(&path, baselen);
+			strbuf_addstr(&path, d->untracked[i]);
+			dir_add_name(dir, path.buf, path.len);
+		}
+	}
+	dir->untracked_dir = d;
+	for (i = 0; i < d->dirs_nr; i++) {
+		struct untracked_cache_dir *sub = d->dirs[i];
+		if (sub->check_only)
+			continue;
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, sub->name);
+		strbuf_addch(&path, '/');
+		contents += read_directory_recursive(dir, path.buf, path.len,
+						     0, simplify);
+	}
+	strbuf_release(&path);
+	return contents;
+}
+
+static void prune_unvisited_dirs(struct untracked_cache_dir *d)
+{
+	unsigned int i, j;
+
+	for (i = j = 0; i < d->dirs_nr; i++) {
+		if (d->dirs[i]->visited)
+			d->dirs[j++] = d->dirs[i];
+		else
+			free_untracked_dir(d->dirs[i]);
+	}
+	d->dirs_nr = j;
+}
+
+static void add_untracked(struct untracked_cache_dir *d, const char *name)
+{
+	ALLOC_GROW(d->untracked, d->untracked_nr + 1, d->untracked_alloc);
+	d->untracked[d->untracked_nr++] = xstrdup(name);
+}
+
 /*
  * Read a directory tree. We currently ignore anything but
  * directories, regular files and symlinks. That's because git
@@ -960,17 +1426,49 @@ static int read_directory_recursive(struct dir_struct *dir,
 				    int check_only,
 				    const struct path_simplify *simplify)
 {
-	DIR *fdir = opendir(*base ? base : ".");
+	DIR *fdir;
 	int contents = 0;
 	struct dirent *de;
 	struct strbuf path = STRBUF_INIT;
-
-	if (!fdir)
-		return 0;
+	struct untracked_cache_dir *parent = dir->untracked_dir;
+	struct untracked_cache_dir *untracked = NULL;
+	struct stat st;
 
 	strbuf_add(&path, base, baselen);
+	if (dir->untracked) {
+		unsigned int i;
+
+		untracked = lookup_untracked(dir->untracked, parent,
+					     base, baselen, check_only);
+		if (valid_cached_directory(dir, untracked, &path)) {
+			contents = read_cached_directory(dir, untracked,
+							 base, baselen,
+							 check_only, simplify);
+			goto done;
+		}
+		if (untracked->valid)
+			dir->untracked->dir_invalidated++;
+		dir->untracked->dir_opened++;
+		dir->untracked->changed = 1;
+		untracked->valid = 0;
+		clear_untracked_entries(untracked);
+		for (i = 0; i < untracked->dirs_nr; i++)
+			untracked->dirs[i]->visited = 0;
+		if (!refresh_untracked_exclude(dir, untracked, base, baselen))
+			for (i = 0; i < untracked->dirs_nr; i++)
+				invalidate_untracked_subtree(dir->untracked,
+							     untracked->dirs[i]);
+		/* taken before reading, so that changes while we read show */
+		if (stat(*base ? base : ".", &st))
+			goto done;
+	}
+
+	fdir = opendir(*base ? base : ".");
+	if (!fdir)
+		goto done;
 
 	while ((de = readdir(fdir)) != NULL) {
+		dir->untracked_dir = untracked;
 		switch (treat_path(dir, de, &path, baselen, simplify)) {
 		case path_recurse:
 			contents += read_directory_recursive(dir, path.buf,
@@ -983,6 +1481,8 @@ static int read_directory_recursive(struct dir_struct *dir,
 			break;
 		}
 		contents++;
+		if (untracked && !cache_name_exists(path.buf, path.len, ignore_case))
+			add_untracked(untracked, path.buf + baselen);
 		if (check_only)
 			goto exit_early;
 		else
@@ -990,6 +1490,16 @@ static int read_directory_recursive(struct dir_struct *dir,
 	}
 exit_early:
 	closedir(fdir);
+
+	if (untracked) {
+		prune_unvisited_dirs(untracked);
+		untracked->mtime.sec = st.st_mtime;
+		untracked->mtime.nsec = ST_MTIME_NSEC(st);
+		/* a directory modified this second may change unnoticed */
+		untracked->valid = st.st_mtime < dir->untracked_start;
+	}
+done:
+	dir->untracked_dir = parent;
 	strbuf_release(&path);
 
 	return contents;
@@ -1087,6 +1597,58 @@ static int treat_leading_path(struct dir_struct *dir,
 	return rc;
 }
 
+#define UNTRACKED_CACHE_DIR_FLAGS \
+	(DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES | DIR_NO_GITLINKS)
+
+void use_untracked_cache(struct dir_struct *dir, struct index_state *istate)
+{
+	if (!core_untracked_cache || ignore_case)
+		return;
+	if (!istate->untracked && core_untracked_cache > 0) {
+		istate->untracked = xcalloc(1, sizeof(*istate->untracked));
+		istate->cache_changed = 1;
+	}
+	dir->untracked = istate->untracked;
+}
+
+/*
+ * The untracked cache only covers reading the whole tree with the
+ * standard exclude files; reset it if those changed since it was
+ * recorded.
+ */
+static struct untracked_cache *validate_untracked_cache(struct dir_struct *dir,
+							 int len,
+							 const char **pathspec)
+{
+	struct untracked_cache *uc = dir->untracked;
+	const char *info_exclude = git_path("info/exclude");
+	int same;
+
+	if (!uc || len || pathspec ||
+	    (dir->flags & ~UNTRACKED_CACHE_DIR_FLAGS) ||
+	    !dir->exclude_per_dir ||
+	    dir->exclude_list[EXC_CMDL].nr)
+		return NULL;
+
+	dir->untracked_start = time(NULL);
+	same = refresh_untracked_stat(info_exclude, &uc->info_exclude,
+				      dir->untracked_start);
+	if (!refresh_untracked_stat(excludes_file ? excludes_file : "",
+				    &uc->excludes_file, dir->untracked_start))
+		same = 0;
+	if (!same || uc->dir_flags != dir->flags ||
+	    !uc->exclude_per_dir ||
+	    strcmp(uc->exclude_per_dir, dir->exclude_per_dir)) {
+		free_untracked_dir(uc->root);
+		uc->root = NULL;
+		uc->dir_flags = dir->flags;
+		free(uc->exclude_per_dir);
+		uc->exclude_per_dir = xstrdup(dir->exclude_per_dir);
+		uc->changed = 1;
+	}
+	return uc;
+}
+
 int read_directory(struct dir_struct *dir, const char *path, int len, const char **pathspec)
 {
 	struct path_simplify *simplify;
@@ -1094,10 +1656,31 @@ int read_directory(struct dir_struct *dir, const char *path, int len, const char
 	if (has_symlink_leading_path(path, len))
 		return dir->nr;
 
+	dir->untracked = validate_untracked_cache(dir, len, pathspec);
+	dir->untracked_dir = NULL;
 	simplify = create_simplify(pathspec);
 	if (!len || treat_leading_path(dir, path, len, simplify))
 		read_directory_recursive(dir, path, len, 0, simplify);
 	free_simplify(simplify);
+	if (dir->untracked) {
+		struct untracked_cache *uc = dir->untracked;
+
+		if (trace_want("GIT_TRACE_UNTRACKED_STATS")) {
+			struct strbuf sb = STRBUF_INIT;
+			strbuf_addf(&sb, "node creation: %u\n"
+				    "directory invalidation: %u\n"
+				    "opendir: %u\n",
+				    uc->dir_created, uc->dir_invalidated,
+				    uc->dir_opened);
+			trace_strbuf("GIT_TRACE_UNTRACKED_STATS", &sb);
+			strbuf_release(&sb);
+		}
+		uc->dir_created = uc->dir_invalidated = uc->dir_opened = 0;
+		if (uc->changed) {
+			active_cache_changed = 1;
+			uc->changed = 0;
+		}
+	}
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
 	return dir->nr;
@@ -1316,3 +1899,210 @@ void free_pathspec(struct pathspec *pathspec)
 	free(pathspec->items);
 	pathspec->items = NULL;
 }
+
+/*
+ * On-disk format of the untracked cache ("UNTR" index extension):
+ *
+ *   varint	dir_flags
+ *   string	exclude_per_dir, NUL terminated
+ *   stat	info/exclude
+ *   stat	core.excludesfile
+ *   dir	the top-level directory
+ *
+ * where a stat is the 32-bit network order mtime sec, mtime nsec, ino,
+ * size and "exists" flag followed by the 20-byte SHA-1 of the contents,
+ * and a dir is its NUL terminated name, a varint of its flags
+ * (1: valid, 2: check_only), varints of the number of untracked
+ * entries and of subdirectories, its mtime sec and nsec, the stat of
+ * its exclude file, the NUL terminated untracked entries and then the
+ * subdirectories.
+ */
+static void write_untracked_u32(struct strbuf *out, unsigned int v)
+{
+	uint32_t data = htonl(v);
+	strbuf_add(out, &data, sizeof(data));
+}
+
+static void write_untracked_varint(struct strbuf *out, uintmax_t v)
+{
+	unsigned char buf[16];
+	strbuf_add(out, buf, encode_varint(v, buf));
+}
+
+static void write_untracked_stat(struct strbuf *out, const struct untracked_stat *us)
+{
+	write_untracked_u32(out, us->mtime.sec);
+	write_untracked_u32(out, us->mtime.nsec);
+	write_untracked_u32(out, us->ino);
+	write_untracked_u32(out, us->size);
+	write_untracked_u32(out, us->exists);
+	strbuf_add(out, us->sha1, 20);
+}
+
+static void write_untracked_dir(struct strbuf *out, const struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	strbuf_add(out, d->name, strlen(d->name) + 1);
+	write_untracked_varint(out, d->valid | (d->check_only << 1));
+	write_untracked_varint(out, d->untracked_nr);
+	write_untracked_varint(out, d->dirs_nr);
+	write_untracked_u32(out, d->mtime.sec);
+	write_untracked_u32(out, d->mtime.nsec);
+	write_untracked_stat(out, &d->exclude);
+	for (i = 0; i < d->untracked_nr; i++)
+		strbuf_add(out, d->untracked[i], strlen(d->untracked[i]) + 1);
+	for (i = 0; i < d->dirs_nr; i++)
+		write_untracked_dir(out, d->dirs[i]);
+}
+
+void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc)
+{
+	const char *exclude_per_dir = uc->exclude_per_dir ? uc->exclude_per_dir : "";
+
+	write_untracked_varint(out, uc->dir_flags);
+	strbuf_add(out, exclude_per_dir, strlen(exclude_per_dir) + 1);
+	write_untracked_stat(out, &uc->info_exclude);
+	write_untracked_stat(out, &uc->excludes_file);
+	if (uc->root)
+		write_untracked_dir(out, uc->root);
+}
+
+struct untracked_reader {
+	const unsigned char *data, *end;
+	int error;
+};
+
+static unsigned int read_untracked_u32(struct untracked_reader *rd)
+{
+	uint32_t data;
+
+	if (rd->end - rd->data < sizeof(data)) {
+		rd->error = 1;
+		return 0;
+	}
+	memcpy(&data, rd->data, sizeof(data));
+	rd->data += sizeof(data);
+	return ntohl(data);
+}
+
+static uintmax_t read_untracked_varint(struct untracked_reader *rd)
+{
+	uintmax_t v;
+
+	if (rd->data >= rd->end) {
+		rd->error = 1;
+		return 0;
+	}
+	v = decode_varint(&rd->data);
+	if (rd->data > rd->end)
+		rd->error = 1;
+	return v;
+}
+
+static const char *read_untracked_string(struct untracked_reader *rd)
+{
+	const unsigned char *s = rd->data;
+	const unsigned char *nul = memchr(s, '\0', rd->end - s);
+
+	if (!nul) {
+		rd->error = 1;
+		return "";
+	}
+	rd->data = nul + 1;
+	return (const char *)s;
+}
+
+static void read_untracked_stat(struct untracked_reader *rd, struct untracked_stat *us)
+{
+	us->mtime.sec = read_untracked_u32(rd);
+	us->mtime.nsec = read_untracked_u32(rd);
+	us->ino = read_untracked_u32(rd);
+	us->size = read_untracked_u32(rd);
+	us->exists = read_untracked_u32(rd);
+	if (rd->end - rd->data < 20) {
+		rd->error = 1;
+		return;
+	}
+	hashcpy(us->sha1, rd->data);
+	rd->data += 20;
+}
+
+static struct untracked_cache_dir *read_untracked_dir(struct untracked_reader *rd)
+{
+	struct untracked_cache_dir *d;
+	const char *name = read_untracked_string(rd);
+	unsigned int flags, untracked_nr, dirs_nr, i;
+
+	d = new_untracked_dir(name, strlen(name));
+	flags = read_untracked_varint(rd);
+	untracked_nr = read_untracked_varint(rd);
+	dirs_nr = read_untracked_varint(rd);
+	d->valid = flags & 1;
+	d->check_only = !!(flags & 2);
+	d->mtime.sec = read_untracked_u32(rd);
+	d->mtime.nsec = read_untracked_u32(rd);
+	read_untracked_stat(rd, &d->exclude);
+	/* every entry takes at least one byte */
+	if (rd->error || untracked_nr > rd->end - rd->data ||
+	    dirs_nr > rd->end - rd->data) {
+		rd->error = 1;
+		return d;
+	}
+	for (i = 0; i < untracked_nr && !rd->error; i++)
+		add_untracked(d, read_untracked_string(rd));
+	for (i = 0; i < dirs_nr && !rd->error; i++) {
+		ALLOC_GROW(d->dirs, d->dirs_nr + 1, d->dirs_alloc);
+		d->dirs[d->dirs_nr++] = read_untracked_dir(rd);
+	}
+	return d;
+}
+
+struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz)
+{
+	struct untracked_cache *uc = xcalloc(1, sizeof(*uc));
+	struct untracked_reader rd;
+
+	rd.data = data;
+	rd.end = rd.data + sz;
+	rd.error = 0;
+	uc->dir_flags = read_untracked_varint(&rd);
+	uc->exclude_per_dir = xstrdup(read_untracked_string(&rd));
+	read_untracked_stat(&rd, &uc->info_exclude);
+	read_untracked_stat(&rd, &uc->excludes_file);
+	if (!rd.error && rd.data < rd.end)
+		uc->root = read_untracked_dir(&rd);
+	if (rd.error || rd.data != rd.end) {
+		free_untracked_cache(uc);
+		return NULL;
+	}
+	return uc;
+}
+
+/*
+ * An index entry for "path" was added or removed: whether it and
+ * the directories leading to it are untracked may have changed.
+ */
+void untracked_cache_invalidate_path(struct index_state *istate, const char *path)
+{
+	struct untracked_cache_dir *d;
+	const char *slash;
+
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	d = istate->untracked->root;
+	for (;;) {
+		int pos;
+
+		if (d->valid)
+			istate->untracked->dir_invalidated++;
+		d->valid = 0;
+		slash = strchr(path, '/');
+		if (!slash)
+			break;
+		d = find_untracked_dir(d, path, slash - path, &pos);
+		if (!d)
+			break;
+		path = slash + 1;
+	}
+}
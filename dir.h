@@ -22,6 +22,14 @@ struct exclude_list {
 		int to_exclude;
 		int flags;
 	} **excludes;
+
+	/*
+	 * With "cone" patterns (see setup_cone_patterns()), the
+	 * directories they name, looked up by their path without
+	 * a trailing slash.
+	 */
+	int use_cone_patterns;
+	struct hash_table cone_dirs;
 };
 
 struct exclude_stack {
@@ -31,6 +39,50 @@ struct exclude_stack {
 	int exclude_ix;
 };
 
+/*
+ * Stat data and content hash of a file whose contents the results of
+ * read_directory() depend on, e.g. a .gitignore file.
+ */
+struct untracked_stat {
+	struct cache_time mtime;
+	unsigned int ino;
+	unsigned int size;
+	unsigned char sha1[20];
+	int exists;
+};
+
+/*
+ * What read_directory() found in one directory the last time it was
+ * read: the untracked entries (directories with a trailing slash) and
+ * the subdirectories it looked into, either to recurse or, with
+ * check_only, to see whether they are empty.
+ */
+struct untracked_cache_dir {
+	struct untracked_cache_dir **dirs;
+	char **untracked;
+	unsigned int dirs_nr, dirs_alloc;
+	unsigned int untracked_nr, untracked_alloc;
+	struct cache_time mtime;
+	struct untracked_stat exclude;
+	unsigned valid : 1,
+		 check_only : 1,
+		 visited : 1;
+	char name[FLEX_ARRAY];
+};
+
+struct untracked_cache {
+	unsigned int dir_flags;
+	char *exclude_per_dir;
+	struct untracked_stat info_exclude;
+	struct untracked_stat excludes_file;
+	struct untracked_cache_dir *root;
+	unsigned changed : 1;
+	/* statistics */
+	unsigned int dir_created;
+	unsigned int dir_invalidated;
+	unsigned int dir_opened;
+};
+
 struct dir_struct {
 	int nr, alloc;
 	int ignored_nr, ignored_alloc;
@@ -59,6 +111,11 @@ struct dir_struct {
 
 	struct exclude_stack *exclude_stack;
 	char basebuf[PATH_MAX];
+
+	/* Untracked cache, and the directory being read, if used */
+	struct untracked_cache *untracked;
+	struct untracked_cache_dir *untracked_dir;
+	time_t untracked_start;
 };
 
 #define MATCHED_RECURSIVELY 1
@@ -84,6 +141,11 @@ extern void add_excludes_from_file(struct dir_struct *, const char *fname);
 extern void add_exclude(const char *string, const char *base,
 			int baselen, struct exclude_list *which);
 extern void free_excludes(struct exclude_list *el);
+
+#define CONE_MATCH_PARENT 1
+#define CONE_MATCH_RECURSIVE 2
+extern int setup_cone_patterns(struct exclude_list *el);
+extern int cone_directory_match(struct exclude_list *el, const char *dir, int len);
 extern int file_exists(const char *);
 
 extern int is_inside_dir(const char *dir);
@@ -100,6 +162,12 @@ extern int is_empty_dir(const char *dir);
 
 extern void setup_standard_excludes(struct dir_struct *dir);
 
+extern void use_untracked_cache(struct dir_struct *dir, struct index_state *istate);
+extern void free_untracked_cache(struct untracked_cache *uc);
+extern void untracked_cache_invalidate_path(struct index_state *istate, const char *path);
+extern struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz);
+extern void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc);
+
 #define REMOVE_DIR_EMPTY_ONLY 01
 #define REMOVE_DIR_KEEP_NESTED_GIT 02
 #define REMOVE_DIR_KEEP_TOPLEVEL 04
@@ -25,6 +25,7 @@ int is_bare_repository_cfg = -1; /* unspecified */
 int log_all_ref_updates = -1; /* unspecified */
 int warn_ambiguous_refs = 1;
 int repository_format_version;
+int repository_format_ref_tables;
 const char *git_commit_encoding;
 const char *git_log_output_encoding;
 int shared_repository = PERM_UMASK;
@@ -57,9 +58,11 @@ enum push_default_type push_default = PUSH_DEFAULT_UNSPECIFIED;
 #define OBJECT_CREATION_MODE OBJECT_CREATION_USES_HARDLINKS
 #endif
 enum object_creation_mode object_creation_mode = OBJECT_CREATION_MODE;
+enum packed_refs_format packed_refs_format = PACKED_REFS_TEXT;
 char *notes_ref_name;
 int grafts_replace_parents = 1;
 int core_apply_sparse_checkout;
+int core_sparse_checkout_cone;
 int merge_log_config = -1;
 struct startup_info *startup_info;
 unsigned long pack_size_limit_cfg;
@@ -67,6 +70,15 @@ unsigned long pack_size_limit_cfg;
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
 
+/* Write the index as a shared index plus changes? -1 means "unset". */
+int core_split_index = -1;
+
+/* Keep an untracked cache in the index? -1 means "unset". */
+int core_untracked_cache = -1;
+
+/* Hook to ask which paths changed since the index was last refreshed */
+const char *core_fsmonitor;
+
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
 static char *work_tree;
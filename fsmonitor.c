@@ -0,0 +1,231 @@
+#include "cache.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+#include "varint.h"
+
+#define FSMONITOR_VERSION 1
+
+static uint64_t getnanotime(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+static int fsmonitor_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "core.fsmonitor"))
+		return git_config_pathname(&core_fsmonitor, var, value);
+	return 0;
+}
+
+/*
+ * The index may be read before the command got to read its
+ * configuration; look core.fsmonitor up ourselves then.
+ */
+static const char *fsmonitor_hook(void)
+{
+	static int config_read;
+
+	if (!core_fsmonitor && !config_read) {
+		config_read = 1;
+		git_config(fsmonitor_config, NULL);
+	}
+	return core_fsmonitor;
+}
+
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_, *end = data + sz;
+	uint32_t version, hi, lo;
+	unsigned int pos = 0;
+
+	if (sz < 12)
+		return error("corrupt fsmonitor extension (too short)");
+	memcpy(&version, data, 4);
+	memcpy(&hi, data + 4, 4);
+	memcpy(&lo, data + 8, 4);
+	if (ntohl(version) != FSMONITOR_VERSION)
+		return error("unsupported fsmonitor extension version %u",
+			     ntohl(version));
+	data += 12;
+
+	istate->fsmonitor_last_update = ((uint64_t)ntohl(hi) << 32) | ntohl(lo);
+	istate->fsmonitor_dirty_nr = 0;
+	while (data < end) {
+		pos += decode_varint(&data);
+		if (end < data)
+			return error("corrupt fsmonitor extension");
+		ALLOC_GROW(istate->fsmonitor_dirty, istate->fsmonitor_dirty_nr + 1,
+			   istate->fsmonitor_dirty_alloc);
+		istate->fsmonitor_dirty[istate->fsmonitor_dirty_nr++] = pos++;
+	}
+	istate->fsmonitor_has_extension = 1;
+	return 0;
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	uint32_t data;
+	unsigned int i, nr, prev;
+
+	data = htonl(FSMONITOR_VERSION);
+	strbuf_add(sb, &data, 4);
+	data = htonl((uint32_t)(istate->fsmonitor_last_update >> 32));
+	strbuf_add(sb, &data, 4);
+	data = htonl((uint32_t)istate->fsmonitor_last_update);
+	strbuf_add(sb, &data, 4);
+
+	/* positions, among the entries written, that are not known clean */
+	for (i = nr = prev = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		unsigned char buf[16];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!(ce->ce_flags & CE_FSMONITOR_VALID)) {
+			strbuf_add(sb, buf, encode_varint(nr - prev, buf));
+			prev = nr + 1;
+		}
+		nr++;
+	}
+}
+
+/*
+ * Ask the hook which paths changed since the token.  Returns -1 if
+ * that is unknown, and everything has to be checked.
+ */
+static int query_fsmonitor(uint64_t last_update, struct strbuf *out)
+{
+	struct child_process cp;
+	const char *argv[4];
+	char version[16], token[32];
+	int ret;
+
+	snprintf(version, sizeof(version), "%d", FSMONITOR_VERSION);
+	snprintf(token, sizeof(token), "%"PRIuMAX, (uintmax_t)last_update);
+	argv[0] = core_fsmonitor;
+	argv[1] = version;
+	argv[2] = token;
+	argv[3] = NULL;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.argv = argv;
+	cp.use_shell = 1;
+	cp.out = -1;
+	if (start_command(&cp))
+		return error("unable to run fsmonitor hook '%s'", core_fsmonitor);
+	ret = strbuf_read(out, cp.out, 1024) < 0 ? -1 : 0;
+	close(cp.out);
+	if (finish_command(&cp))
+		ret = -1;
+	return ret;
+}
+
+/* Returns 1 if the entry was valid before */
+static int invalidate_entry(struct cache_entry *ce)
+{
+	int was_valid = !!(ce->ce_flags & CE_FSMONITOR_VALID);
+
+	ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	return was_valid;
+}
+
+static int fsmonitor_invalidate_path(struct index_state *istate,
+				     const char *name, int len)
+{
+	int pos, nr = 0;
+
+	if (len && name[len - 1] == '/')
+		len--;
+	pos = index_name_pos(istate, name, len);
+	if (pos >= 0) {
+		/* a file: it, and any other stages of it */
+		while (pos < istate->cache_nr &&
+		       !strncmp(istate->cache[pos]->name, name, len) &&
+		       !istate->cache[pos]->name[len])
+			nr += invalidate_entry(istate->cache[pos++]);
+		return nr;
+	}
+	/* a directory: everything below it */
+	for (pos = -pos - 1; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+		if (strncmp(ce->name, name, len) || ce->name[len] > '/')
+			break;
+		if (ce->name[len] == '/')
+			nr += invalidate_entry(ce);
+	}
+	return nr;
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	struct strbuf out = STRBUF_INIT;
+	uint64_t last_update = istate->fsmonitor_last_update;
+	unsigned int i, d;
+	int query_ret = -1, invalidated = 0;
+
+	if (!fsmonitor_hook()) {
+		istate->fsmonitor_has_extension = 0;
+		istate->fsmonitor_dirty_nr = 0;
+		return;
+	}
+
+	/*
+	 * Changes from now on are for the next reader to learn about.
+	 * Whenever we take a new token, the index has to be written for
+	 * the next reader to get it.
+	 */
+	istate->fsmonitor_last_update = getnanotime();
+	if (!istate->fsmonitor_has_extension) {
+		istate->cache_changed = 1;
+		return;
+	}
+	istate->fsmonitor_has_extension = 0;
+
+	if (istate->fsmonitor_dirty_nr &&
+	    istate->fsmonitor_dirty[istate->fsmonitor_dirty_nr - 1] >= istate->cache_nr) {
+		warning("fsmonitor extension does not match the index, ignoring it");
+		istate->fsmonitor_dirty_nr = 0;
+		istate->cache_changed = 1;
+		return;
+	}
+	query_ret = query_fsmonitor(last_update, &out);
+	if (query_ret < 0 || !strcmp(out.buf, "/")) {
+		istate->fsmonitor_dirty_nr = 0;
+		istate->cache_changed = 1;
+		strbuf_release(&out);
+		return;
+	}
+
+	for (i = d = 0; i < istate->cache_nr; i++) {
+		if (d < istate->fsmonitor_dirty_nr &&
+		    istate->fsmonitor_dirty[d] == i) {
+			d++;
+			continue;
+		}
+		istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+	}
+	istate->fsmonitor_dirty_nr = 0;
+
+	for (i = 0; i < out.len; ) {
+		const char *name = out.buf + i;
+		int len = strlen(name);
+		if (len)
+			invalidated += fsmonitor_invalidate_path(istate, name, len);
+		i += len + 1;
+	}
+	strbuf_release(&out);
+
+	/*
+	 * If the hook told us nothing new, asking with the old token
+	 * again is just as good; keep it, and spare a read-only command
+	 * from writing the index.
+	 */
+	if (invalidated)
+		istate->cache_changed = 1;
+	else
+		istate->fsmonitor_last_update = last_update;
+}
@@ -0,0 +1,39 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+/*
+ * With core.fsmonitor set, the index remembers which entries were
+ * found clean by the last refresh ("FSMN" extension), together with
+ * a token identifying when that was.  On the next read, the hook
+ * named by core.fsmonitor is asked which paths changed since the
+ * token; all other entries keep CE_FSMONITOR_VALID and need no
+ * lstat() to be known clean.
+ */
+
+extern int read_fsmonitor_extension(struct index_state *istate,
+				    const void *data, unsigned long sz);
+extern void write_fsmonitor_extension(struct strbuf *sb,
+				      struct index_state *istate);
+
+/* Apply the extension just read and the answer of the hook. */
+extern void tweak_fsmonitor(struct index_state *istate);
+
+static inline void mark_fsmonitor_valid(struct index_state *istate,
+					struct cache_entry *ce)
+{
+	if (core_fsmonitor && !(ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+		istate->cache_changed = 1;
+	}
+}
+
+static inline void mark_fsmonitor_invalid(struct index_state *istate,
+					  struct cache_entry *ce)
+{
+	if (ce->ce_flags & CE_FSMONITOR_VALID) {
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		istate->cache_changed = 1;
+	}
+}
+
+#endif /* FSMONITOR_H */
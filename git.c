@@ -4,6 +4,7 @@
 #include "help.h"
 #include "quote.h"
 #include "run-command.h"
+#include "sparse-index.h"
 
 const char git_usage_string[] =
 	"git [--version] [--exec-path[=<path>]] [--html-path] [--man-path] [--info-path]\n"
@@ -266,6 +267,11 @@ const char git_version_string[] = GIT_VERSION;
  * RUN_SETUP for reading from the configuration file.
  */
 #define NEED_WORK_TREE		(1<<3)
+/*
+ * the command copes with sparse directory entries in the index, which
+ * then need not be expanded when it is read.
+ */
+#define SPARSE_INDEX		(1<<4)
 
 struct cmd_struct {
 	const char *cmd;
@@ -302,6 +308,8 @@ static int run_builtin(struct cmd_struct *p, int argc, const char **argv)
 
 	if (!help && p->option & NEED_WORK_TREE)
 		setup_work_tree();
+	if (p->option & SPARSE_INDEX)
+		command_requires_full_index = 0;
 
 	trace_argv_printf(argv, "trace: built-in: git");
 
@@ -342,6 +350,8 @@ static void handle_internal_command(int argc, const char **argv)
 		{ "check-attr", cmd_check_attr, RUN_SETUP },
 		{ "check-ref-format", cmd_check_ref_format },
 		{ "checkout", cmd_checkout, RUN_SETUP | NEED_WORK_TREE },
+		{ "checkout--worker", cmd_checkout__worker,
+			RUN_SETUP | NEED_WORK_TREE },
 		{ "checkout-index", cmd_checkout_index,
 			RUN_SETUP | NEED_WORK_TREE},
 		{ "cherry", cmd_cherry, RUN_SETUP },
@@ -354,9 +364,9 @@ static void handle_internal_command(int argc, const char **argv)
 		{ "config", cmd_config, RUN_SETUP_GENTLY },
 		{ "count-objects", cmd_count_objects, RUN_SETUP },
 		{ "describe", cmd_describe, RUN_SETUP },
-		{ "diff", cmd_diff },
-		{ "diff-files", cmd_diff_files, RUN_SETUP | NEED_WORK_TREE },
-		{ "diff-index", cmd_diff_index, RUN_SETUP },
+		{ "diff", cmd_diff, SPARSE_INDEX },
+		{ "diff-files", cmd_diff_files, RUN_SETUP | NEED_WORK_TREE | SPARSE_INDEX },
+		{ "diff-index", cmd_diff_index, RUN_SETUP | SPARSE_INDEX },
 		{ "diff-tree", cmd_diff_tree, RUN_SETUP },
 		{ "fast-export", cmd_fast_export, RUN_SETUP },
 		{ "fetch", cmd_fetch, RUN_SETUP },
@@ -424,13 +434,14 @@ static void handle_internal_command(int argc, const char **argv)
 		{ "show-branch", cmd_show_branch, RUN_SETUP },
 		{ "show-ref", cmd_show_ref, RUN_SETUP },
 		{ "stage", cmd_add, RUN_SETUP | NEED_WORK_TREE },
-		{ "status", cmd_status, RUN_SETUP | NEED_WORK_TREE },
+		{ "status", cmd_status, RUN_SETUP | NEED_WORK_TREE | SPARSE_INDEX },
 		{ "stripspace", cmd_stripspace },
 		{ "symbolic-ref", cmd_symbolic_ref, RUN_SETUP },
 		{ "tag", cmd_tag, RUN_SETUP },
 		{ "tar-tree", cmd_tar_tree },
 		{ "unpack-file", cmd_unpack_file, RUN_SETUP },
 		{ "unpack-objects", cmd_unpack_objects, RUN_SETUP },
+		{ "update-grep-index", cmd_update_grep_index, RUN_SETUP },
 		{ "update-index", cmd_update_index, RUN_SETUP },
 		{ "update-ref", cmd_update_ref, RUN_SETUP },
 		{ "update-server-info", cmd_update_server_info, RUN_SETUP },
@@ -441,7 +452,7 @@ static void handle_internal_command(int argc, const char **argv)
 		{ "verify-tag", cmd_verify_tag, RUN_SETUP },
 		{ "version", cmd_version },
 		{ "whatchanged", cmd_whatchanged, RUN_SETUP },
-		{ "write-tree", cmd_write_tree, RUN_SETUP },
+		{ "write-tree", cmd_write_tree, RUN_SETUP | SPARSE_INDEX },
 	};
 	int i;
 	static const char ext[] = STRIP_EXTENSION;
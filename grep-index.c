@@ -0,0 +1,693 @@
+#include "cache.h"
+#include "tree.h"
+#include "grep.h"
+#include "varint.h"
+#include "xdiff-interface.h"
+#include "grep-index.h"
+
+#define GREP_INDEX_SIGNATURE "GIDX"
+#define GREP_INDEX_VERSION 1
+#define GREP_INDEX_HEADER_SIZE 16
+#define GREP_INDEX_FOOTER_SIZE 4
+
+/* The postings of this pseudo-trigram are the blobs left unindexed. */
+#define UNINDEXED 0xffffffff
+
+struct grep_index {
+	unsigned char *buf;
+	size_t len;
+	uint32_t nr_blobs;
+	uint32_t nr_trigrams;
+	const unsigned char *blobs;	/* object names, by blob number */
+	const unsigned char *lookup;	/* blob numbers, by object name */
+	const unsigned char *trigrams;	/* trigrams and postings offsets */
+	const unsigned char *postings;
+	size_t postings_len;
+	unsigned char *selected;	/* bitmap of blobs that may match */
+	int corrupt;
+};
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static void put_be32(struct strbuf *sb, uint32_t v)
+{
+	v = htonl(v);
+	strbuf_add(sb, &v, sizeof(v));
+}
+
+static const char *grep_index_path(void)
+{
+	return mkpath("%s/pack/grep-index", get_object_directory());
+}
+
+/*
+ * Trigrams are folded to lowercase, so that one index serves both
+ * case sensitive and insensitive searches, and never span lines.
+ */
+static uint32_t trigram(const char *s)
+{
+	return (tolower(s[0]) << 16) | (tolower(s[1]) << 8) | tolower(s[2]);
+}
+
+/*
+ * Check that the blob numbers and postings offsets of the tables
+ * can be used without further bounds checks.
+ */
+static int verify_tables(struct grep_index *ix)
+{
+	uint32_t i, last = 0;
+
+	for (i = 0; i < ix->nr_blobs; i++)
+		if (get_be32(ix->lookup + 4 * i) >= ix->nr_blobs)
+			return -1;
+	for (i = 0; i < ix->nr_trigrams; i++) {
+		uint32_t offset = get_be32(ix->trigrams + 8 * i + 4);
+		if (offset < last || offset > ix->postings_len)
+			return -1;
+		last = offset;
+	}
+	return 0;
+}
+
+/*
+ * The index only ever saves reading blobs, so a broken one is
+ * reported and then searched around, rather than stopping 'git grep'.
+ */
+struct grep_index *open_grep_index(void)
+{
+	const char *path = grep_index_path();
+	struct grep_index *ix;
+	struct stat st;
+	uint64_t tables;
+	size_t len;
+	unsigned char *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		warning("unable to stat '%s': %s", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < GREP_INDEX_HEADER_SIZE + GREP_INDEX_FOOTER_SIZE) {
+		warning("grep index '%s' is too short, ignoring it", path);
+		close(fd);
+		return NULL;
+	}
+	buf = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (memcmp(buf, GREP_INDEX_SIGNATURE, 4) ||
+	    memcmp(buf + len - 4, GREP_INDEX_SIGNATURE, 4)) {
+		warning("grep index '%s' has a bad signature, ignoring it",
+			path);
+		munmap(buf, len);
+		return NULL;
+	}
+	if (get_be32(buf + 4) != GREP_INDEX_VERSION) {
+		warning("grep index '%s' has unknown version %"PRIu32
+			", ignoring it", path, get_be32(buf + 4));
+		munmap(buf, len);
+		return NULL;
+	}
+
+	ix = xcalloc(1, sizeof(*ix));
+	ix->buf = buf;
+	ix->len = len;
+	ix->nr_blobs = get_be32(buf + 8);
+	ix->nr_trigrams = get_be32(buf + 12);
+	tables = GREP_INDEX_HEADER_SIZE + (uint64_t)ix->nr_blobs * 24 +
+		(uint64_t)ix->nr_trigrams * 8;
+	if (len - GREP_INDEX_FOOTER_SIZE < tables) {
+		warning("grep index '%s' is corrupt, ignoring it", path);
+		close_grep_index(ix);
+		return NULL;
+	}
+	ix->blobs = buf + GREP_INDEX_HEADER_SIZE;
+	ix->lookup = ix->blobs + 20 * ix->nr_blobs;
+	ix->trigrams = ix->lookup + 4 * ix->nr_blobs;
+	ix->postings = ix->trigrams + 8 * ix->nr_trigrams;
+	ix->postings_len = len - GREP_INDEX_FOOTER_SIZE - tables;
+	if (verify_tables(ix)) {
+		warning("grep index '%s' is corrupt, ignoring it", path);
+		close_grep_index(ix);
+		return NULL;
+	}
+	return ix;
+}
+
+void close_grep_index(struct grep_index *ix)
+{
+	munmap(ix->buf, ix->len);
+	free(ix->selected);
+	free(ix);
+}
+
+static int find_blob(struct grep_index *ix, const unsigned char *sha1,
+		     uint32_t *nr)
+{
+	uint32_t lo = 0, hi = ix->nr_blobs;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t n = get_be32(ix->lookup + 4 * mi);
+		int cmp;
+
+		cmp = hashcmp(ix->blobs + 20 * n, sha1);
+		if (!cmp) {
+			*nr = n;
+			return 1;
+		}
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+/* Postings lists are byte offsets into ix->postings. */
+static void postings_at(struct grep_index *ix, uint32_t i,
+			size_t *start, size_t *end)
+{
+	*start = get_be32(ix->trigrams + 8 * i + 4);
+	if (i + 1 < ix->nr_trigrams)
+		*end = get_be32(ix->trigrams + 8 * (i + 1) + 4);
+	else
+		*end = ix->postings_len;
+}
+
+static int find_postings(struct grep_index *ix, uint32_t t,
+			 size_t *start, size_t *end)
+{
+	uint32_t lo = 0, hi = ix->nr_trigrams;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t mt = get_be32(ix->trigrams + 8 * mi);
+
+		if (mt == t) {
+			postings_at(ix, mi, start, end);
+			return 1;
+		}
+		if (mt < t)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+/*
+ * A postings list is the increasing blob numbers, each stored as a
+ * varint difference to the one before it (the first one as is).
+ * Returns the last one, or -1 (and marks the index corrupt) if the
+ * list does not decode.
+ */
+static int64_t decode_postings(struct grep_index *ix, size_t start,
+			       size_t end, unsigned char *bitmap)
+{
+	const unsigned char *p = ix->postings + start;
+	const unsigned char *stop = ix->postings + end;
+	uintmax_t n = 0, delta;
+
+	while (p < stop) {
+		if (decode_varint_bounded(&p, stop, &delta) ||
+		    delta >= ix->nr_blobs - n) {
+			if (!ix->corrupt)
+				warning("grep index '%s' is corrupt, ignoring it",
+					grep_index_path());
+			ix->corrupt = 1;
+			return -1;
+		}
+		n += delta;
+		if (bitmap)
+			bitmap[n / 8] |= 1 << (n % 8);
+	}
+	return n;
+}
+
+static size_t bitmap_size(struct grep_index *ix)
+{
+	return (ix->nr_blobs + 7) / 8;
+}
+
+/*
+ * The blobs that may contain a match for p: those having all the
+ * trigrams of a string every match contains.  NULL means all blobs.
+ */
+static unsigned char *pattern_blobs(struct grep_index *ix,
+				    const struct grep_pat *p)
+{
+	size_t len, i, j, size = bitmap_size(ix);
+	const char *literal;
+	unsigned char *ret = NULL, *tmp;
+
+	if (p->token == GREP_PATTERN_HEAD)
+		return NULL;
+	literal = grep_pat_literal(p, &len);
+	if (!literal || len < 3)
+		return NULL;
+
+	tmp = xmalloc(size);
+	for (i = 0; i + 3 <= len; i++) {
+		unsigned char *bitmap;
+		size_t start, end;
+
+		if (memchr(literal + i, '\n', 3))
+			continue;
+		if (!ret) {
+			ret = xcalloc(1, size);
+			bitmap = ret;
+		} else {
+			memset(tmp, 0, size);
+			bitmap = tmp;
+		}
+		if (find_postings(ix, trigram(literal + i), &start, &end))
+			decode_postings(ix, start, end, bitmap);
+		if (bitmap == tmp)
+			for (j = 0; j < size; j++)
+				ret[j] &= tmp[j];
+	}
+	free(tmp);
+	return ret;
+}
+
+static unsigned char *expr_blobs(struct grep_index *ix,
+				 const struct grep_expr *x)
+{
+	unsigned char *left, *right;
+	size_t i, size = bitmap_size(ix);
+
+	if (!x)
+		return NULL;
+	switch (x->node) {
+	case GREP_NODE_ATOM:
+		return pattern_blobs(ix, x->u.atom);
+	case GREP_NODE_AND:
+		left = expr_blobs(ix, x->u.binary.left);
+		right = expr_blobs(ix, x->u.binary.right);
+		if (!left)
+			return right;
+		if (right) {
+			for (i = 0; i < size; i++)
+				left[i] &= right[i];
+			free(right);
+		}
+		return left;
+	case GREP_NODE_OR:
+		left = expr_blobs(ix, x->u.binary.left);
+		if (!left)
+			return NULL;
+		right = expr_blobs(ix, x->u.binary.right);
+		if (!right) {
+			free(left);
+			return NULL;
+		}
+		for (i = 0; i < size; i++)
+			left[i] |= right[i];
+		free(right);
+		return left;
+	default:
+		/* --not and the like can match anywhere */
+		return NULL;
+	}
+}
+
+static unsigned char *list_blobs(struct grep_index *ix,
+				 const struct grep_pat *p)
+{
+	unsigned char *ret = NULL;
+	size_t i, size = bitmap_size(ix);
+
+	for (; p; p = p->next) {
+		unsigned char *bitmap = pattern_blobs(ix, p);
+
+		if (!bitmap) {
+			free(ret);
+			return NULL;
+		}
+		if (!ret) {
+			ret = bitmap;
+			continue;
+		}
+		for (i = 0; i < size; i++)
+			ret[i] |= bitmap[i];
+		free(bitmap);
+	}
+	return ret;
+}
+
+int grep_index_select(struct grep_index *ix, const struct grep_opt *opt)
+{
+	unsigned char *selected;
+	size_t start, end;
+
+	free(ix->selected);
+	ix->selected = NULL;
+
+	if (opt->extended)
+		selected = expr_blobs(ix, opt->pattern_expression);
+	else
+		selected = list_blobs(ix, opt->pattern_list);
+	if (!selected)
+		return 0;
+	if (find_postings(ix, UNINDEXED, &start, &end))
+		decode_postings(ix, start, end, selected);
+	if (ix->corrupt) {
+		free(selected);
+		return 0;
+	}
+	ix->selected = selected;
+	return 1;
+}
+
+int grep_index_may_match(struct grep_index *ix, const unsigned char *sha1)
+{
+	uint32_t nr;
+
+	if (!ix->selected || !find_blob(ix, sha1, &nr))
+		return 1;
+	return !!(ix->selected[nr / 8] & (1 << (nr % 8)));
+}
+
+struct postings {
+	unsigned char *buf;
+	uint32_t len, alloc;
+	uint32_t last;
+};
+
+struct grep_index_writer {
+	struct postings *table[1 << 16];	/* by top 16 bits of trigram */
+	struct postings unindexed;
+	unsigned char (*blobs)[20];
+	uint32_t nr_blobs, alloc_blobs;
+	int fd;
+	struct strbuf out;
+};
+
+static struct postings *trigram_postings(struct grep_index_writer *w,
+					 uint32_t t)
+{
+	struct postings **block;
+
+	if (t == UNINDEXED)
+		return &w->unindexed;
+	block = &w->table[t >> 8];
+	if (!*block)
+		*block = xcalloc(256, sizeof(**block));
+	return *block + (t & 0xff);
+}
+
+static void add_posting(struct postings *p, uint32_t n)
+{
+	unsigned char varint[16];
+	int len;
+
+	if (p->len && p->last == n)
+		return;
+	len = encode_varint(p->len ? n - p->last : n, varint);
+	ALLOC_GROW(p->buf, p->len + len, p->alloc);
+	memcpy(p->buf + p->len, varint, len);
+	p->len += len;
+	p->last = n;
+}
+
+/*
+ * Start from the blobs and postings of the existing index.  New blobs
+ * get higher numbers, so the postings lists are simply extended.
+ * Returns -1 if the postings of the index do not decode.
+ */
+static int load_grep_index(struct grep_index_writer *w,
+			   struct grep_index *ix)
+{
+	uint32_t i;
+
+	w->nr_blobs = ix->nr_blobs;
+	ALLOC_GROW(w->blobs, w->nr_blobs, w->alloc_blobs);
+	memcpy(w->blobs, ix->blobs, 20 * ix->nr_blobs);
+
+	for (i = 0; i < ix->nr_trigrams; i++) {
+		uint32_t t = get_be32(ix->trigrams + 8 * i);
+		struct postings *p;
+		size_t start, end;
+		int64_t last;
+
+		if (t >= (1 << 24) && t != UNINDEXED)
+			return -1;
+		postings_at(ix, i, &start, &end);
+		if (start == end)
+			continue;
+		last = decode_postings(ix, start, end, NULL);
+		if (last < 0)
+			return -1;
+		p = trigram_postings(w, t);
+		ALLOC_GROW(p->buf, end - start, p->alloc);
+		memcpy(p->buf, ix->postings + start, end - start);
+		p->len = end - start;
+		p->last = last;
+	}
+	return 0;
+}
+
+static void index_blob(struct grep_index_writer *w, const unsigned char *sha1)
+{
+	uint32_t n = w->nr_blobs, t = 0;
+	enum object_type type;
+	unsigned long size, i;
+	unsigned char *buf;
+	int run = 0;
+
+	ALLOC_GROW(w->blobs, n + 1, w->alloc_blobs);
+	hashcpy(w->blobs[n], sha1);
+	w->nr_blobs++;
+
+	if (sha1_object_info(sha1, &size) != OBJ_BLOB)
+		die("unable to read blob %s", sha1_to_hex(sha1));
+	if (size > big_file_threshold) {
+		add_posting(&w->unindexed, n);
+		return;
+	}
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf)
+		die("unable to read blob %s", sha1_to_hex(sha1));
+	if (buffer_is_binary((const char *)buf, size)) {
+		add_posting(&w->unindexed, n);
+		free(buf);
+		return;
+	}
+	for (i = 0; i < size; i++) {
+		if (buf[i] == '\n') {
+			run = 0;
+			continue;
+		}
+		t = ((t << 8) | tolower(buf[i])) & 0xffffff;
+		if (++run >= 3)
+			add_posting(trigram_postings(w, t), n);
+	}
+	free(buf);
+}
+
+static void flush_out(struct grep_index_writer *w, size_t limit)
+{
+	if (w->out.len < limit)
+		return;
+	write_or_die(w->fd, w->out.buf, w->out.len);
+	strbuf_reset(&w->out);
+}
+
+static void write_trigram(struct grep_index_writer *w, uint32_t t,
+			  struct postings *p, uint64_t *offset)
+{
+	if (!p->len)
+		return;
+	if (*offset > 0xffffffff)
+		die("grep index too large");
+	put_be32(&w->out, t);
+	put_be32(&w->out, *offset);
+	*offset += p->len;
+	flush_out(w, 8192);
+}
+
+struct blob_order {
+	const unsigned char *sha1;
+	uint32_t nr;
+};
+
+static int blob_order_cmp(const void *a_, const void *b_)
+{
+	const struct blob_order *a = a_, *b = b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static void write_grep_index(struct grep_index_writer *w)
+{
+	struct blob_order *order;
+	uint64_t offset = 0;
+	uint32_t i, j, nr_trigrams = 0;
+
+	for (i = 0; i < ARRAY_SIZE(w->table); i++)
+		for (j = 0; w->table[i] && j < 256; j++)
+			if (w->table[i][j].len)
+				nr_trigrams++;
+	if (w->unindexed.len)
+		nr_trigrams++;
+
+	strbuf_add(&w->out, GREP_INDEX_SIGNATURE, 4);
+	put_be32(&w->out, GREP_INDEX_VERSION);
+	put_be32(&w->out, w->nr_blobs);
+	put_be32(&w->out, nr_trigrams);
+
+	for (i = 0; i < w->nr_blobs; i++) {
+		strbuf_add(&w->out, w->blobs[i], 20);
+		flush_out(w, 8192);
+	}
+
+	order = xmalloc(w->nr_blobs * sizeof(*order));
+	for (i = 0; i < w->nr_blobs; i++) {
+		order[i].sha1 = w->blobs[i];
+		order[i].nr = i;
+	}
+	qsort(order, w->nr_blobs, sizeof(*order), blob_order_cmp);
+	for (i = 0; i < w->nr_blobs; i++) {
+		put_be32(&w->out, order[i].nr);
+		flush_out(w, 8192);
+	}
+	free(order);
+
+	for (i = 0; i < ARRAY_SIZE(w->table); i++)
+		for (j = 0; w->table[i] && j < 256; j++)
+			write_trigram(w, (i << 8) | j, &w->table[i][j], &offset);
+	write_trigram(w, UNINDEXED, &w->unindexed, &offset);
+
+	for (i = 0; i < ARRAY_SIZE(w->table); i++) {
+		for (j = 0; w->table[i] && j < 256; j++) {
+			struct postings *p = &w->table[i][j];
+			strbuf_add(&w->out, p->buf, p->len);
+			flush_out(w, 8192);
+		}
+	}
+	strbuf_add(&w->out, w->unindexed.buf, w->unindexed.len);
+	strbuf_add(&w->out, GREP_INDEX_SIGNATURE, 4);
+	flush_out(w, 0);
+}
+
+static void clear_postings(struct grep_index_writer *w)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < ARRAY_SIZE(w->table); i++) {
+		for (j = 0; w->table[i] && j < 256; j++)
+			free(w->table[i][j].buf);
+		free(w->table[i]);
+		w->table[i] = NULL;
+	}
+	free(w->unindexed.buf);
+	memset(&w->unindexed, 0, sizeof(w->unindexed));
+	w->nr_blobs = 0;
+}
+
+static void release_writer(struct grep_index_writer *w)
+{
+	clear_postings(w);
+	free(w->blobs);
+	strbuf_release(&w->out);
+}
+
+struct new_blobs {
+	struct grep_index *ix;
+	unsigned char (*sha1)[20];
+	int nr, alloc;
+};
+
+static int collect_blob(const unsigned char *sha1, const char *base,
+			int baselen, const char *pathname, unsigned mode,
+			int stage, void *context)
+{
+	struct new_blobs *new_blobs = context;
+	uint32_t nr;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	if (!S_ISREG(mode))
+		return 0;
+	if (new_blobs->ix && find_blob(new_blobs->ix, sha1, &nr))
+		return 0;
+	ALLOC_GROW(new_blobs->sha1, new_blobs->nr + 1, new_blobs->alloc);
+	hashcpy(new_blobs->sha1[new_blobs->nr++], sha1);
+	return 0;
+}
+
+static int sha1_cmp(const void *a, const void *b)
+{
+	return hashcmp(a, b);
+}
+
+static struct lock_file grep_index_lock;
+
+int update_grep_index(struct tree **trees, int nr, unsigned flags)
+{
+	struct new_blobs new_blobs;
+	struct grep_index_writer *w;
+	struct pathspec match_all;
+	char *path = xstrdup(grep_index_path());
+	int i, added = 0, loaded = 0;
+
+	w = xcalloc(1, sizeof(*w));
+	w->fd = hold_lock_file_for_update(&grep_index_lock, path, 0);
+	if (w->fd < 0) {
+		added = unable_to_lock_error(path, errno);
+		free(path);
+		free(w);
+		return added;
+	}
+	strbuf_init(&w->out, 8192);
+
+	memset(&new_blobs, 0, sizeof(new_blobs));
+	if (!(flags & GREP_INDEX_REBUILD))
+		new_blobs.ix = open_grep_index();
+	if (new_blobs.ix && load_grep_index(w, new_blobs.ix)) {
+		/* decode_postings() has warned already */
+		clear_postings(w);
+		close_grep_index(new_blobs.ix);
+		new_blobs.ix = NULL;
+	}
+	init_pathspec(&match_all, NULL);
+	for (i = 0; i < nr; i++)
+		read_tree_recursive(trees[i], "", 0, 0, &match_all,
+				    collect_blob, &new_blobs);
+	free_pathspec(&match_all);
+	if (new_blobs.ix) {
+		close_grep_index(new_blobs.ix);
+		loaded = 1;
+	}
+
+	qsort(new_blobs.sha1, new_blobs.nr, 20, sha1_cmp);
+	for (i = 0; i < new_blobs.nr; i++) {
+		if (i && !hashcmp(new_blobs.sha1[i - 1], new_blobs.sha1[i]))
+			continue;
+		index_blob(w, new_blobs.sha1[i]);
+		added++;
+	}
+	free(new_blobs.sha1);
+
+	if (!added && loaded) {
+		rollback_lock_file(&grep_index_lock);
+	} else {
+		write_grep_index(w);
+		if (commit_lock_file(&grep_index_lock))
+			added = error("unable to write '%s'", path);
+	}
+	release_writer(w);
+	free(w);
+	free(path);
+	return added;
+}
@@ -0,0 +1,37 @@
+#ifndef GREP_INDEX_H
+#define GREP_INDEX_H
+
+struct grep_opt;
+struct grep_index;
+
+/*
+ * Open the grep index of the repository, or return NULL if it does
+ * not have one or it is corrupt (with a warning).
+ */
+extern struct grep_index *open_grep_index(void);
+extern void close_grep_index(struct grep_index *);
+
+/*
+ * Work out which of the indexed blobs can contain a match for the
+ * compiled patterns of opt.  Returns 0 if the patterns do not allow
+ * ruling out any of them.
+ */
+extern int grep_index_select(struct grep_index *, const struct grep_opt *opt);
+
+/*
+ * Can the blob contain a match for the patterns last selected?  Blobs
+ * that are not in the index always can.
+ */
+extern int grep_index_may_match(struct grep_index *, const unsigned char *sha1);
+
+#define GREP_INDEX_REBUILD 01
+
+/*
+ * Add the blobs of the trees to the grep index.  With
+ * GREP_INDEX_REBUILD, or if the existing index is corrupt, start
+ * from an empty one instead.  Returns the number of blobs added, or
+ * -1 on error.
+ */
+extern int update_grep_index(struct tree **trees, int nr, unsigned flags);
+
+#endif /* GREP_INDEX_H */
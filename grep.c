@@ -155,6 +155,170 @@ static int is_fixed(const char *s, size_t len)
 	return 1;
 }
 
+static int skip_bracket(const char **sp, const char *end)
+{
+	const char *s = *sp;
+
+	if (s < end && *s == '^')
+		s++;
+	if (s < end && *s == ']')
+		s++;
+	while (s < end && *s != ']') {
+		if (*s == '[' && s + 1 < end &&
+		    (s[1] == ':' || s[1] == '.' || s[1] == '=')) {
+			char close = s[1];
+			for (s += 2; s + 1 < end; s++)
+				if (s[0] == close && s[1] == ']')
+					break;
+			if (s + 1 >= end)
+				return -1;
+			s++;
+		}
+		s++;
+	}
+	if (s == end)
+		return -1;
+	*sp = s + 1;
+	return 0;
+}
+
+static void keep_longer(struct strbuf *best, struct strbuf *cur)
+{
+	if (best->len < cur->len)
+		strbuf_swap(best, cur);
+	strbuf_reset(cur);
+}
+
+/*
+ * Find the longest string that appears literally in every match of
+ * the regexp of p.  Searching for it with kwset lets us skip the lines
+ * that cannot match without running the regexp engine on them.  This
+ * only understands the simple cases: anything with an alternation
+ * gives up, and nothing inside a group is used.
+ */
+static void compile_regexp_must(struct grep_pat *p, struct grep_opt *opt)
+{
+	int extended = opt->regflags & REG_EXTENDED;
+	int icase = (opt->regflags & REG_ICASE) || p->ignore_case;
+	const char *s = p->pattern, *end = s + p->patternlen;
+	struct strbuf cur = STRBUF_INIT, best = STRBUF_INIT;
+	int depth = 0;
+
+	/* without REG_NEWLINE a match may span lines */
+	if (!(opt->regflags & REG_NEWLINE) ||
+	    memchr(s, '|', p->patternlen) || memchr(s, '\n', p->patternlen))
+		return;
+
+	while (s < end) {
+		int c = (unsigned char)*s++;
+		int literal = -1, quantifier = 0;
+
+		switch (c) {
+		case '\\':
+			if (s == end)
+				goto out;
+			c = (unsigned char)*s++;
+			if (!extended && c == '(')
+				depth++;
+			else if (!extended && c == ')')
+				depth--;
+			else if (!extended && (c == '{' || c == '?' || c == '+'))
+				quantifier = c;
+			else if (!isalnum(c) && !strchr("<>`'", c))
+				literal = c;
+			/* \w, \b, back-references and the like */
+			break;
+		case '[':
+			if (skip_bracket(&s, end))
+				goto out;
+			break;
+		case '(':
+		case ')':
+			if (!extended)
+				literal = c;
+			else if (c == '(')
+				depth++;
+			else
+				depth--;
+			break;
+		case '?':
+		case '+':
+		case '{':
+			if (extended)
+				quantifier = c;
+			else
+				literal = c;
+			break;
+		case '*':
+			quantifier = c;
+			break;
+		case '.':
+		case '^':
+		case '$':
+			break;
+		default:
+			literal = c;
+			break;
+		}
+
+		if (quantifier) {
+			/*
+			 * The preceding character is optional.  If it is a
+			 * multibyte one, drop all of it.
+			 */
+			if (cur.len && (cur.buf[cur.len - 1] & 0x80))
+				while (cur.len && (cur.buf[cur.len - 1] & 0x80))
+					strbuf_setlen(&cur, cur.len - 1);
+			else if (cur.len)
+				strbuf_setlen(&cur, cur.len - 1);
+			if (quantifier == '{') {
+				/* skip the interval */
+				while (s < end && *s != '}')
+					s++;
+				if (s == end)
+					goto out;
+				s++;
+			}
+		}
+		if (literal < 0 || depth) {
+			keep_longer(&best, &cur);
+			continue;
+		}
+		/* our case folding only knows about ASCII */
+		if (icase && (literal & 0x80))
+			goto out;
+		strbuf_addch(&cur, literal);
+	}
+	keep_longer(&best, &cur);
+
+	if (best.len >= 2) {
+		p->must_kws = kwsalloc(icase ? tolower_trans_tbl : NULL);
+		kwsincr(p->must_kws, best.buf, best.len);
+		kwsprep(p->must_kws);
+		p->must = strbuf_detach(&best, &p->mustlen);
+	}
+out:
+	strbuf_release(&cur);
+	strbuf_release(&best);
+}
+
+/*
+ * Return a string that every line matched by p contains, ignoring
+ * ASCII case if p does, or NULL if we do not know of one.
+ */
+const char *grep_pat_literal(const struct grep_pat *p, size_t *len)
+{
+	if (p->fixed) {
+		*len = p->patternlen;
+		return p->pattern;
+	}
+	if (p->must) {
+		*len = p->mustlen;
+		return p->must;
+	}
+	return NULL;
+}
+
 static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 {
 	int err;
@@ -189,6 +353,7 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 		regfree(&p->regexp);
 		compile_regexp_failed(p, errbuf);
 	}
+	compile_regexp_must(p, opt);
 }
 
 static struct grep_expr *compile_pattern_or(struct grep_pat **);
@@ -430,6 +595,9 @@ void free_grep_patterns(struct grep_opt *opt)
 				free_pcre_regexp(p);
 			else
 				regfree(&p->regexp);
+			if (p->must_kws)
+				kwsfree(p->must_kws);
+			free(p->must);
 			break;
 		default:
 			break;
@@ -444,13 +612,12 @@ void free_grep_patterns(struct grep_opt *opt)
 
 static char *end_of_line(char *cp, unsigned long *left)
 {
-	unsigned long l = *left;
-	while (l && *cp != '\n') {
-		l--;
-		cp++;
-	}
-	*left = l;
-	return cp;
+	char *eol = memchr(cp, '\n', *left);
+
+	if (!eol)
+		eol = cp + *left;
+	*left -= eol - cp;
+	return eol;
 }
 
 static int word_char(char ch)
@@ -509,6 +676,40 @@ static int regmatch(const regex_t *preg, char *line, char *eol,
 	return regexec(preg, line, 1, match, eflags);
 }
 
+/*
+ * Like regmatch(), but only run the regexp on the lines that contain
+ * the string every match has to contain.  This also makes it cheap to
+ * look for the first match in a whole buffer, see look_ahead().
+ */
+static int mustmatch(struct grep_pat *p, char *line, char *eol,
+		     regmatch_t *match, int eflags)
+{
+	char *start = line;
+
+	while (line < eol) {
+		struct kwsmatch kwsm;
+		size_t offset = kwsexec(p->must_kws, line, eol - line, &kwsm);
+		char *bol, *end;
+
+		if (offset == -1)
+			break;
+		for (bol = line + offset; line < bol && bol[-1] != '\n'; bol--)
+			; /* find the beginning of the line */
+		end = memchr(line + offset, '\n', eol - line - offset);
+		if (!end)
+			end = eol;
+		if (!regmatch(&p->regexp, bol, end, match,
+			      bol == start ? eflags : eflags & ~REG_NOTBOL)) {
+			match->rm_so += bol - start;
+			match->rm_eo += bol - start;
+			return 0;
+		}
+		line = end + 1;
+	}
+	match->rm_so = match->rm_eo = -1;
+	return REG_NOMATCH;
+}
+
 static int patmatch(struct grep_pat *p, char *line, char *eol,
 		    regmatch_t *match, int eflags)
 {
@@ -518,6 +719,8 @@ static int patmatch(struct grep_pat *p, char *line, char *eol,
 		hit = !fixmatch(p, line, eol, match);
 	else if (p->pcre_regexp)
 		hit = !pcrematch(p, line, eol, match, eflags);
+	else if (p->must_kws)
+		hit = !mustmatch(p, line, eol, match, eflags);
 	else
 		hit = !regmatch(&p->regexp, line, eol, match, eflags);
 
@@ -968,10 +1171,8 @@ static int look_ahead(struct grep_opt *opt,
 		; /* find the beginning of the line */
 	last_bol = sp;
 
-	for (sp = bol; sp < last_bol; sp++) {
-		if (*sp == '\n')
-			lno++;
-	}
+	for (sp = bol; (sp = memchr(sp, '\n', last_bol - sp)); sp++)
+		lno++;
 	*left_p -= last_bol - bol;
 	*bol_p = last_bol;
 	*lno_p = lno;
@@ -987,7 +1188,7 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 {
 	char *bol;
 	unsigned long left;
-	unsigned lno = 1;
+	unsigned lno = gs->lno;
 	unsigned last_hit = 0;
 	int binary_match_only = 0;
 	unsigned count = 0;
@@ -1229,6 +1430,7 @@ void grep_source_init(struct grep_source *gs, enum grep_source_type type,
 	gs->name = name ? xstrdup(name) : NULL;
 	gs->buf = NULL;
 	gs->size = 0;
+	gs->lno = 1;
 	gs->driver = NULL;
 
 	switch (type) {
@@ -45,6 +45,9 @@ struct grep_pat {
 	pcre *pcre_regexp;
 	pcre_extra *pcre_extra_info;
 	kwset_t kws;
+	kwset_t must_kws;	/* a string every match of regexp contains */
+	char *must;		/* ... and that string itself */
+	size_t mustlen;
 	unsigned fixed:1;
 	unsigned ignore_case:1;
 	unsigned word_regexp:1;
@@ -129,6 +132,7 @@ extern void append_header_grep_pattern(struct grep_opt *, enum grep_header_field
 extern void compile_grep_patterns(struct grep_opt *opt);
 extern void free_grep_patterns(struct grep_opt *opt);
 extern int grep_buffer(struct grep_opt *opt, char *buf, unsigned long size);
+extern const char *grep_pat_literal(const struct grep_pat *p, size_t *len);
 
 struct grep_source {
 	char *name;
@@ -142,6 +146,7 @@ struct grep_source {
 
 	char *buf;
 	unsigned long size;
+	unsigned lno; /* line number of the start of buf */
 
 	struct userdiff_driver *driver;
 };
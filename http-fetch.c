@@ -6,6 +6,22 @@
 static const char http_fetch_usage[] = "git http-fetch "
 "[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url";
 
+/* Download a single file, like a bundle */
+static int fetch_file(const char *url, const char *filename)
+{
+	int ret;
+
+	setup_git_directory_gently(NULL);
+	git_config(git_default_config, NULL);
+
+	http_init(NULL, url, 0);
+	ret = http_get_file(url, filename, 0);
+	if (ret != HTTP_OK)
+		http_error(url, ret);
+	http_cleanup();
+	return ret != HTTP_OK;
+}
+
 int main(int argc, const char **argv)
 {
 	struct walker *walker;
@@ -21,6 +37,7 @@ int main(int argc, const char **argv)
 	int get_all = 0;
 	int get_verbosely = 0;
 	int get_recover = 0;
+	const char *output = NULL;
 
 	git_setup_gettext();
 
@@ -46,9 +63,16 @@ int main(int argc, const char **argv)
 			get_recover = 1;
 		} else if (!strcmp(argv[arg], "--stdin")) {
 			commits_on_stdin = 1;
+		} else if (!prefixcmp(argv[arg], "--output=")) {
+			output = argv[arg] + 9;
 		}
 		arg++;
 	}
+	if (output) {
+		if (argc != arg + 1)
+			usage(http_fetch_usage);
+		return fetch_file(argv[arg], output);
+	}
 	if (argc != arg + 2 - commits_on_stdin)
 		usage(http_fetch_usage);
 	if (commits_on_stdin) {
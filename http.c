@@ -18,6 +18,10 @@ static int curl_session_count;
 #ifdef USE_CURL_MULTI
 static int max_requests = -1;
 static CURLM *curlm;
+static long max_host_connections;
+#endif
+#ifdef USE_CURL_SHARE
+static CURLSH *curlsh;
 #endif
 #ifndef NO_CURL_EASY_DUPHANDLE
 static CURL *curl_default;
@@ -45,6 +49,7 @@ static const char *curl_cookie_file;
 static struct credential http_auth = CREDENTIAL_INIT;
 static int http_proactive_auth;
 static const char *user_agent;
+static const char *curl_http_version;
 
 #if LIBCURL_VERSION_NUM >= 0x071700
 /* Use CURLOPT_KEYPASSWD as is */
@@ -174,6 +179,10 @@ static int http_options(const char *var, const char *value, void *cb)
 		max_requests = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp("http.maxhostconnections", var)) {
+		max_host_connections = git_config_int(var, value);
+		return 0;
+	}
 #endif
 	if (!strcmp("http.lowspeedlimit", var)) {
 		curl_low_speed_limit = (long)git_config_int(var, value);
@@ -204,6 +213,9 @@ static int http_options(const char *var, const char *value, void *cb)
 	if (!strcmp("http.useragent", var))
 		return git_config_string(&user_agent, var, value);
 
+	if (!strcmp("http.version", var))
+		return git_config_string(&curl_http_version, var, value);
+
 	/* Fall back on the default ones */
 	return git_default_config(var, value, cb);
 }
@@ -241,6 +253,23 @@ static int has_cert_password(void)
 	return 1;
 }
 
+static void set_curl_http_version(CURL *result)
+{
+	if (!curl_http_version)
+		return;
+	if (!strcmp(curl_http_version, "HTTP/1.1"))
+		curl_easy_setopt(result, CURLOPT_HTTP_VERSION,
+				 CURL_HTTP_VERSION_1_1);
+#if LIBCURL_VERSION_NUM >= 0x072100
+	else if (!strcmp(curl_http_version, "HTTP/2"))
+		curl_easy_setopt(result, CURLOPT_HTTP_VERSION,
+				 CURL_HTTP_VERSION_2_0);
+#endif
+	else
+		warning("ignoring unsupported http.version '%s'",
+			curl_http_version);
+}
+
 static CURL *get_curl_handle(void)
 {
 	CURL *result = curl_easy_init();
@@ -301,6 +330,19 @@ static CURL *get_curl_handle(void)
 	curl_easy_setopt(result, CURLOPT_USERAGENT,
 		user_agent ? user_agent : GIT_HTTP_USER_AGENT);
 
+#ifdef USE_CURL_SHARE
+	if (curlsh)
+		curl_easy_setopt(result, CURLOPT_SHARE, curlsh);
+#endif
+	set_curl_http_version(result);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/*
+	 * Rather than opening a new connection for a request, wait for
+	 * one in use to tell whether it can carry several streams.
+	 */
+	curl_easy_setopt(result, CURLOPT_PIPEWAIT, 1);
+#endif
+
 	if (curl_ftp_no_epsv)
 		curl_easy_setopt(result, CURLOPT_FTP_USE_EPSV, 0);
 
@@ -330,6 +372,26 @@ void http_init(struct remote *remote, const char *url, int proactive_auth)
 
 	curl_global_init(CURL_GLOBAL_ALL);
 
+#ifdef USE_CURL_SHARE
+	/*
+	 * Let every handle we create use the same DNS cache, TLS sessions
+	 * and connections, so that a connection opened by one request is
+	 * reused by the next even if it runs on another slot.
+	 */
+	curlsh = curl_share_init();
+	if (curlsh) {
+		curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x071700
+		curl_share_setopt(curlsh, CURLSHOPT_SHARE,
+				  CURL_LOCK_DATA_SSL_SESSION);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x073900
+		curl_share_setopt(curlsh, CURLSHOPT_SHARE,
+				  CURL_LOCK_DATA_CONNECT);
+#endif
+	}
+#endif
+
 	http_proactive_auth = proactive_auth;
 
 	if (remote && remote->http_proxy)
@@ -350,6 +412,14 @@ void http_init(struct remote *remote, const char *url, int proactive_auth)
 		fprintf(stderr, "Error creating curl multi handle.\n");
 		exit(1);
 	}
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	if (max_host_connections > 0)
+		curl_multi_setopt(curlm, CURLMOPT_MAX_HOST_CONNECTIONS,
+				  max_host_connections);
+#endif
 #endif
 
 	if (getenv("GIT_SSL_NO_VERIFY"))
@@ -421,6 +491,11 @@ void http_cleanup(void)
 
 #ifdef USE_CURL_MULTI
 	curl_multi_cleanup(curlm);
+#endif
+#ifdef USE_CURL_SHARE
+	if (curlsh)
+		curl_share_cleanup(curlsh);
+	curlsh = NULL;
 #endif
 	curl_global_cleanup();
 
@@ -484,6 +559,11 @@ struct active_request_slot *get_active_slot(void)
 		slot->curl = get_curl_handle();
 #else
 		slot->curl = curl_easy_duphandle(curl_default);
+#ifdef USE_CURL_SHARE
+		/* a duplicated handle does not inherit the share */
+		if (curlsh)
+			curl_easy_setopt(slot->curl, CURLOPT_SHARE, curlsh);
+#endif
 #endif
 		curl_session_count++;
 	}
@@ -785,6 +865,8 @@ static int http_request(const char *url, void *result, int target, int options)
 		strbuf_addstr(&buf, " no-cache");
 
 	headers = curl_slist_append(headers, buf.buf);
+	if (options & HTTP_PROTOCOL_V2)
+		headers = curl_slist_append(headers, HTTP_PROTOCOL_V2_HEADER);
 
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, headers);
@@ -839,13 +921,7 @@ int http_get_strbuf(const char *url, struct strbuf *result, int options)
 	return http_request_reauth(url, result, HTTP_REQUEST_STRBUF, options);
 }
 
-/*
- * Downloads a URL and stores the result in the given file.
- *
- * If a previous interrupted download is detected (i.e. a previous temporary
- * file is still around) the download is resumed.
- */
-static int http_get_file(const char *url, const char *filename, int options)
+int http_get_file(const char *url, const char *filename, int options)
 {
 	int ret;
 	struct strbuf tmpfile = STRBUF_INIT;
@@ -42,6 +42,10 @@
 #define NO_CURL_IOCTL
 #endif
 
+#if LIBCURL_VERSION_NUM >= 0x070a03
+#define USE_CURL_SHARE
+#endif
+
 struct slot_results {
 	CURLcode curl_result;
 	long http_code;
@@ -117,6 +121,9 @@ extern char *get_remote_object_url(const char *url, const char *hex,
 
 /* Options for http_request_*() */
 #define HTTP_NO_CACHE		1
+#define HTTP_PROTOCOL_V2	2	/* ask a smart server for protocol v2 */
+
+#define HTTP_PROTOCOL_V2_HEADER "Git-Protocol: version=2"
 
 /* Return values for http_request_*() */
 #define HTTP_OK			0
@@ -133,6 +140,14 @@ extern char *get_remote_object_url(const char *url, const char *hex,
  */
 int http_get_strbuf(const char *url, struct strbuf *result, int options);
 
+/*
+ * Downloads a URL and stores the result in the given file.
+ *
+ * If a previous interrupted download is detected (i.e. a previous temporary
+ * file is still around) the download is resumed.
+ */
+int http_get_file(const char *url, const char *filename, int options);
+
 /*
  * Prints an error message using error() containing url and curl_errorstr,
  * and returns ret.
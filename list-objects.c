@@ -81,8 +81,14 @@ static void process_tree(struct rev_info *revs,
 		die("bad tree object");
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
-	if (parse_tree(tree) < 0)
-		die("bad tree object %s", sha1_to_hex(obj->sha1));
+	if (parse_tree(tree) < 0) {
+		if (!revs->missing_trees_ok)
+			die("bad tree object %s", sha1_to_hex(obj->sha1));
+		/* let the caller see it unparsed */
+		obj->flags |= SEEN;
+		show(obj, path, name, cb_data);
+		return;
+	}
 	obj->flags |= SEEN;
 	show(obj, path, name, cb_data);
 	me.up = path;
@@ -125,6 +131,8 @@ static void process_tree(struct rev_info *revs,
 	strbuf_setlen(base, baselen);
 	free(tree->buffer);
 	tree->buffer = NULL;
+	/* so that a later walk in the same process reads it again */
+	tree->object.parsed = 0;
 }
 
 static void mark_edge_parents_uninteresting(struct commit *commit,
@@ -2,6 +2,7 @@
 #include "refs.h"
 #include "tag.h"
 #include "pack-refs.h"
+#include "ref-table.h"
 
 struct ref_to_prune {
 	struct ref_to_prune *next;
@@ -13,6 +14,7 @@ struct pack_refs_cb_data {
 	unsigned int flags;
 	struct ref_to_prune *ref_to_prune;
 	FILE *refs_file;
+	struct ref_table_writer *table;
 };
 
 static int do_not_prune(int flags)
@@ -27,7 +29,8 @@ static int handle_one_ref(const char *path, const unsigned char *sha1,
 			  int flags, void *cb_data)
 {
 	struct pack_refs_cb_data *cb = cb_data;
-	int is_tag_ref;
+	unsigned char peeled[20];
+	int is_tag_ref, has_peeled = 0;
 
 	/* Do not pack the symbolic refs */
 	if ((flags & REF_ISSYMREF))
@@ -38,16 +41,24 @@ static int handle_one_ref(const char *path, const unsigned char *sha1,
 	if (!(cb->flags & PACK_REFS_ALL) && !is_tag_ref && !(flags & REF_ISPACKED))
 		return 0;
 
-	fprintf(cb->refs_file, "%s %s\n", sha1_to_hex(sha1), path);
 	if (is_tag_ref) {
 		struct object *o = parse_object(sha1);
 		if (o->type == OBJ_TAG) {
 			o = deref_tag(o, path, 0);
-			if (o)
-				fprintf(cb->refs_file, "^%s\n",
-					sha1_to_hex(o->sha1));
+			if (o) {
+				hashcpy(peeled, o->sha1);
+				has_peeled = 1;
+			}
 		}
 	}
+	if (cb->table) {
+		ref_table_write_ref(cb->table, path, sha1,
+				    has_peeled ? peeled : NULL);
+	} else {
+		fprintf(cb->refs_file, "%s %s\n", sha1_to_hex(sha1), path);
+		if (has_peeled)
+			fprintf(cb->refs_file, "^%s\n", sha1_to_hex(peeled));
+	}
 
 	if ((cb->flags & PACK_REFS_PRUNE) && !do_not_prune(flags)) {
 		int namelen = strlen(path) + 1;
@@ -113,6 +124,47 @@ static void prune_refs(struct ref_to_prune *r)
 
 static struct lock_file packed;
 
+static int fill_ref_table(struct ref_table_writer *writer, void *cb_data)
+{
+	struct pack_refs_cb_data *cb = cb_data;
+
+	writer->flags = REF_TABLE_PEELED;
+	cb->table = writer;
+	for_each_ref(handle_one_ref, cb);
+	cb->table = NULL;
+	return 0;
+}
+
+/*
+ * Write all packed refs into a single new ref table; the packed-refs
+ * file, which would be shadowed by it, is removed.
+ */
+static int pack_refs_into_table(struct pack_refs_cb_data *cbdata)
+{
+	char *dir = xstrdup(git_path(REF_TABLES_DIR));
+
+	/*
+	 * Versions of git that do not know about ref tables would not
+	 * see the refs in them; make sure they refuse the repository.
+	 */
+	if (!repository_format_ref_tables &&
+	    git_config_set("extensions.refTables", "true"))
+		die("unable to set extensions.refTables");
+	if (repository_format_version < 1 &&
+	    git_config_set("core.repositoryformatversion", "1"))
+		die("unable to set core.repositoryformatversion");
+
+	hold_lock_file_for_update(&packed, git_path("packed-refs"),
+				  LOCK_DIE_ON_ERROR);
+	if (ref_table_stack_add(dir, fill_ref_table, cbdata, REF_TABLE_REPLACE))
+		die("unable to write ref table");
+	unlink_or_warn(git_path("packed-refs"));
+	rollback_lock_file(&packed);
+	free(dir);
+	prune_refs(cbdata->ref_to_prune);
+	return 0;
+}
+
 int pack_refs(unsigned int flags)
 {
 	int fd;
@@ -121,6 +173,9 @@ int pack_refs(unsigned int flags)
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.flags = flags;
 
+	if (packed_refs_format == PACKED_REFS_TABLE)
+		return pack_refs_into_table(&cbdata);
+
 	fd = hold_lock_file_for_update(&packed, git_path("packed-refs"),
 				       LOCK_DIE_ON_ERROR);
 	cbdata.refs_file = fdopen(fd, "w");
@@ -128,7 +183,7 @@ int pack_refs(unsigned int flags)
 		die_errno("unable to create ref-pack file structure");
 
 	/* perhaps other traits later as well */
-	fprintf(cbdata.refs_file, "# pack-refs with: peeled \n");
+	fprintf(cbdata.refs_file, "# pack-refs with: peeled sorted \n");
 
 	for_each_ref(handle_one_ref, &cbdata);
 	if (ferror(cbdata.refs_file))
@@ -143,6 +198,12 @@ int pack_refs(unsigned int flags)
 	packed.fd = -1;
 	if (commit_lock_file(&packed) < 0)
 		die_errno("unable to overwrite old ref-pack file");
+	/* ref tables would shadow the new packed-refs file */
+	if (!access(git_path("%s/tables.list", REF_TABLES_DIR), F_OK)) {
+		char *dir = xstrdup(git_path(REF_TABLES_DIR));
+		ref_table_stack_clear(dir);
+		free(dir);
+	}
 	prune_refs(cbdata.ref_to_prune);
 	return 0;
 }
@@ -0,0 +1,178 @@
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "run-command.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+static int checkout_workers = 1;
+static unsigned checkout_threshold = 100;
+
+static struct parallel_checkout {
+	int enabled;
+	struct cache_entry **entries;
+	int nr, alloc;
+} pc;
+
+static int parallel_checkout_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "checkout.workers")) {
+		checkout_workers = git_config_int(var, value);
+		if (checkout_workers < 1)
+			checkout_workers = online_cpus();
+		return 0;
+	}
+	if (!strcmp(var, "checkout.thresholdforparallelism")) {
+		checkout_threshold = git_config_ulong(var, value);
+		return 0;
+	}
+	return 0;
+}
+
+void init_parallel_checkout(unsigned nr_updates)
+{
+	git_config(parallel_checkout_config, NULL);
+	pc.enabled = checkout_workers > 1 && nr_updates &&
+		nr_updates >= checkout_threshold;
+	pc.nr = 0;
+}
+
+int enqueue_checkout(struct cache_entry *ce)
+{
+	struct stream_filter *filter;
+
+	if (!pc.enabled || !S_ISREG(ce->ce_mode))
+		return -1;
+
+	/*
+	 * Workers write the blob out as-is; anything that needs to
+	 * be converted is left to the caller.
+	 */
+	filter = get_stream_filter(ce->name, ce->sha1);
+	if (!filter || !is_null_stream_filter(filter)) {
+		if (filter)
+			free_stream_filter(filter);
+		return -1;
+	}
+
+	ALLOC_GROW(pc.entries, pc.nr + 1, pc.alloc);
+	pc.entries[pc.nr++] = ce;
+	return 0;
+}
+
+static int same_directory(const struct cache_entry *a,
+			  const struct cache_entry *b)
+{
+	const char *slash = strrchr(a->name, '/');
+	int len = slash ? slash - a->name : 0;
+
+	return !strncmp(a->name, b->name, len) &&
+		(len ? b->name[len] == '/' : 1) &&
+		!strchr(b->name + len + !!len, '/');
+}
+
+struct checkout_worker {
+	struct child_process cmd;
+	int start, end;
+};
+
+static void send_entries(struct checkout_worker *w)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	for (i = w->start; i < w->end; i++) {
+		struct cache_entry *ce = pc.entries[i];
+		strbuf_addf(&buf, "%s %o %s", sha1_to_hex(ce->sha1),
+			    ce->ce_mode, ce->name);
+		strbuf_addch(&buf, '\0');
+	}
+	if (write_in_full(w->cmd.in, buf.buf, buf.len) < 0)
+		error("unable to send entries to checkout worker: %s",
+		      strerror(errno));
+	close(w->cmd.in);
+	strbuf_release(&buf);
+}
+
+static int collect_results(struct checkout_worker *w,
+			   const struct checkout *state)
+{
+	struct checkout_worker_result res;
+	int i, errs = 0;
+
+	for (i = w->start; i < w->end; i++) {
+		struct cache_entry *ce = pc.entries[i];
+		if (read_in_full(w->cmd.out, &res, sizeof(res)) != sizeof(res)) {
+			error("checkout worker died before writing %s",
+			      ce->name);
+			errs += w->end - i;
+			break;
+		}
+		if (res.status) {
+			errs++;
+			continue;
+		}
+		if (state->refresh_cache)
+			fill_stat_cache_info(ce, &res.st);
+	}
+	close(w->cmd.out);
+	if (finish_command(&w->cmd) && !errs)
+		errs++;
+	return errs;
+}
+
+int run_parallel_checkout(const struct checkout *state)
+{
+	struct checkout_worker *workers;
+	struct strbuf git_dir_env = STRBUF_INIT;
+	const char *argv[] = { "checkout--worker", NULL };
+	const char *env[] = { NULL, "GIT_WORK_TREE=.", NULL };
+	int nr_workers, i, start, errs = 0;
+
+	pc.enabled = 0;
+	if (!pc.nr)
+		return 0;
+
+	nr_workers = checkout_workers < pc.nr ? checkout_workers : pc.nr;
+	workers = xcalloc(nr_workers, sizeof(*workers));
+	strbuf_addf(&git_dir_env, "%s=%s", GIT_DIR_ENVIRONMENT,
+		    absolute_path(get_git_dir()));
+	env[0] = git_dir_env.buf;
+
+	/*
+	 * Give each worker a contiguous slice of the (sorted) queue,
+	 * extended so that a directory is never split between two of
+	 * them.
+	 */
+	for (i = start = 0; i < nr_workers && start < pc.nr; i++) {
+		struct checkout_worker *w = &workers[i];
+		int end = start + (pc.nr - start) / (nr_workers - i);
+
+		if (end <= start)
+			end = start + 1;
+		while (end < pc.nr &&
+		       same_directory(pc.entries[end - 1], pc.entries[end]))
+			end++;
+		w->start = start;
+		w->end = end;
+		start = end;
+
+		w->cmd.argv = argv;
+		w->cmd.env = env;
+		w->cmd.git_cmd = 1;
+		w->cmd.in = -1;
+		w->cmd.out = -1;
+		if (start_command(&w->cmd))
+			die("unable to start checkout worker");
+	}
+	nr_workers = i;
+
+	for (i = 0; i < nr_workers; i++)
+		send_entries(&workers[i]);
+	for (i = 0; i < nr_workers; i++)
+		errs += collect_results(&workers[i], state);
+
+	free(workers);
+	strbuf_release(&git_dir_env);
+	pc.nr = 0;
+	return errs;
+}
@@ -0,0 +1,38 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+/*
+ * Parallel checkout: regular files that are written out to the
+ * working tree without any conversion are handed to a pool of
+ * "git checkout--worker" processes, each of which reads, inflates
+ * and writes its share of the blobs, and reports the stat data of
+ * the files it created back to us.
+ */
+
+/*
+ * Called before checking out "nr_updates" entries.  Enables parallel
+ * checkout if checkout.workers asks for it and there is enough work.
+ */
+extern void init_parallel_checkout(unsigned nr_updates);
+
+/*
+ * Queue "ce" to be written by a worker.  The leading directories of
+ * the path must already exist.  Returns 0 if queued, or -1 if the
+ * caller has to write the entry itself.
+ */
+extern int enqueue_checkout(struct cache_entry *ce);
+
+/*
+ * Write all queued entries and update their stat data in the index
+ * if "state" asks for it.  Returns the number of entries that could
+ * not be written.
+ */
+extern int run_parallel_checkout(const struct checkout *state);
+
+/* What a worker reports back for each entry, in the order they were sent. */
+struct checkout_worker_result {
+	int status;
+	struct stat st;
+};
+
+#endif /* PARALLEL_CHECKOUT_H */
@@ -4,99 +4,147 @@
 #include "cache.h"
 
 #ifdef NO_PTHREADS
-static void preload_index(struct index_state *index, const char **pathspec)
+void preload_index(struct index_state *index, const char **pathspec)
 {
 	; /* nothing */
 }
 #else
 
 #include <pthread.h>
+#include "thread-utils.h"
 
 /*
  * Mostly randomly chosen maximum thread counts: we
  * cap the parallelism to 20 threads, and we want
  * to have at least 500 lstat's per thread for it to
- * be worth starting a thread.
+ * be worth starting a thread.  Threads pull work in
+ * chunks of PRELOAD_CHUNK entries, so that a thread
+ * that got a cheap stretch of the index (e.g. all in
+ * a hot directory) keeps helping the others instead
+ * of sitting idle.
  */
 #define MAX_PARALLEL (20)
 #define THREAD_COST (500)
+#define PRELOAD_CHUNK (128)
 
-struct thread_data {
-	pthread_t pthread;
+struct preload_queue {
+	pthread_mutex_t mutex;
 	struct index_state *index;
-	const char **pathspec;
-	int offset, nr;
+	struct cache_entry **todo;
+	int nr, next;
 };
 
-static void *preload_thread(void *_data)
+static int preload_next_chunk(struct preload_queue *q, int *begin)
 {
 	int nr;
-	struct thread_data *p = _data;
-	struct index_state *index = p->index;
-	struct cache_entry **cep = index->cache + p->offset;
+
+	pthread_mutex_lock(&q->mutex);
+	*begin = q->next;
+	nr = q->nr - q->next;
+	if (nr > PRELOAD_CHUNK)
+		nr = PRELOAD_CHUNK;
+	q->next += nr;
+	pthread_mutex_unlock(&q->mutex);
+	return nr;
+}
+
+static void *preload_thread(void *_data)
+{
+	struct preload_queue *q = _data;
 	struct cache_def cache;
-	struct pathspec pathspec;
+	int begin, nr;
 
-	init_pathspec(&pathspec, p->pathspec);
 	memset(&cache, 0, sizeof(cache));
-	nr = p->nr;
-	if (nr + p->offset > index->cache_nr)
-		nr = index->cache_nr - p->offset;
+	while ((nr = preload_next_chunk(q, &begin)) > 0) {
+		struct cache_entry **cep = q->todo + begin;
+
+		while (nr--) {
+			struct cache_entry *ce = *cep++;
+			struct stat st;
 
-	do {
-		struct cache_entry *ce = *cep++;
-		struct stat st;
+			if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
+				continue;
+			if (lstat(ce->name, &st))
+				continue;
+			if (ie_match_stat(q->index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
+				continue;
+			ce_mark_uptodate(ce);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Collect the entries that actually need an lstat(), so that the
+ * thread count is decided by the real amount of work and not by the
+ * size of the index (a narrow pathspec in a huge index should not
+ * spin up any threads at all).
+ */
+static int collect_preload_entries(struct index_state *index,
+				   const char **pathspec,
+				   struct cache_entry **todo)
+{
+	struct pathspec ps;
+	int i, nr = 0;
+
+	init_pathspec(&ps, pathspec);
+	for (i = 0; i < index->cache_nr; i++) {
+		struct cache_entry *ce = index->cache[i];
 
 		if (ce_stage(ce))
 			continue;
 		if (S_ISGITLINK(ce->ce_mode))
 			continue;
-		if (ce_uptodate(ce))
-			continue;
-		if (!ce_path_match(ce, &pathspec))
+		if (ce_uptodate(ce) || ce_skip_worktree(ce))
 			continue;
-		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
+		if (ce->ce_flags & CE_FSMONITOR_VALID) {
+			ce_mark_uptodate(ce);
 			continue;
-		if (lstat(ce->name, &st))
+		}
+		if (!ce_path_match(ce, &ps))
 			continue;
-		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
-			continue;
-		ce_mark_uptodate(ce);
-	} while (--nr > 0);
-	free_pathspec(&pathspec);
-	return NULL;
+		todo[nr++] = ce;
+	}
+	free_pathspec(&ps);
+	return nr;
 }
 
-static void preload_index(struct index_state *index, const char **pathspec)
+void preload_index(struct index_state *index, const char **pathspec)
 {
-	int threads, i, work, offset;
-	struct thread_data data[MAX_PARALLEL];
+	int threads, i, nr;
+	pthread_t pthread[MAX_PARALLEL];
+	struct preload_queue q;
 
 	if (!core_preload_index)
 		return;
-
-	threads = index->cache_nr / THREAD_COST;
-	if (threads < 2)
+	if (index->cache_nr < 2 * THREAD_COST)
 		return;
+
+	q.todo = xmalloc(index->cache_nr * sizeof(*q.todo));
+	nr = collect_preload_entries(index, pathspec, q.todo);
+
+	threads = nr / THREAD_COST;
+	if (threads > online_cpus())
+		threads = online_cpus();
 	if (threads > MAX_PARALLEL)
 		threads = MAX_PARALLEL;
-	offset = 0;
-	work = DIV_ROUND_UP(index->cache_nr, threads);
-	for (i = 0; i < threads; i++) {
-		struct thread_data *p = data+i;
-		p->index = index;
-		p->pathspec = pathspec;
-		p->offset = offset;
-		p->nr = work;
-		offset += work;
-		if (pthread_create(&p->pthread, NULL, preload_thread, p))
-			die("unable to create threaded lstat");
+	if (threads < 2) {
+		free(q.todo);
+		return;
 	}
-	for (i = 0; i < threads; i++) {
-		struct thread_data *p = data+i;
-		if (pthread_join(p->pthread, NULL))
+
+	pthread_mutex_init(&q.mutex, NULL);
+	q.index = index;
+	q.nr = nr;
+	q.next = 0;
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&pthread[i], NULL, preload_thread, &q))
+			die("unable to create threaded lstat");
+	for (i = 0; i < threads; i++)
+		if (pthread_join(pthread[i], NULL))
 			die("unable to join threaded lstat");
-	}
+	pthread_mutex_destroy(&q.mutex);
+	free(q.todo);
 }
 #endif
 
@@ -14,6 +14,10 @@
 #include "resolve-undo.h"
 #include "strbuf.h"
 #include "varint.h"
+#include "split-index.h"
+#include "fsmonitor.h"
+#include "thread-utils.h"
+#include "sparse-index.h"
 
 static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int really);
 
@@ -29,6 +33,41 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int reall
 #define CACHE_EXT(s) ( (s[0]<<24)|(s[1]<<16)|(s[2]<<8)|(s[3]) )
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
+#define CACHE_EXT_LINK 0x6c696e6b	/* "link" */
+#define CACHE_EXT_UNTRACKED 0x554E5452	/* "UNTR" */
+#define CACHE_EXT_FSMONITOR 0x46534D4E	/* "FSMN" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
+#define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54	/* "IEOT" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972	/* "sdir" */
+
+/* EOIE: 4-byte offset plus the SHA-1 over the extension headers */
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
+
+/*
+ * Below this many entries per thread, loading the index in parallel
+ * costs more than it saves.
+ */
+#define THREAD_COST (10000)
+
+#define IEOT_VERSION (1)
+
+struct index_entry_offset {
+	/* offset of the first entry of the block, from the start of the file */
+	uint32_t offset;
+	/* number of entries in the block */
+	uint32_t nr;
+	/*
+	 * what the first entry strips from the previous name, which is
+	 * not known when the block is loaded on its own (v4 only)
+	 */
+	size_t strip;
+};
+
+struct index_entry_offset_table {
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
 
 struct index_state the_index;
 
@@ -265,6 +304,9 @@ int ie_match_stat(const struct index_state *istate,
 		return 0;
 	if (!ignore_valid && (ce->ce_flags & CE_VALID))
 		return 0;
+	/* so is an entry the file system monitor has seen no change to */
+	if (!ignore_valid && (ce->ce_flags & CE_FSMONITOR_VALID))
+		return 0;
 
 	/*
 	 * Intent-to-add entries have not been added, so the index entry
@@ -449,6 +491,7 @@ int remove_index_entry_at(struct index_state *istate, int pos)
 
 	record_resolve_undo(istate, ce);
 	remove_name_hash(ce);
+	untracked_cache_invalidate_path(istate, ce->name);
 	istate->cache_changed = 1;
 	istate->cache_nr--;
 	if (pos >= istate->cache_nr)
@@ -470,9 +513,11 @@ void remove_marked_cache_entries(struct index_state *istate)
 	unsigned int i, j;
 
 	for (i = j = 0; i < istate->cache_nr; i++) {
-		if (ce_array[i]->ce_flags & CE_REMOVE)
+		if (ce_array[i]->ce_flags & CE_REMOVE) {
 			remove_name_hash(ce_array[i]);
-		else
+			untracked_cache_invalidate_path(istate,
+							ce_array[i]->name);
+		} else
 			ce_array[j++] = ce_array[i];
 	}
 	istate->cache_changed = 1;
@@ -909,6 +954,9 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 	int skip_df_check = option & ADD_CACHE_SKIP_DFCHECK;
 	int new_only = option & ADD_CACHE_NEW_ONLY;
 
+	if (index_path_in_sparse_dir(istate, ce->name, ce_namelen(ce)))
+		ensure_full_index(istate);
+
 	cache_tree_invalidate_path(istate->cache_tree, ce->name);
 	pos = index_name_pos(istate, ce->name, ce->ce_flags);
 
@@ -945,6 +993,7 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 		pos = index_name_pos(istate, ce->name, ce->ce_flags);
 		pos = -pos-1;
 	}
+	untracked_cache_invalidate_path(istate, ce->name);
 	return pos + 1;
 }
 
@@ -1018,6 +1067,10 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		ce_mark_uptodate(ce);
 		return ce;
 	}
+	if (!ignore_valid && (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
 
 	if (lstat(ce->name, &st) < 0) {
 		if (err)
@@ -1045,8 +1098,10 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 * because CE_UPTODATE flag is in-core only;
 			 * we are not going to write this change out.
 			 */
-			if (!S_ISGITLINK(ce->ce_mode))
+			if (!S_ISGITLINK(ce->ce_mode)) {
 				ce_mark_uptodate(ce);
+				mark_fsmonitor_valid(istate, ce);
+			}
 			return ce;
 		}
 	}
@@ -1070,6 +1125,8 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	if (!ignore_valid && assume_unchanged &&
 	    !(ce->ce_flags & CE_VALID))
 		updated->ce_flags &= ~CE_VALID;
+	if (core_fsmonitor && !S_ISGITLINK(ce->ce_mode))
+		updated->ce_flags |= CE_FSMONITOR_VALID;
 
 	return updated;
 }
@@ -1145,6 +1202,7 @@ int refresh_index(struct index_state *istate, unsigned int flags, const char **p
 		if (!new) {
 			const char *fmt;
 
+			mark_fsmonitor_invalid(istate, ce);
 			if (not_new && cache_errno == ENOENT)
 				continue;
 			if (really && cache_errno == EINVAL) {
@@ -1267,6 +1325,25 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_RESOLVE_UNDO:
 		istate->resolve_undo = resolve_undo_read(data, sz);
 		break;
+	case CACHE_EXT_LINK:
+		if (read_link_extension(istate, data, sz))
+			return -1;
+		break;
+	case CACHE_EXT_FSMONITOR:
+		if (read_fsmonitor_extension(istate, data, sz))
+			return -1;
+		break;
+	case CACHE_EXT_UNTRACKED:
+		/* a broken cache is simply rebuilt */
+		istate->untracked = read_untracked_extension(data, sz);
+		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		istate->sparse_index = 1;
+		break;
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
+		/* already used by read_index_from(), if at all */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1332,15 +1409,23 @@ static struct cache_entry *cache_entry_from_ondisk(struct ondisk_cache_entry *on
  * on-disk format of the index, each on-disk cache entry stores the
  * number of bytes to be stripped from the end of the previous name,
  * and the bytes to append to the result, to come up with its name.
+ *
+ * When a block of entries is decoded on its own, the previous name of
+ * its first entry is not known; name is empty then, and the number of
+ * bytes to strip is stored in *unknown_strip for the caller to check.
  */
-static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
+static unsigned long expand_name_field(struct strbuf *name, const char *cp_,
+				       size_t *unknown_strip)
 {
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
-	if (name->len < len)
+	if (unknown_strip)
+		*unknown_strip = len;
+	else if (name->len < len)
 		die("malformed name field in the index");
-	strbuf_remove(name, name->len - len, len);
+	else
+		strbuf_remove(name, name->len - len, len);
 	for (ep = cp; *ep; ep++)
 		; /* find the end */
 	strbuf_add(name, cp, ep - cp);
@@ -1349,7 +1434,8 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 
 static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 					    unsigned long *ent_size,
-					    struct strbuf *previous_name)
+					    struct strbuf *previous_name,
+					    size_t *unknown_strip)
 {
 	struct cache_entry *ce;
 	size_t len;
@@ -1383,7 +1469,7 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 		*ent_size = ondisk_ce_size(ce);
 	} else {
 		unsigned long consumed;
-		consumed = expand_name_field(previous_name, name);
+		consumed = expand_name_field(previous_name, name, unknown_strip);
 		ce = cache_entry_from_ondisk(ondisk, flags,
 					     previous_name->buf,
 					     previous_name->len);
@@ -1393,16 +1479,336 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 	return ce;
 }
 
+/*
+ * The index.* settings are looked up lazily, as the index may well be
+ * read before the configuration is.  For index.threads, 0 means "as
+ * many as there are CPUs", 1 disables threaded loading.
+ */
+static int index_config_read;
+static int index_threads;
+static int index_sparse;
+
+static int index_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "index.sparse")) {
+		index_sparse = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "index.threads")) {
+		int is_bool;
+
+		index_threads = git_config_bool_or_int(var, value, &is_bool);
+		if (is_bool)
+			index_threads = index_threads ? 0 : 1;
+		else if (index_threads < 0)
+			die("invalid number of threads specified (%d) for %s",
+			    index_threads, var);
+	}
+	return 0;
+}
+
+static void read_index_config(void)
+{
+	if (!index_config_read) {
+		index_config_read = 1;
+		git_config(index_config, NULL);
+	}
+}
+
+static int index_thread_count(void)
+{
+#ifdef NO_PTHREADS
+	return 1;
+#else
+	read_index_config();
+	return index_threads;
+#endif
+}
+
+static int want_sparse_index(void)
+{
+	read_index_config();
+	return index_sparse && core_apply_sparse_checkout;
+}
+
+/*
+ * Load nr entries from src_offset on.  first_strip is where to store
+ * what the first entry strips from a previous name we do not know,
+ * or NULL if previous_name holds it.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long src_offset,
+					    int first, int nr,
+					    struct strbuf *previous_name,
+					    size_t *first_strip)
+{
+	int i;
+
+	for (i = first; i < first + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + src_offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name,
+				      i == first ? first_strip : NULL);
+		set_index_entry(istate, i, ce);
+
+		src_offset += consumed;
+	}
+	return src_offset;
+}
+
+static int read_index_extensions(struct index_state *istate,
+				 const char *mmap, size_t mmap_size,
+				 unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(istate,
+					 mmap + src_offset,
+					 (char *) mmap + src_offset + 8,
+					 extsize) < 0)
+			return -1;
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return 0;
+}
+
+#ifndef NO_PTHREADS
+/*
+ * Find where the extensions start from the EOIE extension, which
+ * must be the very last one.  Returns 0 if there is none, or if it
+ * does not describe the extensions that are actually there.
+ */
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *eoie;
+	uint32_t extsize, offset;
+	unsigned long src_offset, eoie_offset;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+	eoie_offset = mmap_size - 20 - EOIE_SIZE_WITH_HEADER;
+	eoie = mmap + eoie_offset;
+	if (CACHE_EXT(eoie) != CACHE_EXT_ENDOFINDEXENTRIES)
+		return 0;
+	memcpy(&extsize, eoie + 4, 4);
+	if (ntohl(extsize) != EOIE_SIZE)
+		return 0;
+	memcpy(&offset, eoie + 8, 4);
+	offset = ntohl(offset);
+	if (offset < sizeof(struct cache_header) || eoie_offset < offset)
+		return 0;
+
+	/* the extension headers must add up to exactly what was recorded */
+	git_SHA1_Init(&c);
+	src_offset = offset;
+	while (src_offset + 8 <= eoie_offset) {
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		src_offset += 8;
+		src_offset += ntohl(extsize);
+	}
+	if (src_offset != eoie_offset)
+		return 0;
+	git_SHA1_Final(sha1, &c);
+	if (hashcmp(sha1, (const unsigned char *)eoie + 12))
+		return 0;
+	return offset;
+}
+
+static struct index_entry_offset_table *read_ieot_extension(const char *mmap,
+							     size_t mmap_size,
+							     unsigned long offset)
+{
+	struct index_entry_offset_table *ieot;
+	const char *data = NULL;
+	uint32_t extsize = 0, version;
+	int i, nr;
+
+	while (offset <= mmap_size - 20 - 8) {
+		memcpy(&extsize, mmap + offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (CACHE_EXT((mmap + offset)) == CACHE_EXT_INDEXENTRYOFFSETTABLE) {
+			data = mmap + offset + 8;
+			break;
+		}
+		offset += 8;
+		offset += extsize;
+	}
+	if (!data || extsize < 4 || (extsize - 4) % 8)
+		return NULL;
+	memcpy(&version, data, 4);
+	if (ntohl(version) != IEOT_VERSION) {
+		error("invalid IEOT version %d", ntohl(version));
+		return NULL;
+	}
+	data += 4;
+
+	nr = (extsize - 4) / 8;
+	ieot = xmalloc(sizeof(*ieot) + nr * sizeof(struct index_entry_offset));
+	ieot->nr = nr;
+	for (i = 0; i < nr; i++) {
+		memcpy(&ieot->entries[i].offset, data, 4);
+		memcpy(&ieot->entries[i].nr, data + 4, 4);
+		ieot->entries[i].offset = ntohl(ieot->entries[i].offset);
+		ieot->entries[i].nr = ntohl(ieot->entries[i].nr);
+		data += 8;
+	}
+	return ieot;
+}
+
+/* Do the blocks cover exactly the entries, and nothing else? */
+static int ieot_is_sane(struct index_state *istate,
+			struct index_entry_offset_table *ieot,
+			unsigned long extension_offset)
+{
+	unsigned long total = 0, prev = 0;
+	int i;
+
+	for (i = 0; i < ieot->nr; i++) {
+		struct index_entry_offset *block = &ieot->entries[i];
+
+		if (block->offset < sizeof(struct cache_header) ||
+		    block->offset <= prev ||
+		    extension_offset <= block->offset ||
+		    !block->nr)
+			return 0;
+		prev = block->offset;
+		total += block->nr;
+	}
+	return total == istate->cache_nr;
+}
+
+struct load_index_extensions {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long src_offset;
+	int ret;
+};
+
+static void *load_index_extensions_thread(void *_data)
+{
+	struct load_index_extensions *p = _data;
+
+	p->ret = read_index_extensions(p->istate, p->mmap, p->mmap_size,
+				       p->src_offset);
+	return NULL;
+}
+
+struct load_cache_entries_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int ieot_start;		/* first block to load */
+	int ieot_blocks;	/* and how many of them */
+	int first;		/* position of the first entry */
+};
+
+static void *load_cache_entries_thread(void *_data)
+{
+	struct load_cache_entries_thread_data *p = _data;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int i, first = p->first;
+
+	previous_name = (p->istate->version == 4) ? &previous_name_buf : NULL;
+	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
+		struct index_entry_offset *block = &p->ieot->entries[i];
+
+		/* name compression starts afresh in each block */
+		strbuf_setlen(&previous_name_buf, 0);
+		load_cache_entry_block(p->istate, p->mmap, block->offset,
+				       first, block->nr, previous_name,
+				       &block->strip);
+		first += block->nr;
+	}
+	strbuf_release(&previous_name_buf);
+	return NULL;
+}
+
+static void load_cache_entries_threaded(struct index_state *istate,
+					const char *mmap,
+					struct index_entry_offset_table *ieot,
+					int nr_threads)
+{
+	struct load_cache_entries_thread_data *data;
+	int i, ieot_start = 0, ieot_blocks, first = 0;
+
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	ieot_blocks = DIV_ROUND_UP(ieot->nr, nr_threads);
+	data = xcalloc(nr_threads, sizeof(*data));
+
+	for (i = 0; i < nr_threads && ieot_start < ieot->nr; i++) {
+		struct load_cache_entries_thread_data *p = &data[i];
+		int j;
+
+		if (ieot_start + ieot_blocks > ieot->nr)
+			ieot_blocks = ieot->nr - ieot_start;
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->ieot_start = ieot_start;
+		p->ieot_blocks = ieot_blocks;
+		p->first = first;
+		for (j = ieot_start; j < ieot_start + ieot_blocks; j++)
+			first += ieot->entries[j].nr;
+		ieot_start += ieot_blocks;
+
+		if (pthread_create(&p->pthread, NULL,
+				   load_cache_entries_thread, p))
+			die("unable to create load_cache_entries thread");
+	}
+	nr_threads = i;
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join load_cache_entries thread");
+	free(data);
+
+	/* now that all names are known, check what each block stripped */
+	if (istate->version != 4)
+		return;
+	for (i = first = 0; i < ieot->nr; i++) {
+		size_t previous_len = first ? ce_namelen(istate->cache[first - 1]) : 0;
+		if (ieot->entries[i].strip != previous_len)
+			die("malformed name field in the index");
+		first += ieot->entries[i].nr;
+	}
+}
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int read_index_from(struct index_state *istate, const char *path)
 {
-	int fd, i;
+	int fd;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+#ifndef NO_PTHREADS
+	int nr_threads;
+	struct load_index_extensions ext;
+	struct index_entry_offset_table *ieot = NULL;
+	unsigned long extension_offset = 0;
+#endif
 
 	errno = EBUSY;
 	if (istate->initialized)
@@ -1435,6 +1841,7 @@ int read_index_from(struct index_state *istate, const char *path)
 	if (verify_hdr(hdr, mmap_size) < 0)
 		goto unmap;
 
+	hashcpy(istate->sha1, (unsigned char *)hdr + mmap_size - 20);
 	istate->version = ntohl(hdr->hdr_version);
 	istate->cache_nr = ntohl(hdr->hdr_entries);
 	istate->cache_alloc = alloc_nr(istate->cache_nr);
@@ -1447,40 +1854,65 @@ int read_index_from(struct index_state *istate, const char *path)
 		previous_name = NULL;
 
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
 
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
+#ifndef NO_PTHREADS
+	nr_threads = index_thread_count();
+	if (!nr_threads)
+		nr_threads = online_cpus();
 
-		src_offset += consumed;
+	/*
+	 * With an EOIE extension we know where the extensions are
+	 * without going through the entries, and can load both at
+	 * the same time; an IEOT extension further lets us split
+	 * the entries between threads.
+	 */
+	if (nr_threads > 1)
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+	if (extension_offset) {
+		ext.istate = istate;
+		ext.mmap = mmap;
+		ext.mmap_size = mmap_size;
+		ext.src_offset = extension_offset;
+		if (pthread_create(&ext.pthread, NULL,
+				   load_index_extensions_thread, &ext))
+			die("unable to create load_index_extensions thread");
+		nr_threads--;
+
+		ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
+		if (ieot && !ieot_is_sane(istate, ieot, extension_offset)) {
+			free(ieot);
+			ieot = NULL;
+		}
 	}
+	if (ieot && nr_threads > 1) {
+		load_cache_entries_threaded(istate, mmap, ieot, nr_threads);
+		src_offset = extension_offset;
+	} else
+#endif
+		src_offset = load_cache_entry_block(istate, mmap, src_offset,
+						    0, istate->cache_nr,
+						    previous_name, NULL);
 	strbuf_release(&previous_name_buf);
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
+#ifndef NO_PTHREADS
+	free(ieot);
+	if (extension_offset) {
+		if (pthread_join(ext.pthread, NULL))
+			die("unable to join load_index_extensions thread");
+		if (ext.ret)
 			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
-	}
+	} else
+#endif
+	if (read_index_extensions(istate, mmap, mmap_size, src_offset) < 0)
+		goto unmap;
 	munmap(mmap, mmap_size);
+	if (istate->split_index)
+		merge_base_index(istate);
+	tweak_fsmonitor(istate);
+	if (istate->sparse_index && command_requires_full_index)
+		ensure_full_index(istate);
 	return istate->cache_nr;
 
 unmap:
@@ -1508,6 +1940,14 @@ int discard_index(struct index_state *istate)
 	istate->name_hash_initialized = 0;
 	free_hash(&istate->name_hash);
 	cache_tree_free(&(istate->cache_tree));
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->fsmonitor_dirty_nr = istate->fsmonitor_dirty_alloc = 0;
+	istate->fsmonitor_has_extension = 0;
+	discard_split_index(istate);
+	istate->sparse_index = 0;
 	istate->initialized = 0;
 
 	/* no need to throw away allocated active_cache */
@@ -1562,16 +2002,21 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
+static int write_index_ext_header(git_SHA_CTX *context,
+				  git_SHA_CTX *eoie_context, int fd,
 				  unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
 
-static int ce_flush(git_SHA_CTX *context, int fd)
+static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 {
 	unsigned int left = write_buffer_len;
 
@@ -1589,6 +2034,7 @@ static int ce_flush(git_SHA_CTX *context, int fd)
 
 	/* Append the SHA1 signature at the end */
 	git_SHA1_Final(write_buffer + left, context);
+	hashcpy(sha1, write_buffer + left);
 	left += 20;
 	return (write_in_full(fd, write_buffer, left) != left) ? -1 : 0;
 }
@@ -1739,15 +2185,61 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
-int write_index(struct index_state *istate, int newfd)
+static void write_ieot_extension(struct strbuf *sb,
+				 struct index_entry_offset_table *ieot)
 {
-	git_SHA_CTX c;
+	uint32_t buffer;
+	int i;
+
+	buffer = htonl(IEOT_VERSION);
+	strbuf_add(sb, &buffer, 4);
+	for (i = 0; i < ieot->nr; i++) {
+		buffer = htonl(ieot->entries[i].offset);
+		strbuf_add(sb, &buffer, 4);
+		buffer = htonl(ieot->entries[i].nr);
+		strbuf_add(sb, &buffer, 4);
+	}
+}
+
+static int write_eoie_extension(git_SHA_CTX *c, git_SHA_CTX *eoie_c,
+				int fd, unsigned long offset)
+{
+	uint32_t buffer;
+	unsigned char sha1[20];
+
+	git_SHA1_Final(sha1, eoie_c);
+	buffer = htonl(offset);
+	return write_index_ext_header(c, NULL, fd, CACHE_EXT_ENDOFINDEXENTRIES,
+				      EOIE_SIZE) < 0
+		|| ce_write(c, fd, &buffer, 4) < 0
+		|| ce_write(c, fd, sha1, 20) < 0;
+}
+
+/* Where the next byte given to ce_write() will end up in the file */
+static off_t ce_write_offset(int fd)
+{
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+
+	return offset < 0 ? offset : offset + write_buffer_len;
+}
+
+/* Flags for do_write_index() */
+#define WRITE_SHARED_INDEX	01	/* no extensions, keep timestamp */
+#define WRITE_SPLIT_INDEX	02	/* with a "link" extension */
+
+static int do_write_index(struct index_state *istate, int newfd,
+			  struct cache_entry **cache, int entries,
+			  unsigned flags)
+{
+	git_SHA_CTX c, eoie_c;
 	struct cache_header hdr;
 	int i, err, removed, extended, hdr_version;
-	struct cache_entry **cache = istate->cache;
-	int entries = istate->cache_nr;
+	int nr_threads, ieot_blocks = 1, ieot_work = 0, block_nr = 0;
 	struct stat st;
+	unsigned char sha1[20];
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	struct index_entry_offset_table *ieot = NULL;
+	off_t offset = 0, entries_end;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -1765,18 +2257,43 @@ int write_index(struct index_state *istate, int newfd)
 		istate->version = INDEX_FORMAT_DEFAULT;
 
 	/* demote version 3 to version 2 when the latter suffices */
-	if (istate->version == 3 || istate->version == 2)
-		istate->version = extended ? 3 : 2;
-
 	hdr_version = istate->version;
+	if (hdr_version == 3 || hdr_version == 2)
+		hdr_version = extended ? 3 : 2;
+	if (!(flags & WRITE_SHARED_INDEX))
+		istate->version = hdr_version;
 
 	hdr.hdr_signature = htonl(CACHE_SIGNATURE);
 	hdr.hdr_version = htonl(hdr_version);
 	hdr.hdr_entries = htonl(entries - removed);
 
+	/*
+	 * Cut the entries in blocks that can be loaded in parallel,
+	 * if the index is large enough for that to pay off (or if
+	 * the user asked for a specific number of threads).
+	 */
+	nr_threads = index_thread_count();
+	if (nr_threads != 1) {
+		if (!nr_threads) {
+			ieot_blocks = (entries - removed) / THREAD_COST;
+			if (ieot_blocks > online_cpus())
+				ieot_blocks = online_cpus();
+		} else {
+			ieot_blocks = nr_threads;
+		}
+		if (ieot_blocks > entries - removed)
+			ieot_blocks = entries - removed;
+	}
+	if (ieot_blocks > 1) {
+		ieot = xcalloc(1, sizeof(*ieot) +
+			       ieot_blocks * sizeof(struct index_entry_offset));
+		ieot_work = DIV_ROUND_UP(entries - removed, ieot_blocks);
+	}
+
 	git_SHA1_Init(&c);
+	git_SHA1_Init(&eoie_c);
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
-		return -1;
+		goto fail;
 
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 	for (i = 0; i < entries; i++) {
@@ -1785,17 +2302,82 @@ int write_index(struct index_state *istate, int newfd)
 			continue;
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
+		if (ieot && block_nr == ieot_work) {
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->entries[ieot->nr].nr = block_nr;
+			ieot->nr++;
+			block_nr = 0;
+		}
+		if (ieot && !block_nr) {
+			offset = ce_write_offset(newfd);
+			if (offset < 0)
+				goto fail;
+			/*
+			 * Make sure nothing is shared with the previous
+			 * name, so that the block can be decoded on its
+			 * own, while older readers still decode it right.
+			 */
+			if (previous_name && previous_name->len)
+				previous_name->buf[0] = '\0';
+		}
 		if (ce_write_entry(&c, newfd, ce, previous_name) < 0)
-			return -1;
+			goto fail;
+		block_nr++;
 	}
 	strbuf_release(&previous_name_buf);
 
+	entries_end = ce_write_offset(newfd);
+	if (entries_end < 0 || (uint32_t)entries_end != entries_end)
+		goto fail;
+
 	/* Write extension data here */
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+
+		if (block_nr) {
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->entries[ieot->nr].nr = block_nr;
+			ieot->nr++;
+		}
+		write_ieot_extension(&sb, ieot);
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_INDEXENTRYOFFSETTABLE,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		free(ieot);
+		ieot = NULL;
+		if (err)
+			return -1;
+	}
+
+	if (flags & WRITE_SHARED_INDEX) {
+		if (ieot_blocks > 1 &&
+		    write_eoie_extension(&c, &eoie_c, newfd, entries_end))
+			return -1;
+		if (ce_flush(&c, newfd, sha1))
+			return -1;
+		replace_base_index(istate, sha1);
+		return 0;
+	}
+
+	if (flags & WRITE_SPLIT_INDEX) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_link_extension(&sb, istate);
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_LINK,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
 	if (istate->cache_tree) {
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_TREE,
+					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -1805,7 +2387,35 @@ int write_index(struct index_state *istate, int newfd)
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (core_fsmonitor) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_FSMONITOR,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (istate->sparse_index) {
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0;
+		if (err)
+			return -1;
+	}
+	if (istate->untracked && core_untracked_cache) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_untracked_extension(&sb, istate->untracked);
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_UNTRACKED,
 					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -1813,11 +2423,154 @@ int write_index(struct index_state *istate, int newfd)
 			return -1;
 	}
 
-	if (ce_flush(&c, newfd) || fstat(newfd, &st))
+	/* the EOIE extension must come last */
+	if (ieot_blocks > 1 &&
+	    write_eoie_extension(&c, &eoie_c, newfd, entries_end))
+		return -1;
+
+	if (ce_flush(&c, newfd, istate->sha1) || fstat(newfd, &st))
 		return -1;
 	istate->timestamp.sec = (unsigned int)st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 	return 0;
+
+fail:
+	free(ieot);
+	strbuf_release(&previous_name_buf);
+	return -1;
+}
+
+static int write_shared_index(struct index_state *istate)
+{
+	struct strbuf tmp = STRBUF_INIT;
+	const char *path;
+	int fd;
+
+	strbuf_addstr(&tmp, git_path("sharedindex_XXXXXX"));
+	fd = git_mkstemp_mode(tmp.buf, 0666);
+	if (fd < 0) {
+		strbuf_release(&tmp);
+		return error("unable to create a shared index: %s",
+			     strerror(errno));
+	}
+	if (do_write_index(istate, fd, istate->cache, istate->cache_nr,
+			   WRITE_SHARED_INDEX) || close(fd)) {
+		unlink_or_warn(tmp.buf);
+		strbuf_release(&tmp);
+		return error("unable to write shared index");
+	}
+	path = git_path("sharedindex.%s",
+			sha1_to_hex(istate->split_index->base_sha1));
+	if (adjust_shared_perm(tmp.buf) || rename(tmp.buf, path)) {
+		unlink_or_warn(tmp.buf);
+		strbuf_release(&tmp);
+		return error("unable to rename shared index into place");
+	}
+	strbuf_release(&tmp);
+	return 0;
+}
+
+/*
+ * Shared indexes that no index file has been written against for
+ * this long are removed when a new shared index is written.
+ */
+#define SHARED_INDEX_EXPIRE (14 * 24 * 60 * 60)
+
+static void clean_shared_index_files(const unsigned char *current)
+{
+	const char *keep = sha1_to_hex(current);
+	DIR *dir = opendir(get_git_dir());
+	struct dirent *de;
+	time_t expire = time(NULL) - SHARED_INDEX_EXPIRE;
+
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		const char *path;
+		struct stat st;
+
+		if (prefixcmp(de->d_name, "sharedindex.") ||
+		    !strcmp(de->d_name + strlen("sharedindex."), keep))
+			continue;
+		path = git_path("%s", de->d_name);
+		if (!stat(path, &st) && st.st_mtime < expire)
+			unlink_or_warn(path);
+	}
+	closedir(dir);
+}
+
+static int write_split_index(struct index_state *istate, int newfd)
+{
+	struct split_index *si = init_split_index(istate);
+	int i;
+
+	/*
+	 * Smudge racily clean entries up front, so that the ones we
+	 * smudge are seen as different from the shared index.
+	 */
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		if (!(ce->ce_flags & CE_REMOVE) &&
+		    !ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+			ce_smudge_racily_clean_entry(ce);
+	}
+
+	if (prepare_split_index_delta(istate)) {
+		if (write_shared_index(istate))
+			return -1;
+		clean_shared_index_files(si->base_sha1);
+		prepare_split_index_delta(istate);
+	} else {
+		/* keep the shared index we depend on from expiring */
+		utime(git_path("sharedindex.%s", sha1_to_hex(si->base_sha1)),
+		      NULL);
+	}
+	return do_write_index(istate, newfd, si->delta, si->nr_delta,
+			      WRITE_SPLIT_INDEX);
+}
+
+/*
+ * Write the entries of istate with the directories outside of the
+ * sparse checkout collapsed, leaving istate itself as it is.
+ */
+static int write_sparse_index(struct index_state *istate, int newfd)
+{
+	struct index_state sparse = *istate;
+	struct cache_entry **cache;
+	struct cache_tree *tree;
+	int i, nr, ret;
+
+	nr = collapse_sparse_index(istate, &cache, &tree);
+	sparse.cache = cache;
+	sparse.cache_nr = sparse.cache_alloc = nr;
+	sparse.cache_tree = tree;
+	sparse.sparse_index = 0;
+	for (i = 0; i < nr; i++)
+		if (S_ISSPARSEDIR(cache[i]->ce_mode)) {
+			sparse.sparse_index = 1;
+			break;
+		}
+
+	ret = do_write_index(&sparse, newfd, cache, nr, 0);
+	istate->version = sparse.version;
+	istate->timestamp = sparse.timestamp;
+	hashcpy(istate->sha1, sparse.sha1);
+	free_sparse_cache(istate, cache, nr, &tree);
+	return ret;
+}
+
+int write_index(struct index_state *istate, int newfd)
+{
+	if (core_split_index > 0 ||
+	    (core_split_index < 0 && istate->split_index)) {
+		ensure_full_index(istate);
+		return write_split_index(istate, newfd);
+	}
+	discard_split_index(istate);
+	if (want_sparse_index())
+		return write_sparse_index(istate, newfd);
+	ensure_full_index(istate);
+	return do_write_index(istate, newfd, istate->cache, istate->cache_nr, 0);
 }
 
 /*
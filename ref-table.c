@@ -0,0 +1,664 @@
+#include "cache.h"
+#include "refs.h"
+#include "string-list.h"
+#include "varint.h"
+#include "ref-table.h"
+
+#define REF_TABLE_SIGNATURE "RTBL"
+#define REF_TABLE_VERSION 1
+#define REF_TABLE_HEADER_SIZE 16
+#define REF_TABLE_FOOTER_SIZE 20
+
+/* record types */
+#define REF_TABLE_DELETION 0
+#define REF_TABLE_VALUE 1
+#define REF_TABLE_VALUE_PEELED 2
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static void put_be32(struct strbuf *sb, uint32_t v)
+{
+	v = htonl(v);
+	strbuf_add(sb, &v, sizeof(v));
+}
+
+static struct ref_table *open_ref_table(const char *dir, const char *name)
+{
+	struct ref_table *table;
+	struct stat st;
+	const unsigned char *footer;
+	uint32_t index_offset;
+	size_t len;
+	void *buf;
+	int fd;
+
+	fd = open(mkpath("%s/%s", dir, name), O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st))
+		die_errno("unable to stat ref table '%s'", name);
+	len = xsize_t(st.st_size);
+	if (len < REF_TABLE_HEADER_SIZE + REF_TABLE_FOOTER_SIZE)
+		die("ref table '%s' is too short", name);
+	buf = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	table = xcalloc(1, sizeof(*table));
+	table->name = xstrdup(name);
+	table->buf = buf;
+	table->len = len;
+	footer = table->buf + len - REF_TABLE_FOOTER_SIZE;
+	if (memcmp(table->buf, REF_TABLE_SIGNATURE, 4) ||
+	    memcmp(footer + 16, REF_TABLE_SIGNATURE, 4))
+		die("ref table '%s' has a bad signature", name);
+	if (get_be32(table->buf + 4) != REF_TABLE_VERSION)
+		die("ref table '%s' has unknown version %"PRIu32,
+		    name, get_be32(table->buf + 4));
+	index_offset = get_be32(footer);
+	table->nr_blocks = get_be32(footer + 4);
+	table->nr_refs = get_be32(footer + 8);
+	table->flags = get_be32(footer + 12);
+	if (index_offset < REF_TABLE_HEADER_SIZE ||
+	    (len - REF_TABLE_FOOTER_SIZE - index_offset) / 4 != table->nr_blocks)
+		die("ref table '%s' has a corrupt index", name);
+	table->index = table->buf + index_offset;
+	return table;
+}
+
+static void close_ref_table(struct ref_table *table)
+{
+	munmap(table->buf, table->len);
+	free(table->name);
+	free(table);
+}
+
+static const char *tables_list_path(const char *dir)
+{
+	return mkpath("%s/tables.list", dir);
+}
+
+static void read_table_names(const char *dir, struct string_list *names)
+{
+	struct strbuf sb = STRBUF_INIT;
+	char *p, *eol;
+
+	if (strbuf_read_file(&sb, tables_list_path(dir), 0) < 0) {
+		if (errno != ENOENT)
+			die_errno("unable to read '%s'", tables_list_path(dir));
+		return;
+	}
+	for (p = sb.buf; *p; p = eol) {
+		eol = strchrnul(p, '\n');
+		if (*eol)
+			*eol++ = '\0';
+		if (*p)
+			string_list_append(names, p);
+	}
+	strbuf_release(&sb);
+}
+
+int ref_table_stack_read(struct ref_table_stack *stack, const char *dir)
+{
+	int retries = 0;
+
+	memset(stack, 0, sizeof(*stack));
+	while (1) {
+		struct string_list names = STRING_LIST_INIT_DUP;
+		int i;
+
+		read_table_names(dir, &names);
+		for (i = 0; i < names.nr; i++) {
+			struct ref_table *table;
+			table = open_ref_table(dir, names.items[i].string);
+			if (!table)
+				break;
+			ALLOC_GROW(stack->table, stack->nr + 1, stack->alloc);
+			stack->table[stack->nr++] = table;
+		}
+		if (i == names.nr) {
+			string_list_clear(&names, 0);
+			return stack->nr;
+		}
+
+		/*
+		 * The stack was compacted under us between reading the
+		 * list and opening its tables; start over.
+		 */
+		if (errno != ENOENT || ++retries > 10)
+			die_errno("unable to open ref table '%s/%s'",
+				  dir, names.items[i].string);
+		string_list_clear(&names, 0);
+		ref_table_stack_release(stack);
+	}
+}
+
+void ref_table_stack_release(struct ref_table_stack *stack)
+{
+	int i;
+
+	for (i = 0; i < stack->nr; i++)
+		close_ref_table(stack->table[i]);
+	free(stack->table);
+	memset(stack, 0, sizeof(*stack));
+}
+
+/*
+ * A cursor over the records of a table.  "name" holds the refname of
+ * the current record, whose type and value are "type", "sha1" and
+ * "peeled".
+ */
+struct ref_table_cursor {
+	struct ref_table *table;
+	uint32_t block;
+	const unsigned char *p, *end;
+	struct strbuf name;
+	int type;
+	const unsigned char *sha1, *peeled;
+};
+
+static uint32_t block_offset(struct ref_table *table, uint32_t block)
+{
+	if (block == table->nr_blocks)
+		return table->index - table->buf;
+	return get_be32(table->index + 4 * block);
+}
+
+static void cursor_seek(struct ref_table_cursor *c, uint32_t block)
+{
+	uint32_t start = block_offset(c->table, block);
+	uint32_t end = block_offset(c->table, block + 1);
+
+	if (end < start || c->table->buf + end > c->table->index)
+		die("ref table '%s' is corrupt", c->table->name);
+	c->block = block;
+	c->p = c->table->buf + start;
+	c->end = c->table->buf + end;
+	strbuf_reset(&c->name);
+}
+
+/* Move to the next record; returns 0 at the end of the table */
+static int cursor_next(struct ref_table_cursor *c)
+{
+	const char *corrupt = "ref table '%s' is corrupt";
+	uintmax_t prefix, suffix;
+
+	while (c->p == c->end) {
+		if (c->block + 1 >= c->table->nr_blocks)
+			return 0;
+		cursor_seek(c, c->block + 1);
+	}
+	prefix = decode_varint(&c->p);
+	suffix = decode_varint(&c->p);
+	if (prefix > c->name.len || c->end - c->p < suffix + 1)
+		die(corrupt, c->table->name);
+	strbuf_setlen(&c->name, prefix);
+	strbuf_add(&c->name, c->p, suffix);
+	c->p += suffix;
+	c->type = *c->p++;
+	c->sha1 = c->peeled = NULL;
+	switch (c->type) {
+	case REF_TABLE_DELETION:
+		break;
+	case REF_TABLE_VALUE_PEELED:
+		c->peeled = c->p + 20;
+		/* fallthrough */
+	case REF_TABLE_VALUE:
+		c->sha1 = c->p;
+		c->p += c->peeled ? 40 : 20;
+		if (c->end < c->p)
+			die(corrupt, c->table->name);
+		break;
+	default:
+		die(corrupt, c->table->name);
+	}
+	return 1;
+}
+
+/* Compare refname to the first refname in block */
+static int cmp_block_start(struct ref_table *table, uint32_t block,
+			   const char *refname, size_t len)
+{
+	const unsigned char *p = table->buf + block_offset(table, block);
+	size_t namelen;
+	int cmp;
+
+	if (decode_varint(&p))
+		die("ref table '%s' is corrupt", table->name);
+	namelen = decode_varint(&p);
+	if (table->index - p < namelen)
+		die("ref table '%s' is corrupt", table->name);
+	cmp = memcmp(refname, p, len < namelen ? len : namelen);
+	if (!cmp)
+		cmp = (len > namelen) - (len < namelen);
+	return cmp;
+}
+
+/*
+ * Look up refname in table; returns the type of its record, or -1 if
+ * the table does not mention it.
+ */
+static int ref_table_lookup(struct ref_table *table, const char *refname,
+			    unsigned char *sha1, unsigned char *peeled)
+{
+	struct ref_table_cursor c;
+	size_t len = strlen(refname);
+	uint32_t lo = 0, hi = table->nr_blocks;
+	int ret = -1;
+
+	/* find the last block starting at or before refname */
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		if (cmp_block_start(table, mi, refname, len) < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	if (!lo)
+		return -1;
+
+	memset(&c, 0, sizeof(c));
+	c.table = table;
+	strbuf_init(&c.name, 0);
+	cursor_seek(&c, lo - 1);
+	while (c.p < c.end && cursor_next(&c)) {
+		int cmp = strcmp(c.name.buf, refname);
+		if (cmp > 0)
+			break;
+		if (cmp < 0)
+			continue;
+		ret = c.type;
+		if (c.sha1)
+			hashcpy(sha1, c.sha1);
+		if (c.peeled && peeled)
+			hashcpy(peeled, c.peeled);
+		break;
+	}
+	strbuf_release(&c.name);
+	return ret;
+}
+
+int ref_table_stack_lookup(struct ref_table_stack *stack,
+			   const char *refname, unsigned char *sha1,
+			   unsigned char *peeled, unsigned int *flags)
+{
+	int i;
+
+	for (i = stack->nr - 1; 0 <= i; i--) {
+		int type = ref_table_lookup(stack->table[i], refname,
+					    sha1, peeled);
+		if (type < 0)
+			continue;
+		*flags = stack->table[i]->flags;
+		switch (type) {
+		case REF_TABLE_DELETION:
+			return -1;
+		case REF_TABLE_VALUE:
+			return 0;
+		default:
+			return !!peeled;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Call fn for the refs of the tables [first, last) of stack, newer
+ * tables overriding older ones.  Deletions are passed on with a NULL
+ * sha1 if include_deletions is set, and dropped otherwise.
+ */
+static int merge_ref_tables(struct ref_table_stack *stack, int first, int last,
+			    int include_deletions,
+			    each_table_ref_fn fn, void *cb_data)
+{
+	struct ref_table_cursor *c;
+	int i, nr = last - first, ret = 0;
+
+	c = xcalloc(nr, sizeof(*c));
+	for (i = 0; i < nr; i++) {
+		c[i].table = stack->table[first + i];
+		strbuf_init(&c[i].name, 0);
+		if (c[i].table->nr_blocks) {
+			cursor_seek(&c[i], 0);
+			if (cursor_next(&c[i]))
+				continue;
+		}
+		c[i].table = NULL;
+	}
+
+	while (!ret) {
+		int best = -1;
+
+		/* the smallest refname, from the newest table having it */
+		for (i = 0; i < nr; i++) {
+			if (!c[i].table)
+				continue;
+			if (best < 0 || strcmp(c[i].name.buf, c[best].name.buf) <= 0)
+				best = i;
+		}
+		if (best < 0)
+			break;
+		if (c[best].sha1 || include_deletions)
+			ret = fn(c[best].name.buf, c[best].sha1, c[best].peeled,
+				 c[best].table->flags, cb_data);
+		for (i = 0; i < nr; i++) {
+			if (i == best || !c[i].table ||
+			    strcmp(c[i].name.buf, c[best].name.buf))
+				continue;
+			if (!cursor_next(&c[i]))
+				c[i].table = NULL;
+		}
+		if (!cursor_next(&c[best]))
+			c[best].table = NULL;
+	}
+
+	for (i = 0; i < nr; i++)
+		strbuf_release(&c[i].name);
+	free(c);
+	return ret;
+}
+
+int ref_table_stack_for_each(struct ref_table_stack *stack,
+			     each_table_ref_fn fn, void *cb_data)
+{
+	return merge_ref_tables(stack, 0, stack->nr, 0, fn, cb_data);
+}
+
+static void flush_block(struct ref_table_writer *writer)
+{
+	if (!writer->block.len)
+		return;
+	write_or_die(writer->fd, writer->block.buf, writer->block.len);
+	if (writer->offset + writer->block.len < writer->offset)
+		die("ref table too large");
+	writer->offset += writer->block.len;
+	strbuf_reset(&writer->block);
+}
+
+static void encode_record(struct strbuf *sb, size_t prefix,
+			  const char *refname, const unsigned char *sha1,
+			  const unsigned char *peeled)
+{
+	unsigned char varint[16];
+	size_t suffix = strlen(refname) - prefix;
+
+	strbuf_add(sb, varint, encode_varint(prefix, varint));
+	strbuf_add(sb, varint, encode_varint(suffix, varint));
+	strbuf_add(sb, refname + prefix, suffix);
+	if (!sha1) {
+		strbuf_addch(sb, REF_TABLE_DELETION);
+	} else if (!peeled) {
+		strbuf_addch(sb, REF_TABLE_VALUE);
+		strbuf_add(sb, sha1, 20);
+	} else {
+		strbuf_addch(sb, REF_TABLE_VALUE_PEELED);
+		strbuf_add(sb, sha1, 20);
+		strbuf_add(sb, peeled, 20);
+	}
+}
+
+void ref_table_write_ref(struct ref_table_writer *writer,
+			 const char *refname, const unsigned char *sha1,
+			 const unsigned char *peeled)
+{
+	struct strbuf record = STRBUF_INIT;
+	size_t prefix = 0;
+
+	if (writer->nr_refs && strcmp(writer->last.buf, refname) >= 0)
+		die("BUG: refs not sorted when writing ref table: %s, %s",
+		    writer->last.buf, refname);
+	if (writer->block.len) {
+		while (writer->last.buf[prefix] &&
+		       writer->last.buf[prefix] == refname[prefix])
+			prefix++;
+		encode_record(&record, prefix, refname, sha1, peeled);
+		if (REF_TABLE_BLOCK_SIZE < writer->block.len + record.len) {
+			flush_block(writer);
+			strbuf_reset(&record);
+		}
+	}
+	if (!writer->block.len) {
+		/* the first record of a block is not prefix-compressed */
+		if (!record.len)
+			encode_record(&record, 0, refname, sha1, peeled);
+		ALLOC_GROW(writer->blocks, writer->nr_blocks + 1,
+			   writer->alloc_blocks);
+		writer->blocks[writer->nr_blocks++] = writer->offset;
+	}
+	strbuf_addbuf(&writer->block, &record);
+	strbuf_release(&record);
+	strbuf_reset(&writer->last);
+	strbuf_addstr(&writer->last, refname);
+	writer->nr_refs++;
+}
+
+static void ref_table_writer_init(struct ref_table_writer *writer, int fd)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->fd = fd;
+	strbuf_init(&writer->block, REF_TABLE_BLOCK_SIZE);
+	strbuf_init(&writer->last, 0);
+
+	strbuf_add(&writer->block, REF_TABLE_SIGNATURE, 4);
+	put_be32(&writer->block, REF_TABLE_VERSION);
+	put_be32(&writer->block, REF_TABLE_BLOCK_SIZE);
+	put_be32(&writer->block, 0);
+	flush_block(writer);
+}
+
+static void ref_table_writer_finish(struct ref_table_writer *writer)
+{
+	uint32_t i, index_offset;
+
+	flush_block(writer);
+	index_offset = writer->offset;
+	for (i = 0; i < writer->nr_blocks; i++)
+		put_be32(&writer->block, writer->blocks[i]);
+	put_be32(&writer->block, index_offset);
+	put_be32(&writer->block, writer->nr_blocks);
+	put_be32(&writer->block, writer->nr_refs);
+	put_be32(&writer->block, writer->flags);
+	strbuf_add(&writer->block, REF_TABLE_SIGNATURE, 4);
+	flush_block(writer);
+
+	free(writer->blocks);
+	strbuf_release(&writer->block);
+	strbuf_release(&writer->last);
+}
+
+static struct lock_file table_lock;
+
+/*
+ * Write a new table with fill, and append its name to written.  Table
+ * names are increasing hexadecimal numbers, so they never repeat.
+ */
+static int write_ref_table(const char *dir, struct string_list *written,
+			   uint32_t *next, fill_ref_table_fn fill, void *cb_data)
+{
+	struct ref_table_writer writer;
+	char name[32];
+	const char *path;
+	int fd;
+
+	sprintf(name, "%08"PRIx32".ref", (*next)++);
+	path = mkpath("%s/%s", dir, name);
+	fd = hold_lock_file_for_update(&table_lock, path, 0);
+	if (fd < 0)
+		return unable_to_lock_error(path, errno);
+	ref_table_writer_init(&writer, fd);
+	if (fill(&writer, cb_data)) {
+		ref_table_writer_finish(&writer);
+		rollback_lock_file(&table_lock);
+		return -1;
+	}
+	ref_table_writer_finish(&writer);
+	if (commit_lock_file(&table_lock))
+		return error("unable to write ref table '%s'", name);
+	string_list_append(written, name);
+	return 0;
+}
+
+struct compact_cb {
+	struct ref_table_stack *stack;
+	int first, last, include_deletions;
+};
+
+static int copy_table_ref(const char *refname, const unsigned char *sha1,
+			  const unsigned char *peeled, unsigned int flags,
+			  void *cb_data)
+{
+	ref_table_write_ref(cb_data, refname, sha1, peeled);
+	return 0;
+}
+
+static int fill_compacted_table(struct ref_table_writer *writer, void *cb_data)
+{
+	struct compact_cb *cb = cb_data;
+	int i;
+
+	writer->flags = REF_TABLE_PEELED;
+	for (i = cb->first; i < cb->last; i++)
+		writer->flags &= cb->stack->table[i]->flags;
+	return merge_ref_tables(cb->stack, cb->first, cb->last,
+				cb->include_deletions, copy_table_ref, writer);
+}
+
+/*
+ * Merge the newest tables of the stack as long as a table is not at
+ * least twice as large as the next newer one, so that the number of
+ * tables stays logarithmic in the number of refs.  Deletions are
+ * dropped once they are merged into the oldest table.
+ */
+static int compact_ref_tables(const char *dir, struct string_list *names,
+			      struct string_list *written,
+			      struct string_list *dropped, uint32_t *next)
+{
+	struct ref_table_stack stack;
+	size_t size;
+	int i, ret = 0;
+
+	memset(&stack, 0, sizeof(stack));
+	for (i = 0; i < names->nr; i++) {
+		struct ref_table *table = open_ref_table(dir, names->items[i].string);
+		if (!table)
+			die_errno("unable to open ref table '%s'",
+				  names->items[i].string);
+		ALLOC_GROW(stack.table, stack.nr + 1, stack.alloc);
+		stack.table[stack.nr++] = table;
+	}
+
+	i = stack.nr - 1;
+	size = stack.table[i]->len;
+	while (0 < i && stack.table[i - 1]->len < 2 * size)
+		size += stack.table[--i]->len;
+	if (i < stack.nr - 1) {
+		struct compact_cb cb;
+		int j;
+
+		cb.stack = &stack;
+		cb.first = i;
+		cb.last = stack.nr;
+		cb.include_deletions = !!i;
+		ret = write_ref_table(dir, written, next,
+				      fill_compacted_table, &cb);
+		if (!ret) {
+			for (j = i; j < names->nr; j++)
+				string_list_append(dropped, names->items[j].string);
+			while (i < names->nr)
+				free(names->items[--names->nr].string);
+			string_list_append(names,
+					   written->items[written->nr - 1].string);
+		}
+	}
+	ref_table_stack_release(&stack);
+	return ret;
+}
+
+static struct lock_file list_lock;
+
+int ref_table_stack_add(const char *dir, fill_ref_table_fn fill,
+			void *cb_data, unsigned int flags)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list written = STRING_LIST_INIT_DUP;
+	struct string_list dropped = STRING_LIST_INIT_DUP;
+	char *list = xstrdup(tables_list_path(dir));
+	uint32_t next = 0;
+	int i, fd, ret = -1;
+
+	if (safe_create_leading_directories(list))
+		die_errno("unable to create directory for '%s'", list);
+	fd = hold_lock_file_for_update(&list_lock, list, 0);
+	if (fd < 0) {
+		unable_to_lock_error(list, errno);
+		goto out;
+	}
+
+	read_table_names(dir, &names);
+	for (i = 0; i < names.nr; i++) {
+		uint32_t n = strtoul(names.items[i].string, NULL, 16);
+		if (next <= n)
+			next = n + 1;
+	}
+	if (flags & REF_TABLE_REPLACE) {
+		for (i = 0; i < names.nr; i++)
+			string_list_append(&dropped, names.items[i].string);
+		string_list_clear(&names, 0);
+	}
+	if (write_ref_table(dir, &written, &next, fill, cb_data))
+		goto fail;
+	string_list_append(&names, written.items[0].string);
+	if (compact_ref_tables(dir, &names, &written, &dropped, &next))
+		goto fail;
+
+	for (i = 0; i < names.nr; i++) {
+		write_or_die(fd, names.items[i].string,
+			     strlen(names.items[i].string));
+		write_or_die(fd, "\n", 1);
+	}
+	if (commit_lock_file(&list_lock)) {
+		error("unable to write '%s'", list);
+		goto fail;
+	}
+	for (i = 0; i < dropped.nr; i++)
+		unlink_or_warn(mkpath("%s/%s", dir, dropped.items[i].string));
+	ret = 0;
+	goto out;
+fail:
+	/* the tables we wrote are not in any list; remove them */
+	for (i = 0; i < written.nr; i++)
+		unlink_or_warn(mkpath("%s/%s", dir, written.items[i].string));
+	rollback_lock_file(&list_lock);
+out:
+	string_list_clear(&names, 0);
+	string_list_clear(&written, 0);
+	string_list_clear(&dropped, 0);
+	free(list);
+	return ret;
+}
+
+int ref_table_stack_clear(const char *dir)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	char *list = xstrdup(tables_list_path(dir));
+	int i;
+
+	if (hold_lock_file_for_update(&list_lock, list, 0) < 0) {
+		unable_to_lock_error(list, errno);
+		free(list);
+		return -1;
+	}
+	read_table_names(dir, &names);
+	unlink_or_warn(list);
+	for (i = 0; i < names.nr; i++)
+		unlink_or_warn(mkpath("%s/%s", dir, names.items[i].string));
+	rollback_lock_file(&list_lock);
+	rmdir(dir);
+	string_list_clear(&names, 0);
+	free(list);
+	return 0;
+}
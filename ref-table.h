@@ -0,0 +1,110 @@
+#ifndef REF_TABLE_H
+#define REF_TABLE_H
+
+/*
+ * A ref table is a binary file holding a sorted list of references,
+ * an alternative to the packed-refs text file for repositories with
+ * very many refs.  The references are stored in blocks of about
+ * REF_TABLE_BLOCK_SIZE bytes; within a block each refname only stores
+ * the part that differs from the previous one.  A fixed-width index
+ * of the block offsets lets a single reference be found with a binary
+ * search over the blocks of a mapped table, without reading the rest.
+ *
+ * The tables of a repository form a stack, listed oldest first in
+ * $GIT_DIR/ref-tables/tables.list.  A newer table overrides the entries
+ * of the older ones and can record deletions; the stack is compacted
+ * as tables are added so that it stays logarithmically short.  See
+ * Documentation/technical/ref-table.txt for the file format.
+ */
+
+#define REF_TABLE_BLOCK_SIZE 4096
+
+/* Where in $GIT_DIR the tables are kept */
+#define REF_TABLES_DIR "ref-tables"
+
+struct ref_table {
+	char *name;
+	unsigned char *buf;
+	size_t len;
+	const unsigned char *index;
+	uint32_t nr_blocks;
+	uint32_t nr_refs;
+	unsigned int flags;
+};
+
+/* The table knows the peeled value of every ref that has one */
+#define REF_TABLE_PEELED 01
+
+struct ref_table_stack {
+	struct ref_table **table;
+	int nr, alloc;
+};
+
+/*
+ * Map the tables listed in dir/tables.list.  Returns the number of
+ * tables, which is 0 if there is no table stack in dir.
+ */
+extern int ref_table_stack_read(struct ref_table_stack *stack, const char *dir);
+extern void ref_table_stack_release(struct ref_table_stack *stack);
+
+/*
+ * Look up refname in the stack.  Returns -1 if it is not there (or
+ * was deleted), otherwise stores its value in sha1 and returns 0, or
+ * 1 if its peeled value was stored in peeled (when not NULL).
+ * *flags receives the REF_TABLE_* flags of the table it was found in.
+ */
+extern int ref_table_stack_lookup(struct ref_table_stack *stack,
+				  const char *refname, unsigned char *sha1,
+				  unsigned char *peeled, unsigned int *flags);
+
+/*
+ * Call fn for all references in the stack, in refname order.  peeled
+ * is NULL if the table does not store a peeled value for the ref;
+ * flags are the REF_TABLE_* flags of the table it comes from.
+ */
+typedef int each_table_ref_fn(const char *refname, const unsigned char *sha1,
+			      const unsigned char *peeled, unsigned int flags,
+			      void *cb_data);
+extern int ref_table_stack_for_each(struct ref_table_stack *stack,
+				    each_table_ref_fn fn, void *cb_data);
+
+struct ref_table_writer {
+	int fd;
+	unsigned int flags;
+	struct strbuf block;
+	struct strbuf last;
+	uint32_t offset;
+	uint32_t *blocks;
+	uint32_t nr_blocks, alloc_blocks;
+	uint32_t nr_refs;
+};
+
+/*
+ * Add a reference to the table being written; refnames must come in
+ * strictly increasing order.  A NULL sha1 records that the reference
+ * was deleted, and peeled may be NULL if there is no peeled value.
+ */
+extern void ref_table_write_ref(struct ref_table_writer *writer,
+				const char *refname, const unsigned char *sha1,
+				const unsigned char *peeled);
+
+/*
+ * Called by ref_table_stack_add() with a writer for the new table.
+ * It may set writer->flags.
+ */
+typedef int fill_ref_table_fn(struct ref_table_writer *writer, void *cb_data);
+
+/*
+ * Write a new table with fill and push it on the stack in dir, or
+ * make it the only table with REF_TABLE_REPLACE; then compact the
+ * stack if needed.  Returns 0 on success, or -1 with an error message
+ * if the stack could not be locked or fill failed.
+ */
+#define REF_TABLE_REPLACE 01
+extern int ref_table_stack_add(const char *dir, fill_ref_table_fn fill,
+			       void *cb_data, unsigned int flags);
+
+/* Remove all tables in dir */
+extern int ref_table_stack_clear(const char *dir);
+
+#endif /* REF_TABLE_H */
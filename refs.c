@@ -3,6 +3,8 @@
 #include "object.h"
 #include "tag.h"
 #include "dir.h"
+#include "string-list.h"
+#include "ref-table.h"
 
 /*
  * Make sure "ref" is something reasonable to have under ".git/refs/";
@@ -507,6 +509,18 @@ static int do_one_ref(const char *base, each_ref_fn fn, int trim,
 	return retval;
 }
 
+/*
+ * Return true iff the directory "entry" can contain references whose
+ * names start with "base", i.e., if one of the two names is a prefix
+ * of the other.  Directories that cannot are skipped without being
+ * read from disk.
+ */
+static int ref_dir_overlaps_base(struct ref_entry *entry, const char *base)
+{
+	size_t len = strlen(entry->name), baselen = strlen(base);
+	return !strncmp(entry->name, base, len < baselen ? len : baselen);
+}
+
 /*
  * Call fn for each reference in dir that has index in the range
  * offset <= index < dir->nr.  Recurse into subdirectories that are in
@@ -523,7 +537,10 @@ static int do_for_each_ref_in_dir(struct ref_dir *dir, int offset,
 		struct ref_entry *entry = dir->entries[i];
 		int retval;
 		if (entry->flag & REF_DIR) {
-			struct ref_dir *subdir = get_ref_dir(entry);
+			struct ref_dir *subdir;
+			if (!ref_dir_overlaps_base(entry, base))
+				continue;
+			subdir = get_ref_dir(entry);
 			sort_ref_dir(subdir);
 			retval = do_for_each_ref_in_dir(subdir, 0,
 							base, fn, trim, flags, cb_data);
@@ -570,8 +587,14 @@ static int do_for_each_ref_in_dirs(struct ref_dir *dir1,
 		if (cmp == 0) {
 			if ((e1->flag & REF_DIR) && (e2->flag & REF_DIR)) {
 				/* Both are directories; descend them in parallel. */
-				struct ref_dir *subdir1 = get_ref_dir(e1);
-				struct ref_dir *subdir2 = get_ref_dir(e2);
+				struct ref_dir *subdir1, *subdir2;
+				if (!ref_dir_overlaps_base(e1, base)) {
+					i1++;
+					i2++;
+					continue;
+				}
+				subdir1 = get_ref_dir(e1);
+				subdir2 = get_ref_dir(e2);
 				sort_ref_dir(subdir1);
 				sort_ref_dir(subdir2);
 				retval = do_for_each_ref_in_dirs(
@@ -598,7 +621,10 @@ static int do_for_each_ref_in_dirs(struct ref_dir *dir1,
 				i2++;
 			}
 			if (e->flag & REF_DIR) {
-				struct ref_dir *subdir = get_ref_dir(e);
+				struct ref_dir *subdir;
+				if (!ref_dir_overlaps_base(e, base))
+					continue;
+				subdir = get_ref_dir(e);
 				sort_ref_dir(subdir);
 				retval = do_for_each_ref_in_dir(
 						subdir, 0,
@@ -687,16 +713,52 @@ static struct ref_cache {
 	struct ref_cache *next;
 	struct ref_entry *loose;
 	struct ref_entry *packed;
+	/*
+	 * The packed-refs file mapped into memory, to look up single
+	 * references in it without parsing all of it into "packed".
+	 */
+	struct packed_ref_file *packed_file;
+	/*
+	 * The ref tables of the repository, if it keeps its packed
+	 * references in them instead of in the packed-refs file.
+	 */
+	struct ref_table_stack *tables;
 	/* The submodule name, or "" for the main repo. */
 	char name[FLEX_ARRAY];
 } *ref_cache;
 
+/*
+ * A packed-refs file as it is on disk.  "refs" points to the first
+ * reference line after the header; the lines are sorted by refname,
+ * each possibly followed by a "^<sha1>" line with its peeled value.
+ * If the file is not known to be sorted, "usable" is 0 and it has
+ * to be read into a ref_dir instead.
+ */
+struct packed_ref_file {
+	char *buf;
+	size_t len;
+	const char *refs;
+	int flag;
+	int usable;
+};
+
 static void clear_packed_ref_cache(struct ref_cache *refs)
 {
 	if (refs->packed) {
 		free_ref_entry(refs->packed);
 		refs->packed = NULL;
 	}
+	if (refs->packed_file) {
+		if (refs->packed_file->buf)
+			munmap(refs->packed_file->buf, refs->packed_file->len);
+		free(refs->packed_file);
+		refs->packed_file = NULL;
+	}
+	if (refs->tables) {
+		ref_table_stack_release(refs->tables);
+		free(refs->tables);
+		refs->tables = NULL;
+	}
 }
 
 static void clear_loose_ref_cache(struct ref_cache *refs)
@@ -816,17 +878,69 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 	}
 }
 
+static const char *packed_refs_path(struct ref_cache *refs)
+{
+	if (*refs->name)
+		return git_path_submodule(refs->name, "packed-refs");
+	return git_path("packed-refs");
+}
+
+static const char *ref_tables_path(struct ref_cache *refs)
+{
+	if (*refs->name)
+		return git_path_submodule(refs->name, REF_TABLES_DIR);
+	return git_path(REF_TABLES_DIR);
+}
+
+/*
+ * Return the stack of ref tables of refs, or NULL if its packed
+ * references are in the packed-refs file.
+ */
+static struct ref_table_stack *get_ref_tables(struct ref_cache *refs)
+{
+	if (!refs->tables) {
+		char *dir = xstrdup(ref_tables_path(refs));
+
+		refs->tables = xmalloc(sizeof(*refs->tables));
+		ref_table_stack_read(refs->tables, dir);
+		free(dir);
+	}
+	return refs->tables->nr ? refs->tables : NULL;
+}
+
+static int ref_table_flag(unsigned int table_flags)
+{
+	return REF_ISPACKED |
+		((table_flags & REF_TABLE_PEELED) ? REF_KNOWS_PEELED : 0);
+}
+
+static int add_table_ref(const char *refname, const unsigned char *sha1,
+			 const unsigned char *peeled, unsigned int flags,
+			 void *cb_data)
+{
+	struct ref_entry *entry;
+
+	entry = create_ref_entry(refname, sha1, ref_table_flag(flags), 1);
+	if (peeled)
+		hashcpy(entry->u.value.peeled, peeled);
+	add_ref(cb_data, entry);
+	return 0;
+}
+
 static struct ref_dir *get_packed_refs(struct ref_cache *refs)
 {
 	if (!refs->packed) {
+		struct ref_table_stack *tables = get_ref_tables(refs);
 		const char *packed_refs_file;
 		FILE *f;
 
 		refs->packed = create_dir_entry(refs, "", 0);
-		if (*refs->name)
-			packed_refs_file = git_path_submodule(refs->name, "packed-refs");
-		else
-			packed_refs_file = git_path("packed-refs");
+		if (tables) {
+			ref_table_stack_for_each(tables, add_table_ref,
+						 get_ref_dir(refs->packed));
+			return get_ref_dir(refs->packed);
+		}
+		packed_refs_file = packed_refs_path(refs);
 		f = fopen(packed_refs_file, "r");
 		if (f) {
 			read_packed_refs(f, get_ref_dir(refs->packed));
@@ -836,6 +950,227 @@ static struct ref_dir *get_packed_refs(struct ref_cache *refs)
 	return get_ref_dir(refs->packed);
 }
 
+/* The end of the line starting at p, i.e. its '\n' or the end of buf */
+static const char *packed_line_end(const char *p, const char *end)
+{
+	const char *eol = memchr(p, '\n', end - p);
+	return eol ? eol : end;
+}
+
+/*
+ * Is the line [line, eol) a reference line ("<sha1> <refname>")?
+ * Set sha1 if so.
+ */
+static int parse_packed_line(const char *line, const char *eol,
+			     unsigned char *sha1)
+{
+	return (eol - line > 41 &&
+		!get_sha1_hex(line, sha1) &&
+		line[40] == ' ' && !isspace(line[41]));
+}
+
+/*
+ * Compare refname with the name of the reference line starting at
+ * line and ending at eol, like strcmp() would.
+ */
+static int cmp_packed_refname(const char *refname,
+			      const char *line, const char *eol)
+{
+	const char *p = line + 41;
+
+	for (; p < eol && *refname; p++, refname++)
+		if (*refname != *p)
+			return (unsigned char)*refname - (unsigned char)*p;
+	if (p < eol)
+		return -1;
+	return *refname ? 1 : 0;
+}
+
+/*
+ * Check that the reference lines from file->refs on are well formed
+ * and sorted, for packed-refs files whose header does not say so.
+ */
+static int packed_refs_are_sorted(struct packed_ref_file *file)
+{
+	const char *end = file->buf + file->len;
+	const char *p, *prev = NULL, *prev_eol = NULL;
+	unsigned char sha1[20];
+
+	for (p = file->refs; p < end; ) {
+		const char *eol = packed_line_end(p, end);
+
+		if (*p != '^') {
+			if (!parse_packed_line(p, eol, sha1))
+				return 0;
+			if (prev) {
+				int len = prev_eol - prev, cmp;
+
+				if (eol - p < len)
+					len = eol - p;
+				cmp = memcmp(prev + 41, p + 41, len - 41);
+				if (cmp > 0 || (!cmp && prev_eol - prev >= eol - p))
+					return 0;
+			}
+			prev = p;
+			prev_eol = eol;
+		}
+		p = eol + 1;
+	}
+	return 1;
+}
+
+/*
+ * Map the packed-refs file of refs into memory, unless that has been
+ * done already.  A missing file is an empty one.
+ */
+static struct packed_ref_file *get_packed_ref_file(struct ref_cache *refs)
+{
+	static const char header[] = "# pack-refs with:";
+	struct packed_ref_file *file;
+	struct stat st;
+	int fd;
+
+	if (refs->packed_file)
+		return refs->packed_file;
+	file = xcalloc(1, sizeof(*file));
+	file->flag = REF_ISPACKED;
+	file->usable = 1;
+	refs->packed_file = file;
+
+	fd = open(packed_refs_path(refs), O_RDONLY);
+	if (fd < 0)
+		return file;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		file->usable = 0;
+		return file;
+	}
+	file->len = xsize_t(st.st_size);
+	if (file->len)
+		file->buf = xmmap(NULL, file->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	file->refs = file->buf;
+	if (file->len >= sizeof(header) - 1 &&
+	    !memcmp(file->buf, header, sizeof(header) - 1)) {
+		const char *eol = packed_line_end(file->buf, file->buf + file->len);
+		char *traits = xmemdupz(file->buf, eol - file->buf);
+
+		if (strstr(traits, " peeled "))
+			file->flag |= REF_KNOWS_PEELED;
+		if (!strstr(traits, " sorted "))
+			file->usable = packed_refs_are_sorted(file);
+		file->refs = eol + (eol < file->buf + file->len);
+		free(traits);
+	} else {
+		file->usable = packed_refs_are_sorted(file);
+	}
+	return file;
+}
+
+/*
+ * Binary search the mapped packed-refs file for refname.  Return 0
+ * and set sha1 (and peeled, if the file records it) if found, -1 if
+ * it is not there, and -2 if the file cannot be searched after all.
+ */
+static int search_packed_ref_file(struct packed_ref_file *file,
+				  const char *refname,
+				  unsigned char *sha1, unsigned char *peeled)
+{
+	const char *lo = file->refs, *hi = file->buf + file->len;
+	const char *end = hi;
+
+	while (lo < hi) {
+		const char *line = lo + (hi - lo) / 2;
+		const char *eol;
+		int cmp;
+
+		/* back up to the start of the reference line */
+		while (line > lo && line[-1] != '\n')
+			line--;
+		if (*line == '^' && line > lo) {
+			line--;
+			while (line > lo && line[-1] != '\n')
+				line--;
+		}
+		eol = packed_line_end(line, end);
+		if (!parse_packed_line(line, eol, sha1))
+			return -2;
+
+		cmp = cmp_packed_refname(refname, line, eol);
+		if (!cmp) {
+			if (peeled) {
+				const char *p = eol + 1;
+
+				hashclr(peeled);
+				if (p < end && *p == '^' &&
+				    (packed_line_end(p, end) - p) == 41 &&
+				    get_sha1_hex(p + 1, peeled))
+					return -2;
+			}
+			return 0;
+		}
+		if (cmp < 0) {
+			hi = line;
+		} else {
+			lo = eol + 1;
+			if (lo < end && *lo == '^')
+				lo = packed_line_end(lo, end) + 1;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Look up refname among the packed references of refs.  On success,
+ * set sha1 and *flag, and return 0; otherwise return -1.  If peeled
+ * is not NULL and the peeled value of the reference is known, it is
+ * stored there and REF_KNOWS_PEELED is set in *flag.
+ *
+ * As long as nobody needed all of the packed references, this
+ * searches the ref tables or the packed-refs file directly instead
+ * of reading it all.
+ */
+static int find_packed_ref(struct ref_cache *refs, const char *refname,
+			   unsigned char *sha1, unsigned char *peeled,
+			   int *flag)
+{
+	struct ref_entry *entry;
+
+	if (!refs->packed && get_ref_tables(refs)) {
+		unsigned int table_flags;
+
+		if (peeled)
+			hashclr(peeled);
+		if (ref_table_stack_lookup(refs->tables, refname, sha1,
+					   peeled, &table_flags) < 0)
+			return -1;
+		*flag = ref_table_flag(table_flags);
+		return 0;
+	}
+	if (!refs->packed) {
+		struct packed_ref_file *file = get_packed_ref_file(refs);
+
+		if (file->usable) {
+			int ret = search_packed_ref_file(file, refname,
+							 sha1, peeled);
+			if (ret != -2) {
+				*flag = file->flag;
+				return ret;
+			}
+			file->usable = 0;
+		}
+	}
+	entry = find_ref(get_packed_refs(refs), refname);
+	if (!entry)
+		return -1;
+	hashcpy(sha1, entry->u.value.sha1);
+	if (peeled)
+		hashcpy(peeled, entry->u.value.peeled);
+	*flag = entry->flag;
+	return 0;
+}
+
 void add_packed_ref(const char *refname, const unsigned char *sha1)
 {
 	add_ref(get_packed_refs(get_ref_cache(NULL)),
@@ -939,15 +1274,9 @@ static struct ref_dir *get_loose_refs(struct ref_cache *refs)
 static int resolve_gitlink_packed_ref(struct ref_cache *refs,
 				      const char *refname, unsigned char *sha1)
 {
-	struct ref_entry *ref;
-	struct ref_dir *dir = get_packed_refs(refs);
-
-	ref = find_ref(dir, refname);
-	if (ref == NULL)
-		return -1;
+	int flag;
 
-	memcpy(sha1, ref->u.value.sha1, 20);
-	return 0;
+	return find_packed_ref(refs, refname, sha1, NULL, &flag);
 }
 
 static int resolve_gitlink_ref_recursive(struct ref_cache *refs,
@@ -1013,13 +1342,9 @@ int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sh
  */
 static int get_packed_ref(const char *refname, unsigned char *sha1)
 {
-	struct ref_dir *packed = get_packed_refs(get_ref_cache(NULL));
-	struct ref_entry *entry = find_ref(packed, refname);
-	if (entry) {
-		hashcpy(sha1, entry->u.value.sha1);
-		return 0;
-	}
-	return -1;
+	int flag;
+
+	return find_packed_ref(get_ref_cache(NULL), refname, sha1, NULL, &flag);
 }
 
 const char *resolve_ref_unsafe(const char *refname, unsigned char *sha1, int reading, int *flag)
@@ -1190,11 +1515,12 @@ int peel_ref(const char *refname, unsigned char *sha1)
 		return -1;
 
 	if ((flag & REF_ISPACKED)) {
-		struct ref_dir *dir = get_packed_refs(get_ref_cache(NULL));
-		struct ref_entry *r = find_ref(dir, refname);
+		unsigned char packed[20], peeled[20];
 
-		if (r != NULL && r->flag & REF_KNOWS_PEELED) {
-			hashcpy(sha1, r->u.value.peeled);
+		if (!find_packed_ref(get_ref_cache(NULL), refname,
+				     packed, peeled, &flag) &&
+		    (flag & REF_KNOWS_PEELED)) {
+			hashcpy(sha1, peeled);
 			return 0;
 		}
 	}
@@ -1389,11 +1715,22 @@ int for_each_namespaced_ref(each_ref_fn fn, void *cb_data)
 	return ret;
 }
 
+int for_each_namespaced_ref_in(const char *prefix, each_ref_fn fn, void *cb_data)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+	strbuf_addf(&buf, "%s%s", get_git_namespace(), prefix);
+	ret = do_for_each_ref(NULL, buf.buf, fn, 0, 0, cb_data);
+	strbuf_release(&buf);
+	return ret;
+}
+
 int for_each_glob_ref_in(each_ref_fn fn, const char *pattern,
 	const char *prefix, void *cb_data)
 {
 	struct strbuf real_pattern = STRBUF_INIT;
 	struct ref_filter filter;
+	char *base;
 	int ret;
 
 	if (!prefix && prefixcmp(pattern, "refs/"))
@@ -1413,7 +1750,12 @@ int for_each_glob_ref_in(each_ref_fn fn, const char *pattern,
 	filter.pattern = real_pattern.buf;
 	filter.fn = fn;
 	filter.cb_data = cb_data;
-	ret = for_each_ref(filter_refs, &filter);
+
+	/* only the part before the first glob character needs to be read */
+	base = xstrndup(real_pattern.buf, strcspn(real_pattern.buf, "?*[\\"));
+	ret = do_for_each_ref(NULL, base, filter_refs, 0, 0, &filter);
+
+	free(base);
 
 	strbuf_release(&real_pattern);
 	return ret;
@@ -1430,6 +1772,12 @@ int for_each_rawref(each_ref_fn fn, void *cb_data)
 			       DO_FOR_EACH_INCLUDE_BROKEN, cb_data);
 }
 
+int for_each_rawref_in(const char *prefix, each_ref_fn fn, void *cb_data)
+{
+	return do_for_each_ref(NULL, prefix, fn, 0,
+			       DO_FOR_EACH_INCLUDE_BROKEN, cb_data);
+}
+
 const char *prettify_refname(const char *name)
 {
 	return name + (
@@ -1684,19 +2032,19 @@ struct ref_lock *lock_any_ref_for_update(const char *refname,
 	return lock_ref_sha1_basic(refname, old_sha1, flags, NULL);
 }
 
-struct repack_without_ref_sb {
-	const char *refname;
+struct repack_without_refs_sb {
+	struct string_list *refnames;
 	int fd;
 };
 
-static int repack_without_ref_fn(const char *refname, const unsigned char *sha1,
-				 int flags, void *cb_data)
+static int repack_without_refs_fn(const char *refname, const unsigned char *sha1,
+				  int flags, void *cb_data)
 {
-	struct repack_without_ref_sb *data = cb_data;
+	struct repack_without_refs_sb *data = cb_data;
 	char line[PATH_MAX + 100];
 	int len;
 
-	if (!strcmp(data->refname, refname))
+	if (string_list_has_string(data->refnames, refname))
 		return 0;
 	len = snprintf(line, sizeof(line), "%s %s\n",
 		       sha1_to_hex(sha1), refname);
@@ -1709,30 +2057,112 @@ static int repack_without_ref_fn(const char *refname, const unsigned char *sha1,
 
 static struct lock_file packlock;
 
-static int repack_without_ref(const char *refname)
+static int write_ref_deletions(struct ref_table_writer *writer, void *cb_data)
+{
+	struct string_list *refnames = cb_data;
+	int i;
+
+	writer->flags = REF_TABLE_PEELED;
+	for (i = 0; i < refnames->nr; i++)
+		ref_table_write_ref(writer, refnames->items[i].string, NULL, NULL);
+	return 0;
+}
+
+/*
+ * Add a table recording the deletion of those of the (sorted) refnames
+ * that are in the ref tables.  Like pack-refs, this holds the lock on
+ * packed-refs, and looks the refs up in the tables as they are under
+ * that lock rather than as we read them earlier, so that what another
+ * writer did in between is not lost.  Returns 1 if there are no ref
+ * tables any more.
+ */
+static int delete_from_ref_tables(struct string_list *refnames)
+{
+	struct string_list packed = STRING_LIST_INIT_NODUP;
+	struct ref_table_stack tables;
+	char *dir = xstrdup(git_path(REF_TABLES_DIR));
+	unsigned char sha1[20];
+	unsigned int flags;
+	int i, ret = 0;
+
+	if (hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0) < 0) {
+		unable_to_lock_error(git_path("packed-refs"), errno);
+		free(dir);
+		return error("cannot delete '%s' from packed refs",
+			     refnames->items[0].string);
+	}
+	memset(&tables, 0, sizeof(tables));
+	if (!ref_table_stack_read(&tables, dir))
+		ret = 1;
+	for (i = 0; !ret && i < refnames->nr; i++) {
+		const char *refname = refnames->items[i].string;
+
+		if (i && !strcmp(refname, refnames->items[i - 1].string))
+			continue;
+		if (ref_table_stack_lookup(&tables, refname, sha1, NULL, &flags) >= 0)
+			string_list_append(&packed, refname);
+	}
+	ref_table_stack_release(&tables);
+	if (packed.nr && ref_table_stack_add(dir, write_ref_deletions, &packed, 0))
+		ret = error("cannot delete '%s' from packed refs",
+			    packed.items[0].string);
+	rollback_lock_file(&packlock);
+	string_list_clear(&packed, 0);
+	free(dir);
+	return ret;
+}
+
+/*
+ * Rewrite the packed-refs file without the (sorted) refnames, if any
+ * of them is in there; however many there are, this is done at most
+ * once.  With ref tables, a table recording their deletion is added
+ * instead.
+ */
+static int repack_without_refs(struct string_list *refnames)
 {
-	struct repack_without_ref_sb data;
-	struct ref_dir *packed = get_packed_refs(get_ref_cache(NULL));
-	if (find_ref(packed, refname) == NULL)
+	static const char header[] = "# pack-refs with: sorted \n";
+	struct repack_without_refs_sb data;
+	struct ref_dir *packed;
+	unsigned char sha1[20];
+	int i, flag;
+
+	if (get_ref_tables(get_ref_cache(NULL))) {
+		int ret = delete_from_ref_tables(refnames);
+		if (ret <= 0)
+			return ret;
+		/* the refs went back to packed-refs meanwhile */
+		invalidate_ref_cache(NULL);
+	}
+	for (i = 0; i < refnames->nr; i++)
+		if (!find_packed_ref(get_ref_cache(NULL), refnames->items[i].string,
+				     sha1, NULL, &flag))
+			break;
+	if (i == refnames->nr)
 		return 0;
-	data.refname = refname;
+	packed = get_packed_refs(get_ref_cache(NULL));
+	sort_ref_dir(packed);
+	data.refnames = refnames;
 	data.fd = hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0);
 	if (data.fd < 0) {
 		unable_to_lock_error(git_path("packed-refs"), errno);
-		return error("cannot delete '%s' from packed refs", refname);
+		return error("cannot delete '%s' from packed refs",
+			     refnames->items[i].string);
 	}
-	do_for_each_ref_in_dir(packed, 0, "", repack_without_ref_fn, 0, 0, &data);
+	write_or_die(data.fd, header, sizeof(header) - 1);
+	do_for_each_ref_in_dir(packed, 0, "", repack_without_refs_fn, 0, 0, &data);
 	return commit_lock_file(&packlock);
 }
 
-int delete_ref(const char *refname, const unsigned char *sha1, int delopt)
+/*
+ * Remove the loose file of refname, locked by lock (which was taken
+ * without REF_NODEREF) and found to be of type flag.  Its packed
+ * entry, if any, is for the caller to take care of.
+ */
+static int delete_ref_loose(struct ref_lock *lock, const char *refname,
+			    int flag, int delopt)
 {
-	struct ref_lock *lock;
-	int err, i = 0, ret = 0, flag = 0;
+	int err, i = 0, ret = 0;
 
-	lock = lock_ref_sha1_basic(refname, sha1, 0, &flag);
-	if (!lock)
-		return 1;
 	if (!(flag & REF_ISPACKED) || flag & REF_ISSYMREF) {
 		/* loose */
 		const char *path;
@@ -1751,11 +2181,27 @@ int delete_ref(const char *refname, const unsigned char *sha1, int delopt)
 		if (!(delopt & REF_NODEREF))
 			lock->lk->filename[i] = '.';
 	}
+	return ret;
+}
+
+int delete_ref(const char *refname, const unsigned char *sha1, int delopt)
+{
+	struct ref_lock *lock;
+	struct string_list refnames = STRING_LIST_INIT_NODUP;
+	int ret = 0, flag = 0;
+
+	lock = lock_ref_sha1_basic(refname, sha1, 0, &flag);
+	if (!lock)
+		return 1;
+	ret |= delete_ref_loose(lock, refname, flag, delopt);
+
 	/* removing the loose one could have resurrected an earlier
 	 * packed one.  Also, if it was not loose we need to repack
 	 * without it.
 	 */
-	ret |= repack_without_ref(refname);
+	string_list_append(&refnames, refname);
+	ret |= repack_without_refs(&refnames);
+	string_list_clear(&refnames, 0);
 
 	unlink_or_warn(git_path("logs/%s", lock->ref_name));
 	invalidate_ref_cache(NULL);
@@ -2385,29 +2831,196 @@ int for_each_reflog(each_ref_fn fn, void *cb_data)
 	return retval;
 }
 
+static int update_error(enum action_on_err onerr, const char *str,
+			const char *refname)
+{
+	switch (onerr) {
+	case MSG_ON_ERR: error(str, refname); break;
+	case DIE_ON_ERR: die(str, refname); break;
+	case QUIET_ON_ERR: break;
+	}
+	return 1;
+}
+
 int update_ref(const char *action, const char *refname,
 		const unsigned char *sha1, const unsigned char *oldval,
 		int flags, enum action_on_err onerr)
 {
 	static struct ref_lock *lock;
 	lock = lock_any_ref_for_update(refname, oldval, flags);
-	if (!lock) {
-		const char *str = "Cannot lock the ref '%s'.";
-		switch (onerr) {
-		case MSG_ON_ERR: error(str, refname); break;
-		case DIE_ON_ERR: die(str, refname); break;
-		case QUIET_ON_ERR: break;
-		}
-		return 1;
+	if (!lock)
+		return update_error(onerr, "Cannot lock the ref '%s'.", refname);
+	if (write_ref_sha1(lock, sha1, action) < 0)
+		return update_error(onerr, "Cannot update the ref '%s'.", refname);
+	return 0;
+}
+
+/*
+ * One update queued in a ref_transaction; a null new_sha1 deletes the
+ * reference.  The lock, and the type of the reference as found when
+ * taking it, are only set while the transaction is being committed.
+ */
+struct ref_update {
+	unsigned char new_sha1[20];
+	unsigned char old_sha1[20];
+	int flags;
+	int have_old;
+	struct ref_lock *lock;
+	int type;
+	int applied;
+	char refname[FLEX_ARRAY];
+};
+
+struct ref_transaction {
+	struct ref_update **updates;
+	int nr, alloc;
+};
+
+struct ref_transaction *ref_transaction_begin(void)
+{
+	return xcalloc(1, sizeof(struct ref_transaction));
+}
+
+void ref_transaction_free(struct ref_transaction *transaction)
+{
+	int i;
+
+	if (!transaction)
+		return;
+	for (i = 0; i < transaction->nr; i++) {
+		if (transaction->updates[i]->lock)
+			unlock_ref(transaction->updates[i]->lock);
+		free(transaction->updates[i]);
+	}
+	free(transaction->updates);
+	free(transaction);
+}
+
+void ref_transaction_update(struct ref_transaction *transaction,
+			    const char *refname,
+			    const unsigned char *new_sha1,
+			    const unsigned char *old_sha1, int flags)
+{
+	int len = strlen(refname) + 1;
+	struct ref_update *update = xcalloc(1, sizeof(*update) + len);
+
+	memcpy(update->refname, refname, len);
+	hashcpy(update->new_sha1, new_sha1);
+	if (old_sha1) {
+		hashcpy(update->old_sha1, old_sha1);
+		update->have_old = 1;
+	}
+	update->flags = flags;
+	ALLOC_GROW(transaction->updates, transaction->nr + 1, transaction->alloc);
+	transaction->updates[transaction->nr++] = update;
+}
+
+void ref_transaction_delete(struct ref_transaction *transaction,
+			    const char *refname,
+			    const unsigned char *old_sha1, int flags)
+{
+	ref_transaction_update(transaction, refname, null_sha1, old_sha1, flags);
+}
+
+static int ref_update_cmp(const void *a_, const void *b_)
+{
+	const struct ref_update *a = *(const struct ref_update **)a_;
+	const struct ref_update *b = *(const struct ref_update **)b_;
+	return strcmp(a->refname, b->refname);
+}
+
+int ref_transaction_commit(struct ref_transaction *transaction,
+			   const char *msg, enum action_on_err onerr)
+{
+	struct ref_update **updates = transaction->updates;
+	struct string_list delnames = STRING_LIST_INIT_NODUP;
+	int i, n = transaction->nr, ret = 0;
+
+	qsort(updates, n, sizeof(*updates), ref_update_cmp);
+	for (i = 1; i < n; i++)
+		if (!strcmp(updates[i - 1]->refname, updates[i]->refname))
+			return update_error(onerr,
+				"Multiple updates for ref '%s' not allowed.",
+				updates[i]->refname);
+
+	/* Take all the locks, checking the old values, before writing */
+	for (i = 0; i < n; i++) {
+		struct ref_update *update = updates[i];
+		int delete = is_null_sha1(update->new_sha1);
+
+		if (check_refname_format(update->refname, REFNAME_ALLOW_ONELEVEL))
+			return update_error(onerr, "Cannot lock the ref '%s'.",
+					    update->refname);
+		update->lock = lock_ref_sha1_basic(update->refname,
+					update->have_old ? update->old_sha1 : NULL,
+					delete ? 0 : update->flags,
+					&update->type);
+		if (!update->lock)
+			return update_error(onerr, "Cannot lock the ref '%s'.",
+					    update->refname);
+	}
+
+	/* Write the new values; write_ref_sha1() releases the lock */
+	for (i = 0; i < n; i++) {
+		struct ref_update *update = updates[i];
+		struct ref_lock *lock = update->lock;
+
+		if (is_null_sha1(update->new_sha1))
+			continue;
+		update->lock = NULL;
+		if (write_ref_sha1(lock, update->new_sha1, msg) < 0)
+			ret = update_error(onerr, "Cannot update the ref '%s'.",
+					   update->refname);
+		else
+			update->applied = 1;
+	}
+
+	/* Delete the loose refs, then the packed ones all at once */
+	for (i = 0; i < n; i++) {
+		struct ref_update *update = updates[i];
+
+		if (!update->lock)
+			continue;
+		if (delete_ref_loose(update->lock, update->refname,
+				     update->type, update->flags))
+			ret = 1;
+		else
+			update->applied = 1;
+		string_list_append(&delnames, update->refname);
 	}
-	if (write_ref_sha1(lock, sha1, action) < 0) {
-		const char *str = "Cannot update the ref '%s'.";
-		switch (onerr) {
-		case MSG_ON_ERR: error(str, refname); break;
-		case DIE_ON_ERR: die(str, refname); break;
-		case QUIET_ON_ERR: break;
+	if (delnames.nr) {
+		int repack_ret = repack_without_refs(&delnames);
+
+		ret |= repack_ret;
+		for (i = 0; i < n; i++) {
+			if (!updates[i]->lock)
+				continue;
+			if (repack_ret)
+				updates[i]->applied = 0;
+			unlink_or_warn(git_path("logs/%s",
+					updates[i]->lock->ref_name));
 		}
-		return 1;
+	}
+	string_list_clear(&delnames, 0);
+	invalidate_ref_cache(NULL);
+	return ret;
+}
+
+int ref_transaction_applied(struct ref_transaction *transaction,
+			    const char *refname)
+{
+	int lo = 0, hi = transaction->nr;
+
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		int cmp = strcmp(refname, transaction->updates[mi]->refname);
+
+		if (!cmp)
+			return transaction->updates[mi]->applied;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
 	}
 	return 0;
 }
@@ -42,6 +42,8 @@ extern int for_each_remote_ref_submodule(const char *submodule, each_ref_fn fn,
 
 extern int head_ref_namespaced(each_ref_fn fn, void *cb_data);
 extern int for_each_namespaced_ref(each_ref_fn fn, void *cb_data);
+/* Like for_each_namespaced_ref(), for the refs that start with prefix */
+extern int for_each_namespaced_ref_in(const char *prefix, each_ref_fn fn, void *cb_data);
 
 static inline const char *has_glob_specials(const char *pattern)
 {
@@ -50,6 +52,7 @@ static inline const char *has_glob_specials(const char *pattern)
 
 /* can be used to learn about broken ref and symref */
 extern int for_each_rawref(each_ref_fn, void *);
+extern int for_each_rawref_in(const char *prefix, each_ref_fn, void *);
 
 extern void warn_dangling_symref(FILE *fp, const char *msg_fmt, const char *refname);
 
@@ -147,4 +150,40 @@ int update_ref(const char *action, const char *refname,
 		const unsigned char *sha1, const unsigned char *oldval,
 		int flags, enum action_on_err onerr);
 
+/*
+ * A ref transaction queues updates and deletions of references, to
+ * carry them out all at once by ref_transaction_commit():
+ *
+ * - all the references are locked (and their old values, if given,
+ *   checked) before anything is written, so that if any of them
+ *   cannot be, nothing is changed;
+ *
+ * - the packed-refs file is rewritten at most once, however many
+ *   packed references are deleted.
+ *
+ * An old_sha1 of NULL means the old value is not checked, and a null
+ * sha1 that the reference must not exist.  A reference may only be
+ * named once in a transaction.  Commit returns 0 on success; the
+ * transaction has to be freed with ref_transaction_free() either way.
+ *
+ * Once all the locks are taken, a failure to write one reference does
+ * not stop the others from being written.  After a failed commit,
+ * ref_transaction_applied() tells whether the update of refname made
+ * it.
+ */
+struct ref_transaction;
+extern struct ref_transaction *ref_transaction_begin(void);
+extern void ref_transaction_update(struct ref_transaction *transaction,
+				   const char *refname,
+				   const unsigned char *new_sha1,
+				   const unsigned char *old_sha1, int flags);
+extern void ref_transaction_delete(struct ref_transaction *transaction,
+				   const char *refname,
+				   const unsigned char *old_sha1, int flags);
+extern int ref_transaction_commit(struct ref_transaction *transaction,
+				  const char *msg, enum action_on_err onerr);
+extern int ref_transaction_applied(struct ref_transaction *transaction,
+				   const char *refname);
+extern void ref_transaction_free(struct ref_transaction *transaction);
+
 #endif /* REFS_H */
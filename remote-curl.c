@@ -7,6 +7,8 @@
 #include "run-command.h"
 #include "pkt-line.h"
 #include "sideband.h"
+#include "quote.h"
+#include "string-list.h"
 
 static struct remote *remote;
 static const char *url; /* always ends with a trailing slash */
@@ -20,6 +22,7 @@ struct options {
 		thin : 1;
 };
 static struct options options;
+static struct string_list ref_prefixes = STRING_LIST_INIT_DUP;
 
 static int set_option(const char *name, const char *value)
 {
@@ -57,6 +60,17 @@ static int set_option(const char *name, const char *value)
 			return -1;
 		return 0;
 	}
+	else if (!strcmp(name, "ref-prefix")) {
+		struct strbuf unquoted = STRBUF_INIT;
+		if (*value == '"') {
+			if (unquote_c_style(&unquoted, value, NULL) < 0)
+				return -1;
+			value = unquoted.buf;
+		}
+		string_list_append(&ref_prefixes, value);
+		strbuf_release(&unquoted);
+		return 0;
+	}
 	else if (!strcmp(name, "dry-run")) {
 		if (!strcmp(value, "true"))
 			options.dry_run = 1;
@@ -76,7 +90,10 @@ struct discovery {
 	char *buf_alloc;
 	char *buf;
 	size_t len;
+	char *capabilities; /* of the fetch command, with protocol v2 */
 	unsigned proto_git : 1;
+	unsigned proto_v2 : 1;
+	unsigned ls_refs : 1; /* buf is the answer to ls-refs */
 };
 static struct discovery *last_discovery;
 
@@ -86,6 +103,7 @@ static void free_discovery(struct discovery *d)
 		if (d == last_discovery)
 			last_discovery = NULL;
 		free(d->buf_alloc);
+		free(d->capabilities);
 		free(d);
 	}
 }
@@ -96,6 +114,7 @@ static struct discovery* discover_refs(const char *service)
 	struct discovery *last = last_discovery;
 	char *refs_url;
 	int http_ret, is_http = 0, proto_git_candidate = 1;
+	int options = HTTP_NO_CACHE;
 
 	if (last && !strcmp(service, last->service))
 		return last;
@@ -112,7 +131,10 @@ static struct discovery* discover_refs(const char *service)
 	}
 	refs_url = strbuf_detach(&buffer, NULL);
 
-	http_ret = http_get_strbuf(refs_url, &buffer, HTTP_NO_CACHE);
+	if (!strcmp(service, "git-upload-pack") &&
+	    get_protocol_version_config() == 2)
+		options |= HTTP_PROTOCOL_V2;
+	http_ret = http_get_strbuf(refs_url, &buffer, options);
 
 	/* try again with "plain" url (no ? or & appended) */
 	if (http_ret != HTTP_OK && http_ret != HTTP_NOAUTH) {
@@ -170,6 +192,30 @@ static struct discovery* discover_refs(const char *service)
 			strbuf_reset(&buffer);
 
 		last->proto_git = 1;
+
+		/*
+		 * A version 2 server only lists its capabilities; the
+		 * refs are asked for with an ls-refs request.
+		 */
+		if (options & HTTP_PROTOCOL_V2) {
+			char *buf = last->buf;
+			size_t len = last->len;
+
+			strbuf_reset(&buffer);
+			if (packet_get_line(&buffer, &buf, &len) > 0 &&
+			    !strcmp(buffer.buf, "version 2\n")) {
+				last->proto_v2 = 1;
+				strbuf_reset(&buffer);
+				while (packet_get_line(&buffer, &buf, &len) > 0) {
+					strbuf_rtrim(&buffer);
+					if (!prefixcmp(buffer.buf, "fetch=")) {
+						free(last->capabilities);
+						last->capabilities = xstrdup(buffer.buf + 6);
+					}
+					strbuf_reset(&buffer);
+				}
+			}
+		}
 	}
 
 	free(refs_url);
@@ -200,8 +246,11 @@ static struct ref *parse_git_refs(struct discovery *heads, int for_push)
 
 	if (start_async(&async))
 		die("cannot start thread to parse advertised refs");
-	get_remote_heads(async.out, &list,
-			for_push ? REF_NORMAL : 0, NULL);
+	if (heads->ls_refs)
+		read_ls_refs_response(async.out, &list, 0);
+	else
+		get_remote_heads(async.out, &list,
+				 for_push ? REF_NORMAL : 0, NULL);
 	close(async.out);
 	if (finish_async(&async))
 		die("ref parsing thread failed");
@@ -259,6 +308,8 @@ static struct ref *parse_info_refs(struct discovery *heads)
 	return refs;
 }
 
+static struct ref *get_refs_v2(void);
+
 static struct ref *get_refs(int for_push)
 {
 	struct discovery *heads;
@@ -268,6 +319,8 @@ static struct ref *get_refs(int for_push)
 	else
 		heads = discover_refs("git-upload-pack");
 
+	if (heads->proto_v2)
+		return get_refs_v2();
 	if (heads->proto_git)
 		return parse_git_refs(heads, for_push);
 	return parse_info_refs(heads);
@@ -301,6 +354,7 @@ struct rpc_state {
 	int in;
 	int out;
 	struct strbuf result;
+	const char *command; /* sent before each request, with protocol v2 */
 	unsigned gzip_request : 1;
 	unsigned initial_buffer : 1;
 };
@@ -388,6 +442,8 @@ static int probe_rpc(struct rpc_state *rpc)
 
 	headers = curl_slist_append(headers, rpc->hdr_content_type);
 	headers = curl_slist_append(headers, rpc->hdr_accept);
+	if (rpc->command)
+		headers = curl_slist_append(headers, HTTP_PROTOCOL_V2_HEADER);
 
 	curl_easy_setopt(slot->curl, CURLOPT_NOBODY, 0);
 	curl_easy_setopt(slot->curl, CURLOPT_POST, 1);
@@ -451,6 +507,8 @@ static int post_rpc(struct rpc_state *rpc)
 	headers = curl_slist_append(headers, rpc->hdr_content_type);
 	headers = curl_slist_append(headers, rpc->hdr_accept);
 	headers = curl_slist_append(headers, "Expect:");
+	if (rpc->command)
+		headers = curl_slist_append(headers, HTTP_PROTOCOL_V2_HEADER);
 
 	if (large_request) {
 		/* The request body is large and the size cannot be predicted.
@@ -536,6 +594,7 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 {
 	const char *svc = rpc->service_name;
 	struct strbuf buf = STRBUF_INIT;
+	struct strbuf command = STRBUF_INIT;
 	struct strbuf *preamble = rpc->stdin_preamble;
 	struct child_process client;
 	int err = 0;
@@ -567,12 +626,17 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 	strbuf_addf(&buf, "Accept: application/x-%s-result", svc);
 	rpc->hdr_accept = strbuf_detach(&buf, NULL);
 
+	if (rpc->command)
+		packet_buf_write(&command, "command=%s\n", rpc->command);
+
 	while (!err) {
-		int n = packet_read_line(rpc->out, rpc->buf, rpc->alloc);
+		int n = packet_read_line(rpc->out, rpc->buf + command.len,
+					 rpc->alloc - command.len);
 		if (!n)
 			break;
+		memcpy(rpc->buf, command.buf, command.len);
 		rpc->pos = 0;
-		rpc->len = n;
+		rpc->len = command.len + n;
 		err |= post_rpc(rpc);
 	}
 
@@ -596,9 +660,60 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 	free(rpc->hdr_accept);
 	free(rpc->buf);
 	strbuf_release(&buf);
+	strbuf_release(&command);
 	return err;
 }
 
+static struct ref *get_refs_v2(void)
+{
+	struct active_request_slot *slot;
+	struct curl_slist *headers = NULL;
+	struct strbuf service_url = STRBUF_INIT;
+	struct strbuf request = STRBUF_INIT;
+	struct discovery result;
+	struct ref *refs;
+
+	write_ls_refs_request(&request, &ref_prefixes);
+	string_list_clear(&ref_prefixes, 0);
+	strbuf_addf(&service_url, "%sgit-upload-pack", url);
+	memset(&result, 0, sizeof(result));
+
+	slot = get_active_slot();
+
+	headers = curl_slist_append(headers,
+		"Content-Type: application/x-git-upload-pack-request");
+	headers = curl_slist_append(headers,
+		"Accept: application/x-git-upload-pack-result");
+	headers = curl_slist_append(headers, HTTP_PROTOCOL_V2_HEADER);
+
+	curl_easy_setopt(slot->curl, CURLOPT_NOBODY, 0);
+	curl_easy_setopt(slot->curl, CURLOPT_POST, 1);
+	curl_easy_setopt(slot->curl, CURLOPT_URL, service_url.buf);
+	curl_easy_setopt(slot->curl, CURLOPT_ENCODING, "");
+	curl_easy_setopt(slot->curl, CURLOPT_POSTFIELDS, request.buf);
+	curl_easy_setopt(slot->curl, CURLOPT_POSTFIELDSIZE, request.len);
+	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_buffer);
+	curl_easy_setopt(slot->curl, CURLOPT_FILE, &request);
+
+	if (options.verbosity > 1) {
+		fprintf(stderr, "POST git-upload-pack (ls-refs)\n");
+		fflush(stderr);
+	}
+	strbuf_reset(&request);
+	if (run_slot(slot))
+		die("unable to list the refs of %s", url);
+	curl_slist_free_all(headers);
+	strbuf_release(&service_url);
+
+	result.buf = request.buf;
+	result.len = request.len;
+	result.ls_refs = 1;
+	refs = parse_git_refs(&result, 0);
+	strbuf_release(&request);
+	return refs;
+}
+
 static int fetch_dumb(int nr_heads, struct ref **to_fetch)
 {
 	struct walker *walker;
@@ -631,6 +746,8 @@ static int fetch_git(struct discovery *heads,
 {
 	struct rpc_state rpc;
 	struct strbuf preamble = STRBUF_INIT;
+	struct strbuf advertised = STRBUF_INIT;
+	struct discovery v2_heads;
 	char *depth_arg = NULL;
 	int argc = 0, i, err;
 	const char *argv[15];
@@ -672,11 +789,39 @@ static int fetch_git(struct discovery *heads,
 	rpc.stdin_preamble = &preamble;
 	rpc.gzip_request = 1;
 
+	if (heads->proto_v2) {
+		/*
+		 * fetch-pack wants to read the refs first, the way a
+		 * version 0 server advertises them along with the
+		 * capabilities; the refs we fetch are all it needs.
+		 */
+		for (i = 0; i < nr_heads; i++) {
+			struct ref *ref = to_fetch[i];
+			if (i)
+				packet_buf_write(&advertised, "%s %s\n",
+						 sha1_to_hex(ref->old_sha1),
+						 ref->name);
+			else
+				packet_buf_write(&advertised, "%s %s%c%s\n",
+						 sha1_to_hex(ref->old_sha1),
+						 ref->name, 0,
+						 heads->capabilities ?
+						 heads->capabilities : "");
+		}
+		packet_buf_flush(&advertised);
+		memset(&v2_heads, 0, sizeof(v2_heads));
+		v2_heads.buf = advertised.buf;
+		v2_heads.len = advertised.len;
+		heads = &v2_heads;
+		rpc.command = "fetch";
+	}
+
 	err = rpc_service(&rpc, heads);
 	if (rpc.result.len)
 		safe_write(1, rpc.result.buf, rpc.result.len);
 	strbuf_release(&rpc.result);
 	strbuf_release(&preamble);
+	strbuf_release(&advertised);
 	free(depth_arg);
 	return err;
 }
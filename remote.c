@@ -1409,6 +1409,23 @@ static struct ref *get_local_ref(const char *name)
 	return alloc_ref_with_prefix("refs/heads/", 11, name);
 }
 
+void refspec_ref_prefixes(const struct refspec *refspec,
+			  struct string_list *prefixes)
+{
+	const char *name = refspec->src && refspec->src[0] ? refspec->src : "HEAD";
+	const char **p;
+
+	if (refspec->pattern) {
+		const char *glob = strchr(name, '*');
+		char *prefix = xstrndup(name, glob ? glob - name : strlen(name));
+		string_list_append(prefixes, prefix);
+		free(prefix);
+		return;
+	}
+	for (p = ref_fetch_rules; *p; p++)
+		string_list_append(prefixes, mkpath(*p, (int)strlen(name), name));
+}
+
 int get_fetch_map(const struct ref *remote_refs,
 		  const struct refspec *refspec,
 		  struct ref ***tail,
@@ -118,6 +118,13 @@ int get_fetch_map(const struct ref *remote_refs, const struct refspec *refspec,
 
 struct ref *get_remote_ref(const struct ref *remote_refs, const char *name);
 
+/*
+ * Add to prefixes (which must duplicate its strings) the prefixes of
+ * the remote refs that get_fetch_map() could match for refspec.
+ */
+void refspec_ref_prefixes(const struct refspec *refspec,
+			  struct string_list *prefixes);
+
 /*
  * For the given remote, reads the refspec's src and sets the other fields.
  */
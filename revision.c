@@ -135,6 +135,7 @@ void mark_tree_uninteresting(struct tree *tree)
 	 */
 	free(tree->buffer);
 	tree->buffer = NULL;
+	tree->object.parsed = 0;
 }
 
 void mark_parents_uninteresting(struct commit *commit)
@@ -74,6 +74,7 @@ struct rev_info {
 			tree_objects:1,
 			blob_objects:1,
 			verify_objects:1,
+			missing_trees_ok:1,
 			edge_hint:1,
 			limited:1,
 			unpacked:1,
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "dir.h"
+#include "string-list.h"
 
 static int inside_git_dir = -1;
 static int inside_work_tree = -1;
@@ -315,6 +316,9 @@ void setup_work_tree(void)
 	initialized = 1;
 }
 
+/* The extensions.* in the config that we do not know about */
+static struct string_list unknown_extensions = STRING_LIST_INIT_DUP;
+
 static int check_repository_format_gently(const char *gitdir, int *nongit_ok)
 {
 	char repo_config[PATH_MAX+1];
@@ -329,13 +333,25 @@ static int check_repository_format_gently(const char *gitdir, int *nongit_ok)
 	 * is a good one.
 	 */
 	snprintf(repo_config, PATH_MAX, "%s/config", gitdir);
+	string_list_clear(&unknown_extensions, 0);
 	git_config_early(check_repository_format_version, NULL, repo_config);
-	if (GIT_REPO_VERSION < repository_format_version) {
+	if (GIT_REPO_VERSION_READ < repository_format_version) {
 		if (!nongit_ok)
 			die ("Expected git repo version <= %d, found %d",
-			     GIT_REPO_VERSION, repository_format_version);
+			     GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Expected git repo version <= %d, found %d",
-			GIT_REPO_VERSION, repository_format_version);
+			GIT_REPO_VERSION_READ, repository_format_version);
+		warning("Please upgrade Git");
+		*nongit_ok = -1;
+		return -1;
+	}
+	/* version 0 predates extensions.*, which it does not honor */
+	if (repository_format_version >= 1 && unknown_extensions.nr) {
+		if (!nongit_ok)
+			die("unknown repository extension '%s'",
+			    unknown_extensions.items[0].string);
+		warning("unknown repository extension '%s'",
+			unknown_extensions.items[0].string);
 		warning("Please upgrade Git");
 		*nongit_ok = -1;
 		return -1;
@@ -753,6 +769,13 @@ int check_repository_format_version(const char *var, const char *value, void *cb
 {
 	if (strcmp(var, "core.repositoryformatversion") == 0)
 		repository_format_version = git_config_int(var, value);
+	else if (!prefixcmp(var, "extensions.")) {
+		const char *ext = var + strlen("extensions.");
+		if (!strcmp(ext, "reftables"))
+			repository_format_ref_tables = git_config_bool(var, value);
+		else
+			string_list_append(&unknown_extensions, ext);
+	}
 	else if (strcmp(var, "core.sharedrepository") == 0)
 		shared_repository = git_config_perm(var, value);
 	else if (strcmp(var, "core.bare") == 0) {
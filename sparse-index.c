@@ -0,0 +1,242 @@
+#include "cache.h"
+#include "tree.h"
+#include "cache-tree.h"
+#include "sparse-index.h"
+
+int command_requires_full_index = 1;
+
+struct expand_data {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	unsigned int nr, alloc;
+};
+
+static void append_entry(struct expand_data *ed, struct cache_entry *ce)
+{
+	ALLOC_GROW(ed->cache, ed->nr + 1, ed->alloc);
+	ed->cache[ed->nr++] = ce;
+}
+
+static int add_path_to_index(const unsigned char *sha1,
+			     const char *base, int baselen,
+			     const char *pathname, unsigned mode,
+			     int stage, void *context)
+{
+	struct expand_data *ed = context;
+	struct cache_entry *ce;
+	int len;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	len = baselen + strlen(pathname);
+	ce = xcalloc(1, cache_entry_size(len));
+	memcpy(ce->name, base, baselen);
+	memcpy(ce->name + baselen, pathname, len - baselen);
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(len, 0) | CE_SKIP_WORKTREE;
+	hashcpy(ce->sha1, sha1);
+	append_entry(ed, ce);
+	add_name_hash(ed->istate, ce);
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct expand_data ed;
+	struct pathspec pathspec;
+	unsigned int i;
+
+	if (!istate->sparse_index)
+		return;
+
+	memset(&ed, 0, sizeof(ed));
+	ed.istate = istate;
+	ed.alloc = alloc_nr(istate->cache_nr);
+	ed.cache = xmalloc(ed.alloc * sizeof(*ed.cache));
+	init_pathspec(&pathspec, NULL);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			append_entry(&ed, ce);
+			continue;
+		}
+		tree = parse_tree_indirect(ce->sha1);
+		if (!tree)
+			die("unable to read tree %s for sparse directory '%s'",
+			    sha1_to_hex(ce->sha1), ce->name);
+		if (read_tree_recursive(tree, ce->name, ce_namelen(ce), 0,
+					&pathspec, add_path_to_index, &ed))
+			die("unable to expand sparse directory '%s'", ce->name);
+		cache_tree_expand(istate->cache_tree, ce->name, tree);
+		remove_name_hash(ce);
+		free(ce);
+	}
+	free_pathspec(&pathspec);
+
+	free(istate->cache);
+	istate->cache = ed.cache;
+	istate->cache_nr = ed.nr;
+	istate->cache_alloc = ed.alloc;
+	istate->sparse_index = 0;
+}
+
+int index_path_in_sparse_dir(struct index_state *istate,
+			     const char *name, int namelen)
+{
+	struct cache_entry *ce;
+	int pos;
+
+	if (!istate->sparse_index)
+		return 0;
+	pos = index_name_pos(istate, name, namelen);
+	if (0 <= pos)
+		return 0;
+	/* a sparse directory containing name sorts right before it */
+	pos = -pos - 2;
+	if (pos < 0)
+		return 0;
+	ce = istate->cache[pos];
+	return S_ISSPARSEDIR(ce->ce_mode) &&
+		ce_namelen(ce) < namelen &&
+		!memcmp(ce->name, name, ce_namelen(ce));
+}
+
+/*
+ * Can the "nr" entries starting at "pos", which should be everything
+ * under the directory "path" (with its trailing slash), be replaced
+ * by a single sparse directory entry?
+ */
+static int is_sparse_dir(struct index_state *istate, int pos, int nr,
+			 const char *path, int pathlen)
+{
+	int i;
+
+	if (istate->cache_nr < pos + nr)
+		return 0;
+	for (i = pos; i < pos + nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) || !ce_skip_worktree(ce) ||
+		    (ce->ce_flags & (CE_REMOVE | CE_INTENT_TO_ADD)))
+			return 0;
+		if (ce_namelen(ce) <= pathlen || memcmp(ce->name, path, pathlen))
+			return 0;
+	}
+	if (i < istate->cache_nr) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (pathlen < ce_namelen(ce) && !memcmp(ce->name, path, pathlen))
+			return 0;
+	}
+	return 1;
+}
+
+static struct cache_entry *make_sparse_dir_entry(const char *path, int len,
+						 const unsigned char *sha1)
+{
+	struct cache_entry *ce = xcalloc(1, cache_entry_size(len));
+
+	memcpy(ce->name, path, len);
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(len, 0) | CE_SKIP_WORKTREE;
+	hashcpy(ce->sha1, sha1);
+	return ce;
+}
+
+static struct cache_tree *copy_cache_tree(struct cache_tree *it)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct cache_tree *copy;
+
+	cache_tree_write(&sb, it);
+	copy = cache_tree_read(sb.buf, sb.len);
+	strbuf_release(&sb);
+	return copy;
+}
+
+int collapse_sparse_index(struct index_state *istate,
+			  struct cache_entry ***cache_p,
+			  struct cache_tree **tree_p)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct cache_entry **cache;
+	struct cache_tree *tree = NULL;
+	int i, nr = 0;
+
+	/*
+	 * We need to know the trees of the directories to collapse; a
+	 * dry run is enough, as a directory can only be collapsed if
+	 * its tree is already in the repository anyway.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (!cache_tree_fully_valid(istate->cache_tree))
+		cache_tree_update(istate->cache_tree,
+				  istate->cache, istate->cache_nr,
+				  WRITE_TREE_SILENT | WRITE_TREE_DRY_RUN |
+				  WRITE_TREE_MISSING_OK);
+	tree = copy_cache_tree(istate->cache_tree);
+
+	cache = xmalloc(istate->cache_nr * sizeof(*cache));
+	for (i = 0; i < istate->cache_nr; ) {
+		struct cache_entry *ce = istate->cache[i];
+		struct cache_entry *prev = i ? istate->cache[i - 1] : NULL;
+		const char *slash;
+
+		/* the outermost directory that can be collapsed wins */
+		for (slash = strchr(ce->name, '/');
+		     slash;
+		     slash = strchr(slash + 1, '/')) {
+			int len = slash + 1 - ce->name;
+			struct cache_tree *it;
+
+			/* only look at a directory where it starts */
+			if (prev && len <= ce_namelen(prev) &&
+			    !memcmp(prev->name, ce->name, len))
+				continue;
+			strbuf_reset(&path);
+			strbuf_add(&path, ce->name, len);
+			it = cache_tree_find(istate->cache_tree, path.buf);
+			if (!it || it->entry_count <= 0 ||
+			    !has_sha1_file(it->sha1) ||
+			    !is_sparse_dir(istate, i, it->entry_count,
+					   path.buf, len))
+				continue;
+			cache[nr++] = make_sparse_dir_entry(path.buf, len, it->sha1);
+			cache_tree_collapse(tree, path.buf);
+			i += it->entry_count;
+			break;
+		}
+		if (!slash)
+			cache[nr++] = istate->cache[i++];
+	}
+	strbuf_release(&path);
+
+	*cache_p = cache;
+	*tree_p = tree;
+	return nr;
+}
+
+void free_sparse_cache(struct index_state *istate,
+		       struct cache_entry **cache, int nr,
+		       struct cache_tree **tree)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct cache_entry *ce = cache[i];
+		int pos;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+		pos = index_name_pos(istate, ce->name, ce_namelen(ce));
+		if (pos < 0 || istate->cache[pos] != ce)
+			free(ce);
+	}
+	free(cache);
+	cache_tree_free(tree);
+}
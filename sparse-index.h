@@ -0,0 +1,44 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+/*
+ * With index.sparse and core.sparseCheckout set, a directory whose
+ * entries are all stage #0 and marked CE_SKIP_WORKTREE is written to
+ * the index as a single "sparse directory" entry: its name is the
+ * directory name with a trailing slash, its mode S_IFDIR and its
+ * object name that of the tree (as found in the cache tree).  The
+ * "sdir" extension marks such an index, so that older versions of
+ * git refuse to read it.
+ *
+ * Most of the code expects one entry per path, so a sparse index is
+ * expanded back to the full list of entries right after reading it,
+ * unless the command has declared that it copes with sparse
+ * directory entries by clearing command_requires_full_index.
+ */
+extern int command_requires_full_index;
+
+/* Replace every sparse directory entry by the entries of its tree. */
+extern void ensure_full_index(struct index_state *istate);
+
+/*
+ * Does "name" lie inside one of the sparse directory entries of
+ * istate (so that it cannot be looked up without expanding it)?
+ */
+extern int index_path_in_sparse_dir(struct index_state *istate,
+				    const char *name, int namelen);
+
+/*
+ * Compute the entries of the sparse index to write for istate into
+ * *cache, and the cache tree that goes with them into *tree, leaving
+ * istate itself alone.  Returns the number of entries.  The array,
+ * the entries allocated for it and the tree are released with
+ * free_sparse_cache().
+ */
+extern int collapse_sparse_index(struct index_state *istate,
+				 struct cache_entry ***cache,
+				 struct cache_tree **tree);
+extern void free_sparse_cache(struct index_state *istate,
+			      struct cache_entry **cache, int nr,
+			      struct cache_tree **tree);
+
+#endif /* SPARSE_INDEX_H */
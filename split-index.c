@@ -0,0 +1,257 @@
+#include "cache.h"
+#include "split-index.h"
+#include "varint.h"
+
+/*
+ * Rewrite the shared index once more than this percentage of its
+ * entries are deleted or replaced, or new entries amount to that
+ * many.
+ */
+#define SPLIT_INDEX_MAX_PERCENT_CHANGE 20
+
+struct split_index *init_split_index(struct index_state *istate)
+{
+	if (!istate->split_index)
+		istate->split_index = xcalloc(1, sizeof(*istate->split_index));
+	return istate->split_index;
+}
+
+void discard_split_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+
+	if (!si)
+		return;
+	istate->split_index = NULL;
+	if (si->base) {
+		discard_index(si->base);
+		free(si->base->cache);
+		free(si->base);
+	}
+	free(si->dropped);
+	free(si->delta);
+	free(si);
+}
+
+int read_link_extension(struct index_state *istate,
+			const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_, *end = data + sz;
+	struct split_index *si;
+	unsigned int pos = 0;
+
+	if (sz < 20)
+		return error("corrupt link extension (too short)");
+	si = init_split_index(istate);
+	hashcpy(si->base_sha1, data);
+	data += 20;
+	si->nr_dropped = 0;
+	while (data < end) {
+		uintmax_t delta;
+
+		if (decode_varint_bounded(&data, end, &delta) ||
+		    delta >= UINT_MAX - pos)
+			return error("corrupt link extension");
+		pos += delta;
+		ALLOC_GROW(si->dropped, si->nr_dropped + 1, si->alloc_dropped);
+		si->dropped[si->nr_dropped++] = pos++;
+	}
+	return 0;
+}
+
+void write_link_extension(struct strbuf *sb, struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	unsigned int i, prev = 0;
+
+	strbuf_add(sb, si->base_sha1, 20);
+	for (i = 0; i < si->nr_dropped; i++) {
+		unsigned char buf[16];
+		int len = encode_varint(si->dropped[i] - prev, buf);
+		strbuf_add(sb, buf, len);
+		prev = si->dropped[i] + 1;
+	}
+}
+
+static struct cache_entry *dup_cache_entry(const struct cache_entry *ce)
+{
+	struct cache_entry *new = xmalloc(ce_size(ce));
+	memcpy(new, ce, ce_size(ce));
+	new->ce_flags &= ~CE_STATE_MASK;
+	new->next = NULL;
+	return new;
+}
+
+void merge_base_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base;
+	struct cache_entry **cache;
+	unsigned int i, j, d, nr, alloc;
+
+	if (!si->base) {
+		si->base = xcalloc(1, sizeof(*si->base));
+	} else {
+		discard_index(si->base);
+		free(si->base->cache);
+		memset(si->base, 0, sizeof(*si->base));
+	}
+	base = si->base;
+	read_index_from(base, git_path("sharedindex.%s",
+				       sha1_to_hex(si->base_sha1)));
+	if (hashcmp(base->sha1, si->base_sha1))
+		die("broken index, expect %s in %s, got %s",
+		    sha1_to_hex(si->base_sha1),
+		    git_path("sharedindex.%s", sha1_to_hex(si->base_sha1)),
+		    sha1_to_hex(base->sha1));
+	if (si->nr_dropped &&
+	    base->cache_nr <= si->dropped[si->nr_dropped - 1])
+		die("corrupt link extension, position %u out of range",
+		    si->dropped[si->nr_dropped - 1]);
+
+	alloc = alloc_nr(base->cache_nr - si->nr_dropped + istate->cache_nr);
+	cache = xcalloc(alloc, sizeof(*cache));
+	nr = i = j = d = 0;
+	while (i < base->cache_nr || j < istate->cache_nr) {
+		struct cache_entry *ce;
+
+		if (d < si->nr_dropped && si->dropped[d] == i) {
+			d++;
+			i++;
+			continue;
+		}
+		if (i == base->cache_nr)
+			ce = istate->cache[j++];
+		else if (j == istate->cache_nr)
+			ce = dup_cache_entry(base->cache[i++]);
+		else {
+			struct cache_entry *a = base->cache[i];
+			struct cache_entry *b = istate->cache[j];
+			int cmp = cache_name_compare(a->name, a->ce_flags,
+						     b->name, b->ce_flags);
+			if (cmp < 0)
+				ce = dup_cache_entry(base->cache[i++]);
+			else {
+				/* our own entry wins over a stale one */
+				if (!cmp)
+					i++;
+				ce = istate->cache[j++];
+			}
+		}
+		cache[nr++] = ce;
+	}
+
+	free(istate->cache);
+	istate->cache = cache;
+	istate->cache_nr = nr;
+	istate->cache_alloc = alloc;
+}
+
+static int ce_same_on_disk(const struct cache_entry *a,
+			   const struct cache_entry *b)
+{
+	unsigned int mask = CE_NAMEMASK | CE_STAGEMASK | CE_VALID |
+		CE_EXTENDED_FLAGS;
+
+	return !((a->ce_flags ^ b->ce_flags) & mask) &&
+		a->ce_ctime.sec == b->ce_ctime.sec &&
+		a->ce_ctime.nsec == b->ce_ctime.nsec &&
+		a->ce_mtime.sec == b->ce_mtime.sec &&
+		a->ce_mtime.nsec == b->ce_mtime.nsec &&
+		a->ce_dev == b->ce_dev &&
+		a->ce_ino == b->ce_ino &&
+		a->ce_mode == b->ce_mode &&
+		a->ce_uid == b->ce_uid &&
+		a->ce_gid == b->ce_gid &&
+		a->ce_size == b->ce_size &&
+		!hashcmp(a->sha1, b->sha1) &&
+		!strcmp(a->name, b->name);
+}
+
+static void add_dropped(struct split_index *si, unsigned int pos)
+{
+	ALLOC_GROW(si->dropped, si->nr_dropped + 1, si->alloc_dropped);
+	si->dropped[si->nr_dropped++] = pos;
+}
+
+static void add_delta(struct split_index *si, struct cache_entry *ce)
+{
+	ALLOC_GROW(si->delta, si->nr_delta + 1, si->alloc_delta);
+	si->delta[si->nr_delta++] = ce;
+}
+
+int prepare_split_index_delta(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base = si->base;
+	unsigned int i = 0, j = 0;
+
+	si->nr_dropped = si->nr_delta = 0;
+	if (!base)
+		return 1;
+
+	while (i < base->cache_nr || j < istate->cache_nr) {
+		struct cache_entry *ce = NULL;
+		int cmp;
+
+		if (j < istate->cache_nr) {
+			ce = istate->cache[j];
+			if (ce->ce_flags & CE_REMOVE) {
+				j++;
+				continue;
+			}
+		}
+		if (i == base->cache_nr)
+			cmp = 1;
+		else if (!ce)
+			cmp = -1;
+		else
+			cmp = cache_name_compare(base->cache[i]->name,
+						 base->cache[i]->ce_flags,
+						 ce->name, ce->ce_flags);
+		if (cmp < 0) {
+			add_dropped(si, i++);
+		} else if (cmp > 0) {
+			add_delta(si, ce);
+			j++;
+		} else {
+			if (!ce_same_on_disk(base->cache[i], ce)) {
+				add_dropped(si, i);
+				add_delta(si, ce);
+			}
+			i++;
+			j++;
+		}
+	}
+
+	return (si->nr_dropped + si->nr_delta) * 100 >
+		SPLIT_INDEX_MAX_PERCENT_CHANGE * base->cache_nr;
+}
+
+void replace_base_index(struct index_state *istate, const unsigned char *sha1)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base;
+	unsigned int i;
+
+	if (si->base) {
+		discard_index(si->base);
+		free(si->base->cache);
+		memset(si->base, 0, sizeof(*si->base));
+	} else
+		si->base = xcalloc(1, sizeof(*si->base));
+	base = si->base;
+
+	base->cache_alloc = alloc_nr(istate->cache_nr);
+	base->cache = xcalloc(base->cache_alloc, sizeof(*base->cache));
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		base->cache[base->cache_nr++] = dup_cache_entry(ce);
+	}
+	base->version = istate->version;
+	base->initialized = 1;
+	hashcpy(base->sha1, sha1);
+	hashcpy(si->base_sha1, sha1);
+}
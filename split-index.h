@@ -0,0 +1,50 @@
+#ifndef SPLIT_INDEX_H
+#define SPLIT_INDEX_H
+
+/*
+ * A split index keeps most of the entries in a "shared index" file,
+ * $GIT_DIR/sharedindex.<sha1>, which is rarely rewritten.  The index
+ * file proper only records the name of the shared index in its
+ * "link" extension, which positions of the shared index are no
+ * longer valid (deleted or replaced), and the entries that are new
+ * or differ from the shared index.
+ */
+struct split_index {
+	unsigned char base_sha1[20];
+	struct index_state *base;
+
+	/* positions in base->cache not to be used; sorted */
+	unsigned int *dropped;
+	unsigned int nr_dropped, alloc_dropped;
+
+	/* entries of the index that are not in base; sorted */
+	struct cache_entry **delta;
+	unsigned int nr_delta, alloc_delta;
+};
+
+extern struct split_index *init_split_index(struct index_state *istate);
+extern void discard_split_index(struct index_state *istate);
+
+extern int read_link_extension(struct index_state *istate,
+			       const void *data, unsigned long sz);
+extern void write_link_extension(struct strbuf *sb,
+				 struct index_state *istate);
+
+/*
+ * Called after reading an index file with a "link" extension, to
+ * load the shared index and fold it into the entries just read.
+ */
+extern void merge_base_index(struct index_state *istate);
+
+/*
+ * Compute the dropped positions and delta entries between the base
+ * and the current entries of istate.  Returns non-zero if there are
+ * so many of them that the shared index should be rewritten.
+ */
+extern int prepare_split_index_delta(struct index_state *istate);
+
+/* Make (copies of) the current entries of istate the new base. */
+extern void replace_base_index(struct index_state *istate,
+			       const unsigned char *sha1);
+
+#endif /* SPLIT_INDEX_H */
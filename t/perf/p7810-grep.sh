@@ -13,11 +13,23 @@ test_perf 'grep worktree, cheap regex' '
 test_perf 'grep worktree, expensive regex' '
 	git grep "^.* *some_nonexistent_string$" || :
 '
+test_perf 'grep worktree, expensive regex, ignoring case' '
+	git grep -i "^.* *some_nonexistent_string$" || :
+'
+test_perf 'grep worktree, regex around a literal' '
+	git grep -E "[a-z]+_nonexistent_[a-z]+" || :
+'
+test_perf 'grep worktree, frequent literal' '
+	git grep -c "static int" >/dev/null || :
+'
 test_perf 'grep --cached, cheap regex' '
 	git grep --cached some_nonexistent_string || :
 '
 test_perf 'grep --cached, expensive regex' '
 	git grep --cached "^.* *some_nonexistent_string$" || :
 '
+test_perf 'grep --cached, regex around a literal' '
+	git grep --cached -E "[a-z]+_nonexistent_[a-z]+" || :
+'
 
 test_done
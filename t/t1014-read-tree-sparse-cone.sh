@@ -0,0 +1,126 @@
+#!/bin/sh
+
+test_description='sparse checkout with cone patterns
+
+With core.sparseCheckoutCone, sparse checkout patterns that only name
+directories are matched as a set of directories; the result must be
+the same as matching them one by one.'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	mkdir -p a/b/c a/d e/f g &&
+	for f in top a/1 a/b/1 a/b/c/1 a/d/1 e/1 e/f/1 g/1
+	do
+		echo "$f" >$f || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git config core.sparseCheckout true &&
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	/a/
+	!/a/*/
+	/a/b/
+	/e/
+	!/e/*/
+	/e/f/
+	EOF
+	cat >expect <<-\EOF
+	H a/1
+	H a/b/1
+	H a/b/c/1
+	S a/d/1
+	H e/1
+	H e/f/1
+	S g/1
+	H top
+	EOF
+'
+
+test_expect_success 'patterns matched one by one' '
+	git read-tree -mu HEAD &&
+	git ls-files -t >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'patterns matched as directories' '
+	git config core.sparseCheckoutCone true &&
+	git read-tree -mu HEAD 2>err &&
+	! test -s err &&
+	git ls-files -t >actual &&
+	test_cmp expect actual &&
+	test_path_is_file a/b/c/1 &&
+	test_path_is_file e/f/1 &&
+	test_path_is_missing a/d &&
+	test_path_is_missing g
+'
+
+test_expect_success 'widening and narrowing with cone patterns' '
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	/g/
+	EOF
+	git read-tree -mu HEAD 2>err &&
+	! test -s err &&
+	cat >expect <<-\EOF &&
+	S a/1
+	S a/b/1
+	S a/b/c/1
+	S a/d/1
+	S e/1
+	S e/f/1
+	H g/1
+	H top
+	EOF
+	git ls-files -t >actual &&
+	test_cmp expect actual &&
+	test_path_is_file g/1 &&
+	test_path_is_missing a
+'
+
+test_expect_success 'other patterns fall back to matching one by one' '
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	a/b/c/
+	EOF
+	git read-tree -mu HEAD 2>err &&
+	grep "unrecognized pattern: .a/b/c/." err &&
+	grep "disabling cone pattern matching" err &&
+	cat >expect <<-\EOF &&
+	S a/1
+	S a/b/1
+	H a/b/c/1
+	S a/d/1
+	S e/1
+	S e/f/1
+	S g/1
+	H top
+	EOF
+	git ls-files -t >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cone patterns must include the top-level files' '
+	echo /e/ >.git/info/sparse-checkout &&
+	git read-tree -mu HEAD 2>err &&
+	grep "disabling cone pattern matching" err &&
+	cat >expect <<-\EOF &&
+	S a/1
+	S a/b/1
+	S a/b/c/1
+	S a/d/1
+	H e/1
+	H e/f/1
+	S g/1
+	S top
+	EOF
+	git ls-files -t >actual &&
+	test_cmp expect actual
+'
+
+test_done
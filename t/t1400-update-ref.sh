@@ -284,4 +284,71 @@ test_expect_success \
 	'git cat-file blob master@{2005-05-26 23:42}:F (expect OTHER)' \
 	'test OTHER = $(git cat-file blob "master@{2005-05-26 23:42}:F")'
 
+test_expect_success 'setup for --stdin' '
+	git update-ref refs/stdin/a $A &&
+	git update-ref refs/stdin/b $A &&
+	git update-ref refs/stdin/c $A &&
+	git pack-refs --all &&
+	git update-ref refs/stdin/d $A
+'
+
+test_expect_success 'update-ref --stdin applies all the updates' '
+	cat >stdin <<-EOF &&
+	update refs/stdin/a $B $A
+	create refs/stdin/new $B
+	delete refs/stdin/b $A
+	delete refs/stdin/c
+	delete refs/stdin/d
+	verify refs/stdin/missing
+	EOF
+	git update-ref -m "from stdin" --stdin <stdin &&
+	test $B = $(git rev-parse --verify refs/stdin/a) &&
+	test $B = $(git rev-parse --verify refs/stdin/new) &&
+	test_must_fail git rev-parse --verify refs/stdin/b &&
+	test_must_fail git rev-parse --verify refs/stdin/c &&
+	test_must_fail git rev-parse --verify refs/stdin/d &&
+	test_must_fail git rev-parse --verify refs/stdin/missing &&
+	! grep refs/stdin/[bcd] .git/packed-refs
+'
+
+test_expect_success 'update-ref --stdin is all or nothing' '
+	cat >stdin <<-EOF &&
+	update refs/stdin/a $A $B
+	delete refs/stdin/new $A
+	EOF
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "Cannot lock the ref .refs/stdin/new." err &&
+	test $B = $(git rev-parse --verify refs/stdin/a) &&
+	test $B = $(git rev-parse --verify refs/stdin/new) &&
+	echo "verify refs/stdin/a $A" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	echo "create refs/stdin/a $A" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	test $B = $(git rev-parse --verify refs/stdin/a)
+'
+
+test_expect_success 'update-ref --stdin rejects bad input' '
+	printf "update refs/stdin/a $A\nupdate refs/stdin/a $B\n" >stdin &&
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "Multiple updates for ref .refs/stdin/a. not allowed" err &&
+	echo "frobnicate refs/stdin/a" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	echo "update refs/stdin/a" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	echo "update refs/stdin/a nosuchvalue" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	echo "delete refs/stdin/a $Z" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	test $B = $(git rev-parse --verify refs/stdin/a)
+'
+
+test_expect_success 'update-ref --stdin with no-deref' '
+	git symbolic-ref refs/stdin/sym refs/stdin/a &&
+	printf "option no-deref\nupdate refs/stdin/sym $A\n" >stdin &&
+	git update-ref --stdin <stdin &&
+	test $A = $(git rev-parse --verify refs/stdin/sym) &&
+	test $B = $(git rev-parse --verify refs/stdin/a) &&
+	test_must_fail git symbolic-ref refs/stdin/sym
+'
+
 test_done
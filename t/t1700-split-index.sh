@@ -0,0 +1,154 @@
+#!/bin/sh
+
+test_description='split index mode tests'
+
+. ./test-lib.sh
+
+base_of () {
+	test-dump-split-index | sed -n "s/^base //p"
+}
+
+test_expect_success 'setup' '
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
+	do
+		echo $i >file$i || return 1
+	done &&
+	git update-index --add file* &&
+	git ls-files --stage >ls-files.expect &&
+	test-dump-split-index >actual &&
+	grep "not a split index" actual
+'
+
+test_expect_success 'enable split index' '
+	git update-index --split-index &&
+	test-dump-split-index >actual &&
+	own=$(sed -n "s/^own //p" actual) &&
+	base=$(sed -n "s/^base //p" actual) &&
+	test "$own" != "$base" &&
+	test -f .git/sharedindex.$base &&
+	sed -e "/^own /d" -e "/^base /d" actual >actual.rest &&
+	echo dropped >expect &&
+	test_cmp expect actual.rest &&
+	git ls-files --stage >ls-files.actual &&
+	test_cmp ls-files.expect ls-files.actual
+'
+
+test_expect_success 'modify one file' '
+	base=$(base_of) &&
+	echo modified >file3 &&
+	git update-index file3 &&
+	test-dump-split-index >actual &&
+	test "$(sed -n "s/^base //p" actual)" = "$base" &&
+	grep "^dropped 13\$" actual &&
+	grep "	file3\$" actual &&
+	test $(grep -c "	" actual) = 1 &&
+	echo "100644 $(git hash-object file3) 0	file3" >expect &&
+	git ls-files --stage file3 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'add and remove files' '
+	base=$(base_of) &&
+	: >new &&
+	git update-index --add new &&
+	git update-index --force-remove file5 &&
+	test-dump-split-index >actual &&
+	test "$(sed -n "s/^base //p" actual)" = "$base" &&
+	grep "^dropped 13 15\$" actual &&
+	grep "	new\$" actual &&
+	git ls-files >actual &&
+	! grep "^file5\$" actual &&
+	grep "^new\$" actual &&
+	test $(wc -l <actual) = 20
+'
+
+test_expect_success 'too many changes rewrite the shared index' '
+	base=$(base_of) &&
+	echo changed >file0 &&
+	echo changed >file1 &&
+	git update-index file0 file1 &&
+	test-dump-split-index >actual &&
+	newbase=$(sed -n "s/^base //p" actual) &&
+	test "$newbase" != "$base" &&
+	test -f .git/sharedindex.$newbase &&
+	grep "^dropped\$" actual &&
+	! grep "	" actual &&
+	git ls-files --stage file0 >actual &&
+	echo "100644 $(git hash-object file0) 0	file0" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commit and checkout keep the index split' '
+	git commit -q -m one &&
+	git checkout -q -b side &&
+	echo side >file9 &&
+	git commit -q -a -m side &&
+	git checkout -q master &&
+	test "$(cat file9)" = 9 &&
+	git diff-index --cached --exit-code HEAD &&
+	git diff-files --exit-code &&
+	test-dump-split-index >actual &&
+	grep "^base " actual
+'
+
+test_expect_success 'disable split index' '
+	git update-index --no-split-index &&
+	test-dump-split-index >actual &&
+	grep "not a split index" actual &&
+	git diff-index --cached --exit-code HEAD
+'
+
+test_expect_success 'core.splitIndex=true splits the index' '
+	test_config core.splitIndex true &&
+	: >another &&
+	git add another &&
+	test-dump-split-index >actual &&
+	grep "^base " actual &&
+	git ls-files another >actual &&
+	echo another >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.splitIndex=false writes a full index' '
+	test_config core.splitIndex false &&
+	git update-index --split-index 2>err &&
+	grep "core.splitIndex is set to false" err &&
+	: >yet-another &&
+	git add yet-another &&
+	test-dump-split-index >actual &&
+	grep "not a split index" actual
+'
+
+test_expect_success 'index with a missing shared index is refused' '
+	git update-index --split-index &&
+	base=$(base_of) &&
+	mv .git/sharedindex.$base .git/sharedindex.saved &&
+	test_must_fail git ls-files &&
+	mv .git/sharedindex.saved .git/sharedindex.$base &&
+	git ls-files >actual &&
+	grep "^yet-another\$" actual
+'
+
+test_expect_success 'index with a truncated link extension is refused' '
+	git update-index --split-index &&
+	git update-index --force-remove file6 &&
+	cp .git/index index.saved &&
+	test_when_finished "mv index.saved .git/index" &&
+	cat >truncate-link.perl <<-\EOF &&
+	use Digest::SHA qw(sha1);
+	local $/;
+	my $index = <STDIN>;
+	my $link = index($index, "link");
+	my $size = unpack("N", substr($index, $link + 4, 4));
+	die "no dropped entries" if $size <= 20;
+	# make the last varint continue past the end of the extension
+	substr($index, $link + 8 + $size - 1, 1) = "\x80";
+	substr($index, -20) = sha1(substr($index, 0, -20));
+	print $index;
+	EOF
+	"$PERL_PATH" truncate-link.perl <index.saved >.git/index &&
+	test_must_fail git ls-files 2>err &&
+	grep "corrupt link extension" err
+'
+
+test_done
@@ -0,0 +1,120 @@
+#!/bin/sh
+
+test_description='loading the index with several threads'
+
+. ./test-lib.sh
+
+has_extension () {
+	grep -a "$1" .git/index >/dev/null
+}
+
+test_expect_success 'setup' '
+	mkdir -p one/two three &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		echo $i >one/file$i &&
+		echo $i >one/two/file$i &&
+		echo $i >three/file$i &&
+		echo $i >file$i || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	git write-tree >/dev/null &&
+	git ls-files -s >expect.ls &&
+	test-dump-cache-tree >expect.tree
+'
+
+test_expect_success 'small indexes are written without offset table' '
+	git update-index --force-remove file0 &&
+	git update-index --add file0 &&
+	! has_extension EOIE &&
+	! has_extension IEOT
+'
+
+test_expect_success 'index.threads=4 writes offset table and EOIE' '
+	git config index.threads 4 &&
+	git update-index --force-remove file0 &&
+	git update-index --add file0 &&
+	git write-tree >/dev/null &&
+	has_extension EOIE &&
+	has_extension IEOT
+'
+
+test_expect_success 'threaded load gives the same entries and extensions' '
+	git ls-files -s >actual.ls &&
+	test_cmp expect.ls actual.ls &&
+	test-dump-cache-tree >actual.tree &&
+	test_cmp expect.tree actual.tree &&
+	git diff-index --cached --exit-code HEAD
+'
+
+test_expect_success 'single-threaded load ignores the offset table' '
+	git -c index.threads=false ls-files -s >actual.ls &&
+	test_cmp expect.ls actual.ls &&
+	git -c index.threads=1 diff-index --cached --exit-code HEAD
+'
+
+test_expect_success 'index version 4 restarts name compression per block' '
+	git update-index --index-version 4 &&
+	has_extension IEOT &&
+	git ls-files -s >actual.ls &&
+	test_cmp expect.ls actual.ls &&
+	git -c index.threads=1 ls-files -s >actual.ls &&
+	test_cmp expect.ls actual.ls &&
+	git -c index.threads=3 ls-files -s >actual.ls &&
+	test_cmp expect.ls actual.ls
+'
+
+# Add one to what the entry at the given offset strips from the
+# previous name, and fix up the checksum.
+cat >bad-strip.perl <<\EOF
+use Digest::SHA qw(sha1);
+local $/;
+my $index = <STDIN>;
+my $offset = $ARGV[0];
+if ($offset eq "second-block") {
+	my $ieot = index($index, "IEOT");
+	$offset = unpack("N", substr($index, $ieot + 4 + 4 + 4 + 8, 4));
+}
+# the name field follows the 62 bytes of stat data, sha1 and flags
+my $strip = ord(substr($index, $offset + 62, 1));
+die "long strip count" if $strip >= 128;
+substr($index, $offset + 62, 1) = chr($strip + 1);
+substr($index, -20) = sha1(substr($index, 0, -20));
+print $index;
+EOF
+
+test_expect_success 'index version 4 with a bad strip count is refused' '
+	cp .git/index index.saved &&
+	test_when_finished "mv index.saved .git/index" &&
+	"$PERL_PATH" bad-strip.perl 12 <index.saved >.git/index &&
+	test_must_fail git -c index.threads=1 ls-files 2>err &&
+	grep "malformed name field" err &&
+	"$PERL_PATH" bad-strip.perl second-block <index.saved >.git/index &&
+	test_must_fail git -c index.threads=1 ls-files 2>err &&
+	grep "malformed name field" err &&
+	test_must_fail git -c index.threads=3 ls-files 2>err &&
+	grep "malformed name field" err
+'
+
+test_expect_success 'index written without threads drops the extensions' '
+	git -c index.threads=false update-index --index-version 2 &&
+	! has_extension EOIE &&
+	! has_extension IEOT &&
+	git ls-files -s >actual.ls &&
+	test_cmp expect.ls actual.ls
+'
+
+test_expect_success 'split index keeps working with an offset table' '
+	git update-index --split-index &&
+	echo changed >one/file3 &&
+	git update-index one/file3 &&
+	git ls-files -s one/file3 >actual &&
+	echo "100644 $(git hash-object one/file3) 0	one/file3" >expect &&
+	test_cmp expect actual &&
+	git -c index.threads=1 ls-files -s >actual.ls &&
+	git ls-files -s >actual.threaded &&
+	test_cmp actual.ls actual.threaded
+'
+
+test_done
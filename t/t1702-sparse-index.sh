@@ -0,0 +1,125 @@
+#!/bin/sh
+
+test_description='sparse index
+
+With index.sparse, directories that lie entirely outside the sparse
+checkout are written to the index as a single tree entry.  Commands
+that understand such entries must give the same answers as with a
+full index, and all other commands must see the full index.'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	mkdir -p a b c/d deep/x/y &&
+	for f in a/1 a/2 b/1 b/2 c/1 c/d/1 deep/x/y/1 deep/x/2 top
+	do
+		echo "$f" >$f || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git tag initial &&
+	echo changed >b/1 &&
+	echo new >c/new &&
+	echo changed >deep/x/y/1 &&
+	echo changed >a/2 &&
+	git add . &&
+	test_tick &&
+	git commit -m second &&
+	git ls-files -s >expect.full &&
+	git diff-index --cached initial >expect.diff-index &&
+	git diff-index --cached initial -- deep >expect.diff-index-deep &&
+	git diff --cached --name-status initial >expect.diff-cached &&
+	git config core.sparseCheckout true &&
+	echo /a/ >.git/info/sparse-checkout &&
+	git config index.sparse true &&
+	git read-tree -mu HEAD
+'
+
+test_expect_success 'directories outside the checkout are collapsed' '
+	grep -a sdir .git/index &&
+	test_path_is_missing b &&
+	test_path_is_file a/1 &&
+	cat >expect <<-\EOF &&
+	a/1
+	a/2
+	b/
+	c/
+	deep/
+	top
+	EOF
+	git ls-files --sparse >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'other commands see the full index' '
+	git ls-files -s >actual &&
+	test_cmp expect.full actual
+'
+
+test_expect_success 'write-tree from a sparse index' '
+	git rev-parse HEAD^{tree} >expect &&
+	git write-tree >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff-index --cached with sparse directories' '
+	git diff-index --cached initial >actual &&
+	test_cmp expect.diff-index actual &&
+	git diff-index --cached initial -- deep >actual &&
+	test_cmp expect.diff-index-deep actual &&
+	git diff --cached --name-status initial >actual &&
+	test_cmp expect.diff-cached actual
+'
+
+test_expect_success 'status and diff with a sparse index' '
+	echo more >>a/1 &&
+	git status --porcelain -uno >actual &&
+	echo " M a/1" >expect &&
+	test_cmp expect actual &&
+	git diff --name-only >actual &&
+	echo a/1 >expect &&
+	test_cmp expect actual &&
+	git add a/1 &&
+	git ls-files --sparse >actual &&
+	grep "^b/$" actual
+'
+
+test_expect_success 'adding a path inside a sparse directory expands it' '
+	blob=$(echo new | git hash-object -w --stdin) &&
+	git update-index --add --cacheinfo 100644 $blob b/new &&
+	git ls-files --sparse >actual &&
+	grep "^b/new$" actual &&
+	grep "^b/1$" actual &&
+	grep "^deep/$" actual &&
+	git diff-index --cached --name-status HEAD >actual &&
+	cat >expect <<-\EOF &&
+	M	a/1
+	A	b/new
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a full index is written without index.sparse' '
+	git reset -q --hard &&
+	git -c index.sparse=false update-index --refresh &&
+	git -c index.sparse=false read-tree -mu HEAD &&
+	! grep -a sdir .git/index &&
+	git ls-files --sparse >actual &&
+	grep "^deep/x/y/1$" actual &&
+	git read-tree -mu HEAD &&
+	grep -a sdir .git/index
+'
+
+test_expect_success 'switching branches with a sparse index' '
+	git checkout -q initial &&
+	test_path_is_missing b &&
+	echo a/2 >expect &&
+	test_cmp expect a/2 &&
+	git ls-files -s >actual &&
+	git ls-tree -r initial | sed -e "s/ blob / /" -e "s/	/ 0	/" >expect &&
+	test_cmp expect actual &&
+	git diff-index --cached --exit-code HEAD
+'
+
+test_done
@@ -0,0 +1,85 @@
+#!/bin/sh
+
+test_description='parallel checkout with checkout--worker processes'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	for d in a b c d
+	do
+		mkdir $d &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo "$d $i" >$d/file$i || exit
+		done
+	done &&
+	echo top >top &&
+	echo crlf >b/text &&
+	echo "b/text eol=crlf" >.gitattributes &&
+	git add . &&
+	test_tick &&
+	git commit -q -m initial &&
+	for d in a b c d
+	do
+		echo "$d changed" >$d/file1 || exit
+	done &&
+	git rm -q -r -f c &&
+	git add . &&
+	test_tick &&
+	git commit -q -m second &&
+	git config checkout.workers 3 &&
+	git config checkout.thresholdForParallelism 1
+'
+
+test_expect_success 'checkout uses workers and writes the right contents' '
+	GIT_TRACE="$(pwd)/trace" git checkout -q HEAD^ &&
+	grep "checkout--worker" trace &&
+	echo "a 1" >expect &&
+	test_cmp expect a/file1 &&
+	echo "c 5" >expect &&
+	test_cmp expect c/file5 &&
+	git diff-files --exit-code &&
+	git diff-index --exit-code HEAD
+'
+
+test_expect_success 'converted files are written by the main process' '
+	rm -f a/file2 b/text &&
+	git reset -q --hard &&
+	printf "crlf\r\n" >expect &&
+	test_cmp expect b/text
+'
+
+test_expect_success 'reset --hard writes removed files back in parallel' '
+	rm -rf a d top &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git reset -q --hard &&
+	grep "checkout--worker" trace &&
+	echo "d 7" >expect &&
+	test_cmp expect d/file7 &&
+	echo top >expect &&
+	test_cmp expect top &&
+	git diff-files --exit-code
+'
+
+test_expect_success POSIXPERM 'executable bit is honored' '
+	git checkout -q master &&
+	chmod +x a/file2 &&
+	git update-index --chmod=+x a/file2 &&
+	test_tick &&
+	git commit -q -m exec &&
+	rm -rf a &&
+	git reset -q --hard &&
+	test -x a/file2 &&
+	! test -x a/file3
+'
+
+test_expect_success 'below the threshold no worker is started' '
+	git config checkout.thresholdForParallelism 1000 &&
+	rm -rf a &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git reset -q --hard &&
+	! grep "checkout--worker" trace &&
+	git diff-files --exit-code
+'
+
+test_done
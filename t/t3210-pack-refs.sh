@@ -118,4 +118,43 @@ test_expect_success 'pack, prune and repack' '
 	test_cmp all-of-them again
 '
 
+test_expect_success 'look up single refs in a large packed-refs file' '
+	commit=$(git rev-parse HEAD) &&
+	awk "BEGIN { for (i = 1000; i < 3000; i++)
+		print \"$commit refs/many/r\" i }" </dev/null >refs-to-pack &&
+	{
+		cat .git/packed-refs &&
+		cat refs-to-pack
+	} | sort -k 2 | grep -v "^#" >sorted-refs &&
+	{
+		echo "# pack-refs with: sorted " &&
+		cat sorted-refs
+	} >.git/packed-refs &&
+	for ref in refs/many/r1000 refs/many/r1999 refs/many/r2999 \
+		refs/heads/q refs/tags/foo
+	do
+		test "$(git rev-parse --verify $ref)" = \
+			"$(sed -n "s| $ref\$||p" sorted-refs)" || return 1
+	done &&
+	test_must_fail git rev-parse --verify refs/many/r3000 &&
+	test_must_fail git rev-parse --verify refs/many/r &&
+	test_must_fail git rev-parse --verify refs/many
+'
+
+test_expect_success 'packed-refs file not known to be sorted' '
+	sort -r -k 2 sorted-refs >.git/packed-refs &&
+	test "$(git rev-parse --verify refs/many/r1500)" = "$commit" &&
+	test_must_fail git rev-parse --verify refs/many/r3000 &&
+	cp sorted-refs .git/packed-refs &&
+	test "$(git rev-parse --verify refs/many/r1500)" = "$commit"
+'
+
+test_expect_success 'deleting a packed ref from a large packed-refs file' '
+	git update-ref -d refs/many/r2000 &&
+	test_must_fail git rev-parse --verify refs/many/r2000 &&
+	test "$(git rev-parse --verify refs/many/r2001)" = "$commit" &&
+	git show-ref | grep " refs/many/" >actual &&
+	test_line_count = 1999 actual
+'
+
 test_done
@@ -0,0 +1,124 @@
+#!/bin/sh
+
+test_description='packed refs stored in ref tables
+
+With core.packedRefsFormat=table, pack-refs stores the packed refs in
+a stack of binary ref tables instead of the packed-refs file.  All
+commands must see the same refs as with the packed-refs file.'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated one &&
+	awk "BEGIN { for (i = 1; i <= 2000; i++)
+		printf \"create refs/pull/%d/head HEAD\\n\", i }" </dev/null |
+	git update-ref --stdin &&
+	git branch topic one &&
+	git for-each-ref >expect &&
+	git show-ref -d >expect.show-ref
+'
+
+test_expect_success 'pack refs into a table' '
+	git config core.packedRefsFormat table &&
+	git pack-refs --all &&
+	test_path_is_missing .git/packed-refs &&
+	test_path_is_missing .git/refs/pull/1/head &&
+	test_line_count = 1 .git/ref-tables/tables.list &&
+	git for-each-ref >actual &&
+	test_cmp expect actual &&
+	git show-ref -d >actual &&
+	test_cmp expect.show-ref actual
+'
+
+test_expect_success 'ref tables bump the repository format version' '
+	echo true >expect.extension &&
+	git config extensions.refTables >actual &&
+	test_cmp expect.extension actual &&
+	echo 1 >expect.version &&
+	git config core.repositoryformatversion >actual &&
+	test_cmp expect.version actual &&
+	git init &&
+	git config core.repositoryformatversion >actual &&
+	test_cmp expect.version actual &&
+	git rev-parse --verify refs/pull/1/head
+'
+
+test_expect_success 'a repository in a newer format is refused' '
+	cp -R .git newer.git &&
+	git --git-dir=newer.git config core.repositoryformatversion 2 &&
+	test_must_fail git --git-dir=newer.git rev-parse --verify HEAD 2>err &&
+	grep "Expected git repo version <= 1, found 2" err
+'
+
+test_expect_success 'unknown extensions are refused in version 1 only' '
+	git init --bare ext.git &&
+	git --git-dir=ext.git config extensions.noSuchExtension true &&
+	git --git-dir=ext.git rev-parse --git-dir &&
+	git --git-dir=ext.git config core.repositoryformatversion 1 &&
+	test_must_fail git --git-dir=ext.git rev-parse --git-dir 2>err &&
+	grep "unknown repository extension .nosuchextension." err
+'
+
+test_expect_success 'look up single refs in the table' '
+	git rev-parse two one one >expect &&
+	git rev-parse refs/pull/1234/head topic annotated^{} >actual &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify refs/pull/12345/head
+'
+
+test_expect_success 'a loose ref overrides the table' '
+	git update-ref refs/pull/7/head one &&
+	git rev-parse one >expect &&
+	git rev-parse refs/pull/7/head >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'delete packed refs' '
+	git update-ref -d refs/pull/7/head &&
+	git branch -D topic &&
+	test_must_fail git rev-parse --verify refs/pull/7/head &&
+	test_must_fail git rev-parse --verify topic &&
+	grep -v -e refs/pull/7/head -e refs/heads/topic expect.show-ref >expect &&
+	git show-ref -d >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'deletions are stacked and compacted' '
+	awk "BEGIN { for (i = 100; i < 300; i++)
+		printf \"delete refs/pull/%d/head\\n\", i }" </dev/null |
+	git update-ref --stdin &&
+	for i in 11 12 13 14 15 16 17 18 19
+	do
+		git update-ref -d refs/pull/$i/head || return 1
+	done &&
+	test $(wc -l <.git/ref-tables/tables.list) -le 4 &&
+	test $(ls .git/ref-tables/*.ref | wc -l) = $(wc -l <.git/ref-tables/tables.list) &&
+	git show-ref >actual &&
+	test_line_count = 1794 actual &&
+	test_must_fail git rev-parse --verify refs/pull/150/head &&
+	test_must_fail git rev-parse --verify refs/pull/15/head &&
+	git rev-parse --verify refs/pull/10/head
+'
+
+test_expect_success 'a deleted packed ref can be recreated' '
+	git branch topic two &&
+	git pack-refs --all &&
+	test_line_count = 1 .git/ref-tables/tables.list &&
+	git rev-parse two >expect &&
+	git rev-parse topic >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'switch back to the packed-refs file' '
+	git for-each-ref >expect &&
+	git config core.packedRefsFormat text &&
+	git pack-refs --all &&
+	test_path_is_file .git/packed-refs &&
+	test_path_is_missing .git/ref-tables &&
+	git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -310,4 +310,29 @@ test_expect_success 'git add --dry-run --ignore-missing of non-existing file out
 	test_i18ncmp expect.err actual.err
 '
 
+test_expect_success 'add -u and commit with core.preloadindex on a large index' '
+	git reset --hard &&
+	mkdir -p many &&
+	for i in $(awk "BEGIN { for (i = 0; i < 3000; i++) print i }")
+	do
+		echo $i >many/$i || return 1
+	done &&
+	git add many &&
+	git commit -q -m many &&
+	echo changed >many/17 &&
+	echo changed >many/2500 &&
+	rm many/1000 &&
+	git -c core.preloadindex=true add -u many &&
+	git diff-index --cached --name-status HEAD >actual &&
+	printf "M\tmany/17\nD\tmany/1000\nM\tmany/2500\n" | sort >expect &&
+	sort actual >actual.sorted &&
+	test_cmp expect actual.sorted &&
+	echo again >many/42 &&
+	git -c core.preloadindex=true commit -q -m partial many/42 &&
+	git diff --name-only HEAD^ HEAD >actual &&
+	echo many/42 >expect &&
+	test_cmp expect actual &&
+	git diff-files --exit-code
+'
+
 test_done
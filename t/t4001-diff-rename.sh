@@ -102,4 +102,51 @@ test_expect_success 'setup for many rename source candidates' '
 	grep warning actual.err
 '
 
+test_expect_success 'setup files with unique contents' '
+	git reset --hard &&
+	mkdir -p unique &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		for j in 0 1 2 3 4 5 6 7 8 9
+		do
+			printf "line %s\\n" "$i$j" 1 2 3 4 5 6 7 "$j$i" \
+				>"unique/file$i$j" || return 1
+		done
+	done &&
+	git add unique &&
+	test_tick &&
+	git commit -m "unique contents"
+'
+
+test_expect_success 'basename matches are paired before the full matrix' '
+	mkdir -p moved &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		git mv "unique/file1$i" "moved/file1$i" &&
+		echo "edit $i" >>"moved/file1$i" || return 1
+	done &&
+	git add moved &&
+	git diff -M --cached --name-status >actual &&
+	grep "^R[0-9]*	unique/file10	moved/file10$" actual &&
+	test $(grep -c "^R" actual) = 10
+'
+
+test_expect_success 'threaded rename detection gives the same result' '
+	git reset --hard &&
+	mkdir -p other &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		for j in 0 1 2 3 4 5 6 7 8 9
+		do
+			git mv "unique/file$i$j" "other/moved-$i$j" &&
+			echo "edit $i$j" >>"other/moved-$i$j" || return 1
+		done
+	done &&
+	git add other &&
+	git -c diff.renameThreads=1 diff -M --cached --name-status >expect &&
+	git -c diff.renameThreads=4 diff -M --cached --name-status >actual &&
+	test_cmp expect actual &&
+	test $(grep -c "^R" actual) = 100
+'
+
 test_done
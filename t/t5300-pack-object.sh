@@ -400,6 +400,49 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'setup repository packed with deltas' '
+	test_create_repo reuse &&
+	(
+		cd reuse &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			test-genrandom foo $((i * 1000)) >file &&
+			echo $i >>small &&
+			git add file small &&
+			test_tick &&
+			git commit -q -m $i || exit
+		done &&
+		git repack -a -d -q &&
+		git verify-pack -v .git/objects/pack/pack-*.idx >verify &&
+		grep " 1 [0-9a-f]*$" verify
+	)
+'
+
+test_expect_success 'pack-objects --stdout copies a whole pack verbatim' '
+	(
+		cd reuse &&
+		git pack-objects --stdout --revs --all --delta-base-offset \
+			</dev/null >../reused.pack &&
+		cmp ../reused.pack .git/objects/pack/pack-*.pack
+	)
+'
+
+test_expect_success 'pack-objects --stdout rewrites deltas for partial packs' '
+	(
+		cd reuse &&
+		git pack-objects --stdout --revs --delta-base-offset \
+			>../partial.pack <<-\EOF &&
+		HEAD
+		^HEAD~3
+		EOF
+		git pack-objects --stdout --revs --all \
+			</dev/null >../ref-delta.pack
+	) &&
+	git index-pack -o partial.idx partial.pack &&
+	git index-pack -o ref-delta.idx ref-delta.pack &&
+	git verify-pack partial.idx ref-delta.idx
+'
+
 #
 # WARNING!
 #
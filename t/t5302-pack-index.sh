@@ -243,4 +243,13 @@ test_expect_success 'running index-pack in the object store' '
     test -f .git/objects/pack/pack-${pack1}.idx
 '
 
+test_expect_success 'index-pack --stdin resolves offset deltas while reading' '
+    pack7=$(git pack-objects --delta-base-offset test-7 <obj-list) &&
+    git index-pack --threads=1 -o 7-serial.idx "test-7-${pack7}.pack" &&
+    GIT_FORCE_THREADS=1 git index-pack --threads=2 --stdin 7-stdin.pack \
+	<"test-7-${pack7}.pack" &&
+    cmp 7-serial.idx 7-stdin.idx &&
+    cmp "test-7-${pack7}.pack" 7-stdin.pack
+'
+
 test_done
@@ -0,0 +1,91 @@
+#!/bin/sh
+
+test_description='receive-pack connectivity check using what index-pack saw
+
+index-pack --report-external lists the objects that the pack refers to
+but does not contain; receive-pack uses it to avoid walking history
+when all pushed ref values are in the pack.'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	mkdir dir &&
+	echo one >file &&
+	echo one >dir/file &&
+	git add file dir &&
+	test_tick &&
+	git commit -m one &&
+	git init --bare dst.git &&
+	git push dst.git master &&
+	git --git-dir=dst.git config receive.unpackLimit 1 &&
+	echo two >file &&
+	test_tick &&
+	git commit -a -m two
+'
+
+test_expect_success 'index-pack reports objects outside the pack' '
+	git rev-list --objects master^..master |
+	git pack-objects --stdout >two.pack &&
+	{
+		echo "external	$(git rev-parse master^)" &&
+		echo "external	$(git rev-parse master:dir)"
+	} | sort >expect &&
+	(
+		GIT_DIR=dst.git &&
+		export GIT_DIR &&
+		git index-pack --stdin --report-external <two.pack >out &&
+		sed -n -e "1s/^pack	[0-9a-f]*$/pack/p" out >actual &&
+		echo pack >expect.pack &&
+		test_cmp expect.pack actual &&
+		sed 1d out | sort >actual &&
+		test_cmp expect actual &&
+		git index-pack --stdin --strict --report-external <two.pack >out &&
+		sed 1d out | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'push through index-pack' '
+	echo three >file &&
+	test_tick &&
+	git commit -a -m three &&
+	git push dst.git master &&
+	git rev-parse master >expect &&
+	git --git-dir=dst.git rev-parse master >actual &&
+	test_cmp expect actual &&
+	git --git-dir=dst.git fsck
+'
+
+test_expect_success 'push a ref not in the pack along with one in it' '
+	echo four >file &&
+	test_tick &&
+	git commit -a -m four &&
+	git push dst.git master master~2:refs/heads/old &&
+	git rev-parse master master~2 >expect &&
+	git --git-dir=dst.git rev-parse master old >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'existing objects outside the pack must be connected' '
+	git checkout -b side master &&
+	echo five >file &&
+	test_tick &&
+	git commit -a -m five &&
+	echo six >file &&
+	test_tick &&
+	git commit -a -m six &&
+	git cat-file commit side^ |
+	git --git-dir=dst.git hash-object -w -t commit --stdin &&
+	test_must_fail git --git-dir=dst.git cat-file -e $(git rev-parse side^^{tree}) &&
+	zero=0000000000000000000000000000000000000000 &&
+	{
+		printf "0066%s %s refs/heads/side\n0000" $zero $(git rev-parse side) &&
+		git pack-objects --revs --stdout <<-\EOF
+		side
+		^side^
+		EOF
+	} | git receive-pack dst.git >/dev/null &&
+	test_must_fail git --git-dir=dst.git rev-parse --verify side
+'
+
+test_done
@@ -139,4 +139,28 @@ test_expect_success 'quickfetch should handle ~1000 refs (on Windows)' '
 
 '
 
+test_expect_success 'quickfetch notices a missing tree' '
+
+	mkdir dir &&
+	echo san >dir/file &&
+	git add dir &&
+	test_tick &&
+	git commit -m third &&
+	git rev-list --objects HEAD^..HEAD |
+	git pack-objects --stdout |
+	(
+		cd cloned &&
+		git unpack-objects
+	) &&
+	tree=$(git rev-parse HEAD:dir) &&
+	rm -f "cloned/.git/objects/$(echo $tree | sed -e "s|..|&/|")" &&
+	(
+		cd cloned &&
+		git fetch &&
+		git cat-file -e $tree &&
+		git fsck
+	)
+
+'
+
 test_done
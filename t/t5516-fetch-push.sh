@@ -690,6 +690,35 @@ test_expect_success 'deletion of a non-existent ref is not fed to post-receive a
 	)
 '
 
+test_expect_success 'a ref that cannot be written does not hold back the others' '
+	mk_test_with_hooks heads/master &&
+	orgmaster=$(cd testrepo && git show-ref -s --verify refs/heads/master) &&
+	newmaster=$(git show-ref -s --verify refs/heads/master) &&
+	git tag -a -m annotated annotated-master master &&
+	test_when_finished "git tag -d annotated-master" &&
+	test_must_fail git push testrepo master \
+		refs/tags/annotated-master:refs/heads/tagged 2>err &&
+	grep "master -> master" err &&
+	grep "remote rejected.*tagged (failed to write)" err &&
+	(
+		cd testrepo/.git &&
+		echo $newmaster >expect &&
+		git rev-parse refs/heads/master >actual &&
+		test_cmp expect actual &&
+		test_must_fail git rev-parse --verify refs/heads/tagged &&
+		cat >post-receive.expect <<-EOF &&
+		$orgmaster $newmaster refs/heads/master
+		EOF
+
+		cat >post-update.expect <<-EOF &&
+		refs/heads/master
+		EOF
+
+		test_cmp post-receive.expect post-receive.actual &&
+		test_cmp post-update.expect post-update.actual
+	)
+'
+
 test_expect_success 'deletion of a non-existent ref alone does trigger post-receive and post-update hooks' '
 	mk_test_with_hooks heads/master &&
 	git push testrepo :refs/heads/nonexistent &&
@@ -0,0 +1,106 @@
+#!/bin/sh
+
+test_description='fetch-pack with fetch.negotiationAlgorithm=skipping'
+
+. ./test-lib.sh
+
+# commit_chain <branch> <count>: add <count> commits on top of <branch>
+commit_chain () {
+	git checkout -q "$1" &&
+	awk "BEGIN { for (i = 1; i <= $2; i++) print i }" |
+	while read i
+	do
+		test_tick &&
+		echo "$1 $i" >file &&
+		git add file &&
+		git commit -q -m "$1 $i" || return 1
+	done
+}
+
+# fetch_with <algorithm>: fetch the server's master into a copy of the
+# client and count the "have" lines and the requests that carried them
+fetch_with () {
+	rm -rf "client-$1" &&
+	cp -R client "client-$1" &&
+	(
+		cd "client-$1" &&
+		GIT_TRACE_PACKET="$(pwd)/../trace-$1" &&
+		export GIT_TRACE_PACKET &&
+		git -c fetch.negotiationAlgorithm="$1" \
+			fetch-pack -k ../server refs/heads/master >../fetched-$1 &&
+		git cat-file -e $(git --git-dir=../server/.git rev-parse master)
+	) &&
+	grep -c "fetch-pack> have" "trace-$1" >"haves-$1" &&
+	grep -c "fetch-pack> 0000" "trace-$1" >"rounds-$1"
+}
+
+test_expect_success setup '
+	git init server &&
+	(
+		cd server &&
+		test_commit base &&
+		commit_chain master 10
+	) &&
+	git clone server client &&
+	(
+		cd client &&
+		git branch one master &&
+		git branch two master &&
+		git branch three master &&
+		commit_chain one 100 &&
+		commit_chain two 100 &&
+		commit_chain three 100 &&
+		git checkout -q master &&
+		git remote rm origin
+	) &&
+	(
+		cd server &&
+		commit_chain master 5
+	)
+'
+
+test_expect_success 'default negotiation walks every local commit' '
+	fetch_with default &&
+	test $(cat haves-default) -ge 300
+'
+
+test_expect_success 'skipping negotiation finds the common commit' '
+	fetch_with skipping &&
+	test_cmp fetched-default fetched-skipping &&
+	grep "fetch-pack< ACK $(git --git-dir=client/.git rev-parse master)" \
+		trace-skipping
+'
+
+test_expect_success 'skipping negotiation sends fewer haves in fewer rounds' '
+	test $(cat haves-skipping) -lt 100 &&
+	test $(cat rounds-skipping) -lt $(cat rounds-default)
+'
+
+test_expect_success 'tips and roots are always sent' '
+	git init unrelated &&
+	(
+		cd unrelated &&
+		test_commit root &&
+		commit_chain master 50 &&
+		GIT_TRACE_PACKET="$(pwd)/../trace-unrelated" &&
+		export GIT_TRACE_PACKET &&
+		git -c fetch.negotiationAlgorithm=skipping \
+			fetch-pack -k ../server refs/heads/master &&
+		git rev-parse master >expect &&
+		git rev-list --max-parents=0 master >>expect
+	) &&
+	sed -n "s/.*fetch-pack> have //p" trace-unrelated >have &&
+	grep -f unrelated/expect have >actual &&
+	test_line_count = 2 actual &&
+	test $(wc -l <have) -lt 20
+'
+
+test_expect_success 'unknown algorithm falls back to the default' '
+	rm -rf client-bogus &&
+	cp -R client client-bogus &&
+	git --git-dir=client-bogus/.git -c fetch.negotiationAlgorithm=bogus \
+		fetch-pack -k server refs/heads/master 2>err &&
+	grep "ignoring unknown" err
+'
+
+test_done
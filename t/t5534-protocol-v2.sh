@@ -0,0 +1,101 @@
+#!/bin/sh
+
+test_description='fetching with version 2 of the protocol'
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated &&
+	git branch other one &&
+	for i in 1 2 3
+	do
+		git update-ref refs/pull/$i/head HEAD || return 1
+	done
+'
+
+test_expect_success 'ls-remote lists the refs asked for' '
+	GIT_TRACE_PACKET=$(pwd)/trace \
+	git -c protocol.version=2 ls-remote --heads "file://$(pwd)" >actual &&
+	git for-each-ref --format="%(objectname)	%(refname)" refs/heads >expect &&
+	test_cmp expect actual &&
+	grep "< version 2" trace &&
+	grep "> ref-prefix refs/heads/" trace &&
+	! grep refs/pull trace
+'
+
+test_expect_success 'ls-remote peels tags' '
+	git -c protocol.version=2 ls-remote --tags "file://$(pwd)" >actual &&
+	git ls-remote --tags . >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone' '
+	rm -f trace &&
+	GIT_TRACE_PACKET=$(pwd)/trace \
+	git -c protocol.version=2 clone "file://$(pwd)" clone &&
+	git --git-dir=clone/.git rev-parse master origin/other annotated >actual &&
+	git rev-parse master other annotated >expect &&
+	test_cmp expect actual &&
+	grep "> command=fetch" trace &&
+	! grep refs/pull trace
+'
+
+test_expect_success 'fetch lists only the refs of its refspec' '
+	git commit --allow-empty -m three &&
+	rm -f trace &&
+	(
+		cd clone &&
+		GIT_TRACE_PACKET=$(pwd)/../trace \
+		git -c protocol.version=2 fetch origin \
+			refs/heads/master:refs/remotes/origin/master
+	) &&
+	git rev-parse master >expect &&
+	git --git-dir=clone/.git rev-parse origin/master >actual &&
+	test_cmp expect actual &&
+	grep "> ref-prefix refs/heads/master" trace &&
+	! grep refs/heads/other trace
+'
+
+test_expect_success 'version 0 is used when not configured' '
+	rm -f trace &&
+	GIT_TRACE_PACKET=$(pwd)/trace git ls-remote "file://$(pwd)" >/dev/null &&
+	! grep "version 2" trace &&
+	grep refs/pull trace
+'
+
+test_expect_success 'unknown protocol.version falls back to version 0' '
+	git -c protocol.version=5 ls-remote --heads "file://$(pwd)" >actual 2>err &&
+	grep "protocol.version" err &&
+	git ls-remote --heads . >expect &&
+	test_cmp expect actual
+'
+
+run_backend () {
+	REQUEST_METHOD=$1 \
+	CONTENT_TYPE=application/x-git-upload-pack-request \
+	QUERY_STRING="${2#*\?}" \
+	PATH_TRANSLATED="$(pwd)/.git/${2%%\?*}" \
+	HTTP_GIT_PROTOCOL=version=2 \
+	GIT_HTTP_EXPORT_ALL=1 \
+	git http-backend <request >act.out 2>act.err
+}
+
+test_expect_success 'http-backend advertises version 2' '
+	: >request &&
+	run_backend GET "info/refs?service=git-upload-pack" &&
+	grep "version 2" act.out &&
+	grep "fetch=" act.out &&
+	! grep refs/heads act.out
+'
+
+test_expect_success 'http-backend answers ls-refs' '
+	printf "0014command=ls-refs\n001bref-prefix refs/heads/\n0000" >request &&
+	run_backend POST git-upload-pack &&
+	grep "refs/heads/master" act.out &&
+	grep "refs/heads/other" act.out &&
+	! grep "refs/tags" act.out &&
+	! grep "refs/pull" act.out
+'
+
+test_done
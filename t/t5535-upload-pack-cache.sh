@@ -0,0 +1,116 @@
+#!/bin/sh
+
+test_description='upload-pack pack cache'
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated &&
+	git config uploadpack.packCacheSize 10m
+'
+
+test_expect_success 'first clone fills the cache' '
+	GIT_TRACE="$(pwd)/trace" git clone "file://$(pwd)" first &&
+	grep "run_command: .pack-objects" trace &&
+	ls .git/pack-cache >cached &&
+	test_line_count = 1 cached &&
+	! grep tmp_ cached
+'
+
+test_expect_success 'identical clone is served from the cache' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone "file://$(pwd)" second &&
+	! grep "run_command: .pack-objects" trace &&
+	git --git-dir=second/.git fsck &&
+	git --git-dir=second/.git rev-parse master annotated >actual &&
+	git rev-parse master annotated >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'new commits change the key' '
+	test_commit three &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone "file://$(pwd)" third &&
+	grep "run_command: .pack-objects" trace &&
+	git --git-dir=third/.git rev-parse master >actual &&
+	git rev-parse master >expect &&
+	test_cmp expect actual &&
+	ls .git/pack-cache >cached &&
+	test_line_count = 2 cached
+'
+
+test_expect_success 'fetches with haves are cached too' '
+	git commit --allow-empty -m four &&
+	(cd first && git fetch) &&
+	rm -f trace &&
+	(cd second && GIT_TRACE="$(pwd)/../trace" git fetch) &&
+	! grep "run_command: .pack-objects" trace &&
+	git --git-dir=second/.git rev-parse origin/master >actual &&
+	git rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects configuration changes the key' '
+	git config pack.compression 0 &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone "file://$(pwd)" uncompressed &&
+	grep "run_command: .pack-objects" trace &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone "file://$(pwd)" uncompressed2 &&
+	! grep "run_command: .pack-objects" trace &&
+	git config --unset pack.compression &&
+	git config pack.depth 1 &&
+	test_when_finished "git config --unset pack.depth" &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone "file://$(pwd)" shallow-deltas &&
+	grep "run_command: .pack-objects" trace
+'
+
+test_expect_success 'shallow clones are not cached' '
+	ls .git/pack-cache >before &&
+	git clone --depth=1 "file://$(pwd)" shallow &&
+	ls .git/pack-cache >after &&
+	test_cmp before after
+'
+
+test_expect_success 'client hanging up leaves no temporary pack' '
+	test-genrandom big 1000000 >big &&
+	git add big &&
+	test_tick &&
+	git commit -m big &&
+	printf "0032want %s\n00000009done\n" $(git rev-parse HEAD) >request &&
+	# stop reading as soon as the pack starts
+	test_might_fail git upload-pack . <request 2>/dev/null |
+	"$PERL_PATH" -e "
+		my \$seen = q();
+		while (sysread(STDIN, my \$buf, 4096)) {
+			\$seen .= \$buf;
+			exit 0 if \$seen =~ /PACK/;
+		}
+	" &&
+	ls .git/pack-cache >cached &&
+	! grep tmp_ cached
+'
+
+test_expect_success 'expired packs are not used' '
+	git config uploadpack.packCacheTTL 0 &&
+	for f in .git/pack-cache/*
+	do
+		test-chmtime -10 "$f" || return 1
+	done &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone "file://$(pwd)" fourth &&
+	grep "run_command: .pack-objects" trace
+'
+
+test_expect_success 'cache is kept within its size' '
+	git config --unset uploadpack.packCacheTTL &&
+	git config uploadpack.packCacheSize 1 &&
+	git commit --allow-empty -m five &&
+	git clone "file://$(pwd)" fifth &&
+	ls .git/pack-cache >cached &&
+	! test -s cached
+'
+
+test_done
@@ -202,6 +202,13 @@ test_expect_success 'fetch notices corrupt idx' '
 	)
 '
 
+test_expect_success 'fetch loose objects over a single connection' '
+	rm -rf clone-one &&
+	git -c http.version=HTTP/2 -c http.maxHostConnections=1 \
+		clone $HTTPD_URL/dumb/repo.git clone-one &&
+	(cd clone-one && git fsck --full)
+'
+
 test_expect_success 'did not use upload-pack service' '
 	grep '/git-upload-pack' <"$HTTPD_ROOT_PATH"/access.log >act
 	: >exp
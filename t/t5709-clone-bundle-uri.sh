@@ -0,0 +1,85 @@
+#!/bin/sh
+
+test_description='clone starting from a bundle'
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_commit one &&
+	test_commit two &&
+	git branch old &&
+	git bundle create old.bundle old &&
+	git bundle create thin.bundle one..old &&
+	test_commit three &&
+	echo garbage >broken.bundle &&
+	bundle_uri="file://$(pwd | sed -e "s/%/%25/g" -e "s/ /%20/g")/old.bundle"
+'
+
+test_expect_success 'clone --bundle-uri only fetches what the bundle lacks' '
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git clone --bundle-uri="$(pwd)/old.bundle" "file://$(pwd)" clone &&
+	git --git-dir=clone/.git rev-parse refs/bundles/heads/old >actual &&
+	git rev-parse old >expect &&
+	test_cmp expect actual &&
+	grep "clone> have $(git rev-parse old)" trace &&
+	git --git-dir=clone/.git fsck &&
+	git --git-dir=clone/.git rev-parse origin/master >actual &&
+	git rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone --bundle-uri with file:// URI' '
+	git clone --bundle-uri="$bundle_uri" "file://$(pwd)" clone-file &&
+	git --git-dir=clone-file/.git rev-parse --verify refs/bundles/heads/old
+'
+
+test_expect_success 'unusable bundles are ignored' '
+	git clone --bundle-uri="$(pwd)/broken.bundle" "file://$(pwd)" clone-broken 2>err &&
+	grep "could not unbundle" err &&
+	git clone --bundle-uri="$(pwd)/thin.bundle" "file://$(pwd)" clone-thin 2>err &&
+	grep "could not unbundle" err &&
+	git --git-dir=clone-thin/.git fsck &&
+	test_must_fail git --git-dir=clone-thin/.git rev-parse --verify refs/bundles/heads/old
+'
+
+test_expect_success 'bundle tips with missing history are ignored' '
+	{
+		echo "# v2 git bundle" &&
+		echo "$(git rev-parse old) refs/heads/old" &&
+		echo &&
+		git rev-list --objects one..old | git pack-objects --stdout
+	} >truncated.bundle &&
+	git clone --bundle-uri="$(pwd)/truncated.bundle" "file://$(pwd)" clone-truncated 2>err &&
+	grep "missing objects of refs/heads/old" err &&
+	test_must_fail git --git-dir=clone-truncated/.git rev-parse --verify refs/bundles/heads/old &&
+	git --git-dir=clone-truncated/.git fsck
+'
+
+# Nothing listens on port 1; trying to download from there shows that
+# the advertised URL was accepted.
+test_expect_success 'server-advertised bundle is only used when enabled' '
+	git config uploadpack.bundleURI http://127.0.0.1:1/old.bundle &&
+	git clone "file://$(pwd)" clone-default 2>err &&
+	! grep "bundle" err &&
+	git -c transfer.bundleURI=true clone "file://$(pwd)" clone-advertised 2>err &&
+	grep "could not download bundle http://127.0.0.1:1/old.bundle" err &&
+	git --git-dir=clone-advertised/.git fsck
+'
+
+test_expect_success 'server-advertised bundle with protocol v2' '
+	git -c transfer.bundleURI=true -c protocol.version=2 \
+		clone "file://$(pwd)" clone-v2 2>err &&
+	grep "could not download bundle http://127.0.0.1:1/old.bundle" err
+'
+
+test_expect_success 'local bundles advertised by the server are ignored' '
+	git config uploadpack.bundleURI "$bundle_uri" &&
+	git -c transfer.bundleURI=true clone "file://$(pwd)" clone-file-uri 2>err &&
+	grep "ignoring bundle URI" err &&
+	test_must_fail git --git-dir=clone-file-uri/.git rev-parse --verify refs/bundles/heads/old &&
+	git config uploadpack.bundleURI old.bundle &&
+	git -c transfer.bundleURI=true clone "file://$(pwd)" clone-path 2>err &&
+	grep "ignoring bundle URI" err &&
+	test_must_fail git --git-dir=clone-path/.git rev-parse --verify refs/bundles/heads/old
+'
+
+test_done
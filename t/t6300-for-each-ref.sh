@@ -456,4 +456,40 @@ test_atom refs/tags/signed-long contents "subject line
 body contents
 $sig"
 
+test_expect_success 'setup refs outside refs/heads and refs/tags' '
+	git update-ref refs/pull/1/head HEAD &&
+	git update-ref refs/pull/2/head HEAD &&
+	git update-ref refs/pulls/3 HEAD &&
+	git pack-refs --all &&
+	git update-ref refs/pull/4/head HEAD &&
+	git update-ref refs/heads/pull/5 HEAD
+'
+
+test_prefix () {
+	pattern=$1
+	shift
+	expect=$(printf "%s\n" "$@")
+	test_expect_success "for-each-ref $pattern" '
+		echo "$expect" | sed -e "/^\$/d" >expect &&
+		git for-each-ref --format="%(refname)" $pattern >actual &&
+		test_cmp expect actual
+	'
+}
+
+test_prefix refs/pull refs/pull/1/head refs/pull/2/head refs/pull/4/head
+test_prefix refs/pull/ refs/pull/1/head refs/pull/2/head refs/pull/4/head
+test_prefix refs/pull/4/head refs/pull/4/head
+test_prefix refs/pul
+test_prefix "refs/pul*/*" refs/pulls/3
+test_prefix "refs/pull/*/head" refs/pull/1/head refs/pull/2/head refs/pull/4/head
+test_prefix "refs/*/pull/*" refs/heads/pull/5
+test_prefix "refs/pull/[14]/head" refs/pull/1/head refs/pull/4/head
+test_prefix "refs/pull/1 refs/pulls" refs/pull/1/head refs/pulls/3
+
+test_expect_success 'branch -a does not list other refs' '
+	git branch -a >actual &&
+	grep "pull/5" actual &&
+	! grep "pull/[1234]" actual
+'
+
 test_done
@@ -0,0 +1,198 @@
+#!/bin/sh
+
+test_description='test untracked cache'
+
+. ./test-lib.sh
+
+# The tests work in a repository of its own, so that the files
+# they write do not show up as untracked.
+in_repo () {
+	(cd repo && "$@")
+}
+
+# Directories modified in the current second are never trusted, so
+# push the mtimes of recently modified ones back after every change,
+# to a different time each call.
+racy_offset=1000
+avoid_racy () {
+	racy_offset=$(($racy_offset - 1)) &&
+	for d in $(find repo -type d -mmin -1 \
+		   ! -path "repo/.git" ! -path "repo/.git/*")
+	do
+		test-chmtime =-$racy_offset "$d" || return 1
+	done
+}
+
+status_with_stats () {
+	rm -f trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	in_repo git status --porcelain "$@" >actual &&
+	avoid_racy
+}
+
+# core.untrackedCache=false drops the cache from the index it writes,
+# so work on a copy of it.
+status_without_cache () {
+	cp repo/.git/index index.copy &&
+	GIT_INDEX_FILE="$TRASH_DIRECTORY/index.copy" \
+	in_repo git -c core.untrackedCache=false status --porcelain "$@" >expect
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		mkdir dir1 dir2 dir3 &&
+		: >done &&
+		: >dir1/tracked &&
+		: >dir2/tracked &&
+		git add done dir1/tracked dir2/tracked &&
+		git commit -q -m initial &&
+		: >one &&
+		: >dir1/one &&
+		: >dir1/two &&
+		: >dir2/two &&
+		: >dir3/three &&
+		echo "*.ign" >.gitignore &&
+		: >dir1/ignored.ign &&
+		git update-index --untracked-cache
+	) &&
+	avoid_racy
+'
+
+test_expect_success 'status records untracked entries' '
+	status_with_stats &&
+	cat >expect <<-\EOF &&
+	?? .gitignore
+	?? dir1/one
+	?? dir1/two
+	?? dir2/two
+	?? dir3/
+	?? one
+	EOF
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	node creation: 4
+	directory invalidation: 0
+	opendir: 4
+	EOF
+	test_cmp expect trace
+'
+
+test_expect_success 'unchanged directories are not read again' '
+	status_with_stats &&
+	cat >expect <<-\EOF &&
+	node creation: 0
+	directory invalidation: 0
+	opendir: 0
+	EOF
+	test_cmp expect trace
+'
+
+test_expect_success 'a new file causes its directory to be read' '
+	: >repo/dir1/three &&
+	avoid_racy &&
+	status_with_stats &&
+	grep "^?? dir1/three\$" actual &&
+	cat >expect <<-\EOF &&
+	node creation: 0
+	directory invalidation: 1
+	opendir: 1
+	EOF
+	test_cmp expect trace
+'
+
+test_expect_success 'adding a file to the index invalidates its directories' '
+	in_repo git add dir1/three &&
+	status_with_stats &&
+	grep "^A  dir1/three\$" actual &&
+	! grep "^?? dir1/three\$" actual &&
+	cat >expect <<-\EOF &&
+	node creation: 0
+	directory invalidation: 0
+	opendir: 2
+	EOF
+	test_cmp expect trace
+'
+
+test_expect_success 'changing a .gitignore invalidates everything below it' '
+	echo "two" >>repo/.gitignore &&
+	status_with_stats &&
+	cat >expect <<-\EOF &&
+	A  dir1/three
+	?? .gitignore
+	?? dir1/one
+	?? dir3/
+	?? one
+	EOF
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	node creation: 0
+	directory invalidation: 4
+	opendir: 4
+	EOF
+	test_cmp expect trace
+'
+
+test_expect_success 'changing info/exclude resets the cache' '
+	echo one >>repo/.git/info/exclude &&
+	status_with_stats &&
+	cat >expect <<-\EOF &&
+	A  dir1/three
+	?? .gitignore
+	?? dir3/
+	EOF
+	test_cmp expect actual &&
+	grep "^node creation: 4\$" trace
+'
+
+test_expect_success 'status -uall resets the cache' '
+	status_with_stats -uall &&
+	status_without_cache -uall &&
+	test_cmp expect actual &&
+	grep "dir3/three" actual &&
+	grep "^node creation: 4\$" trace &&
+	status_with_stats &&
+	status_without_cache &&
+	test_cmp expect actual &&
+	grep "^node creation: 4\$" trace
+'
+
+test_expect_success 'a removed directory is noticed' '
+	rm -r repo/dir3 &&
+	avoid_racy &&
+	status_with_stats &&
+	! grep dir3 actual &&
+	grep "^opendir: 1\$" trace
+'
+
+test_expect_success 'untracked cache is kept across checkout' '
+	in_repo git commit -q -m three &&
+	: >repo/dir2/new &&
+	(
+		cd repo &&
+		git checkout -q -b side &&
+		git rm -q dir2/tracked &&
+		git commit -q -m side &&
+		git checkout -q master
+	) &&
+	avoid_racy &&
+	status_with_stats &&
+	status_without_cache &&
+	test_cmp expect actual &&
+	grep "^node creation: 0\$" trace &&
+	in_repo git checkout -q side &&
+	avoid_racy &&
+	status_with_stats &&
+	status_without_cache &&
+	test_cmp expect actual &&
+	grep "^?? dir2/\$" actual
+'
+
+test_expect_success 'disable the untracked cache' '
+	in_repo git update-index --no-untracked-cache &&
+	status_with_stats &&
+	test_path_is_missing trace
+'
+
+test_done
@@ -0,0 +1,158 @@
+#!/bin/sh
+
+test_description='git status with file system monitor hook'
+
+. ./test-lib.sh
+
+# The hook logs the arguments it was called with and reports the
+# paths recorded in "changed" by mark_changed after the token it is
+# given, NUL separated.
+mkdir -p .git/hooks
+write_script .git/hooks/fsmonitor-test <<\EOF
+echo "$*" >>"$HOOK_LOG"
+test -f "$HOOK_CHANGED" || exit 0
+while read time path
+do
+	test "$time" -gt "$2" && echo "$path"
+done <"$HOOK_CHANGED" | tr "\n" "\0"
+EOF
+
+# Record the paths as changed now, in the nanoseconds of the token.
+mark_changed () {
+	now=$("$PERL_PATH" -MTime::HiRes=gettimeofday \
+		-e "printf qq{%d%06d000}, gettimeofday") &&
+	for path
+	do
+		echo "$now $path"
+	done >>"$HOOK_CHANGED"
+}
+
+HOOK_LOG="$TRASH_DIRECTORY/hook-log"
+HOOK_CHANGED="$TRASH_DIRECTORY/changed"
+export HOOK_LOG HOOK_CHANGED
+
+test_expect_success 'setup' '
+	mkdir dir1 dir2 &&
+	echo 1 >file1 &&
+	echo 2 >file2 &&
+	echo 3 >dir1/file3 &&
+	echo 4 >dir2/file4 &&
+	cat >.gitignore <<-\EOF &&
+	.gitignore
+	expect*
+	actual*
+	changed
+	hook-log
+	index.*
+	tokens
+	EOF
+	git add file1 file2 dir1 dir2 &&
+	git commit -q -m initial &&
+	git config core.fsmonitor .git/hooks/fsmonitor-test
+'
+
+test_expect_success 'the first refresh records the token without asking' '
+	git status --porcelain >actual &&
+	! test -s actual &&
+	test_path_is_missing hook-log
+'
+
+test_expect_success 'the hook is asked with the recorded token' '
+	git status --porcelain >actual &&
+	! test -s actual &&
+	test $(wc -l <hook-log) = 1 &&
+	grep "^1 [1-9][0-9]*\$" hook-log
+'
+
+test_expect_success 'unreported changes are not seen' '
+	echo changed >file1 &&
+	echo changed >dir1/file3 &&
+	git diff-files --name-only >actual &&
+	! test -s actual &&
+	git status --porcelain >actual &&
+	! test -s actual
+'
+
+test_expect_success 'reported files are checked' '
+	mark_changed file1 &&
+	git diff-files --name-only >actual &&
+	echo file1 >expect &&
+	test_cmp expect actual &&
+	git status --porcelain >actual &&
+	echo " M file1" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reported directories are checked' '
+	mark_changed dir1 &&
+	git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M dir1/file3
+	 M file1
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'entries found modified stay invalid' '
+	git status --porcelain >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the token moves forward' '
+	tail -n 2 hook-log | cut -d" " -f2 >tokens &&
+	first=$(sed -n 1p tokens) &&
+	second=$(sed -n 2p tokens) &&
+	test "$first" -lt "$second"
+'
+
+test_expect_success 'a clean status does not write the index' '
+	git reset -q --hard &&
+	test-chmtime =-60 file1 file2 dir1/file3 dir2/file4 &&
+	git update-index --really-refresh &&
+	git status --porcelain &&
+	test-chmtime =-30 .git/index &&
+	test-chmtime -v +0 .git/index >index.before &&
+	git status --porcelain >actual &&
+	! test -s actual &&
+	git status --porcelain >actual &&
+	! test -s actual &&
+	test-chmtime -v +0 .git/index >index.after &&
+	test_cmp index.before index.after &&
+	tail -n 2 hook-log | cut -d" " -f2 >tokens &&
+	first=$(sed -n 1p tokens) &&
+	second=$(sed -n 2p tokens) &&
+	test "$first" = "$second"
+'
+
+test_expect_success '"/" from the hook invalidates everything' '
+	git reset -q --hard &&
+	git status --porcelain >actual &&
+	! test -s actual &&
+	echo changed >file2 &&
+	git status --porcelain >actual &&
+	! test -s actual &&
+	mark_changed / &&
+	git status --porcelain >actual &&
+	echo " M file2" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a failing hook invalidates everything' '
+	git reset -q --hard &&
+	git status --porcelain &&
+	echo changed >file1 &&
+	test_config core.fsmonitor false &&
+	git status --porcelain >actual &&
+	echo " M file1" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '--really-refresh ignores the file system monitor' '
+	git reset -q --hard &&
+	git status --porcelain &&
+	echo changed >file2 &&
+	test_must_fail git update-index --really-refresh >actual &&
+	grep "^file2: needs update\$" actual
+'
+
+test_done
@@ -916,4 +916,61 @@ test_expect_success LIBPCRE 'grep -P "^ "' '
 	test_cmp expected actual
 '
 
+cat >literal <<EOF
+acd
+abd
+xy in a line of its own
+an xy that is not followed by a z
+a later xyz
+EOF
+
+test_expect_success 'grep with optional parts next to a literal' '
+	git add literal &&
+	cat >expected <<-\EOF &&
+	literal:acd
+	literal:abd
+	EOF
+	git grep "ab*[cd]" literal >actual &&
+	test_cmp expected actual &&
+	git grep -E "a(b)?[cd]" literal >actual &&
+	test_cmp expected actual &&
+	git grep "a\(bc\)*[bc]*d" literal >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep skips lines that contain the literal but do not match' '
+	echo "literal:5:a later xyz" >expected &&
+	git grep -n "later xy[z]" literal >actual &&
+	test_cmp expected actual &&
+	git grep -n -i "LATER XY[Z]" literal >actual &&
+	test_cmp expected actual &&
+	git grep -n "xyz*z" literal >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep with threads gives the same output' '
+	git grep -n --threads=1 -e "a" -e "o" >expected &&
+	git grep -n --threads=4 -e "a" -e "o" >actual &&
+	test_cmp expected actual &&
+	git -c grep.threads=4 grep -c -e "a" -e "o" >actual &&
+	git grep -c --threads=1 -e "a" -e "o" >expected &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep with threads splits a large file in order' '
+	"$PERL_PATH" -e "print qq{line \$_\n} for 1..300000" >large &&
+	git add large &&
+	git grep -n --threads=1 "line 1.*7$" large >expected &&
+	git grep -n --threads=4 "line 1.*7$" large >actual &&
+	test_cmp expected actual &&
+	git grep -n --threads=4 -v "1" large >actual &&
+	git grep -n --threads=1 -v "1" large >expected &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep rejects a negative number of threads' '
+	test_must_fail git grep --threads=-1 a &&
+	test_must_fail git -c grep.threads=-1 grep a
+'
+
 test_done
@@ -0,0 +1,166 @@
+#!/bin/sh
+
+test_description='git grep with a trigram index'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	cat >hello.c <<-\EOF &&
+	#include <stdio.h>
+	int main(void)
+	{
+		printf("Hello world.\n");
+		return 0;
+	}
+	EOF
+	cat >other.c <<-\EOF &&
+	static int count_lines(const char *buf)
+	{
+		return 0;
+	}
+	EOF
+	printf "binary\0Hello world\n" >binary &&
+	echo ab >short &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git update-grep-index &&
+	test -f .git/objects/pack/grep-index
+'
+
+check_grep () {
+	test_expect_success "grep $1 with the index" "
+		test_might_fail git -c grep.trigramIndex=false grep $1 HEAD >expected &&
+		test_might_fail git grep $1 HEAD >actual &&
+		test_cmp expected actual &&
+		test_might_fail git -c grep.trigramIndex=false grep --cached $1 >expected &&
+		test_might_fail git grep --cached $1 >actual &&
+		test_cmp expected actual
+	"
+}
+
+check_grep "-e Hello"
+check_grep "-i -e hello"
+check_grep "-F -e 'world.'"
+check_grep "-w -e count"
+check_grep "-n -e 'print.*world'"
+check_grep "-e Hello -e lines"
+check_grep "-e Hello --and -e world"
+check_grep "-e return --and --not -e Hello"
+check_grep "-c -e 'return 0'"
+check_grep "-l -e main"
+check_grep "-L -e main"
+check_grep "-v -e main"
+check_grep "-e ab"
+check_grep "-E -e '(foo|main)'"
+check_grep "-e nosuchstring"
+
+other_object () {
+	sha1=$(git rev-parse HEAD:other.c) &&
+	echo .git/objects/$(echo $sha1 | sed -e "s|^..|&/|")
+}
+
+test_expect_success 'grep does not read blobs that cannot match' '
+	mv "$(other_object)" saved-object &&
+	test_when_finished "mv saved-object \"$(other_object)\"" &&
+	cat >expected <<-\EOF &&
+	HEAD:hello.c:printf("Hello world.\n");
+	EOF
+	git grep printf HEAD >actual 2>err &&
+	test_cmp expected actual &&
+	! test -s err &&
+	git -c grep.trigramIndex=false grep printf HEAD >actual 2>err &&
+	test_cmp expected actual &&
+	test -s err
+'
+
+test_expect_success 'blobs missing from the index are searched' '
+	echo "printf in a new file" >new.c &&
+	git add new.c &&
+	test_tick &&
+	git commit -m new &&
+	cat >expected <<-\EOF &&
+	HEAD:hello.c:printf("Hello world.\n");
+	HEAD:new.c:printf in a new file
+	EOF
+	git grep printf HEAD >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'update-grep-index only adds new blobs' '
+	git update-grep-index -v HEAD HEAD^ 2>err &&
+	echo "Added 1 blob to the grep index." >expected &&
+	test_cmp expected err &&
+	git update-grep-index -v 2>err &&
+	echo "Added 0 blobs to the grep index." >expected &&
+	test_cmp expected err &&
+	git grep printf HEAD >actual &&
+	cat >expected <<-\EOF &&
+	HEAD:hello.c:printf("Hello world.\n");
+	HEAD:new.c:printf in a new file
+	EOF
+	test_cmp expected actual
+'
+
+test_expect_success 'binary blobs are always searched' '
+	echo "HEAD:binary" >expected &&
+	git grep -l -a "Hello world" HEAD -- binary >actual &&
+	test_cmp expected actual
+'
+
+cat >expected-printf <<\EOF
+HEAD:hello.c:printf("Hello world.\n");
+HEAD:new.c:printf in a new file
+EOF
+
+test_expect_success 'a truncated index is ignored and rebuilt' '
+	cp .git/objects/pack/grep-index saved-index &&
+	test_when_finished "mv -f saved-index .git/objects/pack/grep-index" &&
+	printf GIDX >.git/objects/pack/grep-index &&
+	git grep printf HEAD >actual 2>err &&
+	test_cmp expected-printf actual &&
+	grep "too short" err &&
+	git update-grep-index -v 2>err &&
+	grep "Added 5 blobs" err &&
+	git grep printf HEAD >actual 2>err &&
+	test_cmp expected-printf actual &&
+	! test -s err
+'
+
+test_expect_success 'an index with broken postings is ignored and rebuilt' '
+	cp .git/objects/pack/grep-index saved-index &&
+	test_when_finished "mv -f saved-index .git/objects/pack/grep-index" &&
+	"$PERL_PATH" -e "
+		local \$/;
+		my \$ix = <STDIN>;
+		substr(\$ix, -5, 1) = chr(0x80);
+		print \$ix;
+	" <saved-index >.git/objects/pack/grep-index &&
+	git grep printf HEAD >actual 2>err &&
+	test_cmp expected-printf actual &&
+	grep "is corrupt" err &&
+	git update-grep-index -v 2>err &&
+	grep "Added 5 blobs" err &&
+	git grep printf HEAD >actual 2>err &&
+	test_cmp expected-printf actual &&
+	! test -s err
+'
+
+test_expect_success 'update-grep-index --rebuild drops blobs no longer wanted' '
+	git rm -q new.c &&
+	test_tick &&
+	git commit -m "remove new.c" &&
+	git update-grep-index -v 2>err &&
+	grep "Added 0 blobs" err &&
+	git update-grep-index -v --rebuild 2>err &&
+	grep "Added 4 blobs" err &&
+	git grep printf HEAD^ >actual &&
+	sed -e "s/^HEAD:/HEAD^:/" expected-printf >expected &&
+	test_cmp expected actual
+'
+
+test_expect_success 'update-grep-index rejects what is not a tree' '
+	test_must_fail git update-grep-index nosuchref
+'
+
+test_done
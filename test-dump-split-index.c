@@ -0,0 +1,29 @@
+#include "cache.h"
+#include "split-index.h"
+
+int main(int ac, char **av)
+{
+	struct split_index *si;
+	unsigned int i;
+
+	setup_git_directory();
+	read_cache();
+	printf("own %s\n", sha1_to_hex(the_index.sha1));
+	si = the_index.split_index;
+	if (!si) {
+		printf("not a split index\n");
+		return 0;
+	}
+	printf("base %s\n", sha1_to_hex(si->base_sha1));
+	printf("dropped");
+	for (i = 0; i < si->nr_dropped; i++)
+		printf(" %u", si->dropped[i]);
+	printf("\n");
+	prepare_split_index_delta(&the_index);
+	for (i = 0; i < si->nr_delta; i++) {
+		struct cache_entry *ce = si->delta[i];
+		printf("%06o %s %d\t%s\n", ce->ce_mode,
+		       sha1_to_hex(ce->sha1), ce_stage(ce), ce->name);
+	}
+	return 0;
+}
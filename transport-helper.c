@@ -831,6 +831,13 @@ static struct ref *get_refs_list(struct transport *transport, int for_push)
 		return transport->get_refs_list(transport, for_push);
 	}
 
+	if (transport->ref_prefixes && !for_push) {
+		int i;
+		for (i = 0; i < transport->ref_prefixes->nr; i++)
+			set_helper_option(transport, "ref-prefix",
+					  transport->ref_prefixes->items[i].string);
+	}
+
 	if (data->push && for_push)
 		write_str_in_full(helper->in, "list for-push\n");
 	else
@@ -451,6 +451,7 @@ struct git_transport_data {
 	struct child_process *conn;
 	int fd[2];
 	unsigned got_remote_heads : 1;
+	unsigned protocol_v2 : 1;
 	struct extra_have_objects extra_have;
 };
 
@@ -496,20 +497,38 @@ static int connect_setup(struct transport *transport, int for_push, int verbose)
 	data->conn = git_connect(data->fd, transport->url,
 				 for_push ? data->options.receivepack :
 				 data->options.uploadpack,
-				 verbose ? CONNECT_VERBOSE : 0);
+				 (verbose ? CONNECT_VERBOSE : 0) |
+				 (!for_push && get_protocol_version_config() == 2 ?
+				  CONNECT_PROTOCOL_V2 : 0));
 
 	return 0;
 }
 
+/*
+ * Read the refs of the remote side.  A version 2 server does not list
+ * them by itself; ask it for the ones starting with the prefixes.
+ */
+static void get_remote_refs(struct git_transport_data *data, struct ref **refs,
+			    unsigned int flags,
+			    struct extra_have_objects *extra_have,
+			    const struct string_list *prefixes)
+{
+	get_remote_heads(data->fd[0], refs, flags, extra_have);
+	data->protocol_v2 = server_protocol_version() == 2;
+	if (data->protocol_v2)
+		get_remote_refs_v2(data->fd[0], data->fd[1], refs, flags,
+				   prefixes);
+	data->got_remote_heads = 1;
+}
+
 static struct ref *get_refs_via_connect(struct transport *transport, int for_push)
 {
 	struct git_transport_data *data = transport->data;
 	struct ref *refs;
 
 	connect_setup(transport, for_push, 0);
-	get_remote_heads(data->fd[0], &refs,
-			 for_push ? REF_NORMAL : 0, &data->extra_have);
-	data->got_remote_heads = 1;
+	get_remote_refs(data, &refs, for_push ? REF_NORMAL : 0,
+			&data->extra_have, transport->ref_prefixes);
 
 	return refs;
 }
@@ -541,10 +560,16 @@ static int fetch_refs_via_pack(struct transport *transport,
 		origh[i] = heads[i] = xstrdup(to_fetch[i]->name);
 
 	if (!data->got_remote_heads) {
+		struct string_list names = STRING_LIST_INIT_NODUP;
+
+		for (i = 0; i < nr_heads; i++)
+			string_list_append(&names, heads[i]);
 		connect_setup(transport, 0, 0);
-		get_remote_heads(data->fd[0], &refs_tmp, 0, NULL);
-		data->got_remote_heads = 1;
+		get_remote_refs(data, &refs_tmp, 0, NULL, &names);
+		string_list_clear(&names, 0);
 	}
+	if (data->protocol_v2)
+		packet_write(data->fd[1], "command=fetch\n");
 
 	refs = fetch_pack(&args, data->fd, data->conn,
 			  refs_tmp ? refs_tmp : transport->remote_refs,
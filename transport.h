@@ -19,6 +19,14 @@ struct transport {
 	void *data;
 	const struct ref *remote_refs;
 
+	/**
+	 * If set, the caller of transport_get_remote_refs() only needs
+	 * the refs starting with one of these prefixes.  Transports that
+	 * can ask the remote side for fewer refs do so; the others still
+	 * return all of them.
+	 **/
+	const struct string_list *ref_prefixes;
+
 	/**
 	 * Indicates whether we already called get_refs_list(); set by
 	 * transport.c::transport_get_remote_refs().
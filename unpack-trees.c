@@ -9,6 +9,8 @@
 #include "refs.h"
 #include "attr.h"
 #include "submodule.h"
+#include "parallel-checkout.h"
+#include "sparse-index.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -224,6 +226,14 @@ static int check_updates(struct unpack_trees_options *o)
 	remove_marked_cache_entries(&o->result);
 	remove_scheduled_dirs();
 
+	if (o->update && !o->dry_run) {
+		unsigned nr_updates = 0;
+		for (i = 0; i < index->cache_nr; i++)
+			if (index->cache[i]->ce_flags & CE_UPDATE)
+				nr_updates++;
+		init_parallel_checkout(nr_updates);
+	}
+
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -235,6 +245,8 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	if (o->update && !o->dry_run)
+		errs |= run_parallel_checkout(&state);
 	stop_progress(&progress);
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKIN, NULL);
@@ -520,8 +532,12 @@ static int compare_entry(const struct cache_entry *ce, const struct traverse_inf
 
 	/*
 	 * Even if the beginning compared identically, the ce should
-	 * compare as bigger than a directory leading up to it!
+	 * compare as bigger than a directory leading up to it!  A
+	 * sparse directory entry, trailing slash and all, is that
+	 * directory, though.
 	 */
+	if (S_ISSPARSEDIR(ce->ce_mode) && S_ISDIR(n->mode))
+		return ce_namelen(ce) > traverse_path_len(info, n) + 1;
 	return ce_namelen(ce) > traverse_path_len(info, n);
 }
 
@@ -604,6 +620,25 @@ static int unpack_nondirectories(int n, unsigned long mask,
 	return 0;
 }
 
+/*
+ * A sparse directory entry in the index stands for the whole tree
+ * below it: hand it to the callback along with the tree it is to be
+ * compared with (if any), instead of descending into that tree.
+ */
+static int unpack_sparse_directory(unsigned long dirmask,
+				   struct cache_entry **src,
+				   const struct name_entry *names,
+				   const struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+
+	if (dirmask & 1) {
+		src[1] = create_ce_entry(info, names, 0);
+		src[1]->ce_mode = S_IFDIR;
+	}
+	return call_unpack_fn(src, o);
+}
+
 static int unpack_failed(struct unpack_trees_options *o, const char *message)
 {
 	discard_index(&o->result);
@@ -782,6 +817,13 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 		}
 	}
 
+	if (src[0] && S_ISSPARSEDIR(src[0]->ce_mode)) {
+		if (unpack_sparse_directory(dirmask, src, names, info) < 0)
+			return -1;
+		mark_ce_used(src[0], o);
+		return mask;
+	}
+
 	if (unpack_nondirectories(n, mask, dirmask, src, names, info) < 0)
 		return -1;
 
@@ -842,13 +884,14 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 {
 	struct cache_entry **cache_end;
 	int dtype = DT_DIR;
-	int ret = excluded_from_list(prefix, prefix_len, basename, &dtype, el);
+	int ret;
 
-	prefix[prefix_len++] = '/';
+	if (el->use_cone_patterns)
+		ret = cone_directory_match(el, prefix, prefix_len);
+	else
+		ret = excluded_from_list(prefix, prefix_len, basename, &dtype, el);
 
-	/* If undecided, use matching result of parent dir in defval */
-	if (ret < 0)
-		ret = defval;
+	prefix[prefix_len++] = '/';
 
 	for (cache_end = cache; cache_end != cache + nr; cache_end++) {
 		struct cache_entry *ce = *cache_end;
@@ -856,6 +899,29 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 			break;
 	}
 
+	/*
+	 * With cone patterns the fate of the whole directory is known
+	 * up front, unless only the files directly in it are in.
+	 */
+	if (el->use_cone_patterns) {
+		struct cache_entry **ce;
+
+		if (ret == CONE_MATCH_PARENT)
+			return clear_ce_flags_1(cache, cache_end - cache,
+						prefix, prefix_len,
+						select_mask, clear_mask,
+						el, 0);
+		if (ret == CONE_MATCH_RECURSIVE)
+			for (ce = cache; ce != cache_end; ce++)
+				if (!select_mask || ((*ce)->ce_flags & select_mask))
+					(*ce)->ce_flags &= ~clear_mask;
+		return cache_end - cache;
+	}
+
+	/* If undecided, use matching result of parent dir in defval */
+	if (ret < 0)
+		ret = defval;
+
 	/*
 	 * TODO: check el, if there are no patterns that may conflict
 	 * with ret (iow, we know in advance the incl/excl
@@ -942,9 +1008,15 @@ static int clear_ce_flags_1(struct cache_entry **cache, int nr,
 			continue;
 		}
 
-		/* Non-directory */
+		/*
+		 * Non-directory; with cone patterns we only get to see
+		 * those whose directory wants all its files.
+		 */
 		dtype = ce_to_dtype(ce);
-		ret = excluded_from_list(ce->name, ce_namelen(ce), name, &dtype, el);
+		if (el->use_cone_patterns)
+			ret = 1;
+		else
+			ret = excluded_from_list(ce->name, ce_namelen(ce), name, &dtype, el);
 		if (ret < 0)
 			ret = defval;
 		if (ret > 0)
@@ -1029,8 +1101,18 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 			o->skip_sparse_checkout = 1;
 		else
 			o->el = &el;
+		if (o->el && core_sparse_checkout_cone)
+			setup_cone_patterns(&el);
 	}
 
+	/*
+	 * Only "diff-index --cached" knows how to compare a sparse
+	 * directory entry with a tree; everybody else gets one entry
+	 * per path.
+	 */
+	if (!o->diff_index_cached)
+		ensure_full_index(o->src_index);
+
 	memset(&o->result, 0, sizeof(o->result));
 	o->result.initialized = 1;
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
@@ -1149,6 +1231,14 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		}
 	}
 
+	/* the result takes over the shared index and untracked cache */
+	if (o->dst_index && o->dst_index == o->src_index) {
+		o->result.split_index = o->src_index->split_index;
+		o->src_index->split_index = NULL;
+		o->result.untracked = o->src_index->untracked;
+		o->src_index->untracked = NULL;
+	}
+
 	o->src_index = NULL;
 	ret = check_updates(o) ? (-2) : 0;
 	if (o->dst_index)
@@ -1277,8 +1367,10 @@ static int verify_uptodate_submodule(struct cache_entry *old,
 
 static void invalidate_ce_path(struct cache_entry *ce, struct unpack_trees_options *o)
 {
-	if (ce)
-		cache_tree_invalidate_path(o->src_index->cache_tree, ce->name);
+	if (!ce)
+		return;
+	cache_tree_invalidate_path(o->src_index->cache_tree, ce->name);
+	untracked_cache_invalidate_path(o->src_index, ce->name);
 }
 
 /*
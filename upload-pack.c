@@ -11,6 +11,9 @@
 #include "list-objects.h"
 #include "run-command.h"
 #include "sigchain.h"
+#include "string-list.h"
+#include "sha1-array.h"
+#include "dir.h"
 
 static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] <dir>";
 
@@ -44,6 +47,25 @@ static int debug_fd;
 static int advertise_refs;
 static int stateless_rpc;
 
+/*
+ * Packs sent to clients are kept in $GIT_DIR/pack-cache for
+ * pack_cache_ttl seconds, up to pack_cache_size bytes in total, and
+ * sent again as they are to clients asking for the same objects.
+ */
+static unsigned long pack_cache_size;
+static unsigned long pack_cache_ttl = 300;
+/* The settings pack-objects reads, as "var=value\n" lines */
+static struct strbuf pack_config = STRBUF_INIT;
+/* The pack being written to the cache, removed if we die */
+static char cache_tmp[PATH_MAX];
+
+/* A bundle clients may clone from before fetching the rest from us */
+static const char *bundle_uri;
+
+static const char capabilities[] = "multi_ack thin-pack side-band"
+	" side-band-64k ofs-delta shallow no-progress"
+	" include-tag multi_ack_detailed";
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -71,6 +93,176 @@ static ssize_t send_client_data(int fd, const char *data, ssize_t sz)
 	return safe_write(fd, data, sz);
 }
 
+static int hash_ref(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
+{
+	git_SHA1_Update(cb_data, refname, strlen(refname) + 1);
+	git_SHA1_Update(cb_data, sha1, 20);
+	return 0;
+}
+
+static void hash_sha1(const unsigned char sha1[20], void *data)
+{
+	git_SHA1_Update(data, sha1, 20);
+}
+
+static void hash_objects(git_SHA_CTX *ctx, const char *what,
+			 struct object_array *objects)
+{
+	struct sha1_array sorted = SHA1_ARRAY_INIT;
+	int i;
+
+	for (i = 0; i < objects->nr; i++)
+		sha1_array_append(&sorted, objects->objects[i].item->sha1);
+	git_SHA1_Update(ctx, what, strlen(what) + 1);
+	sha1_array_for_each_unique(&sorted, hash_sha1, ctx);
+	sha1_array_clear(&sorted);
+}
+
+/*
+ * The pack only depends on what the client wants and has, and on the
+ * options and configuration of pack-objects; with --all or
+ * --include-tag it also depends on the refs.
+ */
+static void pack_cache_key(unsigned char *key, int create_full_pack)
+{
+	git_SHA_CTX ctx;
+	char options[64];
+
+	git_SHA1_Init(&ctx);
+	sprintf(options, "full=%d thin=%d ofs=%d tag=%d", create_full_pack,
+		use_thin_pack, use_ofs_delta, use_include_tag);
+	git_SHA1_Update(&ctx, options, strlen(options) + 1);
+	git_SHA1_Update(&ctx, pack_config.buf, pack_config.len + 1);
+	hash_objects(&ctx, "want", &want_obj);
+	hash_objects(&ctx, "have", &have_obj);
+	if (create_full_pack || use_include_tag) {
+		head_ref(hash_ref, &ctx);
+		for_each_ref(hash_ref, &ctx);
+	}
+	git_SHA1_Final(key, &ctx);
+}
+
+static void remove_cache_tmp(void)
+{
+	if (*cache_tmp)
+		unlink(cache_tmp);
+	*cache_tmp = '\0';
+}
+
+static void remove_cache_tmp_on_signal(int signo)
+{
+	remove_cache_tmp();
+	sigchain_pop(signo);
+	raise(signo);
+}
+
+static const char *cached_pack_path(const unsigned char *key)
+{
+	return git_path("pack-cache/%s.pack", sha1_to_hex(key));
+}
+
+/*
+ * Send the cached pack for key if there is one.  Returns 1 if it was
+ * sent, 0 if there was none, and -1 if it could not be read after
+ * part of it was sent.
+ */
+static int send_cached_pack(const unsigned char *key)
+{
+	char data[8192];
+	struct stat st;
+	ssize_t sz;
+	int fd;
+
+	fd = open(cached_pack_path(key), O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) ||
+	    st.st_mtime + pack_cache_ttl < time(NULL)) {
+		close(fd);
+		return 0;
+	}
+	while (0 < (sz = xread(fd, data, sizeof(data)))) {
+		reset_timeout();
+		if (send_client_data(1, data, sz) < 0)
+			break;
+	}
+	close(fd);
+	if (sz)
+		return -1;
+	if (use_sideband)
+		packet_flush(1);
+	return 1;
+}
+
+struct cached_pack {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int cached_pack_cmp(const void *a_, const void *b_)
+{
+	const struct cached_pack *a = a_, *b = b_;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/* Remove expired packs, then the oldest ones until the cache fits */
+static void prune_pack_cache(void)
+{
+	struct cached_pack *packs = NULL;
+	int nr = 0, alloc = 0, i;
+	unsigned long total = 0;
+	time_t expired = time(NULL) - pack_cache_ttl;
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	size_t baselen;
+	DIR *dir;
+
+	dir = opendir(git_path("pack-cache"));
+	if (!dir)
+		return;
+	strbuf_addstr(&path, git_path("pack-cache/"));
+	baselen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (lstat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (st.st_mtime < expired) {
+			unlink(path.buf);
+			continue;
+		}
+		/* packs still being written */
+		if (!prefixcmp(de->d_name, "tmp_"))
+			continue;
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = xstrdup(path.buf);
+		packs[nr].mtime = st.st_mtime;
+		packs[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	qsort(packs, nr, sizeof(*packs), cached_pack_cmp);
+	for (i = 0; i < nr; i++) {
+		if (pack_cache_size < total) {
+			unlink(packs[i].path);
+			total -= packs[i].size;
+		}
+		free(packs[i].path);
+	}
+	free(packs);
+	strbuf_release(&path);
+}
+
 static FILE *pack_pipe = NULL;
 static void show_commit(struct commit *commit, void *data)
 {
@@ -146,6 +338,34 @@ static void create_pack_file(void)
 	ssize_t sz;
 	const char *argv[10];
 	int arg = 0;
+	unsigned char cache_key[20];
+	int cache_fd = -1;
+
+	if (pack_cache_size && !shallow_nr) {
+		pack_cache_key(cache_key, create_full_pack);
+		switch (send_cached_pack(cache_key)) {
+		case 1:
+			return;
+		case -1:
+			goto fail;
+		}
+		if (!safe_create_leading_directories(
+				git_path("pack-cache/tmp_pack_XXXXXX"))) {
+			static int cleanup_registered;
+
+			if (!cleanup_registered) {
+				atexit(remove_cache_tmp);
+				sigchain_push_common(remove_cache_tmp_on_signal);
+				sigchain_push(SIGALRM, remove_cache_tmp_on_signal);
+				cleanup_registered = 1;
+			}
+			strlcpy(cache_tmp, git_path("pack-cache/tmp_pack_XXXXXX"),
+				sizeof(cache_tmp));
+			cache_fd = git_mkstemp_mode(cache_tmp, 0444);
+			if (cache_fd < 0)
+				*cache_tmp = '\0';
+		}
+	}
 
 	argv[arg++] = "pack-objects";
 	if (!shallow_nr) {
@@ -289,6 +509,11 @@ static void create_pack_file(void)
 			sz = send_client_data(1, data, sz);
 			if (sz < 0)
 				goto fail;
+			if (0 <= cache_fd && write_in_full(cache_fd, data, sz) < 0) {
+				close(cache_fd);
+				remove_cache_tmp();
+				cache_fd = -1;
+			}
 		}
 	}
 
@@ -306,12 +531,28 @@ static void create_pack_file(void)
 		if (sz < 0)
 			goto fail;
 		fprintf(stderr, "flushed.\n");
+		if (0 <= cache_fd && write_in_full(cache_fd, data, 1) < 0) {
+			close(cache_fd);
+			remove_cache_tmp();
+			cache_fd = -1;
+		}
 	}
 	if (use_sideband)
 		packet_flush(1);
+	if (0 <= cache_fd) {
+		if (!close(cache_fd) &&
+		    !rename(cache_tmp, cached_pack_path(cache_key)))
+			*cache_tmp = '\0';
+		remove_cache_tmp();
+		prune_pack_cache();
+	}
 	return;
 
  fail:
+	if (0 <= cache_fd) {
+		close(cache_fd);
+		remove_cache_tmp();
+	}
 	send_client_data(3, abort_msg, sizeof(abort_msg));
 	die("git upload-pack: %s", abort_msg);
 }
@@ -721,9 +962,7 @@ static void receive_needs(void)
 
 static int send_ref(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
 {
-	static const char *capabilities = "multi_ack thin-pack side-band"
-		" side-band-64k ofs-delta shallow no-progress"
-		" include-tag multi_ack_detailed";
+	static int sent_capabilities;
 	struct object *o = lookup_unknown_object(sha1);
 	const char *refname_nons = strip_namespace(refname);
 
@@ -733,13 +972,15 @@ static int send_ref(const char *refname, const unsigned char *sha1, int flag, vo
 		    die("git upload-pack: cannot find object %s:", sha1_to_hex(sha1));
 	}
 
-	if (capabilities)
-		packet_write(1, "%s %s%c%s%s\n", sha1_to_hex(sha1), refname_nons,
+	if (!sent_capabilities)
+		packet_write(1, "%s %s%c%s%s%s%s\n", sha1_to_hex(sha1), refname_nons,
 			     0, capabilities,
-			     stateless_rpc ? " no-done" : "");
+			     stateless_rpc ? " no-done" : "",
+			     bundle_uri ? " bundle-uri=" : "",
+			     bundle_uri ? bundle_uri : "");
 	else
 		packet_write(1, "%s %s\n", sha1_to_hex(sha1), refname_nons);
-	capabilities = NULL;
+	sent_capabilities = 1;
 	if (!(o->flags & OUR_REF)) {
 		o->flags |= OUR_REF;
 		nr_our_refs++;
@@ -764,6 +1005,115 @@ static int mark_our_ref(const char *refname, const unsigned char *sha1, int flag
 	return 0;
 }
 
+static int send_ls_ref(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
+{
+	int *peel = cb_data;
+	unsigned char peeled[20];
+
+	if (*peel && !peel_ref(refname, peeled))
+		packet_write(1, "%s %s peeled:%s\n", sha1_to_hex(sha1),
+			     strip_namespace(refname), sha1_to_hex(peeled));
+	else
+		packet_write(1, "%s %s\n", sha1_to_hex(sha1),
+			     strip_namespace(refname));
+	return 0;
+}
+
+/*
+ * List the refs starting with one of the prefixes the client asked
+ * for, or all of them if it did not ask for any.
+ */
+static void ls_refs(void)
+{
+	struct string_list prefixes = STRING_LIST_INIT_DUP;
+	static char line[1000];
+	int len, i, peel = 0;
+
+	while ((len = packet_read_line(0, line, sizeof(line)))) {
+		reset_timeout();
+		strip(line, len);
+		if (!strcmp(line, "peel"))
+			peel = 1;
+		else if (!prefixcmp(line, "ref-prefix "))
+			string_list_insert(&prefixes, line + 11);
+		else
+			die("git upload-pack: unexpected ls-refs argument '%s'",
+			    line);
+	}
+
+	if (!prefixes.nr) {
+		head_ref_namespaced(send_ls_ref, &peel);
+		for_each_namespaced_ref(send_ls_ref, &peel);
+	} else {
+		/* prefixes are sorted, so one covering others comes first */
+		const char *last = NULL;
+
+		for (i = 0; i < prefixes.nr; i++) {
+			if (!prefixcmp("HEAD", prefixes.items[i].string)) {
+				head_ref_namespaced(send_ls_ref, &peel);
+				break;
+			}
+		}
+		for (i = 0; i < prefixes.nr; i++) {
+			const char *prefix = prefixes.items[i].string;
+			if (last && !prefixcmp(prefix, last))
+				continue;
+			last = prefix;
+			for_each_namespaced_ref_in(prefix, send_ls_ref, &peel);
+		}
+	}
+	packet_flush(1);
+	string_list_clear(&prefixes, 0);
+}
+
+static void upload_pack_v2(void)
+{
+	static char line[1000];
+	int len;
+
+	if (advertise_refs || !stateless_rpc) {
+		reset_timeout();
+		packet_write(1, "version 2\n");
+		packet_write(1, "ls-refs\n");
+		packet_write(1, "fetch=%s%s%s%s\n", capabilities,
+			     stateless_rpc ? " no-done" : "",
+			     bundle_uri ? " bundle-uri=" : "",
+			     bundle_uri ? bundle_uri : "");
+		packet_flush(1);
+	}
+	if (advertise_refs)
+		return;
+
+	/* a flush instead of a command means the client is done */
+	while ((len = packet_read_line(0, line, sizeof(line)))) {
+		reset_timeout();
+		strip(line, len);
+		if (!strcmp(line, "command=ls-refs")) {
+			ls_refs();
+			if (stateless_rpc)
+				return;
+			continue;
+		}
+		if (!strcmp(line, "command=fetch")) {
+			/*
+			 * The request that follows is the one of version
+			 * 0, after the ref advertisement.  It ends the
+			 * session, as a fetch does not need the refs
+			 * listed again.
+			 */
+			head_ref_namespaced(mark_our_ref, NULL);
+			for_each_namespaced_ref(mark_our_ref, NULL);
+			receive_needs();
+			if (want_obj.nr) {
+				get_common_commits();
+				create_pack_file();
+			}
+			return;
+		}
+		die("git upload-pack: unknown command '%s'", line);
+	}
+}
+
 static void upload_pack(void)
 {
 	if (advertise_refs || !stateless_rpc) {
@@ -785,6 +1135,33 @@ static void upload_pack(void)
 	}
 }
 
+static int upload_pack_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "uploadpack.packcachesize")) {
+		pack_cache_size = git_config_ulong(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "uploadpack.packcachettl")) {
+		pack_cache_ttl = git_config_ulong(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "uploadpack.bundleuri")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (value[strcspn(value, " \t\n")]) {
+			warning("ignoring %s with whitespace: '%s'", var, value);
+			return 0;
+		}
+		bundle_uri = *value ? xstrdup(value) : NULL;
+		return 0;
+	}
+	if (!prefixcmp(var, "pack.") || !prefixcmp(var, "repack.") ||
+	    !strcmp(var, "core.compression") ||
+	    !strcmp(var, "core.bigfilethreshold"))
+		strbuf_addf(&pack_config, "%s=%s\n", var, value ? value : "");
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	char *dir;
@@ -838,6 +1215,10 @@ int main(int argc, char **argv)
 		die("attempt to fetch/clone from a shallow repository");
 	if (getenv("GIT_DEBUG_SEND_PACK"))
 		debug_fd = atoi(getenv("GIT_DEBUG_SEND_PACK"));
-	upload_pack();
+	git_config(upload_pack_config, NULL);
+	if (requested_protocol_version() == 2)
+		upload_pack_v2();
+	else
+		upload_pack();
 	return 0;
 }
@@ -16,6 +16,29 @@ uintmax_t decode_varint(const unsigned char **bufp)
 	return val;
 }
 
+int decode_varint_bounded(const unsigned char **bufp,
+			  const unsigned char *end, uintmax_t *value)
+{
+	const unsigned char *buf = *bufp;
+	unsigned char c;
+	uintmax_t val;
+
+	if (buf >= end)
+		return -1;
+	c = *buf++;
+	val = c & 127;
+	while (c & 128) {
+		val += 1;
+		if (!val || MSB(val, 7) || buf >= end)
+			return -1;
+		c = *buf++;
+		val = (val << 7) + (c & 127);
+	}
+	*bufp = buf;
+	*value = val;
+	return 0;
+}
+
 int encode_varint(uintmax_t value, unsigned char *buf)
 {
 	unsigned char varint[16];
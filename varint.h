@@ -6,4 +6,11 @@
 extern int encode_varint(uintmax_t, unsigned char *);
 extern uintmax_t decode_varint(const unsigned char **);
 
+/*
+ * Like decode_varint(), but without reading at or past end.  Returns
+ * -1 if the varint is cut short by end or overflows, 0 otherwise.
+ */
+extern int decode_varint_bounded(const unsigned char **bufp,
+				 const unsigned char *end, uintmax_t *value);
+
 #endif /* VARINT_H */
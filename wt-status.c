@@ -12,6 +12,7 @@
 #include "refs.h"
 #include "submodule.h"
 #include "column.h"
+#include "sparse-index.h"
 
 static char default_wt_status_colors[][COLOR_MAXLEN] = {
 	GIT_COLOR_NORMAL, /* WT_STATUS_HEADER */
@@ -432,6 +433,8 @@ static void wt_status_collect_changes_initial(struct wt_status *s)
 	struct pathspec pathspec;
 	int i;
 
+	/* there is no tree to compare sparse directories with */
+	ensure_full_index(&the_index);
 	init_pathspec(&pathspec, s->pathspec);
 	for (i = 0; i < active_nr; i++) {
 		struct string_list_item *it;
@@ -468,6 +471,7 @@ static void wt_status_collect_untracked(struct wt_status *s)
 		dir.flags |=
 			DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
 	setup_standard_excludes(&dir);
+	use_untracked_cache(&dir, &the_index);
 
 	fill_directory(&dir, s->pathspec);
 	for (i = 0; i < dir.nr; i++) {